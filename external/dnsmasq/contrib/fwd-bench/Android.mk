@@ -0,0 +1,13 @@
+LOCAL_PATH := $(call my-dir)
+
+#########################
+
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES := fwd-bench.c
+
+LOCAL_MODULE := dnsmasq-fwd-bench
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_CFLAGS := -O2 -g -W -Wall -Werror
+
+include $(BUILD_EXECUTABLE)
@@ -0,0 +1,426 @@
+/* fwd-bench: keep many queries in flight through dnsmasq to a slow upstream.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 dated June, 1991, or
+   (at your option) version 3 dated 29 June, 2007.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+*/
+
+/* It plays both ends. The client side sends queries for names never asked
+   before to dnsmasq, and keeps -n of them outstanding. The upstream side is
+   the server dnsmasq forwards them to; it answers each query -d milliseconds
+   after it came in. So every query holds a forward record for the whole
+   delay, and with a large --dns-forward-max dnsmasq has thousands of them in
+   use while it matches replies and new queries against them.
+
+     dnsmasq -k -p 5353 --listen-address=127.0.0.1 --bind-interfaces \
+             --no-resolv --server=127.0.0.1#5354 --dns-forward-max=5000
+     fwd-bench -p 5353 -u 5354 -n 4000 -d 200 -t 10 -P <pid of dnsmasq>
+
+   Queries not answered a second after the upstream delay are counted as
+   lost and replaced by new ones. Keep -n below --dns-forward-max, since
+   dnsmasq drops queries it has no record for. With -P the CPU time dnsmasq
+   used during the run is reported too.
+
+   Build with "cc -O2 -o fwd-bench fwd-bench.c" or as dnsmasq-fwd-bench. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#define PACKETSZ 512
+#define MAX_WAIT_MS 10000
+#define MAX_INFLIGHT 30000
+#define UPSTREAM_QUEUE 32768 /* more than MAX_INFLIGHT */
+#define SEND_BURST 64
+
+struct held {
+  long long due;
+  struct sockaddr_in from;
+  size_t len;
+  unsigned char packet[PACKETSZ];
+};
+
+/* Queries held by the upstream side, in arrival order which is also the
+   order they are due in. */
+static struct held *queue;
+static unsigned int queue_head, queue_len;
+
+/* Send time of each outstanding query by id, 0 when the id is free. */
+static long long sent_at[65536];
+static unsigned int latency_hist[MAX_WAIT_MS + 1];
+
+static unsigned long long sent, answered, lost, dropped, forwarded;
+
+static long long now_us(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void die(const char *msg)
+{
+  fprintf(stderr, "fwd-bench: %s: %s\n", msg, strerror(errno));
+  exit(1);
+}
+
+static int udp_socket(struct sockaddr_in *bind_to)
+{
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  int size = 4 * 1024 * 1024;
+
+  if (fd == -1)
+    die("socket");
+  if (bind_to && bind(fd, (struct sockaddr *)bind_to, sizeof(*bind_to)) == -1)
+    die("bind");
+
+  /* many replies and queries arrive at once, don't drop them here */
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+  setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+
+  if (fcntl(fd, F_SETFL, O_NONBLOCK) == -1)
+    die("fcntl");
+
+  return fd;
+}
+
+/* Returns the offset just past the question, or 0 if it does not fit. */
+static size_t skip_question(unsigned char *packet, size_t len)
+{
+  size_t p = 12;
+
+  while (p < len && packet[p] != 0)
+    {
+      if ((packet[p] & 0xc0) == 0xc0)
+	{
+	  p++;
+	  break;
+	}
+      p += packet[p] + 1;
+    }
+  p += 1 + 4; /* terminating label, type and class */
+
+  return p <= len ? p : 0;
+}
+
+static void send_query(int fd, struct sockaddr_in *server, unsigned short id, unsigned long long serial)
+{
+  unsigned char packet[PACKETSZ], *p;
+  char label[32];
+  int l;
+
+  memset(packet, 0, 12);
+  packet[0] = id >> 8;
+  packet[1] = id & 0xff;
+  packet[2] = 0x01; /* RD */
+  packet[5] = 1; /* QDCOUNT */
+
+  /* q<serial>.bench.test A IN */
+  p = packet + 12;
+  l = sprintf(label, "q%llu", serial);
+  *p++ = l;
+  memcpy(p, label, l);
+  p += l;
+  memcpy(p, "\005bench\004test\000\000\001\000\001", 16);
+  p += 16;
+
+  if (sendto(fd, packet, p - packet, 0, (struct sockaddr *)server, sizeof(*server)) == -1)
+    {
+      if (errno != EAGAIN && errno != ENOBUFS)
+	die("sendto dnsmasq");
+      dropped++;
+      return;
+    }
+
+  sent_at[id] = now_us();
+  sent++;
+}
+
+static void read_replies(int fd)
+{
+  unsigned char packet[PACKETSZ];
+  unsigned short id;
+  long long ms;
+  ssize_t n;
+
+  while ((n = recv(fd, packet, sizeof(packet), 0)) != -1)
+    {
+      if (n < 12)
+	continue;
+      id = packet[0] << 8 | packet[1];
+      if (sent_at[id] == 0)
+	continue; /* already given up on */
+      ms = (now_us() - sent_at[id]) / 1000;
+      latency_hist[ms > MAX_WAIT_MS ? MAX_WAIT_MS : ms]++;
+      sent_at[id] = 0;
+      answered++;
+    }
+
+  if (errno != EAGAIN)
+    die("recv from dnsmasq");
+}
+
+static void read_forwarded(int fd, long long delay_us)
+{
+  struct held *h;
+  socklen_t fromlen;
+  ssize_t n;
+
+  while (1)
+    {
+      h = &queue[(queue_head + queue_len) % UPSTREAM_QUEUE];
+      fromlen = sizeof(h->from);
+      if ((n = recvfrom(fd, h->packet, sizeof(h->packet), 0,
+			(struct sockaddr *)&h->from, &fromlen)) == -1)
+	break;
+      if (queue_len == UPSTREAM_QUEUE)
+	continue; /* cannot happen with -n below MAX_INFLIGHT */
+      h->len = n;
+      h->due = now_us() + delay_us;
+      queue_len++;
+      forwarded++;
+    }
+
+  if (errno != EAGAIN)
+    die("recv from forwarder");
+}
+
+/* Answer the queries which have waited long enough, with a single A
+   record pointing back at the question name. */
+static void answer_due(int fd, long long now)
+{
+  static const unsigned char answer[] = {
+    0xc0, 0x0c, 0, 1, 0, 1, 0, 0, 0, 0, 0, 4, 192, 0, 2, 1
+  };
+  struct held *h;
+  size_t len;
+
+  while (queue_len != 0 && queue[queue_head].due <= now)
+    {
+      h = &queue[queue_head];
+      queue_head = (queue_head + 1) % UPSTREAM_QUEUE;
+      queue_len--;
+
+      if ((len = skip_question(h->packet, h->len)) == 0 ||
+	  len + sizeof(answer) > sizeof(h->packet))
+	continue;
+
+      h->packet[2] |= 0x80; /* QR */
+      h->packet[3] = 0x80; /* RA, NOERROR */
+      h->packet[6] = 0;
+      h->packet[7] = 1; /* ANCOUNT */
+      memset(&h->packet[8], 0, 4);
+      memcpy(&h->packet[len], answer, sizeof(answer));
+
+      sendto(fd, h->packet, len + sizeof(answer), 0, (struct sockaddr *)&h->from, sizeof(h->from));
+    }
+}
+
+static void expire(long long now, long long wait_us)
+{
+  unsigned int id;
+
+  for (id = 0; id < 65536; id++)
+    if (sent_at[id] != 0 && now - sent_at[id] > wait_us)
+      {
+	sent_at[id] = 0;
+	lost++;
+      }
+}
+
+/* utime + stime of a process, in clock ticks; -1 if unknown */
+static long long cpu_ticks(int pid)
+{
+  char path[64], buf[1024], *p;
+  unsigned long utime, stime;
+  FILE *f;
+  int i;
+
+  sprintf(path, "/proc/%d/stat", pid);
+  if (!(f = fopen(path, "r")))
+    return -1;
+  p = fgets(buf, sizeof(buf), f);
+  fclose(f);
+  if (!p || !(p = strrchr(buf, ')')))
+    return -1;
+
+  /* utime and stime are the 12th and 13th fields after the command */
+  for (i = 0; i < 12 && p; i++)
+    p = strchr(p + 1, ' ');
+  if (!p || sscanf(p, " %lu %lu", &utime, &stime) != 2)
+    return -1;
+
+  return utime + stime;
+}
+
+static unsigned int percentile(unsigned long long count, double fraction)
+{
+  unsigned long long seen = 0;
+  unsigned int ms;
+
+  for (ms = 0; ms < MAX_WAIT_MS; ms++)
+    if ((seen += latency_hist[ms]) >= count * fraction)
+      break;
+
+  return ms;
+}
+
+static void usage(void)
+{
+  fprintf(stderr, "usage: fwd-bench [-s server] [-p port] [-u upstream port] [-n in flight]\n"
+	  "                 [-d upstream delay ms] [-t seconds] [-P dnsmasq pid]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  struct sockaddr_in server, upstream;
+  struct pollfd fds[2];
+  long long start, end, now, next_expire, wait, cpu_start = -1, cpu_end;
+  unsigned long long serial = 0, sum_ms = 0, limit;
+  unsigned int inflight = 1000, delay_ms = 100, seconds = 10, max_ms = 0, ms, burst;
+  unsigned short next_id = 0;
+  int opt, pid = 0, client, up;
+
+  memset(&server, 0, sizeof(server));
+  server.sin_family = AF_INET;
+  server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  server.sin_port = htons(5353);
+  upstream = server;
+  upstream.sin_port = htons(5354);
+
+  while ((opt = getopt(argc, argv, "s:p:u:n:d:t:P:")) != -1)
+    switch (opt)
+      {
+      case 's':
+	if (inet_pton(AF_INET, optarg, &server.sin_addr) != 1)
+	  usage();
+	break;
+      case 'p':
+	server.sin_port = htons(atoi(optarg));
+	break;
+      case 'u':
+	upstream.sin_port = htons(atoi(optarg));
+	break;
+      case 'n':
+	inflight = atoi(optarg);
+	break;
+      case 'd':
+	delay_ms = atoi(optarg);
+	break;
+      case 't':
+	seconds = atoi(optarg);
+	break;
+      case 'P':
+	pid = atoi(optarg);
+	break;
+      default:
+	usage();
+      }
+
+  if (optind != argc || inflight == 0 || inflight > MAX_INFLIGHT ||
+      delay_ms + 1000 > MAX_WAIT_MS || seconds == 0)
+    usage();
+
+  if (!(queue = malloc(UPSTREAM_QUEUE * sizeof(*queue))))
+    die("malloc");
+
+  client = udp_socket(NULL);
+  up = udp_socket(&upstream);
+  fds[0].fd = client;
+  fds[0].events = POLLIN;
+  fds[1].fd = up;
+  fds[1].events = POLLIN;
+
+  if (pid)
+    cpu_start = cpu_ticks(pid);
+
+  start = now_us();
+  end = start + seconds * 1000000LL;
+  next_expire = start + 100000;
+
+  for (now = start; now < end; now = now_us())
+    {
+      /* top up the queries in flight, a burst at a time so that replies
+	 and forwarded queries are read in between. Reach -n over the
+	 first upstream delay rather than at once, the socket buffer of
+	 dnsmasq would overflow. */
+      limit = inflight;
+      if (now - start < delay_ms * 1000LL)
+	limit = SEND_BURST + inflight * (now - start) / (delay_ms * 1000LL);
+      for (burst = 0; burst < SEND_BURST && sent - answered - lost < limit; burst++)
+	{
+	  while (sent_at[next_id] != 0)
+	    next_id++;
+	  send_query(client, &server, next_id++, serial++);
+	}
+
+      if (burst == SEND_BURST)
+	wait = 0;
+      else
+	{
+	  wait = next_expire - now;
+	  if (queue_len != 0 && queue[queue_head].due - now < wait)
+	    wait = queue[queue_head].due - now;
+	  if (wait < 0)
+	    wait = 0;
+	}
+
+      if (poll(fds, 2, (wait + 999) / 1000) == -1 && errno != EINTR)
+	die("poll");
+
+      now = now_us();
+      if (fds[0].revents & POLLIN)
+	read_replies(client);
+      if (fds[1].revents & POLLIN)
+	read_forwarded(up, delay_ms * 1000LL);
+      answer_due(up, now);
+
+      if (now >= next_expire)
+	{
+	  expire(now, (delay_ms + 1000) * 1000LL);
+	  next_expire = now + 100000;
+	}
+    }
+
+  if (pid && cpu_start != -1 && (cpu_end = cpu_ticks(pid)) != -1)
+    cpu_end -= cpu_start;
+  else
+    cpu_end = -1;
+
+  for (ms = 0; ms <= MAX_WAIT_MS; ms++)
+    if (latency_hist[ms])
+      {
+	sum_ms += (unsigned long long)ms * latency_hist[ms];
+	max_ms = ms;
+      }
+
+  printf("in flight %u, upstream delay %u ms, %u s\n", inflight, delay_ms, seconds);
+  printf("sent      %llu, forwarded %llu, not sent %llu\n", sent, forwarded, dropped);
+  printf("answered  %llu (%.0f/s), lost %llu, still waiting %llu\n", answered,
+	 answered / ((end - start) / 1e6), lost, sent - answered - lost);
+  if (answered)
+    printf("latency   mean %llu ms, median %u ms, 99%% %u ms, max %u ms\n",
+	   sum_ms / answered, percentile(answered, 0.5), percentile(answered, 0.99), max_ms);
+  if (cpu_end != -1)
+    printf("dnsmasq   %.2f s cpu, %.1f us per answer\n",
+	   (double)cpu_end / sysconf(_SC_CLK_TCK),
+	   answered ? cpu_end * 1e6 / sysconf(_SC_CLK_TCK) / answered : 0.0);
+
+  return 0;
+}
@@ -4,7 +4,8 @@ LOCAL_PATH := $(call my-dir)
 
 include $(CLEAR_VARS)
 LOCAL_SRC_FILES :=  cache.c dhcp.c dnsmasq.c forward.c helper.c lease.c log.c \
-                    netlink.c network.c option.c rfc1035.c rfc2131.c util.c
+                    netlink.c network.c option.c poll.c rfc1035.c rfc2131.c util.c \
+                    workers.c
 
 LOCAL_MODULE := dnsmasq
 
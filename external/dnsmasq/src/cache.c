@@ -160,6 +160,11 @@ static void cache_hash(struct crec *crecp)
 
   struct crec **up = hash_bucket(cache_get_name(crecp));
 
+#ifdef HAVE_DNS_THREADS
+  /* answers published for the name may be incomplete now */
+  answer_forget(cache_get_name(crecp));
+#endif
+
   if (!(crecp->flags & F_REVERSE))
     {
       while (*up && ((*up)->flags & F_REVERSE))
@@ -873,6 +878,10 @@ void cache_reload(void)
 
   cache_inserted = cache_live_freed = 0;
   
+#ifdef HAVE_DNS_THREADS
+  answer_forget_all();
+#endif
+
   for (i=0; i<hash_size; i++)
     for (cache = hash_table[i], up = &hash_table[i]; cache; cache = tmp)
       {
@@ -1020,6 +1029,10 @@ void cache_unhash_dhcp(void)
   struct crec *cache, **up;
   int i;
 
+#ifdef HAVE_DNS_THREADS
+  answer_forget_all();
+#endif
+
   for (i=0; i<hash_size; i++)
     for (cache = hash_table[i], up = &hash_table[i]; cache; cache = cache->hash_next)
       if (cache->flags & F_DHCP)
@@ -1124,7 +1137,11 @@ void cache_add_dhcp_entry(char *host_name,
 
 void dump_cache(time_t now)
 {
+  static time_t last_dump = 0;
+  static unsigned int last_queries = 0;
   struct server *serv, *serv1;
+  unsigned int queries;
+  long secs;
 
   my_syslog(LOG_INFO, _("time %lu"), (unsigned long)now);
   my_syslog(LOG_INFO, _("cache size %d, %d/%d cache insertions re-used unexpired cache entries."), 
@@ -1132,6 +1149,33 @@ void dump_cache(time_t now)
   my_syslog(LOG_INFO, _("queries forwarded %u, queries answered locally %u"), 
 	    daemon->queries_forwarded, daemon->local_answer);
 
+  /* query rate since the last dump, or since startup for the first */
+  queries = daemon->queries_forwarded + daemon->local_answer;
+#ifdef HAVE_DNS_THREADS
+  queries += worker_answers();
+#endif
+  if (last_dump == 0)
+    last_dump = daemon->start_time;
+  if ((secs = difftime(now, last_dump)) > 0)
+    my_syslog(LOG_INFO, _("queries per second %u over the last %lu seconds"), 
+	      (queries - last_queries) / (unsigned int)secs, (unsigned long)secs);
+  last_dump = now;
+  last_queries = queries;
+  
+  if (daemon->udp_reads != 0)
+    my_syslog(LOG_INFO, _("UDP packets read %u in %u reads, %u.%02u per read"), 
+	      daemon->udp_packets, daemon->udp_reads, daemon->udp_packets / daemon->udp_reads,
+	      (unsigned int)(100ULL * (daemon->udp_packets % daemon->udp_reads) / daemon->udp_reads));
+  
+  if (daemon->forward_replies != 0)
+    my_syslog(LOG_INFO, _("upstream replies %u, latency average %lums, max %ums"), 
+	      daemon->forward_replies, daemon->forward_ms_total / daemon->forward_replies, 
+	      daemon->forward_ms_max);
+
+#ifdef HAVE_DNS_THREADS
+  dump_workers();
+#endif
+
   if (!addrbuff && !(addrbuff = whine_malloc(ADDRSTRLEN)))
     return;
 
@@ -24,7 +24,10 @@
 #define FORWARD_TEST 50 /* try all servers every 50 queries */
 #define FORWARD_TIME 10 /* or 10 seconds */
 #define RANDOM_SOCKS 64 /* max simultaneous random ports */
+#define MMSG_BATCH 32 /* max UDP packets read or sent by one syscall */
+#define MAX_DNS_THREADS 16 /* max threads answering from the cache */
 #define LEASE_RETRY 60 /* on error, retry writing leasefile after LEASE_RETRY seconds */
+#define LEASE_SLACK 64 /* stale records allowed in the lease file beyond one per lease */
 #define CACHESIZ 150 /* default cache size */
 #define MAXLEASES 150 /* maximum number of DHCP leases */
 #define PING_WAIT 3 /* wait for ping address-in-use test */
@@ -271,3 +274,19 @@ NOTES:
 #  undef HAVE_SCRIPT
 #endif
 
+/* epoll and recvmmsg()/sendmmsg() are used on Linux. They can be
+   turned off for old kernels and C libraries with
+   COPTS=-DNO_EPOLL and COPTS=-DNO_MMSG */
+#if defined(HAVE_LINUX_NETWORK) && !defined(NO_EPOLL)
+#  define HAVE_EPOLL
+#endif
+#if defined(HAVE_LINUX_NETWORK) && !defined(NO_MMSG)
+#  define HAVE_MMSG
+#endif
+
+/* --dns-threads needs epoll and SO_REUSEPORT. Leave it out with
+   COPTS=-DNO_DNS_THREADS */
+#if defined(HAVE_EPOLL) && !defined(NO_DNS_THREADS)
+#  define HAVE_DNS_THREADS
+#endif
+
@@ -57,8 +57,20 @@ static char *compile_opts =
 #endif
 "DHCP "
 #if defined(HAVE_DHCP) && !defined(HAVE_SCRIPT)
-"no-scripts"
+"no-scripts "
 #endif
+#ifndef HAVE_EPOLL
+"no-"
+#endif
+"epoll "
+#ifndef HAVE_MMSG
+"no-"
+#endif
+"mmsg "
+#ifndef HAVE_DNS_THREADS
+"no-"
+#endif
+"threads"
 "";
 
 
@@ -66,15 +78,15 @@ static char *compile_opts =
 static volatile pid_t pid = 0;
 static volatile int pipewrite;
 
-static int set_dns_listeners(time_t now, fd_set *set, int *maxfdp);
-static void check_dns_listeners(fd_set *set, time_t now);
+static int set_dns_listeners(time_t now);
+static void check_dns_listeners(time_t now);
 static void sig_handler(int sig);
 static void async_event(int pipe, time_t now);
 static void fatal_event(struct event_desc *ev);
 static void poll_resolv(void);
 #if defined(__ANDROID__) && !defined(__BRILLO__)
-static int set_android_listeners(fd_set *set, int *maxfdp);
-static int check_android_listeners(fd_set *set);
+static int set_android_listeners(void);
+static int check_android_listeners(void);
 #endif
 
 void setupSignalHandling() {
@@ -183,6 +195,7 @@ int main (int argc, char **argv)
   rand_init();
 
   now = dnsmasq_time();
+  daemon->start_time = now;
 
 #ifdef HAVE_DHCP
   if (daemon->dhcp)
@@ -218,7 +231,10 @@ int main (int argc, char **argv)
     die(_("failed to create listening socket: %s"), NULL, EC_BADNET);
   
   if (daemon->port != 0)
-    cache_init();
+    {
+      cache_init();
+      frec_init();
+    }
  
   if (daemon->port != 0)
     pre_allocate_sfds();
@@ -511,73 +527,65 @@ int main (int argc, char **argv)
     check_servers();
   
   pid = getpid();
+
+  poll_init();
+
+#ifdef HAVE_DNS_THREADS
+  workers_init();
+#endif
   
   while (1)
     {
-      int maxfd = -1;
-      struct timeval t, *tp = NULL;
-      fd_set rset, wset, eset;
+      int t, timeout = -1;
       
-      FD_ZERO(&rset);
-      FD_ZERO(&wset);
-      FD_ZERO(&eset);
+      poll_reset();
       
       /* if we are out of resources, find how long we have to wait
 	 for some to come free, we'll loop around then and restart
 	 listening for queries */
-      if ((t.tv_sec = set_dns_listeners(now, &rset, &maxfd)) != 0)
-	{
-	  t.tv_usec = 0;
-	  tp = &t;
-	}
+      if ((t = set_dns_listeners(now)) != 0)
+	timeout = t * 1000;
+#ifdef HAVE_DNS_THREADS
+      /* come back to free what the DNS threads have finished with */
+      if (workers_pending() && (timeout == -1 || timeout > 1000))
+	timeout = 1000;
+#endif
 #if defined(__ANDROID__) && !defined(__BRILLO__)
-      set_android_listeners(&rset, &maxfd);
+      set_android_listeners();
 #endif
 
 #ifdef HAVE_DHCP
       if (daemon->dhcp)
-	{
-	  FD_SET(daemon->dhcpfd, &rset);
-	  bump_maxfd(daemon->dhcpfd, &maxfd);
-	}
+	poll_listen(daemon->dhcpfd, POLLIN);
 #endif
 
 #ifdef HAVE_LINUX_NETWORK
-      FD_SET(daemon->netlinkfd, &rset);
-      bump_maxfd(daemon->netlinkfd, &maxfd);
+      poll_listen(daemon->netlinkfd, POLLIN);
 #endif
       
-      FD_SET(piperead, &rset);
-      bump_maxfd(piperead, &maxfd);
+      poll_listen(piperead, POLLIN);
 
 #ifdef HAVE_DHCP
 #  ifdef HAVE_SCRIPT
       while (helper_buf_empty() && do_script_run(now));
 
       if (!helper_buf_empty())
-	{
-	  FD_SET(daemon->helperfd, &wset);
-	  bump_maxfd(daemon->helperfd, &maxfd);
-	}
+	poll_listen(daemon->helperfd, POLLOUT);
 #  else
       /* need this for other side-effects */
       while (do_script_run(now));
 #  endif
 #endif
    
-      /* must do this just before select(), when we know no
+      /* must do this just before do_poll(), when we know no
 	 more calls to my_syslog() can occur */
-      set_log_writer(&wset, &maxfd);
+      set_log_writer();
       
-      if (select(maxfd+1, &rset, &wset, &eset, tp) < 0)
-	{
-	  /* otherwise undefined after error */
-	  FD_ZERO(&rset); FD_ZERO(&wset); FD_ZERO(&eset);
-	}
+      do_poll(timeout);
 
       now = dnsmasq_time();
 
-      check_log_writer(&wset);
+      check_log_writer(0);
 
       /* Check for changes to resolv files once per second max. */
       /* Don't go silent for long periods if the clock goes backwards. */
@@ -591,26 +599,26 @@ int main (int argc, char **argv)
 	    poll_resolv();
 	}
       
-      if (FD_ISSET(piperead, &rset))
+      if (poll_check(piperead, POLLIN))
 	async_event(piperead, now);
       
 #ifdef HAVE_LINUX_NETWORK
-      if (FD_ISSET(daemon->netlinkfd, &rset))
+      if (poll_check(daemon->netlinkfd, POLLIN))
 	netlink_multicast();
 #endif
 
 #if defined(__ANDROID__) && !defined(__BRILLO__)
-      check_android_listeners(&rset);
+      check_android_listeners();
 #endif
       
-      check_dns_listeners(&rset, now);
+      check_dns_listeners(now);
 
 #ifdef HAVE_DHCP
-      if (daemon->dhcp && FD_ISSET(daemon->dhcpfd, &rset))
+      if (daemon->dhcp && poll_check(daemon->dhcpfd, POLLIN))
 	dhcp_packet(now);
 
 #  ifdef HAVE_SCRIPT
-      if (daemon->helperfd != -1 && FD_ISSET(daemon->helperfd, &wset))
+      if (daemon->helperfd != -1 && poll_check(daemon->helperfd, POLLOUT))
 	helper_write();
 #  endif
 #endif
@@ -873,15 +881,14 @@ void clear_cache_and_reload(time_t now) {
 
 #if defined(__ANDROID__) && !defined(__BRILLO__)
 
-static int set_android_listeners(fd_set *set, int *maxfdp) {
-    FD_SET(STDIN_FILENO, set);
-    bump_maxfd(STDIN_FILENO, maxfdp);
+static int set_android_listeners(void) {
+    poll_listen(STDIN_FILENO, POLLIN);
     return 0;
 }
 
-static int check_android_listeners(fd_set *set) {
+static int check_android_listeners(void) {
     int retcode = 0;
-    if (FD_ISSET(STDIN_FILENO, set)) {
+    if (poll_check(STDIN_FILENO, POLLIN)) {
         char buffer[1024];
         int rc;
         int consumed = 0;
@@ -924,7 +931,7 @@ static int check_android_listeners(fd_set *set) {
 }
 #endif
 
-static int set_dns_listeners(time_t now, fd_set *set, int *maxfdp)
+static int set_dns_listeners(time_t now)
 {
   struct serverfd *serverfdp;
   struct listener *listener;
@@ -935,65 +942,61 @@ static int set_dns_listeners(time_t now, fd_set *set, int *maxfdp)
     get_new_frec(now, &wait);
   
   for (serverfdp = daemon->sfds; serverfdp; serverfdp = serverfdp->next)
-    {
-      FD_SET(serverfdp->fd, set);
-      bump_maxfd(serverfdp->fd, maxfdp);
-    }
+    poll_listen(serverfdp->fd, POLLIN);
 
   if (daemon->port != 0 && !daemon->osport)
     for (i = 0; i < RANDOM_SOCKS; i++)
       if (daemon->randomsocks[i].refcount != 0)
-	{
-	  FD_SET(daemon->randomsocks[i].fd, set);
-	  bump_maxfd(daemon->randomsocks[i].fd, maxfdp);
-	}
+	poll_listen(daemon->randomsocks[i].fd, POLLIN);
   
   for (listener = daemon->listeners; listener; listener = listener->next)
     {
       /* only listen for queries if we have resources */
       if (listener->fd != -1 && wait == 0)
-	{
-	  FD_SET(listener->fd, set);
-	  bump_maxfd(listener->fd, maxfdp);
-	}
+	poll_listen(listener->fd, POLLIN);
 
-      /* death of a child goes through the select loop, so
+      /* death of a child goes through the main loop, so
 	 we don't need to explicitly arrange to wake up here */
       if  (listener->tcpfd != -1)
 	for (i = 0; i < MAX_PROCS; i++)
 	  if (daemon->tcp_pids[i] == 0)
 	    {
-	      FD_SET(listener->tcpfd, set);
-	      bump_maxfd(listener->tcpfd, maxfdp);
+	      poll_listen(listener->tcpfd, POLLIN);
 	      break;
 	    }
     }
+
+#ifdef HAVE_DNS_THREADS
+  /* misses passed on by the DNS threads */
+  if (wait == 0)
+    set_worker_listeners();
+#endif
   
   return wait;
 }
 
-static void check_dns_listeners(fd_set *set, time_t now)
+static void check_dns_listeners(time_t now)
 {
   struct serverfd *serverfdp;
   struct listener *listener;
   int i;
 
   for (serverfdp = daemon->sfds; serverfdp; serverfdp = serverfdp->next)
-    if (FD_ISSET(serverfdp->fd, set))
+    if (poll_check(serverfdp->fd, POLLIN))
       reply_query(serverfdp->fd, serverfdp->source_addr.sa.sa_family, now);
   
   if (daemon->port != 0 && !daemon->osport)
     for (i = 0; i < RANDOM_SOCKS; i++)
       if (daemon->randomsocks[i].refcount != 0 && 
-	  FD_ISSET(daemon->randomsocks[i].fd, set))
+	  poll_check(daemon->randomsocks[i].fd, POLLIN))
 	reply_query(daemon->randomsocks[i].fd, daemon->randomsocks[i].family, now);
   
   for (listener = daemon->listeners; listener; listener = listener->next)
     {
-      if (listener->fd != -1 && FD_ISSET(listener->fd, set))
+      if (listener->fd != -1 && poll_check(listener->fd, POLLIN))
 	receive_query(listener, now); 
 
-      if (listener->tcpfd != -1 && FD_ISSET(listener->tcpfd, set))
+      if (listener->tcpfd != -1 && poll_check(listener->tcpfd, POLLIN))
 	{
 	  int confd;
 	  struct irec *iface = NULL;
@@ -1096,6 +1099,10 @@ static void check_dns_listeners(fd_set *set, time_t now)
 	    }
 	}
     }
+
+#ifdef HAVE_DNS_THREADS
+  check_worker_listeners(now);
+#endif
 }
 
 #ifdef HAVE_DHCP
@@ -1169,33 +1176,22 @@ int icmp_ping(struct in_addr addr)
   for (now = start = dnsmasq_time(); 
        difftime(now, start) < (float)PING_WAIT;)
     {
-      struct timeval tv;
-      fd_set rset, wset;
       struct sockaddr_in faddr;
-      int maxfd = fd; 
       socklen_t len = sizeof(faddr);
       
-      tv.tv_usec = 250000;
-      tv.tv_sec = 0; 
-      
-      FD_ZERO(&rset);
-      FD_ZERO(&wset);
-      FD_SET(fd, &rset);
-      set_dns_listeners(now, &rset, &maxfd);
-      set_log_writer(&wset, &maxfd);
+      poll_reset();
+      poll_listen(fd, POLLIN);
+      set_dns_listeners(now);
+      set_log_writer();
 
-      if (select(maxfd+1, &rset, &wset, NULL, &tv) < 0)
-	{
-	  FD_ZERO(&rset);
-	  FD_ZERO(&wset);
-	}
+      do_poll(250);
 
       now = dnsmasq_time();
 
-      check_log_writer(&wset);
-      check_dns_listeners(&rset, now);
+      check_log_writer(0);
+      check_dns_listeners(now);
 
-      if (FD_ISSET(fd, &rset) &&
+      if (poll_check(fd, POLLIN) &&
 	  recvfrom(fd, &packet, sizeof(packet), 0,
 		   (struct sockaddr *)&faddr, &len) == sizeof(packet) &&
 	  saddr.sin_addr.s_addr == faddr.sin_addr.s_addr &&
@@ -1209,6 +1205,7 @@ int icmp_ping(struct in_addr addr)
     }
   
 #if defined(HAVE_LINUX_NETWORK)
+  poll_forget(fd);
   close(fd);
 #else
   opt = 1;
@@ -64,6 +64,7 @@
 #include <sys/stat.h>
 #include <sys/ioctl.h>
 #include <sys/select.h>
+#include <poll.h>
 #include <sys/wait.h>
 #include <sys/time.h>
 #include <sys/un.h>
@@ -97,6 +98,16 @@
 #ifndef HAVE_LINUX_NETWORK
 #  include <net/if_dl.h>
 #endif
+#ifdef HAVE_EPOLL
+#  include <sys/epoll.h>
+#endif
+#ifdef HAVE_DNS_THREADS
+#  include <pthread.h>
+/* older C library headers lack this */
+#  ifndef SO_REUSEPORT
+#    define SO_REUSEPORT 15
+#  endif
+#endif
 
 #if defined(HAVE_LINUX_NETWORK)
 #include <linux/capability.h>
@@ -344,6 +355,7 @@ struct irec {
 struct listener {
   int fd, tcpfd, family;
   struct irec *iface; /* only valid for non-wildcard */
+  struct worker_socks *wsocks; /* sockets of the --dns-threads threads */
   struct listener *next;
 };
 
@@ -386,7 +398,10 @@ struct frec {
   int fd, forwardall;
   unsigned int crc;
   time_t time;
-  struct frec *next;
+  unsigned long sent_ms;               /* when first forwarded, for latency stats */
+  int hashed;                          /* in use: in the hash tables and age list */
+  struct frec *id_next, *sender_next;  /* hash chains */
+  struct frec *age_prev, *age_next;    /* age list, oldest first; free list uses age_next */
 };
 
 /* actions in the daemon->helper RPC */
@@ -406,6 +421,7 @@ struct dhcp_lease {
   char new;              /* newly created */
   char changed;          /* modified */
   char aux_changed;      /* CLID or expiry changed */
+  char file_changed;     /* not yet written to the lease file */
   time_t expires;        /* lease expiry */
 #ifdef HAVE_BROKEN_RTC
   unsigned int length;
@@ -417,6 +433,7 @@ struct dhcp_lease {
   unsigned int vendorclass_len, userclass_len, supplied_hostname_len;
   int last_interface;
   struct dhcp_lease *next;
+  struct dhcp_lease *addr_next, *hw_next, *clid_next; /* hash chains */
 };
 
 struct dhcp_netid {
@@ -597,6 +614,7 @@ extern struct daemon {
   char *log_file; /* optional log file */
   int max_logs;  /* queue limit */
   int cachesize, ftabsize;
+  int dns_threads;
   int port, query_port, min_port;
   unsigned long local_ttl, neg_ttl;
   struct hostsfile *addn_hosts;
@@ -622,7 +640,10 @@ extern struct daemon {
   int packet_buff_sz; /* size of above */
   char *namebuff; /* MAXDNAME size buffer */
   unsigned int local_answer, queries_forwarded;
-  struct frec *frec_list;
+  unsigned int udp_reads, udp_packets;   /* reads of query and reply sockets, packets read */
+  unsigned int forward_replies, forward_ms_max; /* answers from upstream, and their latency */
+  unsigned long forward_ms_total;
+  time_t start_time;
   struct serverfd *sfds;
   struct irec *interfaces;
   struct listener *listeners;
@@ -698,6 +719,7 @@ int sa_len(union mysockaddr *addr);
 int sockaddr_isequal(union mysockaddr *s1, union mysockaddr *s2);
 int hostname_isequal(char *a, char *b);
 time_t dnsmasq_time(void);
+unsigned long dnsmasq_milliseconds(void);
 int is_same_net(struct in_addr a, struct in_addr b, struct in_addr mask);
 int retry_send(void);
 int parse_addr(int family, const char *addrstr, union mysockaddr *addr);
@@ -717,8 +739,8 @@ void die(char *message, char *arg1, int exit_code);
 int log_start(struct passwd *ent_pw, int errfd);
 int log_reopen(char *log_file);
 void my_syslog(int priority, const char *format, ...);
-void set_log_writer(fd_set *set, int *maxfdp);
-void check_log_writer(fd_set *set);
+void set_log_writer(void);
+void check_log_writer(int force);
 void flush_log(void);
 
 /* option.c */
@@ -732,7 +754,33 @@ void receive_query(struct listener *listen, time_t now);
 unsigned char *tcp_request(int confd, time_t now,
 			   struct in_addr local_addr, struct in_addr netmask);
 void server_gone(struct server *server);
+void frec_init(void);
 struct frec *get_new_frec(time_t now, int *wait);
+void handoff_query(struct listener *listen, size_t n, 
+		   union mysockaddr *source_addr, time_t now);
+
+/* poll.c */
+void poll_init(void);
+void poll_reset(void);
+void poll_listen(int fd, short event);
+int poll_check(int fd, short event);
+void poll_forget(int fd);
+int do_poll(int timeout);
+
+/* workers.c */
+#ifdef HAVE_DNS_THREADS
+void workers_init(void);
+void worker_listener_open(struct listener *listener);
+void worker_listener_close(struct listener *listener);
+int workers_pending(void);
+void set_worker_listeners(void);
+void check_worker_listeners(time_t now);
+void answer_publish(HEADER *header, size_t plen, time_t now);
+void answer_forget(char *name);
+void answer_forget_all(void);
+unsigned int worker_answers(void);
+void dump_workers(void);
+#endif
 
 /* network.c */
 int indextoname(int fd, int index, char *name);
@@ -22,45 +22,56 @@ static struct frec *lookup_frec_by_sender(unsigned short id,
 					  unsigned int crc);
 static unsigned short get_id(int force, unsigned short force_id, unsigned int crc);
 static void free_frec(struct frec *f);
+static void link_frec(struct frec *f);
+
+/* Forward records in use are indexed by new_id (for replies) and by
+   sender, orig_id and crc (for repeated queries), and kept on a list in
+   the order they were taken, which is oldest first since they are all
+   stamped with the time they are taken. Records not in use are on a free
+   list. */
+static struct frec **frec_id_hash, **frec_sender_hash;
+static int frec_hash_size;
+static struct frec *frec_oldest, *frec_newest, *frec_free;
+static int frec_count; /* number allocated */
 static struct randfd *allocate_rfd(int family);
 
-/* Send a UDP packet with its source address set as "source" 
-   unless nowild is true, when we just send it with the kernel default */
-static void send_from(int fd, int nowild, char *packet, size_t len, 
-		      union mysockaddr *to, struct all_addr *source,
-		      unsigned int iface)
-{
-  struct msghdr msg;
-  struct iovec iov[1]; 
-  union {
-    struct cmsghdr align; /* this ensures alignment */
+/* Control data to send a UDP packet from a given source address */
+union send_control {
+  struct cmsghdr align; /* this ensures alignment */
 #if defined(HAVE_LINUX_NETWORK)
-    char control[CMSG_SPACE(sizeof(struct in_pktinfo))];
+  char control[CMSG_SPACE(sizeof(struct in_pktinfo))];
 #elif defined(IP_SENDSRCADDR)
-    char control[CMSG_SPACE(sizeof(struct in_addr))];
+  char control[CMSG_SPACE(sizeof(struct in_addr))];
 #endif
 #ifdef HAVE_IPV6
-    char control6[CMSG_SPACE(sizeof(struct in6_pktinfo))];
+  char control6[CMSG_SPACE(sizeof(struct in6_pktinfo))];
 #endif
-  } control_u;
-  
-  iov[0].iov_base = packet;
-  iov[0].iov_len = len;
+};
 
-  msg.msg_control = NULL;
-  msg.msg_controllen = 0;
-  msg.msg_flags = 0;
-  msg.msg_name = to;
-  msg.msg_namelen = sa_len(to);
-  msg.msg_iov = iov;
-  msg.msg_iovlen = 1;
+/* Set up msg to send a UDP packet with its source address set as "source" 
+   unless nowild is true, when we just send it with the kernel default */
+static void setup_send(struct msghdr *msg, struct iovec *iov, union send_control *control_u,
+		       int nowild, char *packet, size_t len, 
+		       union mysockaddr *to, struct all_addr *source,
+		       unsigned int iface)
+{
+  iov->iov_base = packet;
+  iov->iov_len = len;
+
+  msg->msg_control = NULL;
+  msg->msg_controllen = 0;
+  msg->msg_flags = 0;
+  msg->msg_name = to;
+  msg->msg_namelen = sa_len(to);
+  msg->msg_iov = iov;
+  msg->msg_iovlen = 1;
   
   if (!nowild)
     {
       struct cmsghdr *cmptr;
-      msg.msg_control = &control_u;
-      msg.msg_controllen = sizeof(control_u);
-      cmptr = CMSG_FIRSTHDR(&msg);
+      msg->msg_control = control_u;
+      msg->msg_controllen = sizeof(*control_u);
+      cmptr = CMSG_FIRSTHDR(msg);
 
       if (to->sa.sa_family == AF_INET)
 	{
@@ -68,13 +79,13 @@ static void send_from(int fd, int nowild, char *packet, size_t len,
 	  struct in_pktinfo *pkt = (struct in_pktinfo *)CMSG_DATA(cmptr);
 	  pkt->ipi_ifindex = 0;
 	  pkt->ipi_spec_dst = source->addr.addr4;
-	  msg.msg_controllen = cmptr->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
+	  msg->msg_controllen = cmptr->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
 	  cmptr->cmsg_level = SOL_IP;
 	  cmptr->cmsg_type = IP_PKTINFO;
 #elif defined(IP_SENDSRCADDR)
 	  struct in_addr *a = (struct in_addr *)CMSG_DATA(cmptr);
 	  *a = source->addr.addr4;
-	  msg.msg_controllen = cmptr->cmsg_len = CMSG_LEN(sizeof(struct in_addr));
+	  msg->msg_controllen = cmptr->cmsg_len = CMSG_LEN(sizeof(struct in_addr));
 	  cmptr->cmsg_level = IPPROTO_IP;
 	  cmptr->cmsg_type = IP_SENDSRCADDR;
 #endif
@@ -85,7 +96,7 @@ static void send_from(int fd, int nowild, char *packet, size_t len,
 	  struct in6_pktinfo *pkt = (struct in6_pktinfo *)CMSG_DATA(cmptr);
 	  pkt->ipi6_ifindex = iface; /* Need iface for IPv6 to handle link-local addrs */
 	  pkt->ipi6_addr = source->addr.addr6;
-	  msg.msg_controllen = cmptr->cmsg_len = CMSG_LEN(sizeof(struct in6_pktinfo));
+	  msg->msg_controllen = cmptr->cmsg_len = CMSG_LEN(sizeof(struct in6_pktinfo));
 	  cmptr->cmsg_type = IPV6_PKTINFO;
 	  cmptr->cmsg_level = IPV6_LEVEL;
 	}
@@ -93,23 +104,172 @@ static void send_from(int fd, int nowild, char *packet, size_t len,
       iface = 0; /* eliminate warning */
 #endif
     }
-  
+}
+
+static void send_msg(int fd, struct msghdr *msg)
+{
  retry:
-  if (sendmsg(fd, &msg, 0) == -1)
+  if (sendmsg(fd, msg, 0) == -1)
     {
       /* certain Linux kernels seem to object to setting the source address in the IPv6 stack
 	 by returning EINVAL from sendmsg. In that case, try again without setting the
 	 source address, since it will nearly alway be correct anyway.  IPv6 stinks. */
-      if (errno == EINVAL && msg.msg_controllen)
+      if (errno == EINVAL && msg->msg_controllen)
 	{
-	  msg.msg_controllen = 0;
+	  msg->msg_controllen = 0;
 	  goto retry;
 	}
       if (retry_send())
 	goto retry;
     }
 }
-          
+
+/* Send a UDP packet with its source address set as "source" 
+   unless nowild is true, when we just send it with the kernel default */
+static void send_from(int fd, int nowild, char *packet, size_t len, 
+		      union mysockaddr *to, struct all_addr *source,
+		      unsigned int iface)
+{
+  struct msghdr msg;
+  struct iovec iov;
+  union send_control control_u;
+
+  setup_send(&msg, &iov, &control_u, nowild, packet, len, to, source, iface);
+  send_msg(fd, &msg);
+}
+
+#ifdef HAVE_MMSG
+/* Packets are read from the query and reply sockets up to MMSG_BATCH
+   at a time into recv_slots and dealt with in place. Answers to them
+   are queued by queue_send() and go out together from flush_sends()
+   at the end of the batch, so one wakeup costs two syscalls however
+   many queries it brings. Queries which have to be forwarded are
+   copied to daemon->packet, where they are kept for re-sending. */
+struct recv_slot {
+  union mysockaddr addr;
+  union {
+    struct cmsghdr align; /* this ensures alignment */
+#ifdef HAVE_IPV6
+    char control6[CMSG_SPACE(sizeof(struct in6_pktinfo))];
+#endif
+    char control[CMSG_SPACE(sizeof(struct in_pktinfo))];
+  } control_u;
+  struct iovec iov;
+  char *packet;
+};
+
+static struct recv_slot *recv_slots;
+static struct mmsghdr recv_msgs[MMSG_BATCH];
+static int mmsg_broken; /* kernel without recvmmsg() or sendmmsg() */
+
+static struct {
+  int fd, count;
+  struct mmsghdr msgs[MMSG_BATCH];
+  struct iovec iov[MMSG_BATCH];
+  union send_control control[MMSG_BATCH];
+  union mysockaddr to[MMSG_BATCH];
+} sendq;
+
+static void flush_sends(void)
+{
+  int i = 0, n;
+
+  while (i < sendq.count)
+    {
+      if (!mmsg_broken)
+	{
+	  if ((n = sendmmsg(sendq.fd, &sendq.msgs[i], sendq.count - i, 0)) > 0)
+	    {
+	      i += n;
+	      continue;
+	    }
+	  if (errno == ENOSYS)
+	    mmsg_broken = 1;
+	}
+
+      /* send the one which failed the slow way, which knows how to retry */
+      send_msg(sendq.fd, &sendq.msgs[i].msg_hdr);
+      i++;
+    }
+
+  sendq.count = 0;
+}
+
+/* As send_from(), but the packet is sent by flush_sends(), and must
+   stay put until then. */
+static void queue_send(int fd, int nowild, char *packet, size_t len, 
+		       union mysockaddr *to, struct all_addr *source,
+		       unsigned int iface)
+{
+  int i;
+
+  if (sendq.count != 0 && (sendq.fd != fd || sendq.count == MMSG_BATCH))
+    flush_sends();
+
+  i = sendq.count++;
+  sendq.fd = fd;
+  sendq.to[i] = *to;
+  setup_send(&sendq.msgs[i].msg_hdr, &sendq.iov[i], &sendq.control[i], 
+	     nowild, packet, len, &sendq.to[i], source, iface);
+}
+
+/* Read as many packets as are waiting, up to MMSG_BATCH, into recv_slots.
+   Returns the number read, or -1 if batches can't be used and the caller
+   should read a single packet into daemon->packet instead. */
+static int recv_batch(int fd, int want_control)
+{
+  int i, n;
+
+  if (mmsg_broken)
+    return -1;
+
+  if (!recv_slots)
+    {
+      char *packets;
+      
+      if (!(packets = whine_malloc(MMSG_BATCH * daemon->packet_buff_sz)))
+	return -1;
+      
+      if (!(recv_slots = whine_malloc(MMSG_BATCH * sizeof(struct recv_slot))))
+	{
+	  free(packets);
+	  return -1;
+	}
+      
+      for (i = 0; i < MMSG_BATCH; i++)
+	recv_slots[i].packet = packets + i * daemon->packet_buff_sz;
+    }
+
+  for (i = 0; i < MMSG_BATCH; i++)
+    {
+      struct msghdr *msg = &recv_msgs[i].msg_hdr;
+      
+      recv_slots[i].iov.iov_base = recv_slots[i].packet;
+      recv_slots[i].iov.iov_len = daemon->edns_pktsz;
+      msg->msg_name = &recv_slots[i].addr;
+      msg->msg_namelen = sizeof(union mysockaddr);
+      msg->msg_iov = &recv_slots[i].iov;
+      msg->msg_iovlen = 1;
+      msg->msg_control = want_control ? &recv_slots[i].control_u : NULL;
+      msg->msg_controllen = want_control ? sizeof(recv_slots[i].control_u) : 0;
+      msg->msg_flags = 0;
+    }
+
+  if ((n = recvmmsg(fd, recv_msgs, MMSG_BATCH, MSG_DONTWAIT, NULL)) == -1)
+    {
+      if (errno != ENOSYS)
+	return 0;
+      mmsg_broken = 1;
+      return -1;
+    }
+
+  daemon->udp_reads++;
+  daemon->udp_packets += n;
+
+  return n;
+}
+#endif
+
 static unsigned short search_servers(time_t now, struct all_addr **addrpp, 
 				     unsigned short qtype, char *qdomain, int *type, char **domain)
 			      
@@ -254,6 +414,8 @@ static int forward_query(int udpfd, union mysockaddr *udpaddr,
 	  forward->fd = udpfd;
 	  forward->crc = crc;
 	  forward->forwardall = 0;
+	  forward->sent_ms = dnsmasq_milliseconds();
+	  link_frec(forward);
 	  header->id = htons(forward->new_id);
 
 	  /* In strict_order mode, or when using domain specific servers
@@ -467,36 +629,29 @@ static size_t process_reply(HEADER *header, time_t now,
   return resize_packet(header, n, pheader, plen);
 }
 
-/* sets new last_server */
-void reply_query(int fd, int family, time_t now)
+/* Deal with a packet from peer server. The packet is in daemon->packet,
+   or a batch buffer. Sets new last_server. */
+static void reply_packet(int family, HEADER *header, ssize_t n,
+			 union mysockaddr *serveraddr, time_t now)
 {
-  /* packet from peer server, extract data for cache, and send to
-     original requester */
-  HEADER *header;
-  union mysockaddr serveraddr;
+  /* extract data for cache, and send to original requester */
   struct frec *forward;
-  socklen_t addrlen = sizeof(serveraddr);
-  ssize_t n = recvfrom(fd, daemon->packet, daemon->edns_pktsz, 0, &serveraddr.sa, &addrlen);
   size_t nn;
   struct server *server;
-  
-  /* packet buffer overwritten */
-  daemon->srv_save = NULL;
+  unsigned long ms;
   
   /* Determine the address of the server replying  so that we can mark that as good */
-  serveraddr.sa.sa_family = family;
+  serveraddr->sa.sa_family = family;
 #ifdef HAVE_IPV6
-  if (serveraddr.sa.sa_family == AF_INET6)
-    serveraddr.in6.sin6_flowinfo = 0;
+  if (serveraddr->sa.sa_family == AF_INET6)
+    serveraddr->in6.sin6_flowinfo = 0;
 #endif
   
   /* spoof check: answer must come from known server, */
   for (server = daemon->servers; server; server = server->next)
     if (!(server->flags & (SERV_LITERAL_ADDRESS | SERV_NO_ADDR)) &&
-	sockaddr_isequal(&server->addr, &serveraddr))
+	sockaddr_isequal(&server->addr, serveraddr))
       break;
-   
-  header = (HEADER *)daemon->packet;
   
   if (!server ||
       n < (int)sizeof(HEADER) || !header->qr ||
@@ -525,6 +680,13 @@ void reply_query(int fd, int family, time_t now)
 	    {
 	      header->qr = 0;
 	      header->tc = 0;
+	      /* kept in daemon->packet for re-sending */
+	      if ((char *)header != daemon->packet)
+		{
+		  memcpy(daemon->packet, header, nn);
+		  header = (HEADER *)daemon->packet;
+		  daemon->srv_save = NULL;
+		}
 	      forward_query(-1, NULL, NULL, 0, header, nn, now, forward);
 	      return;
 	    }
@@ -542,7 +704,7 @@ void reply_query(int fd, int family, time_t now)
 	  /* find good server by address if possible, otherwise assume the last one we sent to */ 
 	  for (last_server = daemon->servers; last_server; last_server = last_server->next)
 	    if (!(last_server->flags & (SERV_LITERAL_ADDRESS | SERV_HAS_DOMAIN | SERV_FOR_NODOTS | SERV_NO_ADDR)) &&
-		sockaddr_isequal(&last_server->addr, &serveraddr))
+		sockaddr_isequal(&last_server->addr, serveraddr))
 	      {
 		server = last_server;
 		break;
@@ -559,46 +721,72 @@ void reply_query(int fd, int family, time_t now)
   if (forward->forwardall == 0 || --forward->forwardall == 1 || 
       (header->rcode != REFUSED && header->rcode != SERVFAIL))
     {
+      /* time from forwarding the query to the answer, ignoring clock steps */
+      if ((ms = dnsmasq_milliseconds() - forward->sent_ms) <= 1000 * TIMEOUT)
+	{
+	  daemon->forward_replies++;
+	  daemon->forward_ms_total += ms;
+	  if (ms > daemon->forward_ms_max)
+	    daemon->forward_ms_max = ms;
+	}
+
       if ((nn = process_reply(header, now, server, (size_t)n)))
 	{
 	  header->id = htons(forward->orig_id);
 	  header->ra = 1; /* recursion if available */
-	  send_from(forward->fd, daemon->options & OPT_NOWILD, daemon->packet, nn, 
-		    &forward->source, &forward->dest, forward->iface);
+#ifdef HAVE_MMSG
+	  if ((char *)header != daemon->packet)
+	    queue_send(forward->fd, daemon->options & OPT_NOWILD, (char *)header, nn, 
+		       &forward->source, &forward->dest, forward->iface);
+	  else
+#endif
+	    send_from(forward->fd, daemon->options & OPT_NOWILD, (char *)header, nn, 
+		      &forward->source, &forward->dest, forward->iface);
 	}
       free_frec(forward); /* cancel */
     }
 }
 
+void reply_query(int fd, int family, time_t now)
+{
+  union mysockaddr serveraddr;
+  socklen_t addrlen = sizeof(serveraddr);
+  ssize_t n;
+#ifdef HAVE_MMSG
+  int i, count;
+
+  if ((count = recv_batch(fd, 0)) != -1)
+    {
+      for (i = 0; i < count; i++)
+	reply_packet(family, (HEADER *)recv_slots[i].packet, (ssize_t)recv_msgs[i].msg_len,
+		     &recv_slots[i].addr, now);
+      flush_sends();
+      return;
+    }
+#endif
+
+  n = recvfrom(fd, daemon->packet, daemon->edns_pktsz, 0, &serveraddr.sa, &addrlen);
+  daemon->udp_reads++;
+  daemon->udp_packets++;
+  
+  /* packet buffer overwritten */
+  daemon->srv_save = NULL;
+  
+  reply_packet(family, (HEADER *)daemon->packet, n, &serveraddr, now);
+}
+
 
-void receive_query(struct listener *listen, time_t now)
+/* Deal with a query from a client. The packet is in daemon->packet,
+   or a batch buffer, and msg is the message it was read with. */
+static void query_packet(struct listener *listen, HEADER *header, ssize_t n, struct msghdr *msg,
+			 union mysockaddr *source_addr, time_t now)
 {
-  HEADER *header = (HEADER *)daemon->packet;
-  union mysockaddr source_addr;
   unsigned short type;
   struct all_addr dst_addr;
   struct in_addr netmask, dst_addr_4;
   size_t m;
-  ssize_t n;
   int if_index = 0;
-  struct iovec iov[1];
-  struct msghdr msg;
   struct cmsghdr *cmptr;
-  union {
-    struct cmsghdr align; /* this ensures alignment */
-#ifdef HAVE_IPV6
-    char control6[CMSG_SPACE(sizeof(struct in6_pktinfo))];
-#endif
-#if defined(HAVE_LINUX_NETWORK)
-    char control[CMSG_SPACE(sizeof(struct in_pktinfo))];
-#elif defined(IP_RECVDSTADDR)
-    char control[CMSG_SPACE(sizeof(struct in_addr)) +
-		 CMSG_SPACE(sizeof(struct sockaddr_dl))];
-#endif
-  } control_u;
-  
-  /* packet buffer overwritten */
-  daemon->srv_save = NULL;
   
   if (listen->family == AF_INET && (daemon->options & OPT_NOWILD))
     {
@@ -610,42 +798,28 @@ void receive_query(struct listener *listen, time_t now)
       dst_addr_4.s_addr = 0;
       netmask.s_addr = 0;
     }
-
-  iov[0].iov_base = daemon->packet;
-  iov[0].iov_len = daemon->edns_pktsz;
-    
-  msg.msg_control = control_u.control;
-  msg.msg_controllen = sizeof(control_u);
-  msg.msg_flags = 0;
-  msg.msg_name = &source_addr;
-  msg.msg_namelen = sizeof(source_addr);
-  msg.msg_iov = iov;
-  msg.msg_iovlen = 1;
-  
-  if ((n = recvmsg(listen->fd, &msg, 0)) == -1)
-    return;
   
   if (n < (int)sizeof(HEADER) || 
-      (msg.msg_flags & MSG_TRUNC) ||
+      (msg->msg_flags & MSG_TRUNC) ||
       header->qr)
     return;
   
-  source_addr.sa.sa_family = listen->family;
+  source_addr->sa.sa_family = listen->family;
 #ifdef HAVE_IPV6
   if (listen->family == AF_INET6)
-    source_addr.in6.sin6_flowinfo = 0;
+    source_addr->in6.sin6_flowinfo = 0;
 #endif
   
   if (!(daemon->options & OPT_NOWILD))
     {
       struct ifreq ifr;
 
-      if (msg.msg_controllen < sizeof(struct cmsghdr))
+      if (msg->msg_controllen < sizeof(struct cmsghdr))
 	return;
 
 #if defined(HAVE_LINUX_NETWORK)
       if (listen->family == AF_INET)
-	for (cmptr = CMSG_FIRSTHDR(&msg); cmptr; cmptr = CMSG_NXTHDR(&msg, cmptr))
+	for (cmptr = CMSG_FIRSTHDR(msg); cmptr; cmptr = CMSG_NXTHDR(msg, cmptr))
 	  if (cmptr->cmsg_level == SOL_IP && cmptr->cmsg_type == IP_PKTINFO)
 	    {
 	      dst_addr_4 = dst_addr.addr.addr4 = ((struct in_pktinfo *)CMSG_DATA(cmptr))->ipi_spec_dst;
@@ -654,7 +828,7 @@ void receive_query(struct listener *listen, time_t now)
 #elif defined(IP_RECVDSTADDR) && defined(IP_RECVIF)
       if (listen->family == AF_INET)
 	{
-	  for (cmptr = CMSG_FIRSTHDR(&msg); cmptr; cmptr = CMSG_NXTHDR(&msg, cmptr))
+	  for (cmptr = CMSG_FIRSTHDR(msg); cmptr; cmptr = CMSG_NXTHDR(msg, cmptr))
 	    if (cmptr->cmsg_level == IPPROTO_IP && cmptr->cmsg_type == IP_RECVDSTADDR)
 	      dst_addr_4 = dst_addr.addr.addr4 = *((struct in_addr *)CMSG_DATA(cmptr));
 	    else if (cmptr->cmsg_level == IPPROTO_IP && cmptr->cmsg_type == IP_RECVIF)
@@ -665,7 +839,7 @@ void receive_query(struct listener *listen, time_t now)
 #ifdef HAVE_IPV6
       if (listen->family == AF_INET6)
 	{
-	  for (cmptr = CMSG_FIRSTHDR(&msg); cmptr; cmptr = CMSG_NXTHDR(&msg, cmptr))
+	  for (cmptr = CMSG_FIRSTHDR(msg); cmptr; cmptr = CMSG_NXTHDR(msg, cmptr))
 	    if (cmptr->cmsg_level == IPV6_LEVEL && cmptr->cmsg_type == IPV6_PKTINFO)
 	      {
 		dst_addr.addr.addr6 = ((struct in6_pktinfo *)CMSG_DATA(cmptr))->ipi6_addr;
@@ -696,11 +870,11 @@ void receive_query(struct listener *listen, time_t now)
 
       if (listen->family == AF_INET) 
 	log_query(F_QUERY | F_IPV4 | F_FORWARD, daemon->namebuff, 
-		  (struct all_addr *)&source_addr.in.sin_addr, types);
+		  (struct all_addr *)&source_addr->in.sin_addr, types);
 #ifdef HAVE_IPV6
       else
 	log_query(F_QUERY | F_IPV6 | F_FORWARD, daemon->namebuff, 
-		  (struct all_addr *)&source_addr.in6.sin6_addr, types);
+		  (struct all_addr *)&source_addr->in6.sin6_addr, types);
 #endif
     }
 
@@ -708,17 +882,107 @@ void receive_query(struct listener *listen, time_t now)
 		      dst_addr_4, netmask, now);
   if (m >= 1)
     {
-      send_from(listen->fd, daemon->options & OPT_NOWILD, (char *)header, 
-		m, &source_addr, &dst_addr, if_index);
+#ifdef HAVE_MMSG
+      if ((char *)header != daemon->packet)
+	queue_send(listen->fd, daemon->options & OPT_NOWILD, (char *)header, 
+		   m, source_addr, &dst_addr, if_index);
+      else
+#endif
+	send_from(listen->fd, daemon->options & OPT_NOWILD, (char *)header, 
+		  m, source_addr, &dst_addr, if_index);
       daemon->local_answer++;
+#ifdef HAVE_DNS_THREADS
+      answer_publish(header, m, now);
+#endif
+      return;
+    }
+
+  /* kept in daemon->packet for re-sending */
+  if ((char *)header != daemon->packet)
+    {
+      memcpy(daemon->packet, header, n);
+      header = (HEADER *)daemon->packet;
+      daemon->srv_save = NULL;
     }
-  else if (forward_query(listen->fd, &source_addr, &dst_addr, if_index,
-			 header, (size_t)n, now, NULL))
+  
+  if (forward_query(listen->fd, source_addr, &dst_addr, if_index,
+		    header, (size_t)n, now, NULL))
     daemon->queries_forwarded++;
   else
     daemon->local_answer++;
 }
 
+void receive_query(struct listener *listen, time_t now)
+{
+  union mysockaddr source_addr;
+  ssize_t n;
+  struct iovec iov[1];
+  struct msghdr msg;
+  union {
+    struct cmsghdr align; /* this ensures alignment */
+#ifdef HAVE_IPV6
+    char control6[CMSG_SPACE(sizeof(struct in6_pktinfo))];
+#endif
+#if defined(HAVE_LINUX_NETWORK)
+    char control[CMSG_SPACE(sizeof(struct in_pktinfo))];
+#elif defined(IP_RECVDSTADDR)
+    char control[CMSG_SPACE(sizeof(struct in_addr)) +
+		 CMSG_SPACE(sizeof(struct sockaddr_dl))];
+#endif
+  } control_u;
+#ifdef HAVE_MMSG
+  int i, count;
+
+  if ((count = recv_batch(listen->fd, 1)) != -1)
+    {
+      for (i = 0; i < count; i++)
+	query_packet(listen, (HEADER *)recv_slots[i].packet, (ssize_t)recv_msgs[i].msg_len,
+		     &recv_msgs[i].msg_hdr, &recv_slots[i].addr, now);
+      flush_sends();
+      return;
+    }
+#endif
+  
+  /* packet buffer overwritten */
+  daemon->srv_save = NULL;
+
+  iov[0].iov_base = daemon->packet;
+  iov[0].iov_len = daemon->edns_pktsz;
+    
+  msg.msg_control = control_u.control;
+  msg.msg_controllen = sizeof(control_u);
+  msg.msg_flags = 0;
+  msg.msg_name = &source_addr;
+  msg.msg_namelen = sizeof(source_addr);
+  msg.msg_iov = iov;
+  msg.msg_iovlen = 1;
+  
+  if ((n = recvmsg(listen->fd, &msg, 0)) == -1)
+    return;
+
+  daemon->udp_reads++;
+  daemon->udp_packets++;
+  
+  query_packet(listen, (HEADER *)daemon->packet, n, &msg, &source_addr, now);
+}
+
+#ifdef HAVE_DNS_THREADS
+/* A query in daemon->packet which a --dns-threads thread has passed on.
+   It came in on a socket bound to the listener's address. */
+void handoff_query(struct listener *listen, size_t n, 
+		   union mysockaddr *source_addr, time_t now)
+{
+  struct msghdr msg;
+
+  memset(&msg, 0, sizeof(msg));
+
+  /* packet buffer overwritten */
+  daemon->srv_save = NULL;
+
+  query_packet(listen, (HEADER *)daemon->packet, (ssize_t)n, &msg, source_addr, now);
+}
+#endif
+
 /* The daemon forks before calling this: it should deal with one connection,
    blocking as neccessary, and then return. Note, need to be a bit careful
    about resources for debug mode, when the fork is suppressed: that's
@@ -775,7 +1039,7 @@ unsigned char *tcp_request(int confd, time_t now,
 			 local_addr, netmask, now);
 
       /* Do this by steam now we're not in the select() loop */
-      check_log_writer(NULL); 
+      check_log_writer(1); 
       
       if (m == 0)
 	{
@@ -878,7 +1142,7 @@ unsigned char *tcp_request(int confd, time_t now,
 	    m = setup_reply(header, (unsigned int)size, addrp, flags, daemon->local_ttl);
 	}
 
-      check_log_writer(NULL);
+      check_log_writer(1);
       
       c1 = m>>8;
       c2 = m;
@@ -889,20 +1153,116 @@ unsigned char *tcp_request(int confd, time_t now,
     }
 }
 
+void frec_init(void)
+{
+  int i;
+
+  /* hash_size is a power of two, at least one chain per record. */
+  for (frec_hash_size = 64; frec_hash_size < daemon->ftabsize; frec_hash_size = frec_hash_size << 1);
+
+  frec_id_hash = safe_malloc(2 * frec_hash_size * sizeof(struct frec *));
+  frec_sender_hash = frec_id_hash + frec_hash_size;
+  
+  for (i = 0; i < 2 * frec_hash_size; i++)
+    frec_id_hash[i] = NULL;
+}
+
+static struct frec **frec_id_bucket(unsigned short id)
+{
+  /* ids are random */
+  return &frec_id_hash[id & (frec_hash_size - 1)];
+}
+
+static struct frec **frec_sender_bucket(unsigned short id, union mysockaddr *addr, unsigned int crc)
+{
+  unsigned int h = id ^ crc;
+
+  /* use the fields compared by sockaddr_isequal */
+  if (addr->sa.sa_family == AF_INET)
+    h ^= addr->in.sin_addr.s_addr ^ addr->in.sin_port;
+#ifdef HAVE_IPV6
+  else if (addr->sa.sa_family == AF_INET6)
+    {
+      unsigned int w[4];
+      memcpy(w, &addr->in6.sin6_addr, sizeof(w));
+      h ^= w[0] ^ w[1] ^ w[2] ^ w[3] ^ addr->in6.sin6_port;
+    }
+#endif
+
+  h ^= h >> 16;
+  h *= 0x45d9f3b;
+  h ^= h >> 16;
+
+  return &frec_sender_hash[h & (frec_hash_size - 1)];
+}
+
+/* Put a record whose ids, crc and source are set into use */
+static void link_frec(struct frec *f)
+{
+  struct frec **up = frec_id_bucket(f->new_id);
+  
+  f->id_next = *up;
+  *up = f;
+  
+  up = frec_sender_bucket(f->orig_id, &f->source, f->crc);
+  f->sender_next = *up;
+  *up = f;
+  
+  f->age_next = NULL;
+  f->age_prev = frec_newest;
+  if (frec_newest)
+    frec_newest->age_next = f;
+  else
+    frec_oldest = f;
+  frec_newest = f;
+  f->hashed = 1;
+}
+
+static void unlink_frec(struct frec *f)
+{
+  struct frec **up;
+  
+  for (up = frec_id_bucket(f->new_id); *up; up = &(*up)->id_next)
+    if (*up == f)
+      {
+	*up = f->id_next;
+	break;
+      }
+  
+  for (up = frec_sender_bucket(f->orig_id, &f->source, f->crc); *up; up = &(*up)->sender_next)
+    if (*up == f)
+      {
+	*up = f->sender_next;
+	break;
+      }
+  
+  if (f->age_prev)
+    f->age_prev->age_next = f->age_next;
+  else
+    frec_oldest = f->age_next;
+  
+  if (f->age_next)
+    f->age_next->age_prev = f->age_prev;
+  else
+    frec_newest = f->age_prev;
+  
+  f->hashed = 0;
+}
+
 static struct frec *allocate_frec(time_t now)
 {
   struct frec *f;
   
   if ((f = (struct frec *)whine_malloc(sizeof(struct frec))))
     {
-      f->next = daemon->frec_list;
       f->time = now;
       f->sentto = NULL;
       f->rfd4 = NULL;
 #ifdef HAVE_IPV6
       f->rfd6 = NULL;
 #endif
-      daemon->frec_list = f;
+      f->hashed = 0;
+      frec_count++;
     }
 
   return f;
@@ -947,73 +1307,86 @@ static struct randfd *allocate_rfd(int family)
 static void free_frec(struct frec *f)
 {
   if (f->rfd4 && --(f->rfd4->refcount) == 0)
-    close(f->rfd4->fd);
+    {
+      poll_forget(f->rfd4->fd);
+      close(f->rfd4->fd);
+    }
     
   f->rfd4 = NULL;
   f->sentto = NULL;
   
 #ifdef HAVE_IPV6
   if (f->rfd6 && --(f->rfd6->refcount) == 0)
-    close(f->rfd6->fd);
+    {
+      poll_forget(f->rfd6->fd);
+      close(f->rfd6->fd);
+    }
     
   f->rfd6 = NULL;
 #endif
+
+  if (f->hashed)
+    {
+      unlink_frec(f);
+      f->age_next = frec_free;
+      frec_free = f;
+    }
 }
 
 /* if wait==NULL return a free or older than TIMEOUT record.
    else return *wait zero if one available, or *wait is delay to
    when the oldest in-use record will expire. Impose an absolute
-   limit of 4*TIMEOUT before we wipe things (for random sockets) */
+   limit of 4*TIMEOUT before we wipe things (for random sockets).
+   With wait set nothing is taken; a new record goes on the free list. */
 struct frec *get_new_frec(time_t now, int *wait)
 {
-  struct frec *f, *oldest, *target;
-  int count;
+  struct frec *f, *oldest;
   
   if (wait)
     *wait = 0;
 
-  for (f = daemon->frec_list, oldest = NULL, target =  NULL, count = 0; f; f = f->next, count++)
-    if (!f->sentto)
-      target = f;
-    else 
-      {
-	if (difftime(now, f->time) >= 4*TIMEOUT)
-	  {
-	    free_frec(f);
-	    target = f;
-	  }
-	
-	if (!oldest || difftime(f->time, oldest->time) <= 0)
-	  oldest = f;
-      }
+  /* the age list is oldest first */
+  while (frec_oldest && difftime(now, frec_oldest->time) >= 4*TIMEOUT)
+    free_frec(frec_oldest);
 
-  if (target)
+  if ((f = frec_free))
     {
-      target->time = now;
-      return target;
+      if (!wait)
+	frec_free = f->age_next;
+      f->time = now;
+      return f;
     }
   
   /* can't find empty one, use oldest if there is one
      and it's older than timeout */
+  oldest = frec_oldest;
   if (oldest && ((int)difftime(now, oldest->time)) >= TIMEOUT)
     { 
       /* keep stuff for twice timeout if we can by allocating a new
 	 record instead */
       if (difftime(now, oldest->time) < 2*TIMEOUT && 
-	  count <= daemon->ftabsize &&
+	  frec_count <= daemon->ftabsize &&
 	  (f = allocate_frec(now)))
-	return f;
+	{
+	  if (wait)
+	    {
+	      f->age_next = frec_free;
+	      frec_free = f;
+	    }
+	  return f;
+	}
 
       if (!wait)
 	{
-	  free_frec(oldest);
+	  free_frec(oldest); /* puts it at the head of the free list */
+	  frec_free = oldest->age_next;
 	  oldest->time = now;
 	}
       return oldest;
     }
   
   /* none available, calculate time 'till oldest record expires */
-  if (count > daemon->ftabsize)
+  if (frec_count > daemon->ftabsize)
     {
       if (oldest && wait)
 	*wait = oldest->time + (time_t)TIMEOUT - now;
@@ -1023,6 +1396,11 @@ struct frec *get_new_frec(time_t now, int *wait)
   if (!(f = allocate_frec(now)) && wait)
     /* wait one second on malloc failure */
     *wait = 1;
+  else if (f && wait)
+    {
+      f->age_next = frec_free;
+      frec_free = f;
+    }
 
   return f; /* OK if malloc fails and this is NULL */
 }
@@ -1032,7 +1410,7 @@ static struct frec *lookup_frec(unsigned short id, unsigned int crc)
 {
   struct frec *f;
 
-  for(f = daemon->frec_list; f; f = f->next)
+  for(f = *frec_id_bucket(id); f; f = f->id_next)
     if (f->sentto && f->new_id == id && 
 	(f->crc == crc || crc == 0xffffffff))
       return f;
@@ -1046,7 +1424,7 @@ static struct frec *lookup_frec_by_sender(unsigned short id,
 {
   struct frec *f;
   
-  for(f = daemon->frec_list; f; f = f->next)
+  for(f = *frec_sender_bucket(id, addr, crc); f; f = f->sender_next)
     if (f->sentto &&
 	f->orig_id == id && 
 	f->crc == crc &&
@@ -1059,11 +1437,14 @@ static struct frec *lookup_frec_by_sender(unsigned short id,
 /* A server record is going away, remove references to it */
 void server_gone(struct server *server)
 {
-  struct frec *f;
+  struct frec *f, *tmp;
   
-  for (f = daemon->frec_list; f; f = f->next)
-    if (f->sentto && f->sentto == server)
-      free_frec(f);
+  for (f = frec_oldest; f; f = tmp)
+    {
+      tmp = f->age_next;
+      if (f->sentto && f->sentto == server)
+	free_frec(f);
+    }
   
   if (daemon->last_server == server)
     daemon->last_server = NULL;
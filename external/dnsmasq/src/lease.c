@@ -21,6 +21,143 @@
 static struct dhcp_lease *leases = NULL, *old_leases = NULL;
 static int dns_dirty, file_dirty, leases_left;
 
+/* Leases are hashed by address, by hardware address, and by client-id
+   when they have one. */
+static struct dhcp_lease **addr_hash, **hw_hash, **clid_hash;
+static unsigned int lease_hash_size, lease_hash_bits;
+
+/* The lease file is a journal: changed leases are appended to it, and
+   a lease which has gone is recorded by a line with expiry time
+   LEASE_GONE. The latest line for an address wins when it is read back.
+   Once stale lines outnumber the leases by LEASE_SLACK, the file is
+   rewritten with one line per lease. */
+#define LEASE_GONE 1
+static int file_records, file_compact;
+static struct in_addr *gone;
+static int gone_count, gone_max;
+
+static void kill_name(struct dhcp_lease *lease);
+
+static unsigned int hash_bytes(unsigned char *p, int len, unsigned int val)
+{
+  while (len-- > 0)
+    val = (val ^ *p++) * 16777619u;
+
+  return val & (lease_hash_size - 1);
+}
+
+/* Fibonacci hashing: the top bits of the product depend on every bit
+   of the address, the low ones only on its low bits. */
+static struct dhcp_lease **addr_bucket(struct in_addr addr)
+{
+  return &addr_hash[(unsigned int)(ntohl(addr.s_addr) * 2654435761u) >> (32 - lease_hash_bits)];
+}
+
+static struct dhcp_lease **hw_bucket(unsigned char *hwaddr, int hw_len, int hw_type)
+{
+  return &hw_hash[hash_bytes(hwaddr, hw_len, 2166136261u ^ hw_type)];
+}
+
+static struct dhcp_lease **clid_bucket(unsigned char *clid, int clid_len)
+{
+  return &clid_hash[hash_bytes(clid, clid_len, 2166136261u)];
+}
+
+/* leases with no hardware address yet are not in the table */
+static int hw_hashed(struct dhcp_lease *lease)
+{
+  return lease->hwaddr_len > 0 && lease->hwaddr_len <= DHCP_CHADDR_MAX;
+}
+
+static void lease_hash(struct dhcp_lease *lease)
+{
+  struct dhcp_lease **up;
+  
+  up = addr_bucket(lease->addr);
+  lease->addr_next = *up;
+  *up = lease;
+
+  if (hw_hashed(lease))
+    {
+      up = hw_bucket(lease->hwaddr, lease->hwaddr_len, lease->hwaddr_type);
+      lease->hw_next = *up;
+      *up = lease;
+    }
+  
+  if (lease->clid && lease->clid_len != 0)
+    {
+      up = clid_bucket(lease->clid, lease->clid_len);
+      lease->clid_next = *up;
+      *up = lease;
+    }
+}
+
+static void lease_unhash(struct dhcp_lease *lease)
+{
+  struct dhcp_lease **up;
+
+  for (up = addr_bucket(lease->addr); *up; up = &(*up)->addr_next)
+    if (*up == lease)
+      {
+	*up = lease->addr_next;
+	break;
+      }
+  
+  if (hw_hashed(lease))
+    for (up = hw_bucket(lease->hwaddr, lease->hwaddr_len, lease->hwaddr_type); *up; up = &(*up)->hw_next)
+      if (*up == lease)
+	{
+	  *up = lease->hw_next;
+	  break;
+	}
+
+  if (lease->clid && lease->clid_len != 0)
+    for (up = clid_bucket(lease->clid, lease->clid_len); *up; up = &(*up)->clid_next)
+      if (*up == lease)
+	{
+	  *up = lease->clid_next;
+	  break;
+	}
+}
+
+static void lease_file_changed(struct dhcp_lease *lease)
+{
+  lease->file_changed = file_dirty = 1;
+}
+
+/* Remember to record that the lease for addr has gone */
+static void lease_gone(struct in_addr addr)
+{
+  file_dirty = 1;
+
+#ifdef HAVE_BROKEN_RTC
+  /* expiry times are relative, so there's no way to say that */
+  file_compact = 1;
+#else
+  if (gone_count == gone_max)
+    {
+      struct in_addr *new;
+      int new_max = gone_max == 0 ? 16 : 2 * gone_max;
+      
+      if (!(new = whine_malloc(new_max * sizeof(struct in_addr))))
+	{
+	  file_compact = 1;
+	  return;
+	}
+      
+      if (gone)
+	{
+	  memcpy(new, gone, gone_count * sizeof(struct in_addr));
+	  free(gone);
+	}
+      gone = new;
+      gone_max = new_max;
+    }
+
+  gone[gone_count++] = addr;
+#endif
+}
+
 void lease_init(time_t now)
 {
   unsigned long ei;
@@ -36,6 +173,16 @@ void lease_init(time_t now)
   
   leases_left = daemon->dhcp_max;
 
+  for (lease_hash_size = 16, lease_hash_bits = 4;
+       lease_hash_size < (unsigned int)daemon->dhcp_max;
+       lease_hash_size <<= 1, lease_hash_bits++);
+  addr_hash = safe_malloc(lease_hash_size * sizeof(struct dhcp_lease *));
+  hw_hash = safe_malloc(lease_hash_size * sizeof(struct dhcp_lease *));
+  clid_hash = safe_malloc(lease_hash_size * sizeof(struct dhcp_lease *));
+  memset(addr_hash, 0, lease_hash_size * sizeof(struct dhcp_lease *));
+  memset(hw_hash, 0, lease_hash_size * sizeof(struct dhcp_lease *));
+  memset(clid_hash, 0, lease_hash_size * sizeof(struct dhcp_lease *));
+
   if (daemon->options & OPT_LEASE_RO)
     {
       /* run "<lease_change_script> init" once to get the
@@ -88,7 +235,31 @@ void lease_init(time_t now)
 	if (strcmp(daemon->packet, "*") != 0)
 	  clid_len = parse_hex(daemon->packet, (unsigned char *)daemon->packet, 255, NULL, NULL);
 	
-	if (!(lease = lease_allocate(addr)))
+	file_records++;
+	lease = lease_find_by_addr(addr);
+
+#ifndef HAVE_BROKEN_RTC
+	if (ei == LEASE_GONE)
+	  {
+	    if (lease)
+	      {
+		struct dhcp_lease **up;
+
+		for (up = &leases; *up != lease; up = &(*up)->next);
+		*up = lease->next;
+		lease_unhash(lease);
+		leases_left++;
+		free(lease->hostname);
+		free(lease->fqdn);
+		free(lease->old_hostname);
+		free(lease->clid);
+		free(lease);
+	      }
+	    continue;
+	  }
+#endif
+
+	if (!lease && !(lease = lease_allocate(addr)))
 	  die (_("too many stored leases"), NULL, EC_MISC);
        	
 #ifdef HAVE_BROKEN_RTC
@@ -103,10 +274,22 @@ void lease_init(time_t now)
 	lease->expires = (time_t)ei;
 #endif
 	
+	/* a later line for the address replaces the lease entirely */
+	if (clid_len == 0 && lease->clid)
+	  {
+	    lease_unhash(lease);
+	    free(lease->clid);
+	    lease->clid = NULL;
+	    lease->clid_len = 0;
+	    lease_hash(lease);
+	  }
+
 	lease_set_hwaddr(lease, (unsigned char *)daemon->dhcp_buff2, (unsigned char *)daemon->packet, hw_len, hw_type, clid_len);
 	
 	if (strcmp(daemon->dhcp_buff, "*") !=  0)
 	  lease_set_hostname(lease, daemon->dhcp_buff, 0);
+	else if (lease->hostname)
+	  kill_name(lease);
 
 	/* set these correctly: the "old" events are generated later from
 	   the startup synthesised SIGHUP. */
@@ -136,8 +319,19 @@ void lease_init(time_t now)
     }
 #endif
 
+  /* Names which moved between leases as the file was read back
+     aren't news. Rewrite the file now if it has stale lines. */
+  for (lease = leases; lease; lease = lease->next)
+    {
+      free(lease->old_hostname);
+      lease->old_hostname = NULL;
+      lease->file_changed = 0;
+    }
+  
+  file_compact = file_records != daemon->dhcp_max - leases_left;
+
   /* Some leases may have expired */
-  file_dirty = 0;
+  file_dirty = file_compact;
   lease_prune(NULL, now);
   dns_dirty = 1;
 }
@@ -170,6 +364,40 @@ static void ourprintf(int *errp, char *format, ...)
   va_end(ap);
 }
 
+static void write_lease(int *errp, struct dhcp_lease *lease)
+{
+  int i;
+
+#ifdef HAVE_BROKEN_RTC
+  ourprintf(errp, "%u ", lease->length);
+#else
+  ourprintf(errp, "%lu ", (unsigned long)lease->expires);
+#endif
+  if (lease->hwaddr_type != ARPHRD_ETHER || lease->hwaddr_len == 0) 
+    ourprintf(errp, "%.2x-", lease->hwaddr_type);
+  for (i = 0; i < lease->hwaddr_len; i++)
+    {
+      ourprintf(errp, "%.2x", lease->hwaddr[i]);
+      if (i != lease->hwaddr_len - 1)
+	ourprintf(errp, ":");
+    }
+  
+  ourprintf(errp, " %s ", inet_ntoa(lease->addr));
+  ourprintf(errp, "%s ", lease->hostname ? lease->hostname : "*");
+  
+  if (lease->clid && lease->clid_len != 0)
+    {
+      for (i = 0; i < lease->clid_len - 1; i++)
+	ourprintf(errp, "%.2x:", lease->clid[i]);
+      ourprintf(errp, "%.2x\n", lease->clid[i]);
+    }
+  else
+    ourprintf(errp, "*\n");
+  
+  lease->file_changed = 0;
+  file_records++;
+}
+
 void lease_update_file(time_t now)
 {
   struct dhcp_lease *lease;
@@ -179,45 +407,42 @@ void lease_update_file(time_t now)
   if (file_dirty != 0 && daemon->lease_stream)
     {
       errno = 0;
-      rewind(daemon->lease_stream);
-      if (errno != 0 || ftruncate(fileno(daemon->lease_stream), 0) != 0)
-	err = errno;
-      
-      for (lease = leases; lease; lease = lease->next)
+
+      if (file_compact || file_records > 2 * (daemon->dhcp_max - leases_left) + LEASE_SLACK)
 	{
-#ifdef HAVE_BROKEN_RTC
-	  ourprintf(&err, "%u ", lease->length);
-#else
-	  ourprintf(&err, "%lu ", (unsigned long)lease->expires);
-#endif
-	  if (lease->hwaddr_type != ARPHRD_ETHER || lease->hwaddr_len == 0) 
-	    ourprintf(&err, "%.2x-", lease->hwaddr_type);
-	  for (i = 0; i < lease->hwaddr_len; i++)
+	  /* The stream is in append mode, so this writes from the start */
+	  rewind(daemon->lease_stream);
+	  if (errno != 0 || ftruncate(fileno(daemon->lease_stream), 0) != 0)
+	    err = errno;
+	  
+	  file_records = 0;
+	  for (lease = leases; lease; lease = lease->next)
+	    write_lease(&err, lease);
+	}
+      else
+	{
+	  for (i = 0; i < gone_count; i++)
 	    {
-	      ourprintf(&err, "%.2x", lease->hwaddr[i]);
-	      if (i != lease->hwaddr_len - 1)
-		ourprintf(&err, ":");
+	      ourprintf(&err, "%u 00- %s * *\n", LEASE_GONE, inet_ntoa(gone[i]));
+	      file_records++;
 	    }
 
-	  ourprintf(&err, " %s ", inet_ntoa(lease->addr));
-	  ourprintf(&err, "%s ", lease->hostname ? lease->hostname : "*");
-	  	  
-	  if (lease->clid && lease->clid_len != 0)
-	    {
-	      for (i = 0; i < lease->clid_len - 1; i++)
-		ourprintf(&err, "%.2x:", lease->clid[i]);
-	      ourprintf(&err, "%.2x\n", lease->clid[i]);
-	    }
-	  else
-	    ourprintf(&err, "*\n");	  
+	  for (lease = leases; lease; lease = lease->next)
+	    if (lease->file_changed)
+	      write_lease(&err, lease);
 	}
+
+      gone_count = 0;
       
       if (fflush(daemon->lease_stream) != 0 ||
 	  fsync(fileno(daemon->lease_stream)) < 0)
 	err = errno;
       
+      /* a partial append leaves the file in doubt: start afresh */
       if (!err)
-	file_dirty = 0;
+	file_dirty = file_compact = 0;
+      else
+	file_compact = 1;
     }
   
   /* Set alarm for when the first lease expires + slop. */
@@ -270,11 +495,12 @@ void lease_prune(struct dhcp_lease *target, time_t now)
       tmp = lease->next;
       if ((lease->expires != 0 && difftime(now, lease->expires) > 0) || lease == target)
 	{
-	  file_dirty = 1;
+	  lease_gone(lease->addr);
 	  if (lease->hostname)
 	    dns_dirty = 1;
 	  
 	  *up = lease->next; /* unlink */
+	  lease_unhash(lease);
 	  
 	  /* Put on old_leases list 'till we
 	     can run the script */
@@ -294,19 +520,19 @@ struct dhcp_lease *lease_find_by_client(unsigned char *hwaddr, int hw_len, int h
 {
   struct dhcp_lease *lease;
 
-  if (clid)
-    for (lease = leases; lease; lease = lease->next)
-      if (lease->clid && clid_len == lease->clid_len &&
+  if (clid && clid_len != 0)
+    for (lease = *clid_bucket(clid, clid_len); lease; lease = lease->clid_next)
+      if (clid_len == lease->clid_len &&
 	  memcmp(clid, lease->clid, clid_len) == 0)
 	return lease;
   
-  for (lease = leases; lease; lease = lease->next)	
-    if ((!lease->clid || !clid) && 
-	hw_len != 0 && 
-	lease->hwaddr_len == hw_len &&
-	lease->hwaddr_type == hw_type &&
-	memcmp(hwaddr, lease->hwaddr, hw_len) == 0)
-      return lease;
+  if (hw_len > 0 && hw_len <= DHCP_CHADDR_MAX)
+    for (lease = *hw_bucket(hwaddr, hw_len, hw_type); lease; lease = lease->hw_next)
+      if ((!lease->clid || !clid) && 
+	  lease->hwaddr_len == hw_len &&
+	  lease->hwaddr_type == hw_type &&
+	  memcmp(hwaddr, lease->hwaddr, hw_len) == 0)
+	return lease;
   
   return NULL;
 }
@@ -315,7 +541,7 @@ struct dhcp_lease *lease_find_by_addr(struct in_addr addr)
 {
   struct dhcp_lease *lease;
 
-  for (lease = leases; lease; lease = lease->next)
+  for (lease = *addr_bucket(addr); lease; lease = lease->addr_next)
     if (lease->addr.s_addr == addr.s_addr)
       return lease;
   
@@ -339,8 +565,9 @@ struct dhcp_lease *lease_allocate(struct in_addr addr)
 #endif
   lease->next = leases;
   leases = lease;
+  lease_hash(lease);
   
-  file_dirty = 1;
+  lease_file_changed(lease);
   leases_left--;
 
   return lease;
@@ -361,7 +588,8 @@ void lease_set_expires(struct dhcp_lease *lease, unsigned int len, time_t now)
       dns_dirty = 1;
       lease->expires = exp;
 #ifndef HAVE_BROKEN_RTC
-      lease->aux_changed = file_dirty = 1;
+      lease->aux_changed = 1;
+      lease_file_changed(lease);
 #endif
     }
   
@@ -369,7 +597,8 @@ void lease_set_expires(struct dhcp_lease *lease, unsigned int len, time_t now)
   if (len != lease->length)
     {
       lease->length = len;
-      lease->aux_changed = file_dirty = 1; 
+      lease->aux_changed = 1; 
+      lease_file_changed(lease);
     }
 #endif
 } 
@@ -381,10 +610,13 @@ void lease_set_hwaddr(struct dhcp_lease *lease, unsigned char *hwaddr,
       hw_type != lease->hwaddr_type || 
       (hw_len != 0 && memcmp(lease->hwaddr, hwaddr, hw_len) != 0))
     {
+      lease_unhash(lease);
       memcpy(lease->hwaddr, hwaddr, hw_len);
       lease->hwaddr_len = hw_len;
       lease->hwaddr_type = hw_type;
-      lease->changed = file_dirty = 1; /* run script on change */
+      lease_hash(lease);
+      lease->changed = 1; /* run script on change */
+      lease_file_changed(lease);
     }
 
   /* only update clid when one is available, stops packets
@@ -395,18 +627,27 @@ void lease_set_hwaddr(struct dhcp_lease *lease, unsigned char *hwaddr,
       if (!lease->clid)
 	lease->clid_len = 0;
 
+      if (lease->clid_len == clid_len && memcmp(lease->clid, clid, clid_len) == 0)
+	return;
+
+      lease_unhash(lease);
+      lease->aux_changed = 1;
+      lease_file_changed(lease);
+
       if (lease->clid_len != clid_len)
 	{
-	  lease->aux_changed = file_dirty = 1;
 	  free(lease->clid);
 	  if (!(lease->clid = whine_malloc(clid_len)))
-	    return;
+	    {
+	      lease->clid_len = 0;
+	      lease_hash(lease);
+	      return;
+	    }
 	}
-      else if (memcmp(lease->clid, clid, clid_len) != 0)
-	lease->aux_changed = file_dirty = 1;
 	  
       lease->clid_len = clid_len;
       memcpy(lease->clid, clid, clid_len);
+      lease_hash(lease);
     }
 
 }
@@ -488,6 +729,7 @@ void lease_set_hostname(struct dhcp_lease *lease, char *name, int auth)
 	    }
 	
 	  kill_name(lease_tmp);
+	  lease_file_changed(lease_tmp);
 	  break;
 	}
     }
@@ -499,7 +741,7 @@ void lease_set_hostname(struct dhcp_lease *lease, char *name, int auth)
   lease->fqdn = new_fqdn;
   lease->auth_name = auth;
   
-  file_dirty = 1;
+  lease_file_changed(lease);
   dns_dirty = 1; 
   lease->changed = 1; /* run script on change */
 }
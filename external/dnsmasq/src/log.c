@@ -104,7 +104,10 @@ int log_start(struct passwd *ent_pw, int errfd)
 int log_reopen(char *log_file)
 {
   if (log_fd != -1)
-    close(log_fd);
+    {
+      poll_forget(log_fd);
+      close(log_fd);
+    }
 
   /* NOTE: umask is set to 022 by the time this gets called */
      
@@ -392,18 +395,15 @@ void my_syslog(int priority, const char *format, ...)
 #endif
 }
 
-void set_log_writer(fd_set *set, int *maxfdp)
+void set_log_writer(void)
 {
   if (entries && log_fd != -1 && connection_good)
-    {
-      FD_SET(log_fd, set);
-      bump_maxfd(log_fd, maxfdp);
-    }
+    poll_listen(log_fd, POLLOUT);
 }
 
-void check_log_writer(fd_set *set)
+void check_log_writer(int force)
 {
-  if (log_fd != -1 && (!set || FD_ISSET(log_fd, set)))
+  if (log_fd != -1 && (force || poll_check(log_fd, POLLOUT)))
     log_write();
 }
 
@@ -322,6 +322,7 @@ static int create_ipv6_listener(struct listener **link, int port)
   l->tcpfd = tcpfd;
   l->family = AF_INET6;
   l->iface = NULL;
+  l->wsocks = NULL;
   l->next = NULL;
   *link = l;
   
@@ -392,6 +393,7 @@ struct listener *create_wildcard_listeners(void)
   l->fd = fd;
   l->tcpfd = tcpfd;
   l->iface = NULL;
+  l->wsocks = NULL;
   l->next = l6;
 
   return l;
@@ -420,6 +422,7 @@ void create_bound_listener(struct listener **listeners, struct irec *iface)
   struct listener *new = safe_malloc(sizeof(struct listener));
   new->family = iface->addr.sa.sa_family;
   new->iface = iface;
+  new->wsocks = NULL;
   new->next = *listeners;
   new->tcpfd = -1;
   new->fd = -1;
@@ -431,6 +434,10 @@ void create_bound_listener(struct listener **listeners, struct irec *iface)
         (new->fd = socket(iface->addr.sa.sa_family, SOCK_DGRAM, 0)) == -1 ||
         setsockopt(new->fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1 ||
         setsockopt(new->tcpfd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1 ||
+#ifdef HAVE_DNS_THREADS
+        (daemon->dns_threads != 0 &&
+         setsockopt(new->fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1) ||
+#endif
         !fix_fd(new->tcpfd) ||
         !fix_fd(new->fd))
       die(_("failed to create listening socket: %s"), NULL, EC_BADNET);
@@ -487,6 +494,10 @@ void create_bound_listener(struct listener **listeners, struct irec *iface)
 
     if (listen(new->tcpfd, 5) == -1)
       die(_("failed to listen on socket: %s"), NULL, EC_BADNET);
+
+#ifdef HAVE_DNS_THREADS
+    worker_listener_open(new);
+#endif
   }
 }
 
@@ -533,11 +544,16 @@ int delete_listener(struct listener **l)
 
   if (listener->tcpfd != -1)
   {
+    poll_forget(listener->tcpfd);
     close(listener->tcpfd);
     listener->tcpfd = -1;
   }
+#ifdef HAVE_DNS_THREADS
+  worker_listener_close(listener);
+#endif
   if (listener->fd != -1)
   {
+    poll_forget(listener->fd);
     close(listener->fd);
     listener->fd = -1;
   }
@@ -599,6 +615,7 @@ struct listener *create_bound_listeners(void)
       struct listener *new = safe_malloc(sizeof(struct listener));
       new->family = iface->addr.sa.sa_family;
       new->iface = iface;
+      new->wsocks = NULL;
       new->next = listeners;
       new->tcpfd = -1;
       new->fd = -1;
@@ -610,6 +627,10 @@ struct listener *create_bound_listeners(void)
 	      (new->fd = socket(iface->addr.sa.sa_family, SOCK_DGRAM, 0)) == -1 ||
 	      setsockopt(new->fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1 ||
 	      setsockopt(new->tcpfd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1 ||
+#ifdef HAVE_DNS_THREADS
+	      (daemon->dns_threads != 0 &&
+	       setsockopt(new->fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1) ||
+#endif
 	      !fix_fd(new->tcpfd) ||
 	      !fix_fd(new->fd))
 	    die(_("failed to create listening socket: %s"), NULL, EC_BADNET);
@@ -651,6 +672,10 @@ struct listener *create_bound_listeners(void)
 	    
 	  if (listen(new->tcpfd, 5) == -1)
 	    die(_("failed to listen on socket: %s"), NULL, EC_BADNET);
+
+#ifdef HAVE_DNS_THREADS
+	  worker_listener_open(new);
+#endif
 	}
 #endif /* !__ANDROID */
     }
@@ -74,6 +74,7 @@ struct myoption {
 #define LOPT_PXE_SERV  292
 #define LOPT_TEST      293
 #define LOPT_LISTNMARK 294
+#define LOPT_THREADS   295
 
 #ifdef HAVE_GETOPT_LONG
 static const struct option opts[] =  
@@ -183,6 +184,7 @@ static const struct myoption opts[] =
     { "listen-mark", 1, 0, LOPT_LISTNMARK },
 #endif /* __ANDROID__ */
     { "test", 0, 0, LOPT_TEST },
+    { "dns-threads", 1, 0, LOPT_THREADS },
     { NULL, 0, 0, 0 }
   };
 
@@ -297,6 +299,7 @@ static struct {
   { LOPT_PXE_SERV, ARG_DUP, "<service>", gettext_noop("Boot service for PXE menu."), NULL },
   { LOPT_LISTNMARK, ARG_ONE, NULL, gettext_noop("Socket mark to use for listen sockets."), NULL },
   { LOPT_TEST, 0, NULL, gettext_noop("Check configuration syntax."), NULL },
+  { LOPT_THREADS, ARG_ONE, "<threads>", gettext_noop("Answer cached queries with this many extra threads (requires --bind-interfaces)."), NULL },
   { 0, 0, NULL, NULL, NULL }
 }; 
 
@@ -1507,6 +1510,17 @@ static char *one_opt(int option, char *arg, char *gen_prob, int nest)
       if (!atoi_check(arg, &daemon->ftabsize))
 	option = '?';
       break;  
+
+    case LOPT_THREADS: /* --dns-threads */
+#ifdef HAVE_DNS_THREADS
+      if (!atoi_check(arg, &daemon->dns_threads))
+	option = '?';
+      else if (daemon->dns_threads > MAX_DNS_THREADS)
+	problem = _("too many DNS threads");
+#else
+      problem = _("DNS threads are not available on this platform");
+#endif
+      break;
     
     case LOPT_MAX_LOGS:  /* --log-async */
       daemon->max_logs = LOG_MAX; /* default */
@@ -2871,6 +2885,10 @@ void read_opts(int argc, char **argv, char *compile_opts)
 	  mx->target = daemon->mxtarget;
     }
 
+  /* the threads don't log */
+  if (daemon->dns_threads != 0 && (daemon->options & OPT_LOG))
+    die(_("--dns-threads cannot be used with --log-queries"), NULL, EC_BADCONF);
+
   if (!(daemon->options & OPT_NO_RESOLV) &&
       daemon->resolv_files && 
       daemon->resolv_files->next && 
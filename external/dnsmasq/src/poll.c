@@ -0,0 +1,298 @@
+/* dnsmasq is Copyright (c) 2000-2009 Simon Kelley
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 dated June, 1991, or
+   (at your option) version 3 dated 29 June, 2007.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "dnsmasq.h"
+
+/* Each pass of the main loop does poll_reset(), poll_listen() for each
+   fd it is interested in, do_poll() and then poll_check() on the fds.
+
+   With epoll the interest set stays in the kernel between passes and
+   only changes are passed down. Fds are registered EPOLLONESHOT, so the
+   cost of a pass is one epoll_ctl() per fd which fired last time, rather
+   than copying in and scanning every fd. One-shot registrations also
+   stop an fd which was closed while a forked child still holds it from
+   waking us more than once: epoll forgets those only when the child
+   exits. All the fds we listen on are non-blocking, so such a spurious
+   wakeup is harmless. */
+
+#ifdef HAVE_EPOLL
+
+#define PS_ADDED 1 /* registered in the epoll set */
+#define PS_ARMED 2 /* and will report the events in "armed" */
+
+struct pollstate {
+  short want, got, armed;
+  unsigned char flags;
+};
+
+static int epoll_fd = -1;
+static struct pollstate *fds; /* indexed by fd */
+static int fds_sz;
+static int *active; /* fds wanted this pass or registered */
+static int active_count;
+static struct epoll_event *events;
+static int events_sz;
+
+static int poll_grow(int fd);
+
+void poll_init(void)
+{
+  if ((epoll_fd = epoll_create(16)) == -1)
+    die(_("cannot create epoll instance: %s"), NULL, EC_MISC);
+  fcntl(epoll_fd, F_SETFD, FD_CLOEXEC);
+
+  /* epoll_wait() needs room for at least one event */
+  if (!poll_grow(epoll_fd))
+    die(_("could not get memory"), NULL, EC_NOMEM);
+}
+
+void poll_reset(void)
+{
+  int i;
+
+  for (i = 0; i < active_count; i++)
+    fds[active[i]].want = fds[active[i]].got = 0;
+}
+
+static int poll_grow(int fd)
+{
+  int i, sz = fds_sz == 0 ? 64 : fds_sz;
+  struct pollstate *new_fds;
+  int *new_active;
+  struct epoll_event *new_events;
+
+  while (sz <= fd)
+    sz = sz << 1;
+
+  if (!(new_fds = whine_malloc(sz * sizeof(struct pollstate))))
+    return 0;
+
+  if (!(new_active = whine_malloc(sz * sizeof(int))) ||
+      !(new_events = whine_malloc(sz * sizeof(struct epoll_event))))
+    {
+      free(new_fds);
+      if (new_active)
+	free(new_active);
+      return 0;
+    }
+
+  for (i = 0; i < fds_sz; i++)
+    new_fds[i] = fds[i];
+  for (; i < sz; i++)
+    {
+      new_fds[i].want = new_fds[i].got = new_fds[i].armed = 0;
+      new_fds[i].flags = 0;
+    }
+  for (i = 0; i < active_count; i++)
+    new_active[i] = active[i];
+
+  if (fds_sz != 0)
+    {
+      free(fds);
+      free(active);
+      free(events);
+    }
+
+  fds = new_fds;
+  active = new_active;
+  events = new_events;
+  fds_sz = events_sz = sz;
+
+  return 1;
+}
+
+void poll_listen(int fd, short event)
+{
+  struct pollstate *s;
+
+  if (fd < 0 || (fd >= fds_sz && !poll_grow(fd)))
+    return;
+
+  s = &fds[fd];
+  if (s->want == 0 && !(s->flags & PS_ADDED))
+    active[active_count++] = fd;
+  s->want |= event;
+}
+
+int poll_check(int fd, short event)
+{
+  return fd >= 0 && fd < fds_sz && (fds[fd].got & event);
+}
+
+/* Call when closing an fd which may have been passed to poll_listen().
+   Closing it drops the registration in the kernel, but a new socket
+   which gets the same number and the same interest would otherwise
+   look armed already and never be added. */
+void poll_forget(int fd)
+{
+  if (fd >= 0 && fd < fds_sz)
+    fds[fd].flags &= ~PS_ARMED;
+}
+
+/* Bring the epoll set in line with what is wanted this pass */
+static void poll_update(void)
+{
+  int i, op;
+  struct epoll_event ev;
+
+  for (i = 0; i < active_count; )
+    {
+      int fd = active[i];
+      struct pollstate *s = &fds[fd];
+
+      if (s->want == 0)
+	{
+	  /* may fail if the fd is already closed, which is fine */
+	  if (s->flags & PS_ADDED)
+	    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, &ev);
+	  s->flags = 0;
+	  active[i] = active[--active_count];
+	  continue;
+	}
+
+      if (!(s->flags & PS_ARMED) || s->armed != s->want)
+	{
+	  ev.events = EPOLLONESHOT;
+	  if (s->want & POLLIN)
+	    ev.events |= EPOLLIN;
+	  if (s->want & POLLOUT)
+	    ev.events |= EPOLLOUT;
+	  ev.data.fd = fd;
+
+	  /* The fd may have been closed and its number reused since it
+	     was registered, so the kernel may not agree about which. */
+	  op = (s->flags & PS_ADDED) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+	  if (epoll_ctl(epoll_fd, op, fd, &ev) == -1)
+	    {
+	      if (op == EPOLL_CTL_MOD && errno == ENOENT)
+		op = EPOLL_CTL_ADD;
+	      else if (op == EPOLL_CTL_ADD && errno == EEXIST)
+		op = EPOLL_CTL_MOD;
+	      else
+		op = -1;
+
+	      if (op == -1 || epoll_ctl(epoll_fd, op, fd, &ev) == -1)
+		{
+		  s->flags = 0;
+		  active[i] = active[--active_count];
+		  continue;
+		}
+	    }
+
+	  s->flags = PS_ADDED | PS_ARMED;
+	  s->armed = s->want;
+	}
+
+      i++;
+    }
+}
+
+/* timeout in milliseconds, -1 for none. Returns the number of fds ready. */
+int do_poll(int timeout)
+{
+  int i, n;
+
+  poll_update();
+
+  if ((n = epoll_wait(epoll_fd, events, events_sz, timeout)) < 0)
+    return 0;
+
+  for (i = 0; i < n; i++)
+    {
+      int fd = events[i].data.fd;
+      struct pollstate *s;
+
+      if (fd < 0 || fd >= fds_sz)
+	continue;
+
+      s = &fds[fd];
+      s->flags &= ~PS_ARMED;
+
+      /* errors are reported as readable, like select() does */
+      if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+	s->got |= POLLIN;
+      if (events[i].events & (EPOLLOUT | EPOLLERR))
+	s->got |= POLLOUT;
+      s->got &= s->want;
+    }
+
+  return n;
+}
+
+#else
+
+static fd_set rset, wset, rgot, wgot;
+static int maxfd = -1;
+
+void poll_init(void)
+{
+}
+
+void poll_reset(void)
+{
+  FD_ZERO(&rset);
+  FD_ZERO(&wset);
+  FD_ZERO(&rgot);
+  FD_ZERO(&wgot);
+  maxfd = -1;
+}
+
+void poll_listen(int fd, short event)
+{
+  if (event & POLLIN)
+    FD_SET(fd, &rset);
+  if (event & POLLOUT)
+    FD_SET(fd, &wset);
+  bump_maxfd(fd, &maxfd);
+}
+
+int poll_check(int fd, short event)
+{
+  return ((event & POLLIN) && FD_ISSET(fd, &rgot)) ||
+    ((event & POLLOUT) && FD_ISSET(fd, &wgot));
+}
+
+void poll_forget(int fd)
+{
+}
+
+int do_poll(int timeout)
+{
+  struct timeval tv, *tp = NULL;
+  int n;
+
+  if (timeout >= 0)
+    {
+      tv.tv_sec = timeout / 1000;
+      tv.tv_usec = (timeout % 1000) * 1000;
+      tp = &tv;
+    }
+
+  rgot = rset;
+  wgot = wset;
+
+  if ((n = select(maxfd+1, &rgot, &wgot, NULL, tp)) < 0)
+    {
+      /* otherwise undefined after error */
+      FD_ZERO(&rgot);
+      FD_ZERO(&wgot);
+      return 0;
+    }
+
+  return n;
+}
+
+#endif
@@ -321,6 +321,16 @@ time_t dnsmasq_time(void)
 #endif
 }
 
+/* milliseconds from an arbitrary origin, for timing short intervals.
+   Differences wrap correctly. */
+unsigned long dnsmasq_milliseconds(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return (unsigned long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
 int is_same_net(struct in_addr a, struct in_addr b, struct in_addr mask)
 {
   return (a.s_addr & mask.s_addr) == (b.s_addr & mask.s_addr);
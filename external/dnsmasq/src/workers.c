@@ -0,0 +1,757 @@
+/* dnsmasq is Copyright (c) 2000-2009 Simon Kelley
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 dated June, 1991, or
+   (at your option) version 3 dated 29 June, 2007.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "dnsmasq.h"
+
+#ifdef HAVE_DNS_THREADS
+
+/* With --dns-threads=<n>, n threads answer A and AAAA queries from the
+   cache alongside the main thread. Each bound listener gets one extra
+   UDP socket per thread, all in an SO_REUSEPORT group with the
+   listener's own socket, so the kernel spreads queries over them.
+
+   The threads never touch the cache itself, which stays single-threaded.
+   When the main thread answers an A or AAAA query from the cache, it
+   publishes the answer in a separate hash table of immutable entries,
+   which the threads read without locks. Entries are only ever added and
+   removed by the main thread: cache_hash() withdraws the answers for a
+   name whenever it gets new records, and cache_reload() and
+   cache_unhash_dhcp() withdraw the lot. Anything a thread can't answer
+   is passed whole to the main thread over a socketpair, and answered or
+   forwarded as if the main thread had read it.
+
+   Withdrawn entries, and the sockets of closed listeners, are freed once
+   every thread has been through a quiescent state (has been back to
+   epoll_wait()) since they were withdrawn, so a thread can never see
+   freed memory. The threads must not call malloc(), syslog() and the
+   like, since the main thread forks and a child would deadlock on a lock
+   held by a thread which doesn't exist in the child. */
+
+#define ANSWER_MAX_RRS 16 /* more addresses than this go to the main thread */
+#define WORKER_READS 32 /* packets read from a socket before moving on */
+
+struct answer_rr {
+  struct all_addr addr;
+  time_t ttd; /* 0 for local data, which is sent with local-ttl */
+};
+
+struct answer {
+  struct answer *hash_next; /* read by the worker threads */
+  struct answer *retired_next;
+  unsigned int hash;
+  time_t ttd; /* expiry of the first record to go, 0 for never */
+  unsigned short type, count;
+  int auth;
+  struct answer_rr *rrs;
+  char *name;
+};
+
+struct worker_socks {
+  struct worker_socks *next; /* while retired */
+  int fd[MAX_DNS_THREADS];
+};
+
+struct handoff {
+  int fd; /* worker socket the query came in on */
+  union mysockaddr source;
+};
+
+struct worker {
+  pthread_t thread;
+  int epollfd;
+  int handoff[2]; /* main thread reads [0], the worker writes [1] */
+  char *packet;
+  unsigned long seq; /* odd while the worker may hold answer pointers */
+  unsigned int hits, misses, dropped;
+};
+
+static struct worker *workers;
+static struct answer **answers; /* buckets, read by the worker threads */
+static unsigned int answer_buckets, answer_count;
+static time_t last_sweep;
+
+/* Withdrawn but not yet freed, and, in the second pair, those waiting
+   for the grace period whose start was recorded in grace_seq */
+static struct answer *retired, *grace_answers;
+static struct worker_socks *retired_socks, *grace_socks;
+static unsigned long grace_seq[MAX_DNS_THREADS];
+static int grace_running;
+
+static void *worker_run(void *arg);
+
+static unsigned int answer_hash(char *name)
+{
+  unsigned int c, val = 2166136261u;
+
+  while ((c = (unsigned char) *name++))
+    {
+      /* don't use tolower and friends here - they may be messed up by LOCALE */
+      if (c >= 'A' && c <= 'Z')
+	c += 'a' - 'A';
+      val = (val ^ c) * 16777619u;
+    }
+
+  return val;
+}
+
+void workers_init(void)
+{
+  struct listener *listener;
+  int i, j, opt = 1;
+
+  if (daemon->dns_threads == 0)
+    return;
+
+  for (answer_buckets = 64; answer_buckets < (unsigned int)daemon->cachesize; answer_buckets <<= 1);
+  answers = safe_malloc(answer_buckets * sizeof(struct answer *));
+  memset(answers, 0, answer_buckets * sizeof(struct answer *));
+
+  workers = safe_malloc(daemon->dns_threads * sizeof(struct worker));
+  memset(workers, 0, daemon->dns_threads * sizeof(struct worker));
+
+  for (i = 0; i < daemon->dns_threads; i++)
+    {
+      struct worker *w = &workers[i];
+
+      w->packet = safe_malloc(daemon->packet_buff_sz);
+      w->seq = 1; /* starts online */
+
+      if ((w->epollfd = epoll_create(16)) == -1 ||
+	  socketpair(AF_UNIX, SOCK_DGRAM, 0, w->handoff) == -1 ||
+	  !fix_fd(w->handoff[0]))
+	die(_("cannot create DNS thread: %s"), NULL, EC_MISC);
+
+      fcntl(w->epollfd, F_SETFD, FD_CLOEXEC);
+      fcntl(w->handoff[1], F_SETFD, FD_CLOEXEC);
+      /* The worker blocks when the main thread falls behind, and
+	 stops reading, like the main thread would. */
+      opt = 16 * daemon->packet_buff_sz;
+      setsockopt(w->handoff[1], SOL_SOCKET, SO_SNDBUF, &opt, sizeof(opt));
+    }
+
+  /* threads don't take signals, the main thread handles them */
+  for (i = 0; i < daemon->dns_threads; i++)
+    {
+      sigset_t mask, old;
+
+      sigfillset(&mask);
+      pthread_sigmask(SIG_BLOCK, &mask, &old);
+      j = pthread_create(&workers[i].thread, NULL, worker_run, &workers[i]);
+      pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+      if (j != 0)
+	{
+	  errno = j;
+	  die(_("cannot create DNS thread: %s"), NULL, EC_MISC);
+	}
+    }
+
+  for (listener = daemon->listeners; listener; listener = listener->next)
+    if (listener->wsocks)
+      for (i = 0; i < daemon->dns_threads; i++)
+	if (listener->wsocks->fd[i] != -1)
+	  {
+	    struct epoll_event ev;
+	    ev.events = EPOLLIN;
+	    ev.data.fd = listener->wsocks->fd[i];
+	    epoll_ctl(workers[i].epollfd, EPOLL_CTL_ADD, ev.data.fd, &ev);
+	  }
+
+  my_syslog(LOG_INFO, _("answering cached queries with %d threads"), daemon->dns_threads);
+}
+
+/* Called as a bound listener is created: make a socket for each thread,
+   in the same SO_REUSEPORT group as listener->fd. That has to be done
+   before privileges are dropped, so for the listeners which exist at
+   startup the sockets are handed to the threads by workers_init(). */
+void worker_listener_open(struct listener *listener)
+{
+  struct worker_socks *ws;
+  int i, opt = 1;
+
+  listener->wsocks = NULL;
+
+  if (daemon->dns_threads == 0 || listener->fd == -1 || !listener->iface)
+    return;
+
+  if (!(ws = whine_malloc(sizeof(struct worker_socks))))
+    return;
+
+  for (i = 0; i < MAX_DNS_THREADS; i++)
+    ws->fd[i] = -1;
+
+  for (i = 0; i < daemon->dns_threads; i++)
+    {
+      int fd;
+
+      if ((fd = socket(listener->family, SOCK_DGRAM, 0)) == -1)
+	break;
+
+      if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1 ||
+	  setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1 ||
+#ifdef HAVE_IPV6
+	  (listener->family == AF_INET6 &&
+	   setsockopt(fd, IPV6_LEVEL, IPV6_V6ONLY, &opt, sizeof(opt)) == -1) ||
+#endif
+	  (daemon->listen_mark != 0 &&
+	   setsockopt(fd, SOL_SOCKET, SO_MARK, &daemon->listen_mark, sizeof(daemon->listen_mark)) == -1) ||
+	  !fix_fd(fd) ||
+	  bind(fd, &listener->iface->addr.sa, sa_len(&listener->iface->addr)) == -1)
+	{
+	  close(fd);
+	  break;
+	}
+
+      ws->fd[i] = fd;
+
+      if (workers)
+	{
+	  struct epoll_event ev;
+	  ev.events = EPOLLIN;
+	  ev.data.fd = fd;
+	  epoll_ctl(workers[i].epollfd, EPOLL_CTL_ADD, fd, &ev);
+	}
+    }
+
+  /* The main thread's socket answers everything on its own if need be. */
+  if (i != daemon->dns_threads)
+    {
+      prettyprint_addr(&listener->iface->addr, daemon->namebuff);
+      my_syslog(LOG_WARNING, _("failed to create DNS thread socket for %s: %s"),
+		daemon->namebuff, strerror(errno));
+    }
+
+  listener->wsocks = ws;
+}
+
+void worker_listener_close(struct listener *listener)
+{
+  struct worker_socks *ws = listener->wsocks;
+  int i;
+
+  if (!ws)
+    return;
+
+  listener->wsocks = NULL;
+
+  for (i = 0; i < MAX_DNS_THREADS; i++)
+    if (ws->fd[i] != -1)
+      {
+	if (workers)
+	  {
+	    struct epoll_event ev;
+	    epoll_ctl(workers[i].epollfd, EPOLL_CTL_DEL, ws->fd[i], &ev);
+	  }
+	else
+	  {
+	    close(ws->fd[i]);
+	    ws->fd[i] = -1;
+	  }
+      }
+
+  /* a thread may still be reading from them */
+  ws->next = retired_socks;
+  retired_socks = ws;
+}
+
+static void free_socks(struct worker_socks *ws)
+{
+  int i;
+
+  for (i = 0; i < MAX_DNS_THREADS; i++)
+    if (ws->fd[i] != -1)
+      close(ws->fd[i]);
+
+  free(ws);
+}
+
+/* Look for the answer to name/type. Safe in any thread, as long as the
+   caller is a worker inside its online period, or the main thread. */
+static struct answer *answer_find(char *name, unsigned int hash, unsigned short type)
+{
+  struct answer *a;
+
+  for (a = __atomic_load_n(&answers[hash & (answer_buckets - 1)], __ATOMIC_ACQUIRE);
+       a;
+       a = __atomic_load_n(&a->hash_next, __ATOMIC_ACQUIRE))
+    if (a->hash == hash && a->type == type && hostname_isequal(a->name, name))
+      return a;
+
+  return NULL;
+}
+
+static void answer_retire(struct answer **up, struct answer *a)
+{
+  /* unlink, but leave a->hash_next alone for threads walking the chain */
+  __atomic_store_n(up, a->hash_next, __ATOMIC_RELEASE);
+  a->retired_next = retired;
+  retired = a;
+  answer_count--;
+}
+
+/* Remove expired answers from a bucket, or all of them */
+static void answer_sweep(unsigned int bucket, time_t now)
+{
+  struct answer **up, *a;
+
+  for (up = &answers[bucket]; (a = *up); )
+    if (a->ttd != 0 && difftime(now, a->ttd) >= 0)
+      answer_retire(up, a);
+    else
+      up = &a->hash_next;
+}
+
+void answer_forget(char *name)
+{
+  struct answer **up, *a;
+  unsigned int hash;
+
+  if (!answers)
+    return;
+
+  hash = answer_hash(name);
+  for (up = &answers[hash & (answer_buckets - 1)]; (a = *up); )
+    if (a->hash == hash && hostname_isequal(a->name, name))
+      answer_retire(up, a);
+    else
+      up = &a->hash_next;
+}
+
+void answer_forget_all(void)
+{
+  unsigned int i;
+
+  if (!answers)
+    return;
+
+  for (i = 0; i < answer_buckets; i++)
+    while (answers[i])
+      answer_retire(&answers[i], answers[i]);
+}
+
+/* The main thread has answered the query in header from the cache.
+   If the answer is one the threads can give, publish it for them. This
+   must match what answer_request() does for A and AAAA queries. */
+void answer_publish(HEADER *header, size_t plen, time_t now)
+{
+  char *name = daemon->namebuff;
+  struct crec *crecp;
+  struct answer *a;
+  unsigned short type, flag;
+  unsigned int hash, bucket;
+  int count = 0, auth = 1, localise;
+  time_t ttd = 0;
+  size_t len;
+
+  if (!answers || header->rcode != NOERROR || header->tc || ntohs(header->ancount) == 0)
+    return;
+
+  flag = extract_request(header, plen, name, &type);
+  if ((flag != F_IPV4 && flag != F_IPV6) || *name == 0)
+    return;
+
+  hash = answer_hash(name);
+  bucket = hash & (answer_buckets - 1);
+  if (answer_find(name, hash, type))
+    return;
+
+  /* "A for A" queries and interface names aren't in the cache */
+  if (flag == F_IPV4)
+    {
+      struct interface_name *intr;
+
+      if (inet_addr(name) != (in_addr_t) -1)
+	return;
+
+      for (intr = daemon->int_names; intr; intr = intr->next)
+	if (hostname_isequal(name, intr->name))
+	  return;
+    }
+
+  localise = flag == F_IPV4 && (daemon->options & OPT_LOCALISE);
+
+  for (crecp = NULL; (crecp = cache_find_by_name(crecp, name, now, flag | F_CNAME)); count++)
+    {
+      /* CNAME chains, negative answers and answers which depend on
+	 the interface are left to the main thread */
+      if ((crecp->flags & (F_CNAME | F_NEG)) ||
+	  (localise && (crecp->flags & F_HOSTS)) ||
+	  count == ANSWER_MAX_RRS)
+	return;
+
+      if (!(crecp->flags & (F_HOSTS | F_DHCP)))
+	auth = 0;
+
+      if (!(crecp->flags & F_IMMORTAL) && (ttd == 0 || difftime(ttd, crecp->ttd) > 0))
+	ttd = crecp->ttd;
+    }
+
+  if (count == 0)
+    return;
+
+  /* keep the table no larger than the cache, making room by
+     dropping expired answers, at most once a second */
+  if (answer_count >= answer_buckets && now != last_sweep)
+    {
+      unsigned int i;
+
+      last_sweep = now;
+      for (i = 0; i < answer_buckets; i++)
+	answer_sweep(i, now);
+    }
+  else
+    answer_sweep(bucket, now);
+
+  if (answer_count >= answer_buckets)
+    return;
+
+  len = strlen(name) + 1;
+  if (!(a = whine_malloc(sizeof(struct answer) + count * sizeof(struct answer_rr) + len)))
+    return;
+
+  a->rrs = (struct answer_rr *)(a + 1);
+  a->name = (char *)(a->rrs + count);
+  memcpy(a->name, name, len);
+  a->hash = hash;
+  a->type = type;
+  a->auth = auth;
+  a->ttd = ttd;
+  a->count = 0;
+
+  for (crecp = NULL; (crecp = cache_find_by_name(crecp, name, now, flag | F_CNAME)) && a->count < count; a->count++)
+    {
+      a->rrs[a->count].addr = crecp->addr.addr;
+      a->rrs[a->count].ttd = (crecp->flags & (F_IMMORTAL | F_DHCP)) ? 0 : crecp->ttd;
+    }
+
+  a->hash_next = answers[bucket];
+  a->retired_next = NULL;
+  __atomic_store_n(&answers[bucket], a, __ATOMIC_RELEASE);
+  answer_count++;
+}
+
+/* Answer a query in a worker thread. Returns the length of the reply,
+   or 0 to pass the query to the main thread. */
+static size_t worker_answer(HEADER *header, size_t n, time_t now)
+{
+  char name[MAXDNAME];
+  unsigned char *p = (unsigned char *)(header + 1), *end = ((unsigned char *)header) + n;
+  unsigned char *limit = ((unsigned char *)header) + PACKETSZ;
+  unsigned short qtype, qclass;
+  unsigned int l, i, hash, namelen = 0;
+  struct answer *a;
+  int rrsz;
+
+  if (n < sizeof(HEADER) || header->qr || header->opcode != QUERY ||
+      ntohs(header->qdcount) != 1 || header->ancount != 0 ||
+      header->nscount != 0 || header->arcount != 0)
+    return 0;
+
+  /* plain labels only, anything unusual goes to extract_name() */
+  while (1)
+    {
+      if (p >= end)
+	return 0;
+      if ((l = *p++) == 0)
+	break;
+      if (l > 63 || p + l > end || namelen + l + 1 >= MAXDNAME)
+	return 0;
+      for (i = 0; i < l; i++)
+	{
+	  unsigned char c = *p++;
+	  if (c <= ' ' || c > '~' || c == '.')
+	    return 0;
+	  name[namelen++] = c;
+	}
+      name[namelen++] = '.';
+    }
+
+  if (namelen == 0 || p + 4 > end)
+    return 0;
+
+  name[namelen - 1] = 0;
+  GETSHORT(qtype, p);
+  GETSHORT(qclass, p);
+
+  if (qclass != C_IN || (qtype != T_A
+#ifdef HAVE_IPV6
+			 && qtype != T_AAAA
+#endif
+			 ))
+    return 0;
+
+  hash = answer_hash(name);
+  if (!(a = answer_find(name, hash, qtype)) ||
+      (a->ttd != 0 && difftime(now, a->ttd) >= 0))
+    return 0;
+
+  rrsz = qtype == T_A ? INADDRSZ : IN6ADDRSZ;
+  if (p + a->count * (12 + rrsz) > limit)
+    return 0;
+
+  for (i = 0; i < a->count; i++)
+    {
+      unsigned long ttl = a->rrs[i].ttd == 0 ? daemon->local_ttl : (unsigned long)(a->rrs[i].ttd - now);
+
+      PUTSHORT(sizeof(HEADER) | 0xc000, p);
+      PUTSHORT(qtype, p);
+      PUTSHORT(C_IN, p);
+      PUTLONG(ttl, p);
+      PUTSHORT(rrsz, p);
+      memcpy(p, &a->rrs[i].addr, rrsz);
+      p += rrsz;
+    }
+
+  header->qr = 1;
+  header->aa = a->auth;
+  header->ra = 1;
+  header->tc = 0;
+  header->rcode = NOERROR;
+  header->ancount = htons(a->count);
+
+  return p - (unsigned char *)header;
+}
+
+static void worker_packet(struct worker *w, int fd, ssize_t n, union mysockaddr *source, time_t now)
+{
+  struct handoff h;
+  struct msghdr msg;
+  struct iovec iov[2];
+  ssize_t m;
+
+  if ((m = (ssize_t)worker_answer((HEADER *)w->packet, (size_t)n, now)) != 0)
+    {
+      while (sendto(fd, w->packet, m, 0, &source->sa, sa_len(source)) == -1 && errno == EINTR);
+      w->hits++;
+      return;
+    }
+
+  memset(&h, 0, sizeof(h));
+  h.fd = fd;
+  h.source = *source;
+  iov[0].iov_base = &h;
+  iov[0].iov_len = sizeof(h);
+  iov[1].iov_base = w->packet;
+  iov[1].iov_len = n;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = 2;
+
+  while ((m = sendmsg(w->handoff[1], &msg, 0)) == -1 && errno == EINTR);
+
+  if (m == -1)
+    w->dropped++;
+  else
+    w->misses++;
+}
+
+static void *worker_run(void *arg)
+{
+  struct worker *w = arg;
+  struct epoll_event events[16];
+  int i, j, n;
+
+  while (1)
+    {
+      /* quiescent state: no answer pointers held from here */
+      __atomic_add_fetch(&w->seq, 1, __ATOMIC_RELEASE);
+
+      n = epoll_wait(w->epollfd, events, 16, -1);
+
+      __atomic_add_fetch(&w->seq, 1, __ATOMIC_SEQ_CST);
+
+      for (i = 0; i < n; i++)
+	{
+	  int fd = events[i].data.fd;
+	  time_t now = dnsmasq_time();
+
+	  for (j = 0; j < WORKER_READS; j++)
+	    {
+	      union mysockaddr source;
+	      socklen_t len = sizeof(source);
+	      ssize_t sz;
+
+	      if ((sz = recvfrom(fd, w->packet, daemon->edns_pktsz, MSG_TRUNC,
+				 &source.sa, &len)) == -1)
+		break;
+
+	      if (sz <= daemon->edns_pktsz)
+		worker_packet(w, fd, sz, &source, now);
+	    }
+	}
+    }
+
+  return NULL;
+}
+
+/* Main thread: read queries passed on by the workers */
+static void check_handoff(struct worker *w, time_t now)
+{
+  struct handoff h;
+  struct msghdr msg;
+  struct iovec iov[2];
+  struct listener *listener;
+  ssize_t n;
+  int i, j;
+
+  for (j = 0; j < WORKER_READS; j++)
+    {
+      iov[0].iov_base = &h;
+      iov[0].iov_len = sizeof(h);
+      iov[1].iov_base = daemon->packet;
+      iov[1].iov_len = daemon->edns_pktsz;
+      memset(&msg, 0, sizeof(msg));
+      msg.msg_iov = iov;
+      msg.msg_iovlen = 2;
+
+      if ((n = recvmsg(w->handoff[0], &msg, 0)) < (ssize_t)sizeof(h))
+	return;
+
+      /* The socket's listener may have gone since. */
+      for (listener = daemon->listeners; listener; listener = listener->next)
+	if (listener->wsocks)
+	  {
+	    for (i = 0; i < daemon->dns_threads; i++)
+	      if (listener->wsocks->fd[i] == h.fd)
+		break;
+	    if (i != daemon->dns_threads)
+	      break;
+	  }
+
+      if (listener && listener->fd != -1)
+	handoff_query(listener, (size_t)(n - sizeof(h)), &h.source, now);
+    }
+}
+
+/* Main thread: free what was withdrawn before the grace period in
+   progress, if all the threads have been quiescent since it began,
+   then start another for whatever has been withdrawn since. */
+static void reclaim(time_t now)
+{
+  int i;
+
+  if (grace_running)
+    {
+      for (i = 0; i < daemon->dns_threads; i++)
+	{
+	  unsigned long seq = __atomic_load_n(&workers[i].seq, __ATOMIC_ACQUIRE);
+	  if ((grace_seq[i] & 1) && seq == grace_seq[i])
+	    return;
+	}
+
+      /* Queries passed over before the threads went quiescent may
+	 name a socket about to be closed, deal with them first. */
+      if (grace_socks)
+	for (i = 0; i < daemon->dns_threads; i++)
+	  check_handoff(&workers[i], now);
+
+      while (grace_answers)
+	{
+	  struct answer *tmp = grace_answers->retired_next;
+	  free(grace_answers);
+	  grace_answers = tmp;
+	}
+
+      while (grace_socks)
+	{
+	  struct worker_socks *tmp = grace_socks->next;
+	  free_socks(grace_socks);
+	  grace_socks = tmp;
+	}
+
+      grace_running = 0;
+    }
+
+  if (retired || retired_socks)
+    {
+      grace_answers = retired;
+      grace_socks = retired_socks;
+      retired = NULL;
+      retired_socks = NULL;
+
+      /* order the unlinking before reading the counters */
+      __atomic_thread_fence(__ATOMIC_SEQ_CST);
+      for (i = 0; i < daemon->dns_threads; i++)
+	grace_seq[i] = __atomic_load_n(&workers[i].seq, __ATOMIC_ACQUIRE);
+      grace_running = 1;
+    }
+}
+
+/* Non-zero while there's memory or sockets waiting to be freed */
+int workers_pending(void)
+{
+  return workers && (grace_running || retired || retired_socks);
+}
+
+void set_worker_listeners(void)
+{
+  int i;
+
+  if (workers)
+    for (i = 0; i < daemon->dns_threads; i++)
+      poll_listen(workers[i].handoff[0], POLLIN);
+}
+
+void check_worker_listeners(time_t now)
+{
+  int i;
+
+  if (!workers)
+    {
+      /* listeners closed before the threads started */
+      while (retired_socks)
+	{
+	  struct worker_socks *tmp = retired_socks->next;
+	  free_socks(retired_socks);
+	  retired_socks = tmp;
+	}
+      return;
+    }
+
+  for (i = 0; i < daemon->dns_threads; i++)
+    if (poll_check(workers[i].handoff[0], POLLIN))
+      check_handoff(&workers[i], now);
+
+  reclaim(now);
+}
+
+/* Queries answered by the threads */
+unsigned int worker_answers(void)
+{
+  unsigned int hits = 0;
+  int i;
+
+  if (workers)
+    for (i = 0; i < daemon->dns_threads; i++)
+      hits += workers[i].hits;
+
+  return hits;
+}
+
+void dump_workers(void)
+{
+  int i;
+
+  if (!workers)
+    return;
+
+  my_syslog(LOG_INFO, _("%u answers published to DNS threads"), answer_count);
+  for (i = 0; i < daemon->dns_threads; i++)
+    my_syslog(LOG_INFO, _("DNS thread %d: %u cache hits, %u misses passed on, %u dropped"),
+	      i, workers[i].hits, workers[i].misses, workers[i].dropped);
+}
+
+#endif
@@ -194,6 +194,8 @@ struct f2fs_sb_info {
 
 	unsigned int cur_victim_sec;            /* current victim section num */
 	u32 free_segments;
+
+	u64 alloc_hint[NO_CHECK_TYPE];          /* last allocated blkaddr */
 };
 
 static inline struct f2fs_super_block *F2FS_RAW_SUPER(struct f2fs_sb_info *sbi)
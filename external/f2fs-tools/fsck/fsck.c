@@ -13,6 +13,51 @@
 
 char *tree_mark;
 uint32_t tree_mark_size = 256;
+
+/*
+ * While walk threads check directory subtrees in parallel (see queue.c),
+ * the main and nat bitmaps and the counters are updated atomically, and
+ * the rest of the shared state is serialized by fsck->lock.
+ */
+static inline void fsck_lock(struct f2fs_fsck *fsck)
+{
+	if (fsck->nr_walkers)
+		pthread_mutex_lock(&fsck->lock);
+}
+
+static inline void fsck_unlock(struct f2fs_fsck *fsck)
+{
+	if (fsck->nr_walkers)
+		pthread_mutex_unlock(&fsck->lock);
+}
+
+static inline int fsck_test_bit(unsigned int nr, char *addr)
+{
+	char mask = 1 << (7 - (nr & 0x07));
+
+	return (__atomic_load_n(addr + (nr >> 3), __ATOMIC_RELAXED) &
+								mask) != 0;
+}
+
+static inline int fsck_set_bit(unsigned int nr, char *addr)
+{
+	char mask = 1 << (7 - (nr & 0x07));
+
+	return __atomic_fetch_or(addr + (nr >> 3), mask,
+					__ATOMIC_RELAXED) & mask;
+}
+
+static inline int fsck_clear_bit(unsigned int nr, char *addr)
+{
+	char mask = 1 << (7 - (nr & 0x07));
+
+	return __atomic_fetch_and(addr + (nr >> 3), ~mask,
+					__ATOMIC_RELAXED) & mask;
+}
+
+#define chk_add(fsck, cnt, n) \
+	__atomic_add_fetch(&(fsck)->chk.cnt, (n), __ATOMIC_RELAXED)
+
 /*lint -save -e529 -e564*/
 int f2fs_set_main_bitmap(struct f2fs_sb_info *sbi, u32 blk, int type)
 {
@@ -20,6 +65,7 @@ int f2fs_set_main_bitmap(struct f2fs_sb_info *sbi, u32 blk, int type)
 	struct seg_entry *se;
 	int fix = 0;
 
+	fsck_lock(fsck);
 	se = get_seg_entry(sbi, GET_SEGNO(sbi, blk));
 	if (se->type >= NO_CHECK_TYPE)
 		fix = 1;
@@ -33,14 +79,15 @@ int f2fs_set_main_bitmap(struct f2fs_sb_info *sbi, u32 blk, int type)
 				GET_SEGNO(sbi, blk), se->type, type);
 		se->type = type;
 	}
-	return f2fs_set_bit(BLKOFF_FROM_MAIN(sbi, blk), fsck->main_area_bitmap);
+	fsck_unlock(fsck);
+	return fsck_set_bit(BLKOFF_FROM_MAIN(sbi, blk), fsck->main_area_bitmap);
 }
 
 static inline int f2fs_test_main_bitmap(struct f2fs_sb_info *sbi, u32 blk)
 {
 	struct f2fs_fsck *fsck = F2FS_FSCK(sbi);
 
-	return f2fs_test_bit(BLKOFF_FROM_MAIN(sbi, blk),
+	return fsck_test_bit(BLKOFF_FROM_MAIN(sbi, blk),
 						fsck->main_area_bitmap);
 }
 
@@ -135,6 +182,7 @@ static int find_and_dec_hard_link_list(struct f2fs_sb_info *sbi, u32 nid)
 static int is_valid_ssa_node_blk(struct f2fs_sb_info *sbi, u32 nid,
 							u32 blk_addr)
 {
+	struct f2fs_fsck *fsck = F2FS_FSCK(sbi);
 	struct f2fs_summary_block *sum_blk;
 	struct f2fs_summary *sum_entry;
 	struct seg_entry * se;
@@ -145,6 +193,7 @@ static int is_valid_ssa_node_blk(struct f2fs_sb_info *sbi, u32 nid,
 	segno = GET_SEGNO(sbi, blk_addr);
 	offset = OFFSET_IN_SEG(sbi, blk_addr);
 
+	fsck_lock(fsck);
 	sum_blk = get_sum_node_block_from_cache(sbi, segno, &type);
 	if (!sum_blk)
 		/* do not free the sum_blk, it is saved to cache, and will
@@ -204,6 +253,7 @@ static int is_valid_ssa_node_blk(struct f2fs_sb_info *sbi, u32 nid,
 		ASSERT(ret2 >= 0);
 	}
 out:
+	fsck_unlock(fsck);
 	return ret;
 }
 
@@ -256,6 +306,7 @@ out:
 static int is_valid_ssa_data_blk(struct f2fs_sb_info *sbi, u32 blk_addr,
 		u32 parent_nid, u16 idx_in_node, u8 version)
 {
+	struct f2fs_fsck *fsck = F2FS_FSCK(sbi);
 	struct f2fs_summary_block *sum_blk;
 	struct f2fs_summary *sum_entry;
 	struct seg_entry * se;
@@ -266,6 +317,7 @@ static int is_valid_ssa_data_blk(struct f2fs_sb_info *sbi, u32 blk_addr,
 	segno = GET_SEGNO(sbi, blk_addr);
 	offset = OFFSET_IN_SEG(sbi, blk_addr);
 
+	fsck_lock(fsck);
 	sum_blk = get_sum_data_block_from_cache(sbi, segno, &type);
 	if (!sum_blk)
 		/* do not free the sum_blk, it is saved to cache, and will
@@ -334,6 +386,7 @@ static int is_valid_ssa_data_blk(struct f2fs_sb_info *sbi, u32 blk_addr,
 		ASSERT(ret2 >= 0);
 	}
 out:
+	fsck_unlock(fsck);
 	return ret;
 }
 
@@ -472,8 +525,8 @@ static int sanity_check_nid(struct f2fs_sb_info *sbi, u32 nid,
 
 	/* workaround to fix later */
 	if (ftype != F2FS_FT_ORPHAN ||
-			f2fs_test_bit(nid, fsck->nat_area_bitmap) != 0)
-		f2fs_clear_bit(nid, fsck->nat_area_bitmap);
+			fsck_test_bit(nid, fsck->nat_area_bitmap) != 0)
+		fsck_clear_bit(nid, fsck->nat_area_bitmap);
 	else {
 		DMD_ADD_ERROR(LOG_TYP_FSCK, PR_DUPLICATE_ORPHAN_OR_XATTR_NID);
 		ASSERT_MSG("orphan or xattr nid is duplicated [0x%x]\n",
@@ -493,8 +546,8 @@ static int sanity_check_nid(struct f2fs_sb_info *sbi, u32 nid,
 	}
 
 	if (f2fs_test_main_bitmap(sbi, ni->blk_addr) == 0) {
-		fsck->chk.valid_blk_cnt++;
-		fsck->chk.valid_node_cnt++;
+		chk_add(fsck, valid_blk_cnt, 1);
+		chk_add(fsck, valid_node_cnt, 1);
 	}
 	return 0;
 }
@@ -512,9 +565,9 @@ static int sanity_check_inode(struct f2fs_sb_info *sbi, struct f2fs_node *node)
 	return 0;
 
 remove_node:
-	f2fs_set_bit(le32_to_cpu(node->footer.ino), fsck->nat_area_bitmap);
-	fsck->chk.valid_blk_cnt--;
-	fsck->chk.valid_node_cnt--;
+	fsck_set_bit(le32_to_cpu(node->footer.ino), fsck->nat_area_bitmap);
+	chk_add(fsck, valid_blk_cnt, -1);
+	chk_add(fsck, valid_node_cnt, -1);
 	return -EINVAL;
 }
 
@@ -613,8 +666,21 @@ int fsck_chk_node_blk(struct f2fs_sb_info *sbi, struct f2fs_inode *inode,
 		u32 nid, enum FILE_TYPE ftype, enum NODE_TYPE ntype,
 		u32 *blk_cnt, struct child_info *child)
 {
+	struct f2fs_fsck *fsck = F2FS_FSCK(sbi);
 	struct node_info ni;
 	struct f2fs_node *node_blk = NULL;
+	pthread_mutex_t *ino_lock = NULL;
+	int ret = 0;
+
+	/*
+	 * Hard links reach a file from several directories, which may be
+	 * walked at the same time. The first visit counts the inode and the
+	 * later ones only drop a link, so a file is checked under its lock.
+	 */
+	if (fsck->nr_walkers && ntype == TYPE_INODE && ftype != F2FS_FT_DIR) {
+		ino_lock = &fsck->ino_lock[nid % WALK_INO_LOCKS];
+		pthread_mutex_lock(ino_lock);
+	}
 
 	node_blk = (struct f2fs_node *)calloc(BLOCK_SZ, 1);
 	ASSERT(node_blk != NULL);
@@ -623,12 +689,12 @@ int fsck_chk_node_blk(struct f2fs_sb_info *sbi, struct f2fs_inode *inode,
 		goto err;
 
 	if (ntype == TYPE_INODE) {
-		struct f2fs_fsck *fsck = F2FS_FSCK(sbi);
-
 		if (sanity_check_inode(sbi, node_blk))
 			goto err;
 		fsck_chk_inode_blk(sbi, nid, ftype, node_blk, blk_cnt, &ni, child);
+		fsck_lock(fsck);
 		quota_add_inode_usage(fsck->qctx, nid, &node_blk->i);
+		fsck_unlock(fsck);
 	} else {
 		switch (ntype) {
 		case TYPE_DIRECT_NODE:
@@ -653,11 +719,14 @@ int fsck_chk_node_blk(struct f2fs_sb_info *sbi, struct f2fs_inode *inode,
 			ASSERT(0);
 		}
 	}
+out:
+	if (ino_lock)
+		pthread_mutex_unlock(ino_lock);
 	free(node_blk);
-	return 0;
+	return ret;
 err:
-	free(node_blk);
-	return -EINVAL;
+	ret = -EINVAL;
+	goto out;
 }
 
 static inline void get_extent_info(struct extent_info *ext,
@@ -756,9 +825,10 @@ void fsck_chk_inode_blk(struct f2fs_sb_info *sbi, u32 nid,
 	child.p_ino = nid;
 	child.pp_ino = le32_to_cpu(node_blk->i.i_pino);
 	child.dir_level = node_blk->i.i_dir_level;
+	child.depth = (child_d ? child_d->depth : 0) + 1;
 
 	if (f2fs_test_main_bitmap(sbi, ni->blk_addr) == 0)
-		fsck->chk.valid_inode_cnt++;
+		chk_add(fsck, valid_inode_cnt, 1);
 
 	if (ftype == F2FS_FT_DIR) {
 		f2fs_set_main_bitmap(sbi, ni->blk_addr, CURSEG_HOT_NODE);
@@ -769,12 +839,17 @@ void fsck_chk_inode_blk(struct f2fs_sb_info *sbi, u32 nid,
 			if (i_links > 1 && ftype != F2FS_FT_ORPHAN &&
 					!is_qf_ino(F2FS_RAW_SUPER(sbi), nid)) {
 				/* First time. Create new hard link node */
+				fsck_lock(fsck);
 				add_into_hard_link_list(sbi, nid, i_links);
-				fsck->chk.multi_hard_link_files++;
+				fsck_unlock(fsck);
+				chk_add(fsck, multi_hard_link_files, 1);
 			}
 		} else {
 			DBG(3, "[0x%x] has hard links [0x%x]\n", nid, i_links);
-			if (find_and_dec_hard_link_list(sbi, nid)) {
+			fsck_lock(fsck);
+			ret = find_and_dec_hard_link_list(sbi, nid);
+			fsck_unlock(fsck);
+			if (ret) {
 				DMD_ADD_ERROR(LOG_TYP_FSCK, PR_HARD_LINK_NUM_IS_ERROR);
 				ASSERT_MSG("[0x%x] needs more i_links=0x%x",
 						nid, i_links);
@@ -1481,12 +1556,32 @@ static void nullify_dentry(struct f2fs_dir_entry *dentry, int offs,
 	memset(*filename, 0, F2FS_SLOT_LEN);
 }
 
+/* a subdirectory handed to the walk threads by __chk_dentries() */
+struct dir_walk {
+	struct walk_work work;
+	struct child_info child;	/* the parent's, as for a serial check */
+	u32 ino;
+	int ret;
+	struct dir_walk *next;
+};
+
+static void walk_subdir(struct f2fs_sb_info *sbi, struct walk_work *work)
+{
+	struct dir_walk *dw = container_of(work, struct dir_walk, work);
+	u32 blk_cnt = 1;
+
+	dw->ret = fsck_chk_node_blk(sbi, NULL, dw->ino, F2FS_FT_DIR,
+					TYPE_INODE, &blk_cnt, &dw->child);
+}
+
 static int __chk_dentries(struct f2fs_sb_info *sbi, struct child_info *child,
 			u8 *bitmap, struct f2fs_dir_entry *dentry,
 			__u8 (*filenames)[F2FS_SLOT_LEN],
 			int max, int last_blk, int enc_name)
 {
 	struct f2fs_fsck *fsck = F2FS_FSCK(sbi);
+	struct walk_group group;
+	struct dir_walk *dw, *walks = NULL;
 	enum FILE_TYPE ftype;
 	int dentries = 0;
 	u32 blk_cnt;
@@ -1629,15 +1724,33 @@ static int __chk_dentries(struct f2fs_sb_info *sbi, struct child_info *child,
 		en_len = convert_encrypted_name(name, name_len, en, enc_name);
 		en[en_len] = '\0';
 		DBG(1, "[%3u]-[0x%x] name[%s] len[0x%x] ino[0x%x] type[0x%x]\n",
-				fsck->dentry_depth, i, en, name_len,
+				child->depth, i, en, name_len,
 				le32_to_cpu(dentry[i].ino),
 				dentry[i].file_type);
 
-		print_dentry(fsck->dentry_depth, name, bitmap,
+		print_dentry(child->depth, name, bitmap,
 				dentry, max, i, last_blk, enc_name);
 
 		blk_cnt = 1;
 		child->i_namelen = name_len;
+
+		if (fsck->nr_walkers && ftype == F2FS_FT_DIR) {
+			if (!walks)
+				init_walk_group(&group);
+			dw = malloc(sizeof(struct dir_walk));
+			ASSERT(dw != NULL);
+			dw->child = *child;
+			dw->ino = le32_to_cpu(dentry[i].ino);
+			dw->work.fn = walk_subdir;
+			dw->next = walks;
+			walks = dw;
+			queue_walk_work(sbi, &group, &dw->work);
+
+			i += slots;
+			free(name);
+			continue;
+		}
+
 		ret = fsck_chk_node_blk(sbi,
 				NULL, le32_to_cpu(dentry[i].ino),
 				ftype, TYPE_INODE, &blk_cnt, child);
@@ -1662,13 +1775,29 @@ static int __chk_dentries(struct f2fs_sb_info *sbi, struct child_info *child,
 		i += slots;
 		free(name);
 	}
+
+	/*
+	 * Subtrees are only walked in parallel when not fixing, so a failed
+	 * subdirectory leaves its dentry alone, as the serial check would.
+	 */
+	if (walks)
+		wait_walk_group(sbi, &group);
+	while (walks) {
+		dw = walks;
+		walks = dw->next;
+		if (dw->ret == 0) {
+			child->links++;
+			dentries++;
+			child->files++;
+		}
+		free(dw);
+	}
 	return fixed ? -1 : dentries;
 }
 
 int fsck_chk_inline_dentries(struct f2fs_sb_info *sbi,
 		struct f2fs_node *node_blk, struct child_info *child)
 {
-	struct f2fs_fsck *fsck = F2FS_FSCK(sbi);
 	struct f2fs_dentry_ptr d;
 	void *inline_dentry;
 	int dentries;
@@ -1678,27 +1807,24 @@ int fsck_chk_inline_dentries(struct f2fs_sb_info *sbi,
 
 	make_dentry_ptr(&d, node_blk, inline_dentry, 2);
 
-	fsck->dentry_depth++;
 	dentries = __chk_dentries(sbi, child,
 			d.bitmap, d.dentry, d.filename, d.max, 1,
 			file_is_encrypt(&node_blk->i));
 	if (dentries < 0) {
 		DBG(1, "[%3d] Inline Dentry Block Fixed hash_codes\n\n",
-			fsck->dentry_depth);
+			child->depth);
 	} else {
 		DBG(1, "[%3d] Inline Dentry Block Done : "
 				"dentries:%d in %d slots (len:%d)\n\n",
-			fsck->dentry_depth, dentries,
+			child->depth, dentries,
 			d.max, F2FS_NAME_LEN);
 	}
-	fsck->dentry_depth--;
 	return dentries;
 }
 
 int fsck_chk_dentry_blk(struct f2fs_sb_info *sbi, u32 blk_addr,
 		struct child_info *child, int last_blk, int enc_name)
 {
-	struct f2fs_fsck *fsck = F2FS_FSCK(sbi);
 	struct f2fs_dentry_block *de_blk;
 	int dentries, ret;
 
@@ -1708,7 +1834,6 @@ int fsck_chk_dentry_blk(struct f2fs_sb_info *sbi, u32 blk_addr,
 	ret = dev_read_block(de_blk, blk_addr);
 	ASSERT(ret >= 0);
 
-	fsck->dentry_depth++;
 	dentries = __chk_dentries(sbi, child,
 			de_blk->dentry_bitmap,
 			de_blk->dentry, de_blk->filename,
@@ -1718,14 +1843,13 @@ int fsck_chk_dentry_blk(struct f2fs_sb_info *sbi, u32 blk_addr,
 		ret = dev_write_block(de_blk, blk_addr);
 		ASSERT(ret >= 0);
 		DBG(1, "[%3d] Dentry Block [0x%x] Fixed hash_codes\n\n",
-			fsck->dentry_depth, blk_addr);
+			child->depth, blk_addr);
 	} else {
 		DBG(1, "[%3d] Dentry Block [0x%x] Done : "
 				"dentries:%d in %d slots (len:%d)\n\n",
-			fsck->dentry_depth, blk_addr, dentries,
+			child->depth, blk_addr, dentries,
 			NR_DENTRY_IN_BLOCK, F2FS_NAME_LEN);
 	}
-	fsck->dentry_depth--;
 	free(de_blk);
 	return 0;
 }
@@ -1739,7 +1863,7 @@ int fsck_chk_data_blk(struct f2fs_sb_info *sbi, u32 blk_addr,
 
 	/* Is it reserved block? */
 	if (blk_addr == NEW_ADDR) {
-		fsck->chk.valid_blk_cnt++;
+		chk_add(fsck, valid_blk_cnt, 1);
 		return 0;
 	}
 
@@ -1762,21 +1886,19 @@ int fsck_chk_data_blk(struct f2fs_sb_info *sbi, u32 blk_addr,
 		ASSERT_MSG("SIT bitmap is 0x0. blk_addr[0x%x]", blk_addr);
 	}
 
-	if (f2fs_test_main_bitmap(sbi, blk_addr) != 0) {
+	/* test and set at once, two walkers may reach a duplicated block */
+	if (f2fs_set_main_bitmap(sbi, blk_addr, ftype == F2FS_FT_DIR ?
+				CURSEG_HOT_DATA : CURSEG_WARM_DATA) != 0) {
 		DMD_ADD_ERROR(LOG_TYP_FSCK, PR_DUPLICATE_DATA_BLKADDR_IN_MAIN_BITMAP);
 		ASSERT_MSG("Duplicated data [0x%x]. pnid[0x%x] idx[0x%x]",
 				blk_addr, parent_nid, idx_in_node);
 	}
 
-	fsck->chk.valid_blk_cnt++;
+	chk_add(fsck, valid_blk_cnt, 1);
 
-	if (ftype == F2FS_FT_DIR) {
-		f2fs_set_main_bitmap(sbi, blk_addr, CURSEG_HOT_DATA);
+	if (ftype == F2FS_FT_DIR)
 		return fsck_chk_dentry_blk(sbi, blk_addr, child,
 						last_blk, enc_name);
-	} else {
-		f2fs_set_main_bitmap(sbi, blk_addr, CURSEG_WARM_DATA);
-	}
 	return 0;
 }
 
@@ -2213,6 +2335,8 @@ void fsck_init(struct f2fs_sb_info *sbi)
 	ASSERT(fsck->main_area_bitmap != NULL);
 	fsck->force_drop_recovery = 0;
 
+	reada_meta_area(sbi);
+
 	build_nat_area_bitmap(sbi);
 
 	build_sit_area_bitmap(sbi);
@@ -59,6 +59,7 @@ struct child_info {
 	struct extent_info ei;
 	u32 last_blk;
 	u32 i_namelen;  /* dentry namelen */
+	u32 depth;	/* dentry depth of the directory */
 };
 
 enum {
@@ -104,7 +105,6 @@ struct f2fs_fsck {
 	u64 nr_main_blks;
 	u32 nr_nat_entries;
 
-	u32 dentry_depth;
 	struct f2fs_nat_entry *entries;
 	u32 nat_valid_inode_cnt;
 
@@ -122,9 +122,23 @@ struct f2fs_fsck {
 	int sum_cache_cnt[MAX_TYPE][HASHTABLE_SIZE];
 
 	int force_drop_recovery;
+
+	/* threads walking directory subtrees, see queue.c */
+	int nr_walkers;
+	pthread_t *walker;
+	struct list_head walk_queue;
+	pthread_mutex_t walk_lock;
+	pthread_cond_t walk_cond;	/* a work was queued */
+	pthread_cond_t walk_done;	/* a group has finished */
+	int walk_quit;
+
+	/* hard link list, quota, SSA cache and SIT types while walking */
+	pthread_mutex_t lock;
+	pthread_mutex_t ino_lock[WALK_INO_LOCKS];
 };
 
 #define BLOCK_SZ		4096
+#define SLOAD_IO_SIZE		(BLOCK_SZ * 256)
 struct block {
 	unsigned char buf[BLOCK_SZ];
 };
@@ -194,6 +208,7 @@ extern void add_sum_block_to_cache(struct f2fs_sb_info *, unsigned int,
 extern int get_sum_entry(struct f2fs_sb_info *, u32, struct f2fs_summary *);
 extern void update_sum_entry(struct f2fs_sb_info *, block_t,
 				struct f2fs_summary *);
+extern void flush_sum_block_cache(struct f2fs_sb_info *);
 extern void get_node_info(struct f2fs_sb_info *, nid_t, struct node_info *);
 extern void nullify_nat_entry(struct f2fs_sb_info *, u32);
 extern void rewrite_sit_area_bitmap(struct f2fs_sb_info *);
@@ -59,6 +59,7 @@ void fsck_usage()
 	MSG(0, "  -a check/fix potential corruption, reported by f2fs\n");
 	MSG(0, "  -d debug level [default:0]\n");
 	MSG(0, "  -f check/fix entire partition\n");
+	MSG(0, "  -j threads walking directory subtrees when checking\n");
 	MSG(0, "  -p preen mode [default:0 the same as -a [0|1]]\n");
 	MSG(0, "  -S sparse_mode\n");
 	MSG(0, "  -t show directory tree\n");
@@ -179,7 +180,7 @@ void f2fs_parse_options(int argc, char *argv[])
 	}
 
 	if (!strcmp("fsck.f2fs", prog) || !strcmp("fsck.f2fs_s", prog)) {
-		const char *option_string = ":ad:fp:q:Sty";
+		const char *option_string = ":ad:fj:p:q:Sty";
 		int opt = 0;
 		struct option long_opt[] = {
 			{"dry-run", no_argument, 0, 1},
@@ -242,6 +243,16 @@ void f2fs_parse_options(int argc, char *argv[])
 				c.fix_on = 1;
 				MSG(0, "Info: Force to fix corruption\n");
 				break;
+			case 'j':
+				if (optarg[0] == '-') {
+					err = ENEED_ARG;
+					break;
+				} else if (!is_digits(optarg)) {
+					err = EWRONG_OPT;
+					break;
+				}
+				c.walk_threads = atoi(optarg);
+				break;
 			case 'q':
 				c.preserve_limits = atoi(optarg);
 				MSG(0, "Info: Preserve quota limits = %d\n",
@@ -631,8 +642,18 @@ static int do_fsck(struct f2fs_sb_info *sbi)
 		}
 	}
 	fsck_chk_orphan_node(sbi);
+
+	/*
+	 * Fixes rewrite blocks that other subtrees may be reading, and the
+	 * directory tree is printed in order, so both walk serially.
+	 */
+	if (c.walk_threads > 1 && !c.fix_on && !c.show_dentry &&
+							!c.sparse_mode)
+		init_walk_workers(sbi, c.walk_threads);
 	fsck_chk_node_blk(sbi, NULL, sbi->root_ino_num,
 			F2FS_FT_DIR, TYPE_INODE, &blk_cnt, NULL);
+	exit_walk_workers(sbi);
+
 	fsck_chk_quota_files(sbi);
 
 	fsck_verify(sbi);
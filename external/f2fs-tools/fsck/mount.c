@@ -1332,6 +1332,38 @@ static void read_normal_summaries(struct f2fs_sb_info *sbi, int type)
 	free(sum_blk);
 }
 
+/*
+ * sload fills the same data/node segments block by block, so the SSA block
+ * of the last touched segment is kept here and written back only when
+ * another segment is touched or before the checkpoint.
+ */
+static struct {
+	unsigned int segno;
+	struct f2fs_summary_block *sum_blk;
+} ssa_wb[MAX_TYPE];
+
+static void __flush_sum_block_cache(struct f2fs_sb_info *sbi, int i)
+{
+	int ret;
+
+	if (!ssa_wb[i].sum_blk)
+		return;
+
+	ret = dev_write_block(ssa_wb[i].sum_blk,
+				GET_SUM_BLKADDR(sbi, ssa_wb[i].segno));
+	ASSERT(ret >= 0);
+	free(ssa_wb[i].sum_blk);
+	ssa_wb[i].sum_blk = NULL;
+}
+
+void flush_sum_block_cache(struct f2fs_sb_info *sbi)
+{
+	int i;
+
+	for (i = 0; i < MAX_TYPE; i++)
+		__flush_sum_block_cache(sbi, i);
+}
+
 void update_sum_entry(struct f2fs_sb_info *sbi, block_t blk_addr,
 					struct f2fs_summary *sum)
 {
@@ -1339,17 +1371,23 @@ void update_sum_entry(struct f2fs_sb_info *sbi, block_t blk_addr,
 	u32 segno, offset;
 	int type, ret;
 	struct seg_entry *se;
+	int wb_idx;
 
 	segno = GET_SEGNO(sbi, blk_addr);
 	offset = OFFSET_IN_SEG(sbi, blk_addr);
 
 	se = get_seg_entry(sbi, segno);
+	wb_idx = IS_NODESEG(se->type) ? NODE : DATA;
 
 	if (c.func == FSCK) {
 		if (IS_NODESEG(se->type))
 			sum_blk = get_sum_node_block_from_cache(sbi, segno, &type);
 		else
 			sum_blk = get_sum_data_block_from_cache(sbi, segno, &type);
+	} else if (c.func == SLOAD && ssa_wb[wb_idx].sum_blk &&
+					ssa_wb[wb_idx].segno == segno) {
+		sum_blk = ssa_wb[wb_idx].sum_blk;
+		type = SEG_TYPE_MAX;
 	}
 	if (!sum_blk)
 		sum_blk = get_sum_block(sbi, segno, &type);
@@ -1357,6 +1395,17 @@ void update_sum_entry(struct f2fs_sb_info *sbi, block_t blk_addr,
 	sum_blk->footer.entry_type = IS_NODESEG(se->type) ? SUM_TYPE_NODE :
 							SUM_TYPE_DATA;
 
+	/* defer the SSA write of non-current segments for sload */
+	if (c.func == SLOAD && (type == SEG_TYPE_NODE ||
+			type == SEG_TYPE_DATA || type == SEG_TYPE_MAX)) {
+		if (ssa_wb[wb_idx].sum_blk != sum_blk) {
+			__flush_sum_block_cache(sbi, wb_idx);
+			ssa_wb[wb_idx].segno = segno;
+			ssa_wb[wb_idx].sum_blk = sum_blk;
+		}
+		return;
+	}
+
 	/* write SSA all the time */
 	ret = dev_write_block(sum_blk, GET_SUM_BLKADDR(sbi, segno));
 	ASSERT(ret >= 0);
@@ -1589,6 +1638,10 @@ struct f2fs_summary_block *get_sum_block(struct f2fs_sb_info *sbi,
 
 	ssa_blk = GET_SUM_BLKADDR(sbi, segno);
 
+	for (type = 0; type < MAX_TYPE; type++)
+		if (ssa_wb[type].sum_blk && ssa_wb[type].segno == segno)
+			__flush_sum_block_cache(sbi, type);
+
 	/* fsck has already checked curseg in
 	 * get_sum_{data|node}_block_from_cache
 	 */
@@ -2171,6 +2224,8 @@ void move_curseg_info(struct f2fs_sb_info *sbi, u64 from)
 {
 	int i, ret;
 
+	flush_sum_block_cache(sbi);
+
 	/* update summary blocks having nullified journal entries */
 	for (i = 0; i < NO_CHECK_TYPE; i++) {
 		struct curseg_info *curseg = CURSEG_I(sbi, i);
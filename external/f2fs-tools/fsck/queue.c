@@ -8,6 +8,43 @@ struct work_reada_arg {
 };
 static struct work_reada_arg *args[MAX_TYPE] = {NULL, NULL};
 
+static int cmp_block_addr(const void *a, const void *b)
+{
+	block_t x = *(const block_t *)a;
+	block_t y = *(const block_t *)b;
+
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/*
+ * Issue readahead for a batch of block addresses. The batch is sorted and
+ * adjacent blocks are merged, so that one fadvise covers a whole run of
+ * blocks instead of issuing one call per 4KB block.
+ */
+static void reada_block_batch(block_t *blks, int cnt)
+{
+	block_t start, end;
+	int i;
+
+	if (cnt <= 0)
+		return;
+
+	qsort(blks, cnt, sizeof(block_t), cmp_block_addr);
+
+	start = end = blks[0];
+	for (i = 1; i < cnt; i++) {
+		if (blks[i] == end || blks[i] == end + 1) {
+			end = blks[i];
+			continue;
+		}
+		dev_readahead((__u64)start << F2FS_BLKSIZE_BITS,
+				(size_t)(end - start + 1) << F2FS_BLKSIZE_BITS);
+		start = end = blks[i];
+	}
+	dev_readahead((__u64)start << F2FS_BLKSIZE_BITS,
+			(size_t)(end - start + 1) << F2FS_BLKSIZE_BITS);
+}
+
 void *work_reada_block(void *arg)
 {
 	struct f2fs_sb_info *sbi = ((struct work_reada_arg *)arg)->sbi;
@@ -15,6 +52,8 @@ void *work_reada_block(void *arg)
 	struct f2fs_fsck *fsck = F2FS_FSCK(sbi);
 	struct ra_work *w, *t;
 	struct list_head tmp_queue;
+	block_t blks[MAX_RA_BATCH];
+	int cnt;
 
 	for (; ;) {
 		if (fsck->quit_thread[type])
@@ -35,12 +74,20 @@ void *work_reada_block(void *arg)
 		INIT_LIST_HEAD(&fsck->ra_queue[type]);
 		pthread_mutex_unlock(&fsck->mutex[type]);
 
+		cnt = 0;
 		list_for_each_entry_safe(w, t, &tmp_queue, entry) {
 			list_del(&w->entry);
-			if (!fsck->quit_thread[type])
-				dev_reada_block(w->blkaddr);
+			if (!fsck->quit_thread[type]) {
+				blks[cnt++] = w->blkaddr;
+				if (cnt == MAX_RA_BATCH) {
+					reada_block_batch(blks, cnt);
+					cnt = 0;
+				}
+			}
 			free(w);
 		}
+		if (!fsck->quit_thread[type])
+			reada_block_batch(blks, cnt);
 	}
 }
 
@@ -108,5 +155,214 @@ void queue_reada_block(struct f2fs_sb_info *sbi, block_t blkaddr, int type)
 
 	pthread_cond_signal(&fsck->cond[type]);
 }
+
+/*
+ * NAT and SSA blocks are read one by one while building the nat bitmap and
+ * checking summaries, so kick off readahead for both areas up front.
+ */
+void reada_meta_area(struct f2fs_sb_info *sbi)
+{
+	struct f2fs_super_block *sb = F2FS_RAW_SUPER(sbi);
+	struct f2fs_nm_info *nm_i = NM_I(sbi);
+	struct f2fs_sm_info *sm_i = SM_I(sbi);
+	block_t block_addr, start = 0, end = 0;
+	u32 block_off, nr_nat_blks;
+	int seg_off, started = 0;
+
+	nr_nat_blks = (get_sb(segment_count_nat) / 2) <<
+					sbi->log_blocks_per_seg;
+
+	for (block_off = 0; block_off < nr_nat_blks; block_off++) {
+		seg_off = block_off >> sbi->log_blocks_per_seg;
+		block_addr = (block_t)(nm_i->nat_blkaddr +
+			(seg_off << sbi->log_blocks_per_seg << 1) +
+			(block_off & ((1 << sbi->log_blocks_per_seg) - 1)));
+
+		if (f2fs_test_bit(block_off, nm_i->nat_bitmap))
+			block_addr += sbi->blocks_per_seg;
+
+		if (started && block_addr == end + 1) {
+			end = block_addr;
+			continue;
+		}
+		if (started)
+			dev_readahead((__u64)start << F2FS_BLKSIZE_BITS,
+				(size_t)(end - start + 1) << F2FS_BLKSIZE_BITS);
+		start = end = block_addr;
+		started = 1;
+	}
+	if (started)
+		dev_readahead((__u64)start << F2FS_BLKSIZE_BITS,
+				(size_t)(end - start + 1) << F2FS_BLKSIZE_BITS);
+
+	/* one summary block per main segment */
+	dev_readahead((__u64)sm_i->ssa_blkaddr << F2FS_BLKSIZE_BITS,
+			(size_t)sm_i->main_segments << F2FS_BLKSIZE_BITS);
+}
 /*lint -restore*/
 #endif
+
+/*
+ * Directory subtree walkers.
+ *
+ * __chk_dentries() queues the subdirectories found in a dentry block as one
+ * group and waits for it. Idle walkers take works from the oldest group. A
+ * thread waiting for its group runs the group's queued works itself, and
+ * then helps with other groups up to WALK_MAX_NEST levels deep, so it neither
+ * idles while works are queued nor grows its stack without bound.
+ */
+static __thread int walk_nest;
+
+/* called with walk_lock held, g must have queued works */
+static struct walk_work *take_walk_work(struct walk_group *g)
+{
+	struct walk_work *w;
+
+	w = list_first_entry(&g->works, struct walk_work, entry);
+	list_del(&w->entry);
+	if (list_empty(&g->works))
+		list_del(&g->entry);
+	return w;
+}
+
+/* called and returns with walk_lock held */
+static void run_walk_work(struct f2fs_sb_info *sbi, struct walk_work *w)
+{
+	struct f2fs_fsck *fsck = F2FS_FSCK(sbi);
+	struct walk_group *g = w->group;
+
+	pthread_mutex_unlock(&fsck->walk_lock);
+	w->fn(sbi, w);
+	pthread_mutex_lock(&fsck->walk_lock);
+
+	if (--g->pending == 0)
+		pthread_cond_broadcast(&fsck->walk_done);
+}
+
+static void *work_walk_subtree(void *arg)
+{
+	struct f2fs_sb_info *sbi = arg;
+	struct f2fs_fsck *fsck = F2FS_FSCK(sbi);
+	struct walk_group *g;
+
+	pthread_mutex_lock(&fsck->walk_lock);
+	for (; ;) {
+		while (list_empty(&fsck->walk_queue) && !fsck->walk_quit)
+			pthread_cond_wait(&fsck->walk_cond, &fsck->walk_lock);
+		if (fsck->walk_quit)
+			break;
+
+		g = list_first_entry(&fsck->walk_queue,
+					struct walk_group, entry);
+		run_walk_work(sbi, take_walk_work(g));
+	}
+	pthread_mutex_unlock(&fsck->walk_lock);
+	return NULL;
+}
+
+void init_walk_workers(struct f2fs_sb_info *sbi, int nr)
+{
+	struct f2fs_fsck *fsck = F2FS_FSCK(sbi);
+	pthread_attr_t attr;
+	int i, ret;
+
+	INIT_LIST_HEAD(&fsck->walk_queue);
+	pthread_mutex_init(&fsck->walk_lock, NULL);
+	pthread_cond_init(&fsck->walk_cond, NULL);
+	pthread_cond_init(&fsck->walk_done, NULL);
+	pthread_mutex_init(&fsck->lock, NULL);
+	for (i = 0; i < WALK_INO_LOCKS; i++)
+		pthread_mutex_init(&fsck->ino_lock[i], NULL);
+	fsck->walk_quit = 0;
+
+	fsck->walker = calloc(nr, sizeof(pthread_t));
+	ASSERT(fsck->walker);
+
+	/* deep directory trees recurse on the walkers' stacks */
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, WALK_STACK_SIZE);
+	for (i = 0; i < nr; i++) {
+		ret = pthread_create(&fsck->walker[i], &attr,
+					work_walk_subtree, sbi);
+		ASSERT(ret == 0);
+	}
+	pthread_attr_destroy(&attr);
+	fsck->nr_walkers = nr;
+
+	MSG(0, "Info: %d threads walk directory subtrees\n", nr);
+}
+
+void exit_walk_workers(struct f2fs_sb_info *sbi)
+{
+	struct f2fs_fsck *fsck = F2FS_FSCK(sbi);
+	int i;
+
+	if (!fsck->nr_walkers)
+		return;
+
+	pthread_mutex_lock(&fsck->walk_lock);
+	fsck->walk_quit = 1;
+	pthread_cond_broadcast(&fsck->walk_cond);
+	pthread_mutex_unlock(&fsck->walk_lock);
+
+	for (i = 0; i < fsck->nr_walkers; i++)
+		pthread_join(fsck->walker[i], NULL);
+	free(fsck->walker);
+	fsck->walker = NULL;
+	fsck->nr_walkers = 0;
+
+	pthread_mutex_destroy(&fsck->walk_lock);
+	pthread_cond_destroy(&fsck->walk_cond);
+	pthread_cond_destroy(&fsck->walk_done);
+	pthread_mutex_destroy(&fsck->lock);
+	for (i = 0; i < WALK_INO_LOCKS; i++)
+		pthread_mutex_destroy(&fsck->ino_lock[i]);
+}
+
+void init_walk_group(struct walk_group *g)
+{
+	INIT_LIST_HEAD(&g->entry);
+	INIT_LIST_HEAD(&g->works);
+	g->pending = 0;
+}
+
+void queue_walk_work(struct f2fs_sb_info *sbi, struct walk_group *g,
+						struct walk_work *w)
+{
+	struct f2fs_fsck *fsck = F2FS_FSCK(sbi);
+
+	pthread_mutex_lock(&fsck->walk_lock);
+	if (list_empty(&g->works))
+		list_add_tail(&g->entry, &fsck->walk_queue);
+	w->group = g;
+	list_add_tail(&w->entry, &g->works);
+	g->pending++;
+	pthread_mutex_unlock(&fsck->walk_lock);
+
+	pthread_cond_signal(&fsck->walk_cond);
+}
+
+void wait_walk_group(struct f2fs_sb_info *sbi, struct walk_group *g)
+{
+	struct f2fs_fsck *fsck = F2FS_FSCK(sbi);
+	struct walk_group *other;
+
+	pthread_mutex_lock(&fsck->walk_lock);
+	while (g->pending) {
+		if (!list_empty(&g->works)) {
+			run_walk_work(sbi, take_walk_work(g));
+			continue;
+		}
+		if (walk_nest < WALK_MAX_NEST &&
+				!list_empty(&fsck->walk_queue)) {
+			other = list_first_entry(&fsck->walk_queue,
+						struct walk_group, entry);
+			walk_nest++;
+			run_walk_work(sbi, take_walk_work(other));
+			walk_nest--;
+			continue;
+		}
+		pthread_cond_wait(&fsck->walk_done, &fsck->walk_lock);
+	}
+	pthread_mutex_unlock(&fsck->walk_lock);
+}
@@ -1,9 +1,43 @@
 #ifndef _QUEUE_H_
 #define _QUEUE_H_
 
-#ifdef POSIX_FADV_WILLNEED
 #include "list.h"
 
+/* stripes of the per-inode locks used by the walk threads */
+#define WALK_INO_LOCKS		256
+/* how deep a waiting walker nests other groups' works on its stack */
+#define WALK_MAX_NEST		4
+#define WALK_STACK_SIZE		(8 << 20)
+
+struct walk_group;
+
+/* a directory subtree checked by one of the walk threads */
+struct walk_work {
+	struct list_head entry;
+	struct walk_group *group;
+	void (*fn)(struct f2fs_sb_info *, struct walk_work *);
+};
+
+/* the subtrees queued from one dentry block, waited for together */
+struct walk_group {
+	struct list_head entry;		/* on walk_queue while works are queued */
+	struct list_head works;		/* queued works, not started yet */
+	int pending;			/* queued or running works */
+};
+
+/* queue.c */
+extern void init_walk_workers(struct f2fs_sb_info *, int);
+extern void exit_walk_workers(struct f2fs_sb_info *);
+extern void init_walk_group(struct walk_group *);
+extern void queue_walk_work(struct f2fs_sb_info *, struct walk_group *,
+					struct walk_work *);
+extern void wait_walk_group(struct f2fs_sb_info *, struct walk_group *);
+
+#ifdef POSIX_FADV_WILLNEED
+
+/* max blocks sorted and merged by one readahead batch */
+#define MAX_RA_BATCH	1024
+
 struct ra_work {
 	struct list_head entry;
 	block_t blkaddr;
@@ -13,10 +47,12 @@ struct ra_work {
 extern void queue_reada_block(struct f2fs_sb_info *, block_t, int);
 extern void init_reada_queue(struct f2fs_sb_info *);
 extern void exit_reada_queue(struct f2fs_sb_info *);
+extern void reada_meta_area(struct f2fs_sb_info *);
 #else
 #define queue_reada_block(sbi, blkaddr, type) dev_reada_block(blkaddr)
 #define init_reada_queue(sbi) MSG(0, "Info: readahead queue is not enabled\n")
 #define exit_reada_queue(sbi)
+#define reada_meta_area(sbi)
 #endif
 
 #endif
@@ -29,23 +29,33 @@ void reserve_new_block(struct f2fs_sb_info *sbi, block_t *to,
 {
 	struct f2fs_fsck *fsck = F2FS_FSCK(sbi);
 	struct seg_entry *se;
-	u64 blkaddr, offset;
+	u64 blkaddr, start, offset;
 	u64 old_blkaddr = *to;
 	int left;
 
 	if (c.invertion) {
-		blkaddr = ((SM_I(sbi)->main_segments - 1) <<
+		start = ((SM_I(sbi)->main_segments - 1) <<
 			sbi->log_blocks_per_seg) + SM_I(sbi)->main_blkaddr; /*lint !e647*/
 		left = 1;
 	} else {
-		blkaddr = SM_I(sbi)->main_blkaddr;
+		start = SM_I(sbi)->main_blkaddr;
 		left = 0;
 	}
 
+	/*
+	 * Resume the search from the last block allocated for this type
+	 * instead of rescanning the main area for every block; fall back to
+	 * a full scan if nothing is left past the hint.
+	 */
+	blkaddr = sbi->alloc_hint[type] ? sbi->alloc_hint[type] : start;
 	if (find_next_free_block(sbi, &blkaddr, left, type)) {
-		ERR_MSG("Not enough space to allocate blocks");
-		ASSERT(0);
+		blkaddr = start;
+		if (find_next_free_block(sbi, &blkaddr, left, type)) {
+			ERR_MSG("Not enough space to allocate blocks");
+			ASSERT(0);
+		}
 	}
+	sbi->alloc_hint[type] = blkaddr;
 
 	se = get_seg_entry(sbi, GET_SEGNO(sbi, blkaddr));
 	offset = OFFSET_IN_SEG(sbi, blkaddr);
@@ -284,7 +294,7 @@ int f2fs_build_file(struct f2fs_sb_info *sbi, struct dentry *de)
 {
 	int fd, n;
 	pgoff_t off = 0;
-	u8 buffer[BLOCK_SZ];
+	u8 *buffer;
 
 	if (de->ino == 0)
 		return -1;
@@ -295,6 +305,9 @@ int f2fs_build_file(struct f2fs_sb_info *sbi, struct dentry *de)
 		return -1;
 	}
 
+	buffer = malloc(SLOAD_IO_SIZE);
+	ASSERT(buffer);
+
 	/* We disable inline_data here, for old kernels don't support it */
 	if (0) {
 		struct node_info ni;
@@ -324,12 +337,14 @@ int f2fs_build_file(struct f2fs_sb_info *sbi, struct dentry *de)
 		write_inode(ni.blk_addr, node_blk);
 		free(node_blk);
 	} else {
-		while ((n = read(fd, buffer, BLOCK_SZ)) > 0) {
+		/* read in large chunks to map many blocks per f2fs_write() */
+		while ((n = read(fd, buffer, SLOAD_IO_SIZE)) > 0) {
 			f2fs_write(sbi, de->ino, buffer, n, off);
 			off += n;
 		}
 	}
 
+	free(buffer);
 	close(fd);
 	if (n < 0)
 		return -1;
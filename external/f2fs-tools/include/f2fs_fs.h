@@ -387,6 +387,7 @@ struct f2fs_configuration {
 	int preen_mode;
 	int ro;
 	int preserve_limits;		/* preserve quota limits */
+	int walk_threads;		/* fsck threads walking subtrees */
 	__le32 feature;			/* defined features */
 
 	/* defragmentation parameters */
@@ -1164,6 +1165,8 @@ extern int dev_fill_block(void *, __u64);
 
 extern int dev_read_block(void *, __u64);
 extern int dev_reada_block(__u64);
+extern int dev_readahead(__u64, size_t);
+extern void dev_print_io_stat(void);
 
 extern int dev_read_version(void *, __u64, size_t);
 extern void get_kernel_version(__u8 *);
@@ -22,6 +22,7 @@
 #include <sys/stat.h>
 #include <sys/mount.h>
 #include <sys/ioctl.h>
+#include <pthread.h>
 #endif
 #ifdef HAVE_LINUX_HDREG_H
 #include <linux/hdreg.h>
@@ -61,8 +62,139 @@ static inline off64_t lseek64(int fd, __u64 offset, int set)
 {
 	return lseek(fd, offset, set);
 }
+
+#ifndef ANDROID_WINDOWS_HOST
+static inline ssize_t pread64(int fd, void *buf, size_t len, off64_t offset)
+{
+	return pread(fd, buf, len, offset);
+}
+#endif
+#endif
+
+/*
+ * fsck walks directory subtrees on several threads, so the write-back buffer
+ * and the stats are serialized, and reads use pread() instead of sharing the
+ * file offset with lseek().
+ */
+#ifndef ANDROID_WINDOWS_HOST
+static pthread_mutex_t io_lock = PTHREAD_MUTEX_INITIALIZER;
+#define lock_io()	pthread_mutex_lock(&io_lock)
+#define unlock_io()	pthread_mutex_unlock(&io_lock)
+#else
+#define lock_io()
+#define unlock_io()
 #endif
 
+/*
+ * Write-back buffer: adjacent block writes are coalesced and issued with a
+ * single write() once the run breaks, the buffer fills up, or someone needs
+ * to see the data on disk (overlapping read/fill, fsync, close).
+ */
+#define WB_MAX_BLKS	256
+#define WB_BUF_SIZE	(WB_MAX_BLKS * F2FS_BLKSIZE)
+
+static struct {
+	int fd;			/* device the pending run belongs to */
+	__u64 offset;		/* device-relative offset of the run */
+	size_t len;		/* bytes pending in buf */
+	char *buf;
+} wb = { -1, 0, 0, NULL };
+
+static struct {
+	__u64 nr_reads;		/* dev_read calls */
+	__u64 nr_writes;	/* dev_write/dev_fill calls */
+	__u64 nr_merged;	/* writes merged into a pending run */
+	__u64 nr_write_io;	/* write() syscalls actually issued */
+	__u64 read_bytes;
+	__u64 write_bytes;
+} io_stat;
+
+static int __dev_pwrite(int fd, void *buf, __u64 offset, size_t len)
+{
+	io_stat.nr_write_io++;
+	if (lseek64(fd, (off64_t)offset, SEEK_SET) < 0)
+		return -1;
+	if (write(fd, buf, len) < 0)
+		return -1;
+	return 0;
+}
+
+static int __dev_pread(int fd, void *buf, __u64 offset, size_t len)
+{
+#ifndef ANDROID_WINDOWS_HOST
+	if (pread64(fd, buf, len, (off64_t)offset) < 0)
+		return -1;
+#else
+	if (lseek64(fd, (off64_t)offset, SEEK_SET) < 0)
+		return -1;
+	if (read(fd, buf, len) < 0)
+		return -1;
+#endif
+	return 0;
+}
+
+static int dev_flush_write_buffer(void)
+{
+	int ret;
+
+	if (!wb.len)
+		return 0;
+
+	ret = __dev_pwrite(wb.fd, wb.buf, wb.offset, wb.len);
+	wb.len = 0;
+	return ret;
+}
+
+/* flush the pending run if it overlaps [offset, offset + len) on fd */
+static int dev_flush_overlap(int fd, __u64 offset, size_t len)
+{
+	if (!wb.len || wb.fd != fd)
+		return 0;
+	if (offset >= wb.offset + wb.len || offset + len <= wb.offset)
+		return 0;
+	return dev_flush_write_buffer();
+}
+
+static int dev_buffered_write(int fd, void *buf, __u64 offset, size_t len)
+{
+	int ret;
+
+	if (wb.len && wb.fd == fd && wb.offset + wb.len == offset &&
+					wb.len + len <= WB_BUF_SIZE) {
+		memcpy(wb.buf + wb.len, buf, len);
+		wb.len += len;
+		io_stat.nr_merged++;
+		return 0;
+	}
+
+	ret = dev_flush_write_buffer();
+	if (ret < 0)
+		return ret;
+
+	if (!wb.buf && len <= WB_BUF_SIZE)
+		wb.buf = malloc(WB_BUF_SIZE);
+	if (!wb.buf || len > WB_BUF_SIZE)
+		return __dev_pwrite(fd, buf, offset, len);
+
+	memcpy(wb.buf, buf, len);
+	wb.fd = fd;
+	wb.offset = offset;
+	wb.len = len;
+	return 0;
+}
+
+void dev_print_io_stat(void)
+{
+	MSG(1, "Info: I/O stat: reads %llu (%llu KB), writes %llu (%llu KB), "
+		"merged %llu, write syscalls %llu\n",
+		(unsigned long long)io_stat.nr_reads,
+		(unsigned long long)io_stat.read_bytes >> 10,
+		(unsigned long long)io_stat.nr_writes,
+		(unsigned long long)io_stat.write_bytes >> 10,
+		(unsigned long long)io_stat.nr_merged,
+		(unsigned long long)io_stat.nr_write_io);
+}
+
 /*
  * IO interfaces
  */
@@ -155,7 +287,7 @@ static int sparse_write_blk(__u64 block, int count, const void *buf) { return 0;
 
 int dev_read(void *buf, __u64 offset, size_t len)
 {
-	int fd;
+	int fd, ret;
 
 	if (c.sparse_mode)
 		return sparse_read_blk(offset / F2FS_BLKSIZE,
@@ -165,11 +297,14 @@ int dev_read(void *buf, __u64 offset, size_t len)
 	if (fd < 0)
 		return fd;
 
-	if (lseek64(fd, (off64_t)offset, SEEK_SET) < 0)
+	lock_io();
+	ret = dev_flush_overlap(fd, offset, len);
+	io_stat.nr_reads++;
+	io_stat.read_bytes += len;
+	unlock_io();
+	if (ret < 0)
 		return -1;
-	if (read(fd, buf, len) < 0)
-		return -1;
-	return 0;
+	return __dev_pread(fd, buf, offset, len);
 }
 
 #ifdef POSIX_FADV_WILLNEED
@@ -191,7 +326,7 @@ int dev_readahead(__u64 offset, size_t UNUSED(len))
 
 int dev_write(void *buf, __u64 offset, size_t len)
 {
-	int fd;
+	int fd, ret;
 
 	if (c.dry_run)
 		return 0;
@@ -204,11 +339,12 @@ int dev_write(void *buf, __u64 offset, size_t len)
 	if (fd < 0)
 		return fd;
 
-	if (lseek64(fd, (off64_t)offset, SEEK_SET) < 0)
-		return -1;
-	if (write(fd, buf, len) < 0)
-		return -1;
-	return 0;
+	lock_io();
+	io_stat.nr_writes++;
+	io_stat.write_bytes += len;
+	ret = dev_buffered_write(fd, buf, offset, len);
+	unlock_io();
+	return ret;
 }
 
 int dev_write_block(void *buf, __u64 blk_addr)
@@ -227,7 +363,7 @@ int dev_write_dump(void *buf, __u64 offset, size_t len)
 
 int dev_fill(void *buf, __u64 offset, size_t len)
 {
-	int fd;
+	int fd, ret;
 
 	if (c.sparse_mode)
 		return 0;
@@ -239,11 +375,13 @@ int dev_fill(void *buf, __u64 offset, size_t len)
 	/* Only allow fill to zero */
 	if (*((__u8*)buf))
 		return -1;
-	if (lseek64(fd, (off64_t)offset, SEEK_SET) < 0)
-		return -1;
-	if (write(fd, buf, len) < 0)
-		return -1;
-	return 0;
+
+	lock_io();
+	io_stat.nr_writes++;
+	io_stat.write_bytes += len;
+	ret = dev_buffered_write(fd, buf, offset, len);
+	unlock_io();
+	return ret;
 }
 
 int dev_fill_block(void *buf, __u64 blk_addr)
@@ -264,7 +402,15 @@ int dev_reada_block(__u64 blk_addr)
 int f2fs_fsync_device(void)
 {
 #ifndef ANDROID_WINDOWS_HOST
-	int i;
+	int i, ret;
+
+	lock_io();
+	ret = dev_flush_write_buffer();
+	unlock_io();
+	if (ret < 0) {
+		MSG(0, "\tError: Could not flush write buffer!!!\n");
+		return -1;
+	}
 
 	for (i = 0; i < c.ndevs; i++) {
 		if (fsync(c.devices[i].fd) < 0) {
@@ -310,6 +456,18 @@ int f2fs_finalize_device(void)
 {
 	int i;
 	int ret = 0;
+	int flush_err;
+
+	/*
+	 * dev_write() only queues the tail of a sequential run, so this is
+	 * where a failed write of it shows up; it must not get lost below.
+	 */
+	flush_err = dev_flush_write_buffer();
+	if (flush_err < 0)
+		MSG(0, "\tError: Could not flush write buffer!!!\n");
+	free(wb.buf);
+	wb.buf = NULL;
+	dev_print_io_stat();
 
 #ifdef WITH_ANDROID
 	if (c.sparse_mode) {
@@ -372,5 +530,5 @@ int f2fs_finalize_device(void)
 	}
 	close(c.kd);
 
-	return ret;
+	return flush_err < 0 ? flush_err : ret;
 }
@@ -14,6 +14,7 @@
 #else
 #define HAVE_LOG
 #include <sys/uio.h>
+#include <pthread.h>
 #endif
 
 #include <f2fs_fs.h>
@@ -52,6 +53,9 @@ struct log_info log_i = {
 
 #ifdef HAVE_LOG
 
+/* serializes the slog file and the dmd error buffer */
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /*
  * klog_* are copied from system/core/libcutils/klog.c
  * klog write data to /dev/kmsg, to save message in kernel log
@@ -342,14 +346,18 @@ int slog_write(const char *fmt, ...)
 			return -1;
 	}
 
+	/* fsck may log from several walk threads */
+	pthread_mutex_lock(&log_lock);
 	ret = slog_fix_size(size);
 	if (ret < 0) {
+		pthread_mutex_unlock(&log_lock);
 		KLOGE("slog_fix_size fail\n");
 		free(buf);
 		return ret;
 	}
 
 	ret = write(log_i.slog_fd, buf, size);
+	pthread_mutex_unlock(&log_lock);
 	if (ret < 0)
 		KLOGE("write to slog file fail errno %d\n", errno);
 
@@ -465,13 +473,15 @@ void dmd_insert_error(int type, int err, const char *func, int line)
 {
 	int dmd_insert_size = 0;
 	char *dmd_insert_buf_ptr = dmd_insert_buf;
-	int remain_len = DMD_BUF_MAX - dmd_write_size;
+	int remain_len;
 
 	if (type < LOG_TYP_FSCK || type >= LOG_TYP_MAX) {
 		KLOGE("Unknown log type %d\n", type);
 		return;
 	}
 
+	pthread_mutex_lock(&log_lock);
+	remain_len = DMD_BUF_MAX - dmd_write_size;
 	if (remain_len > 0) {
 		dmd_insert_buf_ptr = dmd_insert_buf + dmd_write_size;
 		dmd_insert_size = snprintf(dmd_insert_buf_ptr, remain_len, "%s:%d %x;",
@@ -480,6 +490,7 @@ void dmd_insert_error(int type, int err, const char *func, int line)
 			dmd_insert_size = remain_len;
 		dmd_write_size += dmd_insert_size;
 	}
+	pthread_mutex_unlock(&log_lock);
 }
 
 #else /* !HAVE_LOG */
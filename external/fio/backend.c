@@ -1849,6 +1849,8 @@ err:
 	 */
 	if (o->write_iolog_file)
 		write_iolog_close(td);
+	if (o->read_iolog_file)
+		read_iolog_close(td);
 
 	td_set_runstate(td, TD_EXITED);
 
@@ -25,9 +25,11 @@ int crc32c_intel_available = 0;
 #if BITS_PER_LONG == 64
 #define REX_PRE "0x48, "
 #define SCALE_F 8
+typedef uint64_t crc32c_word_t;
 #else
 #define REX_PRE
 #define SCALE_F 4
+typedef uint32_t crc32c_word_t;
 #endif
 
 static int crc32c_probed;
@@ -78,6 +80,71 @@ uint32_t crc32c_intel(unsigned char const *data, unsigned long length)
 	return crc;
 }
 
+static inline uint32_t crc32c_intel_le_hw_word(uint32_t crc,
+					       crc32c_word_t word)
+{
+	__asm__ __volatile__(
+		".byte 0xf2, " REX_PRE "0xf, 0x38, 0xf1, 0xf1;"
+		:"=S"(crc)
+		:"0"(crc), "c"(word)
+	);
+
+	return crc;
+}
+
+/*
+ * One crc32 instruction has a latency of three cycles but the cpu can
+ * start one per cycle, so running CRC32C_MB_LANES buffers side by side
+ * keeps the unit busy where a single buffer would stall on its own chain.
+ */
+void crc32c_intel_mb(unsigned char const *data[], unsigned long length,
+		     uint32_t *crc, unsigned int nr)
+{
+	unsigned long iquotient = length / SCALE_F;
+	unsigned int iremainder = length % SCALE_F;
+	crc32c_word_t const *ptmp[CRC32C_MB_LANES];
+	uint32_t c0, c1, c2, c3;
+	unsigned long i;
+	unsigned int j;
+
+	if (nr > CRC32C_MB_LANES) {
+		for (j = 0; j < nr; j++)
+			crc[j] = crc32c_intel(data[j], length);
+		return;
+	}
+
+	/* unused lanes recompute the first buffer */
+	for (j = 0; j < CRC32C_MB_LANES; j++)
+		ptmp[j] = (crc32c_word_t const *) data[j < nr ? j : 0];
+
+	c0 = c1 = c2 = c3 = ~0;
+	for (i = 0; i < iquotient; i++) {
+		c0 = crc32c_intel_le_hw_word(c0, ptmp[0][i]);
+		c1 = crc32c_intel_le_hw_word(c1, ptmp[1][i]);
+		c2 = crc32c_intel_le_hw_word(c2, ptmp[2][i]);
+		c3 = crc32c_intel_le_hw_word(c3, ptmp[3][i]);
+	}
+
+	if (iremainder) {
+		c0 = crc32c_intel_le_hw_byte(c0,
+				(unsigned char *) (ptmp[0] + i), iremainder);
+		c1 = crc32c_intel_le_hw_byte(c1,
+				(unsigned char *) (ptmp[1] + i), iremainder);
+		c2 = crc32c_intel_le_hw_byte(c2,
+				(unsigned char *) (ptmp[2] + i), iremainder);
+		c3 = crc32c_intel_le_hw_byte(c3,
+				(unsigned char *) (ptmp[3] + i), iremainder);
+	}
+
+	crc[0] = c0;
+	if (nr > 1)
+		crc[1] = c1;
+	if (nr > 2)
+		crc[2] = c2;
+	if (nr > 3)
+		crc[3] = c3;
+}
+
 void crc32c_intel_probe(void)
 {
 	if (!crc32c_probed) {
@@ -124,3 +124,22 @@ uint32_t crc32c_sw(unsigned char const *data, unsigned long length)
 
 	return crc;
 }
+
+void crc32c_sw_mb(unsigned char const *data[], unsigned long length,
+		  uint32_t *crc, unsigned int nr)
+{
+	uint32_t c[CRC32C_MB_LANES];
+	unsigned long i;
+	unsigned int j;
+
+	for (j = 0; j < nr; j++)
+		c[j] = ~0;
+
+	for (i = 0; i < length; i++)
+		for (j = 0; j < nr; j++)
+			c[j] = crc32c_table[(c[j] ^ data[j][i]) & 0xFFL] ^
+				(c[j] >> 8);
+
+	for (j = 0; j < nr; j++)
+		crc[j] = c[j];
+}
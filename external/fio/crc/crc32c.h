@@ -20,7 +20,11 @@
 
 #include "../arch/arch.h"
 
+#define CRC32C_MB_LANES	4
+
 extern uint32_t crc32c_sw(unsigned char const *, unsigned long);
+extern void crc32c_sw_mb(unsigned char const *[], unsigned long, uint32_t *,
+			 unsigned int);
 extern int crc32c_arm64_available;
 extern int crc32c_intel_available;
 
@@ -36,9 +40,12 @@ static inline void crc32c_arm64_probe(void)
 
 #ifdef ARCH_HAVE_SSE4_2
 extern uint32_t crc32c_intel(unsigned char const *, unsigned long);
+extern void crc32c_intel_mb(unsigned char const *[], unsigned long,
+			    uint32_t *, unsigned int);
 extern void crc32c_intel_probe(void);
 #else
 #define crc32c_intel crc32c_sw
+#define crc32c_intel_mb crc32c_sw_mb
 static inline void crc32c_intel_probe(void)
 {
 }
@@ -55,4 +62,29 @@ static inline uint32_t fio_crc32c(unsigned char const *buf, unsigned long len)
 	return crc32c_sw(buf, len);
 }
 
+/*
+ * crc32c of 'nr' (at most CRC32C_MB_LANES) buffers of the same length. The
+ * streams are interleaved so the independent crc chains overlap in the
+ * pipeline. The arm64 version already runs three chains per buffer, so
+ * it is just called once per buffer.
+ */
+static inline void fio_crc32c_mb(unsigned char const *buf[], unsigned long len,
+				 uint32_t *crc, unsigned int nr)
+{
+	unsigned int i;
+
+	if (crc32c_arm64_available) {
+		for (i = 0; i < nr; i++)
+			crc[i] = crc32c_arm64(buf[i], len);
+		return;
+	}
+
+	if (crc32c_intel_available) {
+		crc32c_intel_mb(buf, len, crc, nr);
+		return;
+	}
+
+	crc32c_sw_mb(buf, len, crc, nr);
+}
+
 #endif
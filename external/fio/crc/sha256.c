@@ -227,6 +227,126 @@ static void sha256_transform(uint32_t *state, const uint8_t *input)
 	memset(W, 0, 64 * sizeof(uint32_t));
 }
 
+#ifdef __GNUC__
+/*
+ * Multi-buffer variant: SHA256_MB_LANES independent streams are run through
+ * the compression function in lockstep, one stream per vector lane. Uses
+ * the generic vector extension, so it becomes SSE2 on x86-64 and NEON on
+ * arm64 without any arch specific code.
+ */
+typedef uint32_t sha256_vec __attribute__((vector_size(SHA256_MB_LANES * 4)));
+
+static const uint32_t sha256_K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define vror32(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+#define ve0(x)		(vror32(x, 2) ^ vror32(x, 13) ^ vror32(x, 22))
+#define ve1(x)		(vror32(x, 6) ^ vror32(x, 11) ^ vror32(x, 25))
+#define vs0(x)		(vror32(x, 7) ^ vror32(x, 18) ^ ((x) >> 3))
+#define vs1(x)		(vror32(x, 17) ^ vror32(x, 19) ^ ((x) >> 10))
+#define vCh(x, y, z)	((z) ^ ((x) & ((y) ^ (z))))
+#define vMaj(x, y, z)	(((x) & (y)) | ((z) & ((x) | (y))))
+
+static void sha256_transform_mb(uint32_t state[][SHA256_DIGEST_SIZE / 4],
+				const uint8_t *input[])
+{
+	sha256_vec a, b, c, d, e, f, g, h, t1, t2;
+	sha256_vec W[64];
+	int i, j;
+
+	for (i = 0; i < 16; i++)
+		for (j = 0; j < SHA256_MB_LANES; j++)
+			W[i][j] = __be32_to_cpu(((uint32_t *)(input[j]))[i]);
+
+	for (i = 16; i < 64; i++)
+		W[i] = vs1(W[i-2]) + W[i-7] + vs0(W[i-15]) + W[i-16];
+
+	for (j = 0; j < SHA256_MB_LANES; j++) {
+		a[j] = state[j][0];  b[j] = state[j][1];
+		c[j] = state[j][2];  d[j] = state[j][3];
+		e[j] = state[j][4];  f[j] = state[j][5];
+		g[j] = state[j][6];  h[j] = state[j][7];
+	}
+
+	for (i = 0; i < 64; i++) {
+		t1 = h + ve1(e) + vCh(e, f, g) + sha256_K[i] + W[i];
+		t2 = ve0(a) + vMaj(a, b, c);
+		h = g;  g = f;  f = e;  e = d + t1;
+		d = c;  c = b;  b = a;  a = t1 + t2;
+	}
+
+	for (j = 0; j < SHA256_MB_LANES; j++) {
+		state[j][0] += a[j];  state[j][1] += b[j];
+		state[j][2] += c[j];  state[j][3] += d[j];
+		state[j][4] += e[j];  state[j][5] += f[j];
+		state[j][6] += g[j];  state[j][7] += h[j];
+	}
+}
+
+/*
+ * Same as calling fio_sha256_update(ctx[i], data[i], len) for each of the
+ * 'nr' (at most SHA256_MB_LANES) contexts. Whole blocks are hashed in
+ * lockstep, the tail goes through the regular update.
+ */
+void fio_sha256_update_mb(struct fio_sha256_ctx *ctx[], const uint8_t *data[],
+			  unsigned int len, unsigned int nr)
+{
+	uint32_t state[SHA256_MB_LANES][SHA256_DIGEST_SIZE / 4];
+	const uint8_t *src[SHA256_MB_LANES];
+	unsigned int i, done = 0;
+
+	if (nr < 2 || nr > SHA256_MB_LANES || len < 64)
+		goto scalar;
+	for (i = 0; i < nr; i++)
+		if (ctx[i]->count & 0x3f)
+			goto scalar;
+
+	/* unused lanes hash a copy of the first one */
+	for (i = 0; i < SHA256_MB_LANES; i++)
+		memcpy(state[i], ctx[i < nr ? i : 0]->state, sizeof(state[i]));
+
+	for (; done + 64 <= len; done += 64) {
+		for (i = 0; i < SHA256_MB_LANES; i++)
+			src[i] = data[i < nr ? i : 0] + done;
+		sha256_transform_mb(state, src);
+	}
+
+	for (i = 0; i < nr; i++) {
+		memcpy(ctx[i]->state, state[i], sizeof(state[i]));
+		ctx[i]->count += done;
+	}
+
+scalar:
+	for (i = 0; i < nr; i++)
+		fio_sha256_update(ctx[i], data[i] + done, len - done);
+}
+#else
+void fio_sha256_update_mb(struct fio_sha256_ctx *ctx[], const uint8_t *data[],
+			  unsigned int len, unsigned int nr)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr; i++)
+		fio_sha256_update(ctx[i], data[i], len);
+}
+#endif
+
 void fio_sha256_init(struct fio_sha256_ctx *sctx)
 {
 	sctx->state[0] = H0;
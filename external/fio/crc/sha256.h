@@ -3,6 +3,7 @@
 
 #define SHA256_DIGEST_SIZE	32
 #define SHA256_BLOCK_SIZE	64
+#define SHA256_MB_LANES		4
 
 struct fio_sha256_ctx {
 	uint32_t count;
@@ -13,5 +14,7 @@ struct fio_sha256_ctx {
 void fio_sha256_init(struct fio_sha256_ctx *);
 void fio_sha256_update(struct fio_sha256_ctx *, const uint8_t *, unsigned int);
 void fio_sha256_final(struct fio_sha256_ctx *);
+void fio_sha256_update_mb(struct fio_sha256_ctx *[], const uint8_t *[],
+			  unsigned int, unsigned int);
 
 #endif
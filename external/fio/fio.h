@@ -275,6 +275,7 @@ struct thread_data {
 	 */
 	struct flist_head verify_list;
 	pthread_t *verify_threads;
+	struct verify_worker *verify_workers;
 	unsigned int nr_verify_threads;
 	pthread_cond_t verify_cond;
 	int verify_thread_exit;
@@ -370,6 +371,7 @@ struct thread_data {
 	 * For IO replaying
 	 */
 	struct flist_head io_log_list;
+	struct iolog_stream *io_log_stream;
 
 	/*
 	 * For tracking/handling discards
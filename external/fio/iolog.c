@@ -23,6 +23,9 @@
 static int iolog_flush(struct io_log *log);
 
 static const char iolog_ver2[] = "fio version 2 iolog";
+static const char iolog_bin[] = "fio binary iolog";
+
+static void iolog_stream_fill(struct thread_data *);
 
 void queue_io_piece(struct thread_data *td, struct io_piece *ipo)
 {
@@ -145,6 +148,10 @@ int read_iolog_get(struct thread_data *td, struct io_u *io_u)
 		flist_del(&ipo->list);
 		remove_trim_entry(td, ipo);
 
+		if (td->io_log_stream &&
+		    --td->io_log_stream->queued < IOLOG_STREAM_WINDOW / 2)
+			iolog_stream_fill(td);
+
 		ret = ipo_special(td, ipo);
 		if (ret < 0) {
 			free(ipo);
@@ -493,6 +500,345 @@ static int read_iolog2(struct thread_data *td, FILE *f)
 	return 0;
 }
 
+void read_iolog_close(struct thread_data *td)
+{
+	struct iolog_stream *s = td->io_log_stream;
+
+	if (!s)
+		return;
+
+	fclose(s->f);
+	free(s->fileno_map);
+	free(s->buf);
+	free(s);
+	td->io_log_stream = NULL;
+}
+
+static struct io_piece *bin_entry_to_ipo(struct thread_data *td,
+					 struct iolog_stream *s,
+					 struct iolog_bin_entry *e)
+{
+	unsigned int fileno = le16_to_cpu(e->fileno);
+	unsigned long long offset;
+	struct io_piece *ipo;
+	enum fio_ddir rw;
+
+	if (e->ddir == IOLOG_BIN_DDIR_INVAL)
+		rw = DDIR_INVAL;
+	else
+		rw = e->ddir;
+
+	if (rw == DDIR_WRITE && read_only)
+		return NULL;
+	if (rw == DDIR_WAIT && td->o.no_stall)
+		return NULL;
+	if (rw != DDIR_INVAL && rw != DDIR_WAIT && !ddir_rw(rw) &&
+	    !ddir_sync(rw)) {
+		log_err("fio: bad binary iolog ddir: %d\n", rw);
+		return NULL;
+	}
+	if (rw != DDIR_WAIT && fileno >= s->nr_files) {
+		log_err("fio: bad binary iolog file index: %u\n", fileno);
+		return NULL;
+	}
+	if (rw == DDIR_INVAL && e->file_action == FIO_LOG_ADD_FILE) {
+		log_err("fio: binary iolog adds files outside file table\n");
+		return NULL;
+	}
+
+	ipo = malloc(sizeof(*ipo));
+	init_ipo(ipo);
+	ipo->ddir = rw;
+	if (rw == DDIR_WAIT) {
+		ipo->delay = le64_to_cpu(e->delay);
+		return ipo;
+	}
+
+	offset = le64_to_cpu(e->offset);
+	if (s->scaled)
+		ipo->offset = offset;
+	else {
+		if (td->o.replay_scale)
+			ipo->offset = offset / td->o.replay_scale;
+		else
+			ipo->offset = offset;
+		ipo_bytes_align(td->o.replay_align, ipo);
+	}
+
+	ipo->len = le32_to_cpu(e->len);
+	ipo->fileno = s->fileno_map[fileno];
+	if (rw == DDIR_INVAL)
+		ipo->file_action = e->file_action;
+	else
+		ipo->delay = le64_to_cpu(e->delay);
+
+	return ipo;
+}
+
+/*
+ * Top up io_log_list from a streamed binary iolog, closing the stream once
+ * all entries have been queued.
+ */
+static void iolog_stream_fill(struct thread_data *td)
+{
+	struct iolog_stream *s = td->io_log_stream;
+	struct io_piece *ipo;
+	size_t want, got, i;
+
+	while (s->left && s->queued < IOLOG_STREAM_WINDOW) {
+		want = IOLOG_STREAM_WINDOW - s->queued;
+		if (want > s->left)
+			want = s->left;
+
+		got = fread(s->buf, sizeof(*s->buf), want, s->f);
+		if (got < want) {
+			log_err("fio: binary iolog truncated, %llu entries "
+				"missing\n", (unsigned long long) s->left - got);
+			s->left = got;
+		}
+		s->left -= got;
+
+		for (i = 0; i < got; i++) {
+			ipo = bin_entry_to_ipo(td, s, &s->buf[i]);
+			if (!ipo)
+				continue;
+			flist_add_tail(&ipo->list, &td->io_log_list);
+			s->queued++;
+		}
+	}
+
+	if (!s->left)
+		read_iolog_close(td);
+}
+
+/*
+ * Read a binary iolog. The header carries the totals that read_iolog2()
+ * has to compute by parsing the whole log, so only the file table is read
+ * here and entries are streamed in as the replay consumes them.
+ */
+static int read_iolog_bin(struct thread_data *td, FILE *f)
+{
+	struct iolog_bin_hdr hdr;
+	struct iolog_stream *s;
+	char fname[PATH_MAX];
+	unsigned int i, reads, writes, waits;
+	uint32_t max_bs;
+	uint16_t len;
+
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1) {
+		log_err("fio: unable to read binary iolog header\n");
+		fclose(f);
+		return 1;
+	}
+	if (le32_to_cpu(hdr.version) != IOLOG_BIN_VERSION) {
+		log_err("fio: binary iolog version %u is not supported\n",
+					le32_to_cpu(hdr.version));
+		fclose(f);
+		return 1;
+	}
+
+	free_release_files(td);
+
+	s = calloc(1, sizeof(*s));
+	s->f = f;
+	s->left = le64_to_cpu(hdr.nr_entries);
+	s->nr_files = le32_to_cpu(hdr.nr_files);
+	s->scaled = (le32_to_cpu(hdr.flags) & IOLOG_BIN_F_SCALED) != 0;
+	s->fileno_map = calloc(s->nr_files + 1, sizeof(int));
+	s->buf = malloc(IOLOG_STREAM_WINDOW * sizeof(*s->buf));
+	td->io_log_stream = s;
+
+	if (s->scaled &&
+	    (td->o.replay_scale != le32_to_cpu(hdr.replay_scale) ||
+	     td->o.replay_align != le32_to_cpu(hdr.replay_align)))
+		log_info("fio: <%s> binary iolog was converted with "
+			 "replay_scale=%u replay_align=%u, ignoring the job's "
+			 "values\n", td->o.name, le32_to_cpu(hdr.replay_scale),
+			 le32_to_cpu(hdr.replay_align));
+
+	for (i = 0; i < s->nr_files; i++) {
+		const char *name = fname;
+
+		if (fread(&len, sizeof(len), 1, f) != 1)
+			goto err;
+		len = le16_to_cpu(len);
+		if (len >= sizeof(fname) || fread(fname, 1, len, f) != len)
+			goto err;
+		fname[len] = '\0';
+
+		if (td->o.replay_redirect) {
+			name = td->o.replay_redirect;
+			s->fileno_map[i] = get_fileno(td, name);
+			if (s->fileno_map[i] != -1) {
+				dprint(FD_FILE, "iolog: ignoring re-add of "
+						"file %s\n", name);
+				continue;
+			}
+		}
+		s->fileno_map[i] = add_file(td, name, 0, 1);
+	}
+
+	for (i = 0; i < DDIR_RWDIR_CNT; i++) {
+		uint64_t bytes = le64_to_cpu(hdr.bytes[i]);
+
+		if (i == DDIR_WRITE && read_only)
+			continue;
+
+		max_bs = le32_to_cpu(hdr.max_bs[i]);
+		if (max_bs > td->o.max_bs[i])
+			td->o.max_bs[i] = max_bs;
+		td->o.size += bytes;
+		td->total_io_size += bytes;
+	}
+
+	reads = le32_to_cpu(hdr.nr_reads);
+	writes = le32_to_cpu(hdr.nr_writes);
+	waits = td->o.no_stall ? 0 : le32_to_cpu(hdr.nr_waits);
+
+	iolog_stream_fill(td);
+
+	if (writes && read_only) {
+		log_err("fio: <%s> skips replay of %d writes due to"
+			" read-only\n", td->o.name, writes);
+		writes = 0;
+	}
+
+	if (!reads && !writes && !waits)
+		return 1;
+	else if (reads && !writes)
+		td->o.td_ddir = TD_DDIR_READ;
+	else if (!reads && writes)
+		td->o.td_ddir = TD_DDIR_WRITE;
+	else
+		td->o.td_ddir = TD_DDIR_RW;
+
+	return 0;
+err:
+	log_err("fio: unable to read binary iolog file table\n");
+	read_iolog_close(td);
+	return 1;
+}
+
+/*
+ * Write the replay list loaded by read_iolog out as a binary iolog, so
+ * that text and blktrace logs can be converted once and streamed later.
+ */
+static int iolog_convert_bin(struct thread_data *td)
+{
+	const char *file = td->o.convert_iolog_file;
+	uint64_t bytes[DDIR_RWDIR_CNT] = { 0, };
+	uint32_t max_bs[DDIR_RWDIR_CNT] = { 0, };
+	uint32_t reads = 0, writes = 0, waits = 0;
+	uint64_t nr_entries = 0;
+	struct iolog_bin_hdr hdr;
+	struct iolog_bin_entry e;
+	struct io_piece *ipo;
+	struct flist_head *n;
+	struct fio_file *ff;
+	unsigned int i;
+	uint16_t len;
+	FILE *f;
+	int ret = 0;
+
+	if (td->io_log_stream) {
+		log_err("fio: %s is already a binary iolog\n",
+					td->o.read_iolog_file);
+		return 1;
+	}
+
+	f = fopen(file, "w");
+	if (!f) {
+		perror("fopen convert iolog");
+		return 1;
+	}
+
+	flist_for_each(n, &td->io_log_list) {
+		ipo = flist_entry(n, struct io_piece, list);
+		nr_entries++;
+		if (ipo->ddir == DDIR_WAIT)
+			waits++;
+		if (!ddir_rw(ipo->ddir))
+			continue;
+		if (ipo->ddir == DDIR_READ)
+			reads++;
+		else if (ipo->ddir == DDIR_WRITE)
+			writes++;
+		bytes[ipo->ddir] += ipo->len;
+		if (ipo->len > max_bs[ipo->ddir])
+			max_bs[ipo->ddir] = ipo->len;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.version = cpu_to_le32((uint32_t) IOLOG_BIN_VERSION);
+	hdr.nr_files = cpu_to_le32(td->files_index);
+	hdr.nr_entries = cpu_to_le64(nr_entries);
+	for (i = 0; i < DDIR_RWDIR_CNT; i++) {
+		hdr.bytes[i] = cpu_to_le64(bytes[i]);
+		hdr.max_bs[i] = cpu_to_le32(max_bs[i]);
+	}
+	hdr.nr_reads = cpu_to_le32(reads);
+	hdr.nr_writes = cpu_to_le32(writes);
+	hdr.nr_waits = cpu_to_le32(waits);
+	/* the loaders have already scaled and aligned the offsets */
+	hdr.flags = cpu_to_le32(IOLOG_BIN_F_SCALED);
+	hdr.replay_scale = cpu_to_le32(td->o.replay_scale);
+	hdr.replay_align = cpu_to_le32(td->o.replay_align);
+
+	fprintf(f, "%s\n", iolog_bin);
+	fwrite(&hdr, sizeof(hdr), 1, f);
+
+	for_each_file(td, ff, i) {
+		len = cpu_to_le16((uint16_t) strlen(ff->file_name));
+		fwrite(&len, sizeof(len), 1, f);
+		fwrite(ff->file_name, 1, strlen(ff->file_name), f);
+	}
+
+	while (!flist_empty(&td->io_log_list)) {
+		ipo = flist_first_entry(&td->io_log_list, struct io_piece, list);
+		flist_del(&ipo->list);
+
+		memset(&e, 0, sizeof(e));
+		if (ipo->ddir == DDIR_INVAL)
+			e.ddir = IOLOG_BIN_DDIR_INVAL;
+		else
+			e.ddir = ipo->ddir;
+
+		if (ipo->ddir == DDIR_WAIT)
+			e.delay = cpu_to_le64((uint64_t) ipo->delay);
+		else {
+			e.offset = cpu_to_le64((uint64_t) ipo->offset);
+			e.len = cpu_to_le32((uint32_t) ipo->len);
+			e.fileno = cpu_to_le16((uint16_t) ipo->fileno);
+			if (ipo->ddir == DDIR_INVAL)
+				e.file_action = ipo->file_action;
+			else
+				e.delay = cpu_to_le64((uint64_t) ipo->delay);
+		}
+
+		fwrite(&e, sizeof(e), 1, f);
+		free(ipo);
+	}
+
+	if (ferror(f)) {
+		log_err("fio: failed writing binary iolog %s\n", file);
+		ret = 1;
+	}
+	if (fclose(f))
+		ret = 1;
+
+	if (!ret)
+		log_info("fio: converted %llu iolog entries to %s\n",
+				(unsigned long long) nr_entries, file);
+
+	/*
+	 * Conversion only, don't replay anything
+	 */
+	td->total_io_size = 0;
+	td->o.size = 0;
+	td->done = 1;
+	return ret;
+}
+
 /*
  * open iolog, check version, and call appropriate parser
  */
@@ -522,7 +868,12 @@ static int init_iolog_read(struct thread_data *td)
 	 */
 	if (!strncmp(iolog_ver2, buffer, strlen(iolog_ver2)))
 		ret = read_iolog2(td, f);
-	else {
+	else if (!strncmp(iolog_bin, buffer, strlen(iolog_bin))) {
+		/*
+		 * the stream owns f from here on
+		 */
+		return read_iolog_bin(td, f);
+	} else {
 		log_err("fio: iolog version 1 is no longer supported\n");
 		ret = 1;
 	}
@@ -585,6 +936,9 @@ int init_iolog(struct thread_data *td)
 			ret = load_blktrace(td, td->o.read_iolog_file, need_swap);
 		else
 			ret = init_iolog_read(td);
+
+		if (!ret && td->o.convert_iolog_file)
+			ret = iolog_convert_bin(td);
 	} else if (td->o.write_iolog_file)
 		ret = init_iolog_write(td);
 
@@ -213,6 +213,62 @@ struct io_piece {
 	};
 };
 
+/*
+ * Binary iolog. After the magic line comes a fixed header carrying the
+ * totals needed to size the job, the file table (a le16 name length
+ * followed by the name, per file) and then fixed size entries. Everything
+ * is stored little endian. Binary logs are streamed during replay rather
+ * than loaded up front.
+ */
+#define IOLOG_BIN_VERSION	2
+#define IOLOG_BIN_DDIR_INVAL	0xff
+
+/*
+ * Offsets already had replay_scale and replay_align applied when the log
+ * was converted; the values used are stored in the header.
+ */
+#define IOLOG_BIN_F_SCALED	(1U << 0)
+
+struct iolog_bin_hdr {
+	uint32_t version;
+	uint32_t nr_files;
+	uint64_t nr_entries;
+	uint64_t bytes[DDIR_RWDIR_CNT];
+	uint32_t max_bs[DDIR_RWDIR_CNT];
+	uint32_t nr_reads;
+	uint32_t nr_writes;
+	uint32_t nr_waits;
+	uint32_t flags;
+	uint32_t replay_scale;
+	uint32_t replay_align;
+	uint32_t pad;		/* keeps the size the same on 32-bit ABIs */
+};
+
+struct iolog_bin_entry {
+	uint64_t offset;
+	uint64_t delay;
+	uint32_t len;
+	uint16_t fileno;
+	uint8_t ddir;
+	uint8_t file_action;
+};
+
+/*
+ * Number of binary entries kept queued on io_log_list while streaming.
+ * The list is topped up once it drops below half of this.
+ */
+#define IOLOG_STREAM_WINDOW	1024
+
+struct iolog_stream {
+	FILE *f;
+	uint64_t left;
+	unsigned int queued;
+	unsigned int nr_files;
+	int scaled;
+	int *fileno_map;
+	struct iolog_bin_entry *buf;
+};
+
 /*
  * Log exports
  */
@@ -234,6 +290,7 @@ extern void trim_io_piece(struct thread_data *, const struct io_u *);
 extern void queue_io_piece(struct thread_data *, struct io_piece *);
 extern void prune_io_piece_log(struct thread_data *);
 extern void write_iolog_close(struct thread_data *);
+extern void read_iolog_close(struct thread_data *);
 extern int iolog_compress_init(struct thread_data *, struct sk_out *);
 extern void iolog_compress_exit(struct thread_data *);
 extern size_t log_chunk_sizes(struct io_log *);
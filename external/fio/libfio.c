@@ -362,6 +362,10 @@ int initialize_fio(char *envp[])
 	compiletime_assert((offsetof(struct thread_options_pack, percentile_list) % 8) == 0, "percentile_list");
 	compiletime_assert((offsetof(struct thread_options_pack, latency_percentile) % 8) == 0, "latency_percentile");
 
+	/* binary iologs are written raw and must not pick up ABI padding */
+	compiletime_assert(sizeof(struct iolog_bin_hdr) == 80, "iolog_bin_hdr");
+	compiletime_assert(sizeof(struct iolog_bin_entry) == 24, "iolog_bin_entry");
+
 	err = endian_check();
 	if (err) {
 		log_err("fio: endianness settings appear wrong.\n");
@@ -3008,6 +3008,17 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 		.category = FIO_OPT_C_IO,
 		.group	= FIO_OPT_G_IOLOG,
 	},
+	{
+		.name	= "convert_iolog",
+		.lname	= "Convert I/O log",
+		.type	= FIO_OPT_STR_STORE,
+		.off1	= offsetof(struct thread_options, convert_iolog_file),
+		.parent	= "read_iolog",
+		.hide	= 1,
+		.help	= "Convert read_iolog to a binary iolog and skip replay",
+		.category = FIO_OPT_C_IO,
+		.group	= FIO_OPT_G_IOLOG,
+	},
 	{
 		.name	= "replay_no_stall",
 		.lname	= "Don't stall on replay",
@@ -241,6 +241,7 @@ struct thread_options {
 
 	char *read_iolog_file;
 	char *write_iolog_file;
+	char *convert_iolog_file;
 
 	unsigned int write_bw_log;
 	unsigned int write_lat_log;
@@ -511,6 +512,7 @@ struct thread_options_pack {
 
 	uint8_t read_iolog_file[FIO_TOP_STR_MAX];
 	uint8_t write_iolog_file[FIO_TOP_STR_MAX];
+	uint8_t convert_iolog_file[FIO_TOP_STR_MAX];
 
 	uint32_t write_bw_log;
 	uint32_t write_lat_log;
@@ -217,6 +217,19 @@ static void *hdr_priv(struct verify_header *hdr)
 	return priv + sizeof(struct verify_header);
 }
 
+/*
+ * Digest of one verify interval, worked out for the whole batch before the
+ * io_us are checked one by one. Only sha256 and crc32c have multi-buffer
+ * versions, everything else is still hashed inline by verify_io_u().
+ */
+struct verify_digest {
+	const uint8_t *data;
+	unsigned int len;
+	unsigned int valid;
+	uint32_t crc32c;
+	uint8_t sha256[64];
+};
+
 /*
  * Verify container, pass info to verify handlers and allow them to
  * pass info back in case of error
@@ -228,6 +241,7 @@ struct vcont {
 	struct io_u *io_u;
 	unsigned int hdr_num;
 	struct thread_data *td;
+	struct verify_digest *digest;
 
 	/*
 	 * Output, only valid in case of error
@@ -558,9 +572,14 @@ static int verify_io_u_sha256(struct verify_header *hdr, struct vcont *vc)
 
 	dprint(FD_VERIFY, "sha256 verify io_u %p, len %u\n", vc->io_u, hdr->len);
 
-	fio_sha256_init(&sha256_ctx);
-	fio_sha256_update(&sha256_ctx, p, hdr->len - hdr_size(vc->td, hdr));
-	fio_sha256_final(&sha256_ctx);
+	if (vc->digest && vc->digest->valid)
+		memcpy(sha256, vc->digest->sha256, sizeof(sha256));
+	else {
+		fio_sha256_init(&sha256_ctx);
+		fio_sha256_update(&sha256_ctx, p,
+					hdr->len - hdr_size(vc->td, hdr));
+		fio_sha256_final(&sha256_ctx);
+	}
 
 	if (!memcmp(vh->sha256, sha256_ctx.buf, sizeof(sha256)))
 		return 0;
@@ -691,7 +710,10 @@ static int verify_io_u_crc32c(struct verify_header *hdr, struct vcont *vc)
 
 	dprint(FD_VERIFY, "crc32c verify io_u %p, len %u\n", vc->io_u, hdr->len);
 
-	c = fio_crc32c(p, hdr->len - hdr_size(vc->td, hdr));
+	if (vc->digest && vc->digest->valid)
+		c = vc->digest->crc32c;
+	else
+		c = fio_crc32c(p, hdr->len - hdr_size(vc->td, hdr));
 
 	if (c == vh->crc32)
 		return 0;
@@ -881,7 +903,8 @@ err:
 	return EILSEQ;
 }
 
-int verify_io_u(struct thread_data *td, struct io_u **io_u_ptr)
+static int __verify_io_u(struct thread_data *td, struct io_u **io_u_ptr,
+			 struct verify_digest *digest)
 {
 	struct verify_header *hdr;
 	struct io_u *io_u = *io_u_ptr;
@@ -912,6 +935,7 @@ int verify_io_u(struct thread_data *td, struct io_u **io_u_ptr)
 			.io_u		= io_u,
 			.hdr_num	= hdr_num,
 			.td		= td,
+			.digest		= digest ? &digest[hdr_num] : NULL,
 		};
 		unsigned int verify_type;
 
@@ -1012,6 +1036,11 @@ done:
 	return ret;
 }
 
+int verify_io_u(struct thread_data *td, struct io_u **io_u_ptr)
+{
+	return __verify_io_u(td, io_u_ptr, NULL);
+}
+
 static void fill_xxhash(struct verify_header *hdr, void *p, unsigned int len)
 {
 	struct vhdr_xxhash *vh = hdr_priv(hdr);
@@ -1390,10 +1419,159 @@ void fio_verify_init(struct thread_data *td)
 	}
 }
 
+#define VERIFY_MB_LANES	(SHA256_MB_LANES > CRC32C_MB_LANES ? \
+				SHA256_MB_LANES : CRC32C_MB_LANES)
+
+static int verify_batch_type(struct thread_data *td)
+{
+	/*
+	 * With verify_offset the header is only swapped back into place
+	 * by verify_io_u(), hashing before that would see the wrong data.
+	 */
+	if (td->o.verify_offset || td_ioengine_flagged(td, FIO_FAKEIO))
+		return VERIFY_NONE;
+
+	switch (td->o.verify) {
+	case VERIFY_SHA256:
+	case VERIFY_CRC32C:
+	case VERIFY_CRC32C_INTEL:
+		return td->o.verify;
+	default:
+		return VERIFY_NONE;
+	}
+}
+
+static unsigned int verify_batch_intervals(struct thread_data *td,
+					   struct io_u *io_u)
+{
+	unsigned int hdr_inc;
+
+	if (io_u->ddir != DDIR_READ || (io_u->flags & IO_U_F_TRIMMED))
+		return 0;
+
+	hdr_inc = get_hdr_inc(td, io_u);
+	return (io_u->buflen + hdr_inc - 1) / hdr_inc;
+}
+
+static void verify_digest_lanes(int type, struct verify_digest **lane,
+				unsigned int nr)
+{
+	const uint8_t *data[VERIFY_MB_LANES];
+	unsigned int i;
+
+	for (i = 0; i < nr; i++)
+		data[i] = lane[i]->data;
+
+	if (type == VERIFY_SHA256) {
+		struct fio_sha256_ctx ctx[SHA256_MB_LANES];
+		struct fio_sha256_ctx *pctx[SHA256_MB_LANES];
+
+		for (i = 0; i < nr; i++) {
+			ctx[i].buf = lane[i]->sha256;
+			fio_sha256_init(&ctx[i]);
+			pctx[i] = &ctx[i];
+		}
+		fio_sha256_update_mb(pctx, data, lane[0]->len, nr);
+		for (i = 0; i < nr; i++)
+			fio_sha256_final(&ctx[i]);
+	} else {
+		uint32_t crc[CRC32C_MB_LANES];
+
+		fio_crc32c_mb(data, lane[0]->len, crc, nr);
+		for (i = 0; i < nr; i++)
+			lane[i]->crc32c = crc[i];
+	}
+
+	for (i = 0; i < nr; i++)
+		lane[i]->valid = 1;
+}
+
+/*
+ * Hash every interval of the batch up front, with intervals of the same
+ * length going through the multi-buffer sha256/crc32c code together.
+ * Intervals whose header doesn't look right are left for verify_io_u(),
+ * which will report them. Returns the number of digests prepared.
+ */
+static unsigned int verify_batch_hash(struct verify_worker *vw,
+				      struct flist_head *list)
+{
+	struct verify_digest *lane[VERIFY_MB_LANES], *d;
+	struct thread_data *td = vw->td;
+	unsigned int nr = 0, lanes, n, i, j, hdr_inc;
+	int type = verify_batch_type(td);
+	struct flist_head *entry;
+	struct io_u *io_u;
+
+	if (type == VERIFY_NONE)
+		return 0;
+
+	flist_for_each(entry, list) {
+		io_u = flist_entry(entry, struct io_u, verify_list);
+		nr += verify_batch_intervals(td, io_u);
+	}
+	if (!nr)
+		return 0;
+
+	if (nr > vw->nr_digests) {
+		free(vw->digests);
+		vw->digests = malloc(nr * sizeof(struct verify_digest));
+		if (!vw->digests) {
+			vw->nr_digests = 0;
+			return 0;
+		}
+		vw->nr_digests = nr;
+	}
+
+	d = vw->digests;
+	flist_for_each(entry, list) {
+		io_u = flist_entry(entry, struct io_u, verify_list);
+		n = verify_batch_intervals(td, io_u);
+		hdr_inc = get_hdr_inc(td, io_u);
+
+		for (j = 0; j < n; j++, d++) {
+			struct verify_header *hdr = io_u->buf + j * hdr_inc;
+
+			d->valid = 0;
+			d->len = 0;
+			if (hdr->magic != FIO_HDR_MAGIC || hdr->len != hdr_inc ||
+			    hdr->verify_type != type)
+				continue;
+
+			d->data = (void *) hdr + hdr_size(td, hdr);
+			d->len = hdr_inc - hdr_size(td, hdr);
+		}
+	}
+
+	lanes = type == VERIFY_SHA256 ? SHA256_MB_LANES : CRC32C_MB_LANES;
+	n = 0;
+	for (i = 0; i < nr; i++) {
+		d = &vw->digests[i];
+		if (!d->len)
+			continue;
+		if (n && lane[0]->len != d->len) {
+			verify_digest_lanes(type, lane, n);
+			n = 0;
+		}
+		lane[n++] = d;
+		if (n == lanes) {
+			verify_digest_lanes(type, lane, n);
+			n = 0;
+		}
+	}
+	if (n)
+		verify_digest_lanes(type, lane, n);
+
+	return nr;
+}
+
 static void *verify_async_thread(void *data)
 {
-	struct thread_data *td = data;
+	struct verify_worker *vw = data;
+	struct thread_data *td = vw->td;
+	struct verify_digest *digest;
+	struct timeval start;
 	struct io_u *io_u;
+	unsigned int nr;
 	int ret = 0;
 
 	if (fio_option_is_set(&td->o, verify_cpumask) &&
@@ -1421,18 +1599,42 @@ static void *verify_async_thread(void *data)
 			}
 		}
 
-		flist_splice_init(&td->verify_list, &list);
+		nr = 0;
+		while (!flist_empty(&td->verify_list) &&
+		       nr < VERIFY_ASYNC_BATCH) {
+			io_u = flist_first_entry(&td->verify_list, struct io_u,
+							verify_list);
+			flist_del(&io_u->verify_list);
+			flist_add_tail(&io_u->verify_list, &list);
+			nr++;
+		}
 		pthread_mutex_unlock(&td->io_u_lock);
 
 		if (flist_empty(&list))
 			continue;
 
+		/*
+		 * Leave the rest to the other workers
+		 */
+		if (!flist_empty(&td->verify_list))
+			pthread_cond_signal(&td->verify_cond);
+
+		fio_gettime(&start, NULL);
+
+		digest = verify_batch_hash(vw, &list) ? vw->digests : NULL;
+
 		while (!flist_empty(&list)) {
 			io_u = flist_first_entry(&list, struct io_u, verify_list);
 			flist_del_init(&io_u->verify_list);
 
+			vw->nr_verified++;
+			vw->bytes += io_u->buflen;
+
+			nr = verify_batch_intervals(td, io_u);
 			io_u_set(td, io_u, IO_U_F_NO_FILE_PUT);
-			ret = verify_io_u(td, &io_u);
+			ret = __verify_io_u(td, &io_u, nr ? digest : NULL);
+			if (digest)
+				digest += nr;
 
 			put_io_u(td, io_u);
 			if (!ret)
@@ -1443,6 +1645,8 @@ static void *verify_async_thread(void *data)
 				ret = 0;
 			}
 		}
+
+		vw->busy_usec += utime_since_now(&start);
 	} while (!ret);
 
 	if (ret) {
@@ -1452,6 +1656,10 @@ static void *verify_async_thread(void *data)
 	}
 
 done:
+	free(vw->digests);
+	vw->digests = NULL;
+	vw->nr_digests = 0;
+
 	pthread_mutex_lock(&td->io_u_lock);
 	td->nr_verify_threads--;
 	pthread_mutex_unlock(&td->io_u_lock);
@@ -1471,9 +1679,14 @@ int verify_async_init(struct thread_data *td)
 	td->verify_thread_exit = 0;
 
 	td->verify_threads = malloc(sizeof(pthread_t) * td->o.verify_async);
+	td->verify_workers = calloc(td->o.verify_async,
+					sizeof(struct verify_worker));
 	for (i = 0; i < td->o.verify_async; i++) {
+		td->verify_workers[i].td = td;
+		td->verify_workers[i].index = i;
 		ret = pthread_create(&td->verify_threads[i], &attr,
-					verify_async_thread, td);
+					verify_async_thread,
+					&td->verify_workers[i]);
 		if (ret) {
 			log_err("fio: async verify creation failed: %s\n",
 					strerror(ret));
@@ -1503,6 +1716,9 @@ int verify_async_init(struct thread_data *td)
 
 void verify_async_exit(struct thread_data *td)
 {
+	struct verify_worker *vw;
+	unsigned int i;
+
 	td->verify_thread_exit = 1;
 	write_barrier();
 	pthread_cond_broadcast(&td->verify_cond);
@@ -1513,8 +1729,22 @@ void verify_async_exit(struct thread_data *td)
 		pthread_cond_wait(&td->free_cond, &td->io_u_lock);
 
 	pthread_mutex_unlock(&td->io_u_lock);
+
+	for (i = 0; td->verify_workers && i < td->o.verify_async; i++) {
+		vw = &td->verify_workers[i];
+		dprint(FD_VERIFY, "verify worker %u: %llu io_us, %llu KiB, "
+			"busy %llu msec, %llu KiB/s\n", vw->index,
+			(unsigned long long) vw->nr_verified,
+			(unsigned long long) vw->bytes >> 10,
+			(unsigned long long) vw->busy_usec / 1000,
+			vw->busy_usec ? (unsigned long long)
+				(vw->bytes * 1000000 / vw->busy_usec) >> 10 : 0);
+	}
+
 	free(td->verify_threads);
 	td->verify_threads = NULL;
+	free(td->verify_workers);
+	td->verify_workers = NULL;
 }
 
 int paste_blockoff(char *buf, unsigned int len, void *priv)
@@ -101,8 +101,26 @@ extern void fill_buffer_pattern(struct thread_data *td, void *p, unsigned int le
 extern void fio_verify_init(struct thread_data *td);
 
 /*
- * Async verify offload
+ * Async verify offload. Each worker pulls at most VERIFY_ASYNC_BATCH io_us
+ * off the shared list at a time, so a burst of completions is spread over
+ * all workers instead of being taken by whichever one woke up first.
  */
+#define VERIFY_ASYNC_BATCH	16
+
+struct verify_digest;
+
+struct verify_worker {
+	struct thread_data *td;
+	unsigned int index;
+	uint64_t nr_verified;
+	uint64_t bytes;
+	uint64_t busy_usec;
+
+	/* per-interval digests of the current batch, see verify_batch_hash() */
+	struct verify_digest *digests;
+	unsigned int nr_digests;
+};
+
 extern int verify_async_init(struct thread_data *);
 extern void verify_async_exit(struct thread_data *);
 
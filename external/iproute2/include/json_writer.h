@@ -26,6 +26,9 @@ json_writer_t *jsonw_new(FILE *f);
 /* End output to JSON stream */
 void jsonw_destroy(json_writer_t **self_p);
 
+/* Start the next top-level value on a new line */
+void jsonw_newline(json_writer_t *self);
+
 /* Cause output to have pretty whitespace */
 void jsonw_pretty(json_writer_t *self, bool on);
 
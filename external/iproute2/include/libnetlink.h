@@ -12,6 +12,8 @@
 #include <linux/netconf.h>
 #include <arpa/inet.h>
 
+struct rtnl_batch;
+
 struct rtnl_handle {
 	int			fd;
 	struct sockaddr_nl	local;
@@ -23,6 +25,7 @@ struct rtnl_handle {
 #define RTNL_HANDLE_F_LISTEN_ALL_NSID		0x01
 #define RTNL_HANDLE_F_SUPPRESS_NLERR		0x02
 	int			flags;
+	struct rtnl_batch      *batch;
 };
 
 struct nlmsg_list {
@@ -101,6 +104,23 @@ int rtnl_talk_extack(struct rtnl_handle *rtnl, struct nlmsghdr *n,
 int rtnl_talk_suppress_rtnl_errmsg(struct rtnl_handle *rtnl, struct nlmsghdr *n,
 				   struct nlmsghdr *answer, size_t len)
 	__attribute__((warn_unused_result));
+
+/*
+ * While a batch is open, rtnl_talk() calls that only want an ack are
+ * queued and sent many per sendmsg(); their acks are collected when the
+ * queue is flushed.  Anything else on the handle flushes the queue first.
+ * errfn is told the tag of every request the kernel refused or that got
+ * no ack back, including those of flushes done on the caller's behalf;
+ * rtnl_batch_flush() and rtnl_batch_end() return -1 if there was any.
+ */
+typedef void (*rtnl_batch_err_fn_t)(unsigned int tag, void *arg);
+
+int rtnl_batch_start(struct rtnl_handle *rth, rtnl_batch_err_fn_t errfn,
+		     void *arg);
+void rtnl_batch_tag(struct rtnl_handle *rth, unsigned int tag);
+int rtnl_batch_flush(struct rtnl_handle *rth);
+int rtnl_batch_end(struct rtnl_handle *rth);
+
 int rtnl_send(struct rtnl_handle *rth, const void *buf, int)
 	__attribute__((warn_unused_result));
 int rtnl_send_check(struct rtnl_handle *rth, const void *buf, int)
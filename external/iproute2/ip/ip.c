@@ -120,12 +120,44 @@ static int do_cmd(const char *argv0, int argc, char **argv)
 }
 
 #ifndef ANDROID
+/*
+ * With -force a failed line does not stop the batch, so requests of the
+ * objects below can be queued and sent to the kernel many at a time;
+ * their errors are reported when the acks come back.  Everything else
+ * (links, tunnels, ...) runs synchronously, after the queue is flushed.
+ */
+static bool cmd_pipelined(const char *argv0)
+{
+	const struct cmd *c;
+
+	for (c = cmds; c->cmd; ++c) {
+		if (matches(argv0, c->cmd) == 0)
+			return c->func == do_iproute || c->func == do_ipaddr ||
+			       c->func == do_ipneigh || c->func == do_iprule;
+	}
+	return false;
+}
+
+struct batch_ctx {
+	const char	*name;
+	int		failed;
+};
+
+static void batch_line_failed(unsigned int lineno, void *arg)
+{
+	struct batch_ctx *ctx = arg;
+
+	fprintf(stderr, "Command failed %s:%u\n", ctx->name, lineno);
+	ctx->failed = 1;
+}
+
 static int batch(const char *name)
 {
 	char *line = NULL;
 	size_t len = 0;
 	int ret = EXIT_SUCCESS;
 	int orig_family = preferred_family;
+	struct batch_ctx ctx = { .name = name };
 
 	batch_mode = 1;
 
@@ -154,6 +186,12 @@ static int batch(const char *name)
 		if (largc == 0)
 			continue;	/* blank line */
 
+		if (force && cmd_pipelined(largv[0]))
+			rtnl_batch_start(&rth, batch_line_failed, &ctx);
+		else if (rtnl_batch_end(&rth) < 0)
+			ret = EXIT_FAILURE;
+		rtnl_batch_tag(&rth, cmdlineno);
+
 		if (do_cmd(largv[0], largc, largv)) {
 			fprintf(stderr, "Command failed %s:%d\n",
 				name, cmdlineno);
@@ -165,6 +203,9 @@ static int batch(const char *name)
 	if (line)
 		free(line);
 
+	if (rtnl_batch_end(&rth) < 0 || ctx.failed)
+		ret = EXIT_FAILURE;
+
 	rtnl_close(&rth);
 	return ret;
 }
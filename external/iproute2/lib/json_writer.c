@@ -118,6 +118,14 @@ void jsonw_destroy(json_writer_t **self_p)
 	*self_p = NULL;
 }
 
+/* End a top-level value and start the next one on a line of its own */
+void jsonw_newline(json_writer_t *self)
+{
+	assert(self->depth == 0);
+	putc('\n', self->out);
+	self->sep = '\0';
+}
+
 void jsonw_pretty(json_writer_t *self, bool on)
 {
 	self->pretty = on;
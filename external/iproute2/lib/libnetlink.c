@@ -34,6 +34,10 @@
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 #endif
 
+#ifndef MAX
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
 int rcvbuf = 1024 * 1024;
 
 #ifdef HAVE_LIBMNL
@@ -128,6 +132,8 @@ static int nl_dump_ext_err(const struct nlmsghdr *nlh, nl_ext_ack_fn_t errfn)
 
 void rtnl_close(struct rtnl_handle *rth)
 {
+	if (rth->batch)
+		rtnl_batch_end(rth);
 	if (rth->fd >= 0) {
 		close(rth->fd);
 		rth->fd = -1;
@@ -224,6 +230,7 @@ int rtnl_wilddump_req_filter(struct rtnl_handle *rth, int family, int type,
 		.ext_filter_mask = filt_mask,
 	};
 
+	rtnl_batch_flush(rth);
 	return send(rth->fd, &req, sizeof(req), 0);
 }
 
@@ -250,6 +257,7 @@ int rtnl_wilddump_req_filter_fn(struct rtnl_handle *rth, int family, int type,
 	if (err)
 		return err;
 
+	rtnl_batch_flush(rth);
 	return send(rth->fd, &req, req.nlh.nlmsg_len, 0);
 }
 
@@ -270,11 +278,13 @@ int rtnl_wilddump_stats_req_filter(struct rtnl_handle *rth, int fam, int type,
 	req.ifsm.family = fam;
 	req.ifsm.filter_mask = filt_mask;
 
+	rtnl_batch_flush(rth);
 	return send(rth->fd, &req, sizeof(req), 0);
 }
 
 int rtnl_send(struct rtnl_handle *rth, const void *buf, int len)
 {
+	rtnl_batch_flush(rth);
 	return send(rth->fd, buf, len, 0);
 }
 
@@ -284,6 +294,7 @@ int rtnl_send_check(struct rtnl_handle *rth, const void *buf, int len)
 	int status;
 	char resp[1024];
 
+	rtnl_batch_flush(rth);
 	status = send(rth->fd, buf, len, 0);
 	if (status < 0)
 		return status;
@@ -332,6 +343,7 @@ int rtnl_dump_request(struct rtnl_handle *rth, int type, void *req, int len)
 		.msg_iovlen = 2,
 	};
 
+	rtnl_batch_flush(rth);
 	return sendmsg(rth->fd, &msg, 0);
 }
 
@@ -351,6 +363,8 @@ int rtnl_dump_request_n(struct rtnl_handle *rth, struct nlmsghdr *n)
 
 	n->nlmsg_flags = NLM_F_DUMP|NLM_F_REQUEST;
 	n->nlmsg_pid = 0;
+
+	rtnl_batch_flush(rth);
 	n->nlmsg_seq = rth->dump = ++rth->seq;
 
 	return sendmsg(rth->fd, &msg, 0);
@@ -404,6 +418,71 @@ static void rtnl_dump_error(const struct rtnl_handle *rth,
 	}
 }
 
+static int __rtnl_recvmsg(int fd, struct msghdr *msg, int flags)
+{
+	int len;
+
+	do {
+		len = recvmsg(fd, msg, flags);
+	} while (len < 0 && (errno == EINTR || errno == EAGAIN));
+
+	if (len < 0) {
+		fprintf(stderr, "netlink receive error %s (%d)\n",
+			strerror(errno), errno);
+		return -1;
+	}
+
+	if (len == 0) {
+		fprintf(stderr, "EOF on netlink\n");
+		return -1;
+	}
+
+	return len;
+}
+
+/*
+ * Receive one datagram into *buf, growing it first if the datagram
+ * would not fit.  The size is learnt with MSG_PEEK|MSG_TRUNC on an
+ * empty iovec, so nothing is copied twice.  The buffer is never made
+ * smaller than RTNL_RECV_BUFSIZE: the kernel sizes the skbs of a dump
+ * after the largest buffer we have offered, so a small first read
+ * would keep every following batch small as well.
+ */
+#define RTNL_RECV_BUFSIZE	32768
+
+static int rtnl_recvmsg(int fd, struct msghdr *msg, char **buf,
+			size_t *size)
+{
+	struct iovec *iov = msg->msg_iov;
+	int len;
+
+	iov->iov_base = NULL;
+	iov->iov_len = 0;
+
+	len = __rtnl_recvmsg(fd, msg, MSG_PEEK | MSG_TRUNC);
+	if (len < 0)
+		return len;
+
+	if (len < RTNL_RECV_BUFSIZE)
+		len = RTNL_RECV_BUFSIZE;
+
+	if (*size < len) {
+		char *nbuf = realloc(*buf, len);
+
+		if (!nbuf) {
+			fprintf(stderr, "malloc error: not enough buffer\n");
+			return -1;
+		}
+		*buf = nbuf;
+		*size = len;
+	}
+
+	iov->iov_base = *buf;
+	iov->iov_len = *size;
+
+	return __rtnl_recvmsg(fd, msg, 0);
+}
+
 int rtnl_dump_filter_l(struct rtnl_handle *rth,
 		       const struct rtnl_dump_filter_arg *arg)
 {
@@ -415,31 +494,20 @@ int rtnl_dump_filter_l(struct rtnl_handle *rth,
 		.msg_iov = &iov,
 		.msg_iovlen = 1,
 	};
-	char buf[32768];
+	char *buf = NULL;
+	size_t bufsize = 0;
 	int dump_intr = 0;
+	int ret = -1;
 
-	iov.iov_base = buf;
 	while (1) {
 		int status;
 		const struct rtnl_dump_filter_arg *a;
 		int found_done = 0;
 		int msglen = 0;
 
-		iov.iov_len = sizeof(buf);
-		status = recvmsg(rth->fd, &msg, 0);
-
-		if (status < 0) {
-			if (errno == EINTR || errno == EAGAIN)
-				continue;
-			fprintf(stderr, "netlink receive error %s (%d)\n",
-				strerror(errno), errno);
-			return -1;
-		}
-
-		if (status == 0) {
-			fprintf(stderr, "EOF on netlink\n");
-			return -1;
-		}
+		status = rtnl_recvmsg(rth->fd, &msg, &buf, &bufsize);
+		if (status < 0)
+			goto out;
 
 		if (rth->dump_fp)
 			fwrite(buf, 1, NLMSG_ALIGN(status), rth->dump_fp);
@@ -465,7 +533,7 @@ int rtnl_dump_filter_l(struct rtnl_handle *rth,
 				if (h->nlmsg_type == NLMSG_DONE) {
 					err = rtnl_dump_done(h);
 					if (err < 0)
-						return -1;
+						goto out;
 
 					found_done = 1;
 					break; /* process next filter */
@@ -473,13 +541,15 @@ int rtnl_dump_filter_l(struct rtnl_handle *rth,
 
 				if (h->nlmsg_type == NLMSG_ERROR) {
 					rtnl_dump_error(rth, h);
-					return -1;
+					goto out;
 				}
 
 				if (!rth->dump_fp) {
 					err = a->filter(&nladdr, h, a->arg1);
-					if (err < 0)
-						return err;
+					if (err < 0) {
+						ret = err;
+						goto out;
+					}
 				}
 
 skip_it:
@@ -491,7 +561,8 @@ skip_it:
 			if (dump_intr)
 				fprintf(stderr,
 					"Dump was interrupted and may be inconsistent.\n");
-			return 0;
+			ret = 0;
+			goto out;
 		}
 
 		if (msg.msg_flags & MSG_TRUNC) {
@@ -503,6 +574,10 @@ skip_it:
 			exit(1);
 		}
 	}
+
+out:
+	free(buf);
+	return ret;
 }
 
 int rtnl_dump_filter_nc(struct rtnl_handle *rth,
@@ -527,6 +602,225 @@ static void rtnl_talk_error(struct nlmsghdr *h, struct nlmsgerr *err,
 		strerror(-err->error));
 }
 
+/*
+ * Pipelined requests.  rtnetlink handles every message of a sendmsg()
+ * in order, inside the sendmsg() call, so by the time it returns all the
+ * acks are waiting on the socket, and any that do not fit in the receive
+ * buffer are dropped.  So the queue is flushed before the acks it would
+ * get back could overflow the receive buffer.  Each ack is a socket
+ * buffer of its own and costs up to RTNL_BATCH_ACK_SIZE of it, plus a
+ * copy of the request when NETLINK_CAP_ACK is not available.
+ */
+#define RTNL_BATCH_BUFSIZE	32768
+#define RTNL_BATCH_ACK_SIZE	1024
+
+struct rtnl_batch_req {
+	unsigned int		tag;
+	bool			acked;
+};
+
+struct rtnl_batch {
+	char			*buf;
+	size_t			len;
+	size_t			size;
+	struct rtnl_batch_req	*reqs;
+	unsigned int		count;
+	unsigned int		max;
+	size_t			acks;
+	size_t			ack_space;
+	bool			capped;
+	__u32			first_seq;
+	unsigned int		tag;
+	rtnl_batch_err_fn_t	errfn;
+	void			*arg;
+};
+
+int rtnl_batch_start(struct rtnl_handle *rth, rtnl_batch_err_fn_t errfn,
+		     void *arg)
+{
+	struct rtnl_batch *b;
+	socklen_t optlen = sizeof(int);
+	int space = 0, one = 1;
+
+	if (rth->batch)
+		return 0;
+
+	b = calloc(1, sizeof(*b));
+	if (!b)
+		return -1;
+
+	/*
+	 * Let the receive buffer grow past rmem_max where we are allowed
+	 * to, and keep refused requests out of their acks.  Both are
+	 * optional; the ack budget follows whatever we end up with.
+	 */
+	setsockopt(rth->fd, SOL_SOCKET, SO_RCVBUFFORCE,
+		   &rcvbuf, sizeof(rcvbuf));
+	if (getsockopt(rth->fd, SOL_SOCKET, SO_RCVBUF, &space, &optlen) < 0)
+		space = 0;
+	b->ack_space = MAX(space, RTNL_BATCH_ACK_SIZE);
+	b->capped = setsockopt(rth->fd, SOL_NETLINK, NETLINK_CAP_ACK,
+			       &one, sizeof(one)) == 0;
+
+	b->errfn = errfn;
+	b->arg = arg;
+	rth->batch = b;
+	return 0;
+}
+
+void rtnl_batch_tag(struct rtnl_handle *rth, unsigned int tag)
+{
+	if (rth->batch)
+		rth->batch->tag = tag;
+}
+
+static void rtnl_batch_failed(struct rtnl_batch *b, unsigned int i)
+{
+	if (b->errfn)
+		b->errfn(b->reqs[i].tag, b->arg);
+}
+
+int rtnl_batch_flush(struct rtnl_handle *rth)
+{
+	struct rtnl_batch *b = rth->batch;
+	struct sockaddr_nl nladdr = { .nl_family = AF_NETLINK };
+	struct iovec iov;
+	struct msghdr msg = {
+		.msg_name = &nladdr,
+		.msg_namelen = sizeof(nladdr),
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+	};
+	char *buf = NULL;
+	size_t bufsize = 0;
+	unsigned int i, pending;
+	int ret = 0;
+
+	if (!b || !b->count)
+		return 0;
+
+	iov.iov_base = b->buf;
+	iov.iov_len = b->len;
+	if (sendmsg(rth->fd, &msg, 0) < 0) {
+		perror("Cannot talk to rtnetlink");
+		ret = -1;
+		goto out;
+	}
+
+	for (pending = b->count; pending; ) {
+		struct nlmsghdr *h;
+		int status;
+
+		status = rtnl_recvmsg(rth->fd, &msg, &buf, &bufsize);
+		if (status < 0) {
+			ret = -1;
+			goto out;
+		}
+
+		for (h = (struct nlmsghdr *)buf; NLMSG_OK(h, status);
+		     h = NLMSG_NEXT(h, status)) {
+			struct nlmsgerr *err = (struct nlmsgerr *)NLMSG_DATA(h);
+
+			i = h->nlmsg_seq - b->first_seq;
+			if (nladdr.nl_pid != 0 ||
+			    h->nlmsg_pid != rth->local.nl_pid ||
+			    h->nlmsg_type != NLMSG_ERROR ||
+			    i >= b->count || b->reqs[i].acked)
+				continue;
+
+			b->reqs[i].acked = true;
+			pending--;
+			if (h->nlmsg_len < NLMSG_LENGTH(sizeof(*err)))
+				fprintf(stderr, "ERROR truncated\n");
+			else if (!err->error)
+				continue;
+			else
+				rtnl_talk_error(h, err, NULL);
+
+			rtnl_batch_failed(b, i);
+			ret = -1;
+		}
+	}
+
+out:
+	/* requests we have no ack for count as failed */
+	for (i = 0; i < b->count && ret < 0; i++)
+		if (!b->reqs[i].acked)
+			rtnl_batch_failed(b, i);
+
+	free(buf);
+	b->len = 0;
+	b->count = 0;
+	b->acks = 0;
+	return ret;
+}
+
+int rtnl_batch_end(struct rtnl_handle *rth)
+{
+	struct rtnl_batch *b = rth->batch;
+	int ret;
+
+	if (!b)
+		return 0;
+
+	ret = rtnl_batch_flush(rth);
+	rth->batch = NULL;
+	if (b->capped) {
+		int zero = 0;
+
+		setsockopt(rth->fd, SOL_NETLINK, NETLINK_CAP_ACK,
+			   &zero, sizeof(zero));
+	}
+	free(b->buf);
+	free(b->reqs);
+	free(b);
+	return ret;
+}
+
+static int rtnl_batch_queue(struct rtnl_handle *rth, struct nlmsghdr *n)
+{
+	struct rtnl_batch *b = rth->batch;
+	size_t len = NLMSG_ALIGN(n->nlmsg_len);
+	size_t ack = RTNL_BATCH_ACK_SIZE + (b->capped ? 0 : len);
+
+	/* what the flush loses is reported through errfn, not to this caller */
+	if (b->count && (b->len + len > RTNL_BATCH_BUFSIZE ||
+			 b->acks + ack > b->ack_space))
+		rtnl_batch_flush(rth);
+
+	if (b->len + len > b->size) {
+		size_t size = MAX(b->len + len, RTNL_BATCH_BUFSIZE);
+		char *nbuf = realloc(b->buf, size);
+
+		if (!nbuf)
+			return -1;
+		b->buf = nbuf;
+		b->size = size;
+	}
+	if (b->count == b->max) {
+		unsigned int max = b->max ? 2 * b->max : 256;
+		struct rtnl_batch_req *reqs;
+
+		reqs = realloc(b->reqs, max * sizeof(*reqs));
+		if (!reqs)
+			return -1;
+		b->reqs = reqs;
+		b->max = max;
+	}
+
+	n->nlmsg_seq = ++rth->seq;
+	n->nlmsg_flags |= NLM_F_ACK;
+	if (!b->count)
+		b->first_seq = n->nlmsg_seq;
+
+	memcpy(b->buf + b->len, n, n->nlmsg_len);
+	memset(b->buf + b->len + n->nlmsg_len, 0, len - n->nlmsg_len);
+	b->len += len;
+	b->acks += ack;
+	b->reqs[b->count++] = (struct rtnl_batch_req){ .tag = b->tag };
+	return 0;
+}
+
 static int __rtnl_talk(struct rtnl_handle *rtnl, struct nlmsghdr *n,
 		       struct nlmsghdr *answer, size_t maxlen,
 		       bool show_rtnl_err, nl_ext_ack_fn_t errfn)
@@ -547,6 +841,12 @@ static int __rtnl_talk(struct rtnl_handle *rtnl, struct nlmsghdr *n,
 	};
 	char   buf[32768] = {};
 
+	if (rtnl->batch) {
+		if (!answer && show_rtnl_err && !errfn)
+			return rtnl_batch_queue(rtnl, n);
+		rtnl_batch_flush(rtnl);
+	}
+
 	n->nlmsg_seq = seq = ++rtnl->seq;
 
 	if (answer == NULL)
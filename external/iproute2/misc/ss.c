@@ -17,6 +17,8 @@
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/uio.h>
+#include <sys/wait.h>
+#include <poll.h>
 #include <netinet/in.h>
 #include <string.h>
 #include <errno.h>
@@ -33,6 +35,7 @@
 #include "ll_map.h"
 #include "libnetlink.h"
 #include "namespace.h"
+#include "json_writer.h"
 #include "SNAPSHOT.h"
 
 #include <linux/tcp.h>
@@ -108,6 +111,9 @@ int addr_width;
 int serv_width;
 char *odd_width_pad = "";
 
+/* set by -J: inet sockets are written as one JSON object per line */
+static json_writer_t *json_wr;
+
 static const char *TCP_PROTO = "tcp";
 static const char *SCTP_PROTO = "sctp";
 static const char *UDP_PROTO = "udp";
@@ -172,6 +178,8 @@ struct filter {
 	int states;
 	int families;
 	struct ssfilter *f;
+	char *bc;		/* f compiled for the kernel, if it can be */
+	int bclen;
 	bool kill;
 };
 
@@ -791,41 +799,41 @@ static const char *proto_name(int protocol)
 	return "???";
 }
 
-static void sock_state_print(struct sockstat *s)
-{
-	const char *sock_name;
-	static const char * const sstate_name[] = {
-		"UNKNOWN",
-		[SS_ESTABLISHED] = "ESTAB",
-		[SS_SYN_SENT] = "SYN-SENT",
-		[SS_SYN_RECV] = "SYN-RECV",
-		[SS_FIN_WAIT1] = "FIN-WAIT-1",
-		[SS_FIN_WAIT2] = "FIN-WAIT-2",
-		[SS_TIME_WAIT] = "TIME-WAIT",
-		[SS_CLOSE] = "UNCONN",
-		[SS_CLOSE_WAIT] = "CLOSE-WAIT",
-		[SS_LAST_ACK] = "LAST-ACK",
-		[SS_LISTEN] =	"LISTEN",
-		[SS_CLOSING] = "CLOSING",
-	};
+static const char * const sstate_name[] = {
+	"UNKNOWN",
+	[SS_ESTABLISHED] = "ESTAB",
+	[SS_SYN_SENT] = "SYN-SENT",
+	[SS_SYN_RECV] = "SYN-RECV",
+	[SS_FIN_WAIT1] = "FIN-WAIT-1",
+	[SS_FIN_WAIT2] = "FIN-WAIT-2",
+	[SS_TIME_WAIT] = "TIME-WAIT",
+	[SS_CLOSE] = "UNCONN",
+	[SS_CLOSE_WAIT] = "CLOSE-WAIT",
+	[SS_LAST_ACK] = "LAST-ACK",
+	[SS_LISTEN] =	"LISTEN",
+	[SS_CLOSING] = "CLOSING",
+};
 
+static const char *sock_netid_name(struct sockstat *s)
+{
 	switch (s->local.family) {
 	case AF_UNIX:
-		sock_name = unix_netid_name(s->type);
-		break;
+		return unix_netid_name(s->type);
 	case AF_INET:
 	case AF_INET6:
-		sock_name = proto_name(s->type);
-		break;
+		return proto_name(s->type);
 	case AF_PACKET:
-		sock_name = s->type == SOCK_RAW ? "p_raw" : "p_dgr";
-		break;
+		return s->type == SOCK_RAW ? "p_raw" : "p_dgr";
 	case AF_NETLINK:
-		sock_name = "nl";
-		break;
+		return "nl";
 	default:
-		sock_name = "unknown";
+		return "unknown";
 	}
+}
+
+static void sock_state_print(struct sockstat *s)
+{
+	const char *sock_name = sock_netid_name(s);
 
 	if (netid_width)
 		printf("%-*s ", netid_width,
@@ -843,6 +851,15 @@ static void sock_state_print(struct sockstat *s)
 
 static void sock_details_print(struct sockstat *s)
 {
+	if (json_wr) {
+		jsonw_uint_field(json_wr, "uid", s->uid);
+		jsonw_uint_field(json_wr, "ino", s->ino);
+		jsonw_lluint_field(json_wr, "sk", s->sk);
+		if (s->mark)
+			jsonw_uint_field(json_wr, "fwmark", s->mark);
+		return;
+	}
+
 	if (s->uid)
 		printf(" uid:%u", s->uid);
 
@@ -1708,6 +1725,14 @@ void *parse_markmask(const char *markmask)
 	return res;
 }
 
+static void proc_ctx_field_print(const char *name, const char *buf)
+{
+	if (json_wr)
+		jsonw_string_field(json_wr, name, buf);
+	else
+		printf(" %s:(%s)", name, buf);
+}
+
 static void proc_ctx_print(struct sockstat *s)
 {
 	char *buf;
@@ -1716,19 +1741,63 @@ static void proc_ctx_print(struct sockstat *s)
 		if (find_entry(s->ino, &buf,
 				(show_proc_ctx & show_sock_ctx) ?
 				PROC_SOCK_CTX : PROC_CTX) > 0) {
-			printf(" users:(%s)", buf);
+			proc_ctx_field_print("users", buf);
 			free(buf);
 		}
 	} else if (show_users) {
 		if (find_entry(s->ino, &buf, USERS) > 0) {
-			printf(" users:(%s)", buf);
+			proc_ctx_field_print("users", buf);
 			free(buf);
 		}
 	}
 }
 
+static void inet_addr_json(const char *name, const inet_prefix *a, int port,
+			   unsigned int ifindex)
+{
+	jsonw_name(json_wr, name);
+	jsonw_start_object(json_wr);
+	jsonw_string_field(json_wr, "addr",
+			   format_host(a->family, a->bytelen, a->data));
+	jsonw_uint_field(json_wr, "port", port);
+	if (ifindex)
+		jsonw_string_field(json_wr, "dev", ll_index_to_name(ifindex));
+	jsonw_end_object(json_wr);
+}
+
+/*
+ * In JSON mode this opens the object of the socket, and the fields the
+ * text output appends to the line go into it until inet_stats_end().
+ */
+static void inet_stats_json(struct sockstat *s)
+{
+	const char *sock_name = sock_netid_name(s);
+
+	jsonw_start_object(json_wr);
+	jsonw_string_field(json_wr, "netid", sock_name);
+	if (is_sctp_assoc(s, sock_name)) {
+		jsonw_string_field(json_wr, "state",
+				   sctp_sstate_name[s->state]);
+		jsonw_bool_field(json_wr, "assoc", true);
+	} else {
+		jsonw_string_field(json_wr, "state", sstate_name[s->state]);
+	}
+	jsonw_uint_field(json_wr, "recv_q", s->rq);
+	jsonw_uint_field(json_wr, "send_q", s->wq);
+
+	inet_addr_json("local", &s->local, s->lport, s->iface);
+	inet_addr_json("peer", &s->remote, s->rport, 0);
+
+	proc_ctx_print(s);
+}
+
 static void inet_stats_print(struct sockstat *s, bool v6only)
 {
+	if (json_wr) {
+		inet_stats_json(s);
+		return;
+	}
+
 	sock_state_print(s);
 
 	inet_addr_print(&s->local, s->lport, s->iface, v6only);
@@ -1737,6 +1806,24 @@ static void inet_stats_print(struct sockstat *s, bool v6only)
 	proc_ctx_print(s);
 }
 
+static void inet_stats_end(void)
+{
+	if (json_wr) {
+		jsonw_end_object(json_wr);
+		jsonw_newline(json_wr);
+	} else {
+		printf("\n");
+	}
+}
+
+static void proc_opt_print(const char *opt)
+{
+	if (json_wr)
+		jsonw_string_field(json_wr, "opt", opt);
+	else
+		printf(" opt:\"%s\"", opt);
+}
+
 static int proc_parse_inet_addr(char *loc, char *rem, int family, struct
 		sockstat * s)
 {
@@ -1848,10 +1935,130 @@ static void sctp_stats_print(struct sctp_info *s)
 		printf(" fraginl:%d", s->sctpi_s_frag_interleave);
 }
 
+static void tcp_stats_json(struct tcpstat *s)
+{
+	jsonw_name(json_wr, "tcp_info");
+	jsonw_start_object(json_wr);
+
+	if (s->has_ts_opt)
+		jsonw_bool_field(json_wr, "ts", true);
+	if (s->has_sack_opt)
+		jsonw_bool_field(json_wr, "sack", true);
+	if (s->has_ecn_opt)
+		jsonw_bool_field(json_wr, "ecn", true);
+	if (s->has_ecnseen_opt)
+		jsonw_bool_field(json_wr, "ecnseen", true);
+	if (s->has_fastopen_opt)
+		jsonw_bool_field(json_wr, "fastopen", true);
+	if (s->cong_alg[0])
+		jsonw_string_field(json_wr, "cong_alg", s->cong_alg);
+	if (s->has_wscale_opt) {
+		jsonw_int_field(json_wr, "snd_wscale", s->snd_wscale);
+		jsonw_int_field(json_wr, "rcv_wscale", s->rcv_wscale);
+	}
+	if (s->rto)
+		jsonw_float_field_fmt(json_wr, "rto", "%g", s->rto);
+	if (s->backoff)
+		jsonw_uint_field(json_wr, "backoff", s->backoff);
+	if (s->rtt) {
+		jsonw_float_field_fmt(json_wr, "rtt", "%g", s->rtt);
+		jsonw_float_field_fmt(json_wr, "rttvar", "%g", s->rttvar);
+	}
+	if (s->ato)
+		jsonw_float_field_fmt(json_wr, "ato", "%g", s->ato);
+	if (s->qack)
+		jsonw_int_field(json_wr, "qack", s->qack);
+	if (s->mss)
+		jsonw_int_field(json_wr, "mss", s->mss);
+	if (s->rcv_mss)
+		jsonw_int_field(json_wr, "rcvmss", s->rcv_mss);
+	if (s->advmss)
+		jsonw_int_field(json_wr, "advmss", s->advmss);
+	if (s->cwnd)
+		jsonw_uint_field(json_wr, "cwnd", s->cwnd);
+	if (s->ssthresh)
+		jsonw_int_field(json_wr, "ssthresh", s->ssthresh);
+
+	if (s->bytes_acked)
+		jsonw_lluint_field(json_wr, "bytes_acked", s->bytes_acked);
+	if (s->bytes_received)
+		jsonw_lluint_field(json_wr, "bytes_received",
+				   s->bytes_received);
+	if (s->segs_out)
+		jsonw_uint_field(json_wr, "segs_out", s->segs_out);
+	if (s->segs_in)
+		jsonw_uint_field(json_wr, "segs_in", s->segs_in);
+	if (s->data_segs_out)
+		jsonw_uint_field(json_wr, "data_segs_out", s->data_segs_out);
+	if (s->data_segs_in)
+		jsonw_uint_field(json_wr, "data_segs_in", s->data_segs_in);
+
+	/* rates in bits per second, times in milliseconds as in tcp_info */
+	if (s->send_bps)
+		jsonw_float_field_fmt(json_wr, "send_bps", "%.0f", s->send_bps);
+	if (s->lastsnd)
+		jsonw_uint_field(json_wr, "lastsnd", s->lastsnd);
+	if (s->lastrcv)
+		jsonw_uint_field(json_wr, "lastrcv", s->lastrcv);
+	if (s->lastack)
+		jsonw_uint_field(json_wr, "lastack", s->lastack);
+	if (s->pacing_rate) {
+		jsonw_float_field_fmt(json_wr, "pacing_rate", "%.0f",
+				      s->pacing_rate);
+		if (s->pacing_rate_max)
+			jsonw_float_field_fmt(json_wr, "pacing_rate_max",
+					      "%.0f", s->pacing_rate_max);
+	}
+	if (s->delivery_rate)
+		jsonw_float_field_fmt(json_wr, "delivery_rate", "%.0f",
+				      s->delivery_rate);
+	if (s->app_limited)
+		jsonw_bool_field(json_wr, "app_limited", true);
+	if (s->busy_time) {
+		jsonw_lluint_field(json_wr, "busy", s->busy_time / 1000);
+		if (s->rwnd_limited)
+			jsonw_lluint_field(json_wr, "rwnd_limited",
+					   s->rwnd_limited / 1000);
+		if (s->sndbuf_limited)
+			jsonw_lluint_field(json_wr, "sndbuf_limited",
+					   s->sndbuf_limited / 1000);
+	}
+
+	if (s->unacked)
+		jsonw_uint_field(json_wr, "unacked", s->unacked);
+	if (s->retrans || s->retrans_total) {
+		jsonw_uint_field(json_wr, "retrans", s->retrans);
+		jsonw_uint_field(json_wr, "retrans_total", s->retrans_total);
+	}
+	if (s->lost)
+		jsonw_uint_field(json_wr, "lost", s->lost);
+	if (s->sacked && s->ss.state != SS_LISTEN)
+		jsonw_uint_field(json_wr, "sacked", s->sacked);
+	if (s->fackets)
+		jsonw_uint_field(json_wr, "fackets", s->fackets);
+	if (s->reordering != 3)
+		jsonw_int_field(json_wr, "reordering", s->reordering);
+	if (s->rcv_rtt)
+		jsonw_float_field_fmt(json_wr, "rcv_rtt", "%g", s->rcv_rtt);
+	if (s->rcv_space)
+		jsonw_int_field(json_wr, "rcv_space", s->rcv_space);
+	if (s->not_sent)
+		jsonw_uint_field(json_wr, "notsent", s->not_sent);
+	if (s->min_rtt)
+		jsonw_float_field_fmt(json_wr, "minrtt", "%g", s->min_rtt);
+
+	jsonw_end_object(json_wr);
+}
+
 static void tcp_stats_print(struct tcpstat *s)
 {
 	char b1[64];
 
+	if (json_wr) {
+		tcp_stats_json(s);
+		return;
+	}
+
 	if (s->has_ts_opt)
 		printf(" ts");
 	if (s->has_sack_opt)
@@ -1988,6 +2195,16 @@ static void tcp_stats_print(struct tcpstat *s)
 		printf(" minrtt:%g", s->min_rtt);
 }
 
+static void timer_json(const char *name, struct tcpstat *s)
+{
+	jsonw_name(json_wr, "timer");
+	jsonw_start_object(json_wr);
+	jsonw_string_field(json_wr, "name", name);
+	jsonw_uint_field(json_wr, "expires_ms", s->timeout);
+	jsonw_uint_field(json_wr, "retrans", s->retrans);
+	jsonw_end_object(json_wr);
+}
+
 static void tcp_timer_print(struct tcpstat *s)
 {
 	static const char * const tmr_name[] = {
@@ -1999,7 +2216,9 @@ static void tcp_timer_print(struct tcpstat *s)
 		"unknown"
 	};
 
-	if (s->timer) {
+	if (s->timer && json_wr) {
+		timer_json(s->timer > 4 ? tmr_name[5] : tmr_name[s->timer], s);
+	} else if (s->timer) {
 		if (s->timer > 4)
 			s->timer = 5;
 		printf(" timer:(%s,%s,%d)",
@@ -2011,7 +2230,9 @@ static void tcp_timer_print(struct tcpstat *s)
 
 static void sctp_timer_print(struct tcpstat *s)
 {
-	if (s->timer)
+	if (s->timer && json_wr)
+		timer_json("T3_RTX", s);
+	else if (s->timer)
 		printf(" timer:(T3_RTX,%s,%d)",
 		       print_ms_timer(s->timeout), s->retrans);
 }
@@ -2072,13 +2293,13 @@ static int tcp_show_line(char *line, const struct filter *f, int family)
 	if (show_details) {
 		sock_details_print(&s.ss);
 		if (opt[0])
-			printf(" opt:\"%s\"", opt);
+			proc_opt_print(opt);
 	}
 
 	if (show_tcpinfo)
 		tcp_stats_print(&s);
 
-	printf("\n");
+	inet_stats_end();
 	return 0;
 }
 
@@ -2109,10 +2330,56 @@ outerr:
 	return ferror(fp) ? -1 : 0;
 }
 
+static void skmeminfo_json(struct rtattr *tb[], int attrtype)
+{
+	const __u32 *skmeminfo;
+
+	if (!tb[attrtype]) {
+		if (attrtype == INET_DIAG_SKMEMINFO && tb[INET_DIAG_MEMINFO]) {
+			const struct inet_diag_meminfo *minfo =
+				RTA_DATA(tb[INET_DIAG_MEMINFO]);
+
+			jsonw_name(json_wr, "mem");
+			jsonw_start_object(json_wr);
+			jsonw_uint_field(json_wr, "r", minfo->idiag_rmem);
+			jsonw_uint_field(json_wr, "w", minfo->idiag_wmem);
+			jsonw_uint_field(json_wr, "f", minfo->idiag_fmem);
+			jsonw_uint_field(json_wr, "t", minfo->idiag_tmem);
+			jsonw_end_object(json_wr);
+		}
+		return;
+	}
+
+	skmeminfo = RTA_DATA(tb[attrtype]);
+
+	/* same keys as the skmem:() text */
+	jsonw_name(json_wr, "skmem");
+	jsonw_start_object(json_wr);
+	jsonw_uint_field(json_wr, "r", skmeminfo[SK_MEMINFO_RMEM_ALLOC]);
+	jsonw_uint_field(json_wr, "rb", skmeminfo[SK_MEMINFO_RCVBUF]);
+	jsonw_uint_field(json_wr, "t", skmeminfo[SK_MEMINFO_WMEM_ALLOC]);
+	jsonw_uint_field(json_wr, "tb", skmeminfo[SK_MEMINFO_SNDBUF]);
+	jsonw_uint_field(json_wr, "f", skmeminfo[SK_MEMINFO_FWD_ALLOC]);
+	jsonw_uint_field(json_wr, "w", skmeminfo[SK_MEMINFO_WMEM_QUEUED]);
+	jsonw_uint_field(json_wr, "o", skmeminfo[SK_MEMINFO_OPTMEM]);
+	if (RTA_PAYLOAD(tb[attrtype]) >=
+		(SK_MEMINFO_BACKLOG + 1) * sizeof(__u32))
+		jsonw_uint_field(json_wr, "bl", skmeminfo[SK_MEMINFO_BACKLOG]);
+	if (RTA_PAYLOAD(tb[attrtype]) >=
+		(SK_MEMINFO_DROPS + 1) * sizeof(__u32))
+		jsonw_uint_field(json_wr, "d", skmeminfo[SK_MEMINFO_DROPS]);
+	jsonw_end_object(json_wr);
+}
+
 static void print_skmeminfo(struct rtattr *tb[], int attrtype)
 {
 	const __u32 *skmeminfo;
 
+	if (json_wr) {
+		skmeminfo_json(tb, attrtype);
+		return;
+	}
+
 	if (!tb[attrtype]) {
 		if (attrtype == INET_DIAG_SKMEMINFO) {
 			if (!tb[INET_DIAG_MEMINFO])
@@ -2299,7 +2566,8 @@ static void tcp_show_info(const struct nlmsghdr *nlh, struct inet_diag_msg *r,
 		free(s.dctcp);
 		free(s.bbr_info);
 	}
-	if (tb[INET_DIAG_MD5SIG]) {
+	/* keys are left out of the JSON output */
+	if (tb[INET_DIAG_MD5SIG] && !json_wr) {
 		struct tcp_diag_md5sig *sig = RTA_DATA(tb[INET_DIAG_MD5SIG]);
 		int len = RTA_PAYLOAD(tb[INET_DIAG_MD5SIG]);
 
@@ -2370,9 +2638,9 @@ static void sctp_show_info(const struct nlmsghdr *nlh, struct inet_diag_msg *r,
 	}
 }
 
-static void parse_diag_msg(struct nlmsghdr *nlh, struct sockstat *s)
+static void parse_diag_msg(struct nlmsghdr *nlh, struct sockstat *s,
+			   struct rtattr *tb[])
 {
-	struct rtattr *tb[INET_DIAG_MAX+1];
 	struct inet_diag_msg *r = NLMSG_DATA(nlh);
 
 	parse_rtattr(tb, INET_DIAG_MAX, (struct rtattr *)(r+1),
@@ -2407,15 +2675,11 @@ static void parse_diag_msg(struct nlmsghdr *nlh, struct sockstat *s)
 }
 
 static int inet_show_sock(struct nlmsghdr *nlh,
-			  struct sockstat *s)
+			  struct sockstat *s, struct rtattr *tb[])
 {
-	struct rtattr *tb[INET_DIAG_MAX+1];
 	struct inet_diag_msg *r = NLMSG_DATA(nlh);
 	unsigned char v6only = 0;
 
-	parse_rtattr(tb, INET_DIAG_MAX, (struct rtattr *)(r+1),
-		     nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*r)));
-
 	if (tb[INET_DIAG_PROTOCOL])
 		s->type = rta_getattr_u8(tb[INET_DIAG_PROTOCOL]);
 
@@ -2436,7 +2700,14 @@ static int inet_show_sock(struct nlmsghdr *nlh,
 			tcp_timer_print(&t);
 	}
 
-	if (show_details) {
+	if (show_details && json_wr) {
+		sock_details_print(s);
+		if (s->local.family == AF_INET6 && tb[INET_DIAG_SKV6ONLY])
+			jsonw_bool_field(json_wr, "v6only", v6only);
+		if (tb[INET_DIAG_SHUTDOWN])
+			jsonw_uint_field(json_wr, "shutdown",
+					 rta_getattr_u8(tb[INET_DIAG_SHUTDOWN]));
+	} else if (show_details) {
 		sock_details_print(s);
 		if (s->local.family == AF_INET6 && tb[INET_DIAG_SKV6ONLY])
 			printf(" v6only:%u", v6only);
@@ -2450,15 +2721,17 @@ static int inet_show_sock(struct nlmsghdr *nlh,
 	}
 
 	if (show_mem || (show_tcpinfo && s->type != IPPROTO_UDP)) {
-		printf("\n\t");
-		if (s->type == IPPROTO_SCTP)
+		if (!json_wr)
+			printf("\n\t");
+		/* SCTP association details are text only */
+		if (s->type == IPPROTO_SCTP && !json_wr)
 			sctp_show_info(nlh, r, tb);
-		else
+		else if (s->type != IPPROTO_SCTP)
 			tcp_show_info(nlh, r, tb);
 	}
 	sctp_ino = s->ino;
 
-	printf("\n");
+	inet_stats_end();
 	return 0;
 }
 
@@ -2475,8 +2748,6 @@ static int tcpdiag_send(int fd, int protocol, struct filter *f)
 		.r.idiag_family = AF_INET,
 		.r.idiag_states = f->states,
 	};
-	char    *bc = NULL;
-	int	bclen;
 	struct msghdr msg;
 	struct rtattr rta;
 	struct iovec iov[3];
@@ -2504,16 +2775,13 @@ static int tcpdiag_send(int fd, int protocol, struct filter *f)
 		.iov_base = &req,
 		.iov_len = sizeof(req)
 	};
-	if (f->f) {
-		bclen = ssfilter_bytecompile(f->f, &bc);
-		if (bclen) {
-			rta.rta_type = INET_DIAG_REQ_BYTECODE;
-			rta.rta_len = RTA_LENGTH(bclen);
-			iov[1] = (struct iovec){ &rta, sizeof(rta) };
-			iov[2] = (struct iovec){ bc, bclen };
-			req.nlh.nlmsg_len += RTA_LENGTH(bclen);
-			iovlen = 3;
-		}
+	if (f->bclen) {
+		rta.rta_type = INET_DIAG_REQ_BYTECODE;
+		rta.rta_len = RTA_LENGTH(f->bclen);
+		iov[1] = (struct iovec){ &rta, sizeof(rta) };
+		iov[2] = (struct iovec){ f->bc, f->bclen };
+		req.nlh.nlmsg_len += RTA_LENGTH(f->bclen);
+		iovlen = 3;
 	}
 
 	msg = (struct msghdr) {
@@ -2535,8 +2803,6 @@ static int sockdiag_send(int family, int fd, int protocol, struct filter *f)
 {
 	struct sockaddr_nl nladdr = { .nl_family = AF_NETLINK };
 	DIAG_REQUEST(req, struct inet_diag_req_v2 r);
-	char    *bc = NULL;
-	int	bclen;
 	struct msghdr msg;
 	struct rtattr rta;
 	struct iovec iov[3];
@@ -2564,16 +2830,13 @@ static int sockdiag_send(int family, int fd, int protocol, struct filter *f)
 		.iov_base = &req,
 		.iov_len = sizeof(req)
 	};
-	if (f->f) {
-		bclen = ssfilter_bytecompile(f->f, &bc);
-		if (bclen) {
-			rta.rta_type = INET_DIAG_REQ_BYTECODE;
-			rta.rta_len = RTA_LENGTH(bclen);
-			iov[1] = (struct iovec){ &rta, sizeof(rta) };
-			iov[2] = (struct iovec){ bc, bclen };
-			req.nlh.nlmsg_len += RTA_LENGTH(bclen);
-			iovlen = 3;
-		}
+	if (f->bclen) {
+		rta.rta_type = INET_DIAG_REQ_BYTECODE;
+		rta.rta_len = RTA_LENGTH(f->bclen);
+		iov[1] = (struct iovec){ &rta, sizeof(rta) };
+		iov[2] = (struct iovec){ f->bc, f->bclen };
+		req.nlh.nlmsg_len += RTA_LENGTH(f->bclen);
+		iovlen = 3;
 	}
 
 	msg = (struct msghdr) {
@@ -2628,12 +2891,13 @@ static int show_one_inet_sock(const struct sockaddr_nl *addr,
 	int err;
 	struct inet_diag_arg *diag_arg = arg;
 	struct inet_diag_msg *r = NLMSG_DATA(h);
+	struct rtattr *tb[INET_DIAG_MAX+1];
 	struct sockstat s = {};
 
 	if (!(diag_arg->f->families & (1 << r->idiag_family)))
 		return 0;
 
-	parse_diag_msg(h, &s);
+	parse_diag_msg(h, &s, tb);
 	s.type = diag_arg->protocol;
 
 	if (diag_arg->f->f && run_ssfilter(diag_arg->f->f, &s) == 0)
@@ -2649,7 +2913,7 @@ static int show_one_inet_sock(const struct sockaddr_nl *addr,
 		}
 	}
 
-	err = inet_show_sock(h, &s);
+	err = inet_show_sock(h, &s, tb);
 	if (err < 0)
 		return err;
 
@@ -2716,9 +2980,13 @@ static int tcp_show_netlink_file(struct filter *f)
 	while (1) {
 		int status, err2;
 		struct nlmsghdr *h = (struct nlmsghdr *)buf;
+		struct rtattr *tb[INET_DIAG_MAX+1];
 		struct sockstat s = {};
 
 		status = fread(buf, 1, sizeof(*h), fp);
+		/* -D writes one dump per family, each ended by NLMSG_DONE */
+		if (status == 0 && feof(fp) && err == 0)
+			break;
 		if (status < 0) {
 			perror("Reading header from $TCPDIAG_FILE");
 			break;
@@ -2739,31 +3007,31 @@ static int tcp_show_netlink_file(struct filter *f)
 			break;
 		}
 
-		/* The only legal exit point */
 		if (h->nlmsg_type == NLMSG_DONE) {
 			err = 0;
-			break;
+			continue;
 		}
 
 		if (h->nlmsg_type == NLMSG_ERROR) {
-			struct nlmsgerr *err = (struct nlmsgerr *)NLMSG_DATA(h);
+			struct nlmsgerr *nlerr = (struct nlmsgerr *)NLMSG_DATA(h);
 
 			if (h->nlmsg_len < NLMSG_LENGTH(sizeof(struct nlmsgerr))) {
 				fprintf(stderr, "ERROR truncated\n");
 			} else {
-				errno = -err->error;
+				errno = -nlerr->error;
 				perror("TCPDIAG answered");
 			}
+			err = -1;
 			break;
 		}
 
-		parse_diag_msg(h, &s);
+		parse_diag_msg(h, &s, tb);
 		s.type = IPPROTO_TCP;
 
 		if (f && f->f && run_ssfilter(f->f, &s) == 0)
 			continue;
 
-		err2 = inet_show_sock(h, &s);
+		err2 = inet_show_sock(h, &s, tb);
 		if (err2 < 0) {
 			err = err2;
 			break;
@@ -2914,9 +3182,9 @@ static int dgram_show_line(char *line, const struct filter *f, int family)
 	inet_stats_print(&s, false);
 
 	if (show_details && opt[0])
-		printf(" opt:\"%s\"", opt);
+		proc_opt_print(opt);
 
-	printf("\n");
+	inet_stats_end();
 	return 0;
 }
 
@@ -3905,6 +4173,172 @@ static int print_summary(void)
 	return 0;
 }
 
+/*
+ * With -P every socket table, and every address family of the inet
+ * ones, is dumped by a child process of its own, so the kernel walks
+ * the tables on as many CPUs as there are jobs.  The parent copies the
+ * output of the job whose turn it is straight to stdout and keeps what
+ * the others produce meanwhile, so the result reads exactly as without
+ * -P.
+ */
+struct show_job {
+	int		(*show)(struct filter *f);
+	int		family;
+	pid_t		pid;
+	int		fd;
+	char		*buf;
+	size_t		len;
+	size_t		size;
+};
+
+#define MAX_SHOW_JOBS	(2 * MAX_DB)
+
+static int show_job_add(struct show_job *jobs, int n,
+			int (*show)(struct filter *f), int family)
+{
+	if (family && !filter_af_get(&current_filter, family))
+		return n;
+
+	jobs[n] = (struct show_job){ .show = show, .family = family, .fd = -1 };
+	return n + 1;
+}
+
+static void show_job_start(struct show_job *job)
+{
+	int p[2];
+
+	if (pipe(p) < 0) {
+		perror("pipe");
+		exit(1);
+	}
+
+	job->pid = fork();
+	if (job->pid < 0) {
+		perror("fork");
+		exit(1);
+	}
+
+	if (job->pid == 0) {
+		struct filter f = current_filter;
+
+		close(p[0]);
+		if (dup2(p[1], STDOUT_FILENO) < 0)
+			_exit(1);
+		close(p[1]);
+
+		if (job->family) {
+			f.families = 1 << job->family;
+			preferred_family = job->family;
+		}
+		job->show(&f);
+		fflush(stdout);
+		_exit(0);
+	}
+
+	close(p[1]);
+	job->fd = p[0];
+}
+
+/* Read what is there; returns 0 once the job has closed its end. */
+static int show_job_read(struct show_job *job, bool direct)
+{
+	char chunk[65536];
+	ssize_t n;
+
+	n = read(job->fd, chunk, sizeof(chunk));
+	if (n < 0)
+		return errno == EINTR ? 1 : 0;
+	if (n == 0)
+		return 0;
+
+	if (direct) {
+		fwrite(chunk, 1, n, stdout);
+		return 1;
+	}
+
+	if (job->len + n > job->size) {
+		job->size = (job->len + n) * 2;
+		job->buf = realloc(job->buf, job->size);
+		if (!job->buf) {
+			fprintf(stderr, "ss: out of memory\n");
+			exit(1);
+		}
+	}
+	memcpy(job->buf + job->len, chunk, n);
+	job->len += n;
+	return 1;
+}
+
+static void show_parallel(void)
+{
+	static const struct {
+		int	db;
+		int	(*show)(struct filter *f);
+	} inet_tables[] = {
+		{ RAW_DB,	raw_show },
+		{ UDP_DB,	udp_show },
+		{ TCP_DB,	tcp_show },
+		{ DCCP_DB,	dccp_show },
+		{ SCTP_DB,	sctp_show },
+	};
+	struct show_job jobs[MAX_SHOW_JOBS];
+	struct pollfd pfd[MAX_SHOW_JOBS];
+	int dbs = current_filter.dbs;
+	int i, n = 0, cur = 0;
+
+	if (dbs & (1<<NETLINK_DB))
+		n = show_job_add(jobs, n, netlink_show, 0);
+	if (dbs & PACKET_DBM)
+		n = show_job_add(jobs, n, packet_show, 0);
+	if (dbs & UNIX_DBM)
+		n = show_job_add(jobs, n, unix_show, 0);
+	for (i = 0; i < ARRAY_SIZE(inet_tables); i++) {
+		if (!(dbs & (1 << inet_tables[i].db)))
+			continue;
+		n = show_job_add(jobs, n, inet_tables[i].show, AF_INET);
+		n = show_job_add(jobs, n, inet_tables[i].show, AF_INET6);
+	}
+
+	for (i = 0; i < n; i++)
+		show_job_start(&jobs[i]);
+
+	while (cur < n) {
+		for (i = cur; i < n; i++) {
+			pfd[i].fd = jobs[i].fd;
+			pfd[i].events = POLLIN;
+			pfd[i].revents = 0;
+		}
+		if (poll(pfd + cur, n - cur, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			exit(1);
+		}
+
+		for (i = cur; i < n; i++) {
+			if (jobs[i].fd < 0 || !pfd[i].revents)
+				continue;
+			if (!show_job_read(&jobs[i], i == cur)) {
+				close(jobs[i].fd);
+				jobs[i].fd = -1;
+			}
+		}
+
+		/* hand over to the next job in order */
+		while (cur < n && jobs[cur].fd < 0) {
+			waitpid(jobs[cur].pid, NULL, 0);
+			if (++cur == n)
+				break;
+			if (jobs[cur].len)
+				fwrite(jobs[cur].buf, 1, jobs[cur].len, stdout);
+			free(jobs[cur].buf);
+			jobs[cur].buf = NULL;
+			jobs[cur].len = jobs[cur].size = 0;
+		}
+	}
+	fflush(stdout);
+}
+
 static void _usage(FILE *dest)
 {
 	fprintf(dest,
@@ -3927,6 +4361,9 @@ static void _usage(FILE *dest)
 "   -Z, --context       display process SELinux security contexts\n"
 "   -z, --contexts      display process and socket SELinux security contexts\n"
 "   -N, --net           switch to the specified network namespace name\n"
+"   -P, --parallel      dump socket tables and families in parallel\n"
+"   -J, --json          write each TCP, UDP, RAW, DCCP or SCTP socket as a\n"
+"                       JSON object on a line of its own\n"
 "\n"
 "   -4, --ipv4          display only IP version 4 sockets\n"
 "   -6, --ipv6          display only IP version 6 sockets\n"
@@ -3947,6 +4384,7 @@ static void _usage(FILE *dest)
 "       QUERY := {all|inet|tcp|udp|raw|unix|unix_dgram|unix_stream|unix_seqpacket|packet|netlink}[,QUERY]\n"
 "\n"
 "   -D, --diag=FILE     Dump raw information about TCP sockets to FILE\n"
+"                       (read it back with TCPDIAG_FILE=FILE ss)\n"
 "   -F, --filter=FILE   read filter information from FILE\n"
 "       FILTER := [ state STATE-FILTER ] [ EXPRESSION ]\n"
 "       STATE-FILTER := {all|connected|synchronized|bucket|big|TCP-STATES}\n"
@@ -4051,6 +4489,8 @@ static const struct option long_opts[] = {
 	{ "net", 1, 0, 'N' },
 	{ "kill", 0, 0, 'K' },
 	{ "no-header", 0, 0, 'H' },
+	{ "parallel", 0, 0, 'P' },
+	{ "json", 0, 0, 'J' },
 	{ 0 }
 
 };
@@ -4065,9 +4505,11 @@ int main(int argc, char *argv[])
 	int ch;
 	int state_filter = 0;
 	int addrp_width, screen_width = 80;
+	int parallel = 0;
+	int json = 0;
 
 	while ((ch = getopt_long(argc, argv,
-				 "dhaletuwxnro460spbEf:miA:D:F:vVzZN:KHS",
+				 "dhaletuwxnro460spbEf:miA:D:F:vVzZN:KHSPJ",
 				 long_opts, NULL)) != EOF) {
 		switch (ch) {
 		case 'n':
@@ -4262,6 +4704,12 @@ int main(int argc, char *argv[])
 		case 'H':
 			show_header = 0;
 			break;
+		case 'P':
+			parallel = 1;
+			break;
+		case 'J':
+			json = 1;
+			break;
 		case 'h':
 			help();
 		case '?':
@@ -4307,6 +4755,10 @@ int main(int argc, char *argv[])
 	filter_states_set(&current_filter, state_filter);
 	filter_merge_defaults(&current_filter);
 
+	/* Only the inet tables have a JSON printer. */
+	if (json)
+		current_filter.dbs &= INET_DBM;
+
 	if (resolve_services && resolve_hosts &&
 	    (current_filter.dbs & (UNIX_DBM|INET_L4_DBM)))
 		init_service_resolver();
@@ -4324,6 +4776,14 @@ int main(int argc, char *argv[])
 		exit(0);
 	}
 
+	if (ssfilter_parse(&current_filter.f, argc, argv, filter_fp))
+		usage();
+
+	/* Compile once here rather than for every dump request. */
+	if (current_filter.f)
+		current_filter.bclen = ssfilter_bytecompile(current_filter.f,
+							    &current_filter.bc);
+
 	if (dump_tcpdiag) {
 		FILE *dump_fp = stdout;
 
@@ -4333,7 +4793,7 @@ int main(int argc, char *argv[])
 		}
 		if (dump_tcpdiag[0] != '-') {
 			dump_fp = fopen(dump_tcpdiag, "w");
-			if (!dump_tcpdiag) {
+			if (!dump_fp) {
 				perror("fopen dump file");
 				exit(-1);
 			}
@@ -4343,8 +4803,8 @@ int main(int argc, char *argv[])
 		exit(0);
 	}
 
-	if (ssfilter_parse(&current_filter.f, argc, argv, filter_fp))
-		usage();
+	if (json)
+		show_header = 0;
 
 	netid_width = 0;
 	if (current_filter.dbs&(current_filter.dbs-1))
@@ -4409,9 +4869,17 @@ int main(int argc, char *argv[])
 
 	fflush(stdout);
 
+	if (json)
+		json_wr = jsonw_new(stdout);
+
 	if (follow_events)
 		exit(handle_follow_request(&current_filter));
 
+	if (parallel) {
+		show_parallel();
+		goto out;
+	}
+
 	if (current_filter.dbs & (1<<NETLINK_DB))
 		netlink_show(&current_filter);
 	if (current_filter.dbs & PACKET_DBM)
@@ -4429,6 +4897,7 @@ int main(int argc, char *argv[])
 	if (current_filter.dbs & (1<<SCTP_DB))
 		sctp_show(&current_filter);
 
+out:
 	if (show_users || show_proc_ctx || show_sock_ctx)
 		user_ent_destroy();
 
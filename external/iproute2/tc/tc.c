@@ -249,11 +249,36 @@ static int do_cmd(int argc, char **argv)
 }
 
 #ifndef ANDROID
+/*
+ * With -force qdisc, class and filter requests are queued and sent to
+ * the kernel many at a time; errors are reported as the acks come back.
+ */
+static bool cmd_pipelined(const char *argv0)
+{
+	return matches(argv0, "qdisc") == 0 ||
+	       matches(argv0, "class") == 0 ||
+	       matches(argv0, "filter") == 0;
+}
+
+struct batch_ctx {
+	const char	*name;
+	int		failed;
+};
+
+static void batch_line_failed(unsigned int lineno, void *arg)
+{
+	struct batch_ctx *ctx = arg;
+
+	fprintf(stderr, "Command failed %s:%u\n", ctx->name, lineno);
+	ctx->failed = 1;
+}
+
 static int batch(const char *name)
 {
 	char *line = NULL;
 	size_t len = 0;
 	int ret = 0;
+	struct batch_ctx ctx = { .name = name };
 
 	batch_mode = 1;
 	if (name && strcmp(name, "-") != 0) {
@@ -280,6 +305,12 @@ static int batch(const char *name)
 		if (largc == 0)
 			continue;	/* blank line */
 
+		if (force && cmd_pipelined(largv[0]))
+			rtnl_batch_start(&rth, batch_line_failed, &ctx);
+		else if (rtnl_batch_end(&rth) < 0)
+			ret = 1;
+		rtnl_batch_tag(&rth, cmdlineno);
+
 		if (do_cmd(largc, largv)) {
 			fprintf(stderr, "Command failed %s:%d\n", name, cmdlineno);
 			ret = 1;
@@ -290,6 +321,9 @@ static int batch(const char *name)
 	if (line)
 		free(line);
 
+	if (rtnl_batch_end(&rth) < 0 || ctx.failed)
+		ret = 1;
+
 	rtnl_close(&rth);
 	return ret;
 }
@@ -27,6 +27,7 @@
 #endif
 
 static int counters = 0, verbose = 0, noflush = 0, wait = 0;
+static int daemon_mode = 0;
 
 static struct timeval wait_interval = {
 	.tv_sec	= 1,
@@ -41,6 +42,7 @@ static const struct option options[] = {
 	{.name = "noflush",       .has_arg = 0, .val = 'n'},
 	{.name = "modprobe",      .has_arg = 1, .val = 'M'},
 	{.name = "table",         .has_arg = 1, .val = 'T'},
+	{.name = "daemon",        .has_arg = 0, .val = 'd'},
 	{.name = "wait",          .has_arg = 2, .val = 'w'},
 	{.name = "wait-interval", .has_arg = 2, .val = 'W'},
 	{NULL},
@@ -50,7 +52,7 @@ static void print_usage(const char *name, const char *version) __attribute__((no
 
 static void print_usage(const char *name, const char *version)
 {
-	fprintf(stderr, "Usage: %s [-c] [-v] [-t] [-h] [-n] [-w secs] [-W usecs] [-T table] [-M command]\n"
+	fprintf(stderr, "Usage: %s [-c] [-v] [-t] [-h] [-n] [-w secs] [-W usecs] [-T table] [-M command] [-d]\n"
 			"	   [ --counters ]\n"
 			"	   [ --verbose ]\n"
 			"	   [ --test ]\n"
@@ -59,6 +61,7 @@ static void print_usage(const char *name, const char *version)
 			"	   [ --wait=<seconds>\n"
 			"	   [ --wait-interval=<usecs>\n"
 			"	   [ --table=<TABLE> ]\n"
+			"	   [ --daemon ]\n"
 			"	   [ --modprobe=<command> ]\n", name);
 
 	exit(1);
@@ -85,6 +88,44 @@ static struct xtc_handle *create_handle(const char *tablename)
 	return handle;
 }
 
+/* With --daemon, the handle of each table is kept after its COMMIT and
+ * reused by the next one, instead of parsing the table again. */
+static struct {
+	char name[XT_TABLE_MAXNAMELEN + 1];
+	struct xtc_handle *handle;
+} kept_handles[8];
+
+static struct xtc_handle *take_handle(const char *tablename)
+{
+	struct xtc_handle *handle;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(kept_handles); i++) {
+		if (kept_handles[i].handle &&
+		    strcmp(kept_handles[i].name, tablename) == 0) {
+			handle = kept_handles[i].handle;
+			kept_handles[i].handle = NULL;
+			return handle;
+		}
+	}
+	return create_handle(tablename);
+}
+
+static void keep_handle(const char *tablename, struct xtc_handle *handle,
+			const struct xtc_ops *ops)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(kept_handles); i++) {
+		if (!kept_handles[i].handle) {
+			strcpy(kept_handles[i].name, tablename);
+			kept_handles[i].handle = handle;
+			return;
+		}
+	}
+	ops->free(handle);
+}
+
 static int parse_counters(char *string, struct xt_counters *ctr)
 {
 	unsigned long long pcnt, bcnt;
@@ -213,7 +254,7 @@ int ip6tables_restore_main(int argc, char *argv[])
 	init_extensions6();
 #endif
 
-	while ((c = getopt_long(argc, argv, "bcvthnwWM:T:", options, NULL)) != -1) {
+	while ((c = getopt_long(argc, argv, "bcvthnwWM:T:d", options, NULL)) != -1) {
 		switch (c) {
 			case 'b':
 				fprintf(stderr, "-b/--binary option is not implemented\n");
@@ -246,6 +287,9 @@ int ip6tables_restore_main(int argc, char *argv[])
 			case 'T':
 				tablename = optarg;
 				break;
+			case 'd':
+				daemon_mode = 1;
+				break;
 		}
 	}
 
@@ -280,7 +324,10 @@ int ip6tables_restore_main(int argc, char *argv[])
 			if (!testing) {
 				DEBUGP("Calling commit\n");
 				ret = ops->commit(handle);
-				ops->free(handle);
+				if (ret && daemon_mode)
+					keep_handle(curtable, handle, ops);
+				else
+					ops->free(handle);
 				handle = NULL;
 			} else {
 				DEBUGP("Not calling commit, testing\n");
@@ -317,7 +364,10 @@ int ip6tables_restore_main(int argc, char *argv[])
 			if (handle)
 				ops->free(handle);
 
-			handle = create_handle(table);
+			if (daemon_mode)
+				handle = take_handle(table);
+			else
+				handle = create_handle(table);
 			if (noflush == 0) {
 				DEBUGP("Cleaning all chains of table '%s'\n",
 					table);
@@ -209,6 +209,24 @@ is_same(const STRUCT_ENTRY *a, const STRUCT_ENTRY *b, unsigned char *matchmask)
 	return mptr;
 }
 
+/* Hash what is_same() compares regardless of the mask */
+static unsigned int
+hash_entry_head(const STRUCT_ENTRY *e)
+{
+	unsigned int hash = 0x811c9dc5;
+
+	hash = iptcc_hash_mix(hash, e->ip.src.s_addr);
+	hash = iptcc_hash_mix(hash, e->ip.dst.s_addr);
+	hash = iptcc_hash_mix(hash, e->ip.smsk.s_addr);
+	hash = iptcc_hash_mix(hash, e->ip.dmsk.s_addr);
+	hash = iptcc_hash_mix(hash, e->ip.proto);
+	hash = iptcc_hash_mix(hash, e->ip.flags << 8 | e->ip.invflags);
+	hash = iptcc_hash_mix(hash, e->target_offset);
+	hash = iptcc_hash_mix(hash, e->next_offset);
+
+	return hash;
+}
+
 #if 0
 /***************************** DEBUGGING ********************************/
 static inline int
@@ -244,6 +244,26 @@ is_same(const STRUCT_ENTRY *a, const STRUCT_ENTRY *b,
 	return mptr;
 }
 
+/* Hash what is_same() compares regardless of the mask */
+static unsigned int
+hash_entry_head(const STRUCT_ENTRY *e)
+{
+	unsigned int hash = 0x811c9dc5;
+	unsigned int i;
+
+	for (i = 0; i < sizeof(struct in6_addr); i++) {
+		hash = iptcc_hash_mix(hash, e->ipv6.src.s6_addr[i]);
+		hash = iptcc_hash_mix(hash, e->ipv6.dst.s6_addr[i]);
+	}
+	hash = iptcc_hash_mix(hash, e->ipv6.proto);
+	hash = iptcc_hash_mix(hash, e->ipv6.tos);
+	hash = iptcc_hash_mix(hash, e->ipv6.flags << 8 | e->ipv6.invflags);
+	hash = iptcc_hash_mix(hash, e->target_offset);
+	hash = iptcc_hash_mix(hash, e->next_offset);
+
+	return hash;
+}
+
 /* All zeroes == unconditional rule. */
 static inline int
 unconditional(const struct ip6t_ip6 *ipv6)
@@ -107,6 +107,10 @@ struct rule_head
 	enum iptcc_rule_type type;
 	struct chain_head *jump;	/* jump target, if IPTCC_R_JUMP */
 
+	struct rule_head *hash_next;	/* next rule in rule hash bucket */
+	unsigned int hash;		/* hash of chain and rule content */
+	int hashed;			/* is in the rule hash */
+
 	unsigned int size;		/* size of entry data */
 	STRUCT_ENTRY entry[0];
 };
@@ -114,6 +118,7 @@ struct rule_head
 struct chain_head
 {
 	struct list_head list;
+	struct chain_head *hash_next;	/* next chain in name hash bucket */
 	char name[TABLE_MAXNAMELEN];
 	unsigned int hooknum;		/* hook number+1 if builtin */
 	unsigned int references;	/* how many jumps reference us */
@@ -129,11 +134,15 @@ struct chain_head
 	unsigned int head_offset;	/* offset in rule blob */
 	unsigned int foot_index;	/* index (needed for counter_map) */
 	unsigned int foot_offset;	/* offset in rule blob */
+
+	int dirty;			/* changed since blob was read/committed */
+	unsigned int blob_offset;	/* offset in handle->entries if clean */
 };
 
 struct xtc_handle {
 	int sockfd;
 	int changed;			 /* Have changes been made? */
+	int committed;			 /* Has this handle been committed? */
 
 	struct list_head chains;
 
@@ -145,6 +154,14 @@ struct xtc_handle {
 	struct chain_head **chain_index;   /* array for fast chain list access*/
 	unsigned int        chain_index_sz;/* size of chain index array */
 
+	struct chain_head **chain_hash;	   /* chains by name */
+	unsigned int        chain_hash_sz; /* buckets, a power of two */
+	unsigned int        chain_hash_cnt;/* chains in the hash */
+
+	struct rule_head  **rule_hash;	   /* rules by chain and content */
+	unsigned int        rule_hash_sz;  /* buckets, a power of two */
+	unsigned int        rule_hash_cnt; /* rules in the hash */
+
 	int sorted_offsets; /* if chains are received sorted from kernel,
 			     * then the offsets are also sorted. Says if its
 			     * possible to bsearch offsets using chain_index.
@@ -169,6 +186,7 @@ static struct chain_head *iptcc_alloc_chain_head(const char *name, int hooknum)
 
 	strncpy(c->name, name, TABLE_MAXNAMELEN);
 	c->hooknum = hooknum;
+	c->dirty = 1;
 	INIT_LIST_HEAD(&c->rules);
 
 	return c;
@@ -195,6 +213,14 @@ set_changed(struct xtc_handle *h)
 	h->changed = 1;
 }
 
+/* notify us that the blob of chain `c' has to be compiled again */
+static inline void
+set_chain_changed(struct xtc_handle *h, struct chain_head *c)
+{
+	c->dirty = 1;
+	set_changed(h);
+}
+
 #ifdef IPTC_DEBUG
 static void do_check(struct xtc_handle *h, unsigned int line);
 #define CHECK(h) do { if (!getenv("IPTC_NO_CHECK")) do_check((h), __LINE__); } while(0)
@@ -460,38 +486,6 @@ iptcc_bsearch_chain_offset(unsigned int offset, unsigned int *idx,
 }
 
 
-#ifdef DEBUG
-/* Trivial linear search of chain index. Function used for verifying
-   the output of bsearch function */
-static struct list_head *
-iptcc_linearly_search_chain_index(const char *name, struct xtc_handle *handle)
-{
-	unsigned int i=0;
-	int res=0;
-
-	struct list_head *list_pos;
-	list_pos = &handle->chains;
-
-	if (handle->chain_index_sz)
-		list_pos = &handle->chain_index[0]->list;
-
-	/* Linearly walk of chain index array */
-
-	for (i=0; i < handle->chain_index_sz; i++) {
-		if (handle->chain_index[i]) {
-			res = strcmp(handle->chain_index[i]->name, name);
-			if (res > 0)
-				break; // One step too far
-			list_pos = &handle->chain_index[i]->list;
-			if (res == 0)
-				break; // Direct hit
-		}
-	}
-
-	return list_pos;
-}
-#endif
-
 static int iptcc_chain_index_alloc(struct xtc_handle *h)
 {
 	unsigned int list_length = CHAIN_INDEX_BUCKET_LEN;
@@ -626,10 +620,18 @@ static int iptcc_chain_index_delete_chain(struct chain_head *c, struct xtc_handl
 		 * is located in the same index bucket.
 		 */
 		c2         = list_entry(next, struct chain_head, list);
-		iptcc_bsearch_chain_index(c2->name, &idx2, h);
-		if (idx != idx2) {
-			/* Rebuild needed */
-			return iptcc_chain_index_rebuild(h);
+		if (next != &h->chains)
+			iptcc_bsearch_chain_index(c2->name, &idx2, h);
+		if (next == &h->chains || idx != idx2) {
+			/* The bucket is empty now, so drop it from the
+			 * array.  Rebuilding here instead would make
+			 * deleting all chains quadratic. */
+			debug("Remove empty cindex[%d]\n", idx);
+			memmove(&h->chain_index[idx], &h->chain_index[idx+1],
+				(h->chain_index_sz - idx - 1) *
+				sizeof(h->chain_index[0]));
+			h->chain_index_sz--;
+			return 0;
 		} else {
 			/* Avoiding rebuild */
 			debug("Update cindex[%d] with next ptr name:[%s]\n",
@@ -642,6 +644,178 @@ static int iptcc_chain_index_delete_chain(struct chain_head *c, struct xtc_handl
 }
 
 
+/**********************************************************************
+ * Chain and rule hashes (cache utility) functions
+ **********************************************************************
+ * Chains are hashed by name, which makes looking up a chain O(1)
+ * whatever the number of user defined chains.  The chain list and
+ * its index above are still kept sorted, for inserting chains in
+ * order and for the offset search while parsing.
+ *
+ * Rules are hashed by chain and by the parts of the rule that
+ * is_same() and target_same() always compare exactly, whatever the
+ * mask: the protocol head, the entry layout and the target.  All
+ * rules which can match a rule given to TC_DELETE_ENTRY or
+ * TC_CHECK_ENTRY are thus in the same bucket.
+ *
+ * Both hashes double in size when they get as many entries as
+ * buckets.  If that fails, they just carry on with longer buckets.
+ */
+#define IPTCC_HASH_MIN_SZ	64
+
+static unsigned int hash_entry_head(const STRUCT_ENTRY *e);
+
+static inline unsigned int iptcc_hash_mix(unsigned int hash, unsigned int val)
+{
+	/* fold the high bits back, addresses differ mostly there */
+	hash = (hash ^ val) * 0x9e3779b1;
+	return hash ^ (hash >> 16);
+}
+
+static unsigned int iptcc_hash_name(const char *name)
+{
+	unsigned int hash = 0x811c9dc5;
+
+	while (*name)
+		hash = iptcc_hash_mix(hash, (unsigned char)*name++);
+	return hash;
+}
+
+static void iptcc_chain_hash_grow(struct xtc_handle *h)
+{
+	struct chain_head **new, *c, *next;
+	unsigned int i, sz = h->chain_hash_sz * 2;
+
+	new = calloc(sz, sizeof(*new));
+	if (!new)
+		return;
+
+	for (i = 0; i < h->chain_hash_sz; i++) {
+		for (c = h->chain_hash[i]; c; c = next) {
+			unsigned int b = iptcc_hash_name(c->name) & (sz - 1);
+
+			next = c->hash_next;
+			c->hash_next = new[b];
+			new[b] = c;
+		}
+	}
+
+	free(h->chain_hash);
+	h->chain_hash = new;
+	h->chain_hash_sz = sz;
+}
+
+static void iptcc_chain_hash_add(struct xtc_handle *h, struct chain_head *c)
+{
+	unsigned int b;
+
+	if (h->chain_hash_cnt >= h->chain_hash_sz)
+		iptcc_chain_hash_grow(h);
+
+	b = iptcc_hash_name(c->name) & (h->chain_hash_sz - 1);
+	c->hash_next = h->chain_hash[b];
+	h->chain_hash[b] = c;
+	h->chain_hash_cnt++;
+}
+
+static void iptcc_chain_hash_del(struct xtc_handle *h, struct chain_head *c)
+{
+	struct chain_head **pc;
+
+	pc = &h->chain_hash[iptcc_hash_name(c->name) & (h->chain_hash_sz - 1)];
+	for (; *pc; pc = &(*pc)->hash_next) {
+		if (*pc == c) {
+			*pc = c->hash_next;
+			h->chain_hash_cnt--;
+			return;
+		}
+	}
+}
+
+/* The target must already be mapped, see iptcc_map_target() */
+static unsigned int iptcc_hash_rule(struct rule_head *r)
+{
+	STRUCT_ENTRY_TARGET *t = GET_TARGET(r->entry);
+	unsigned int hash;
+	const char *p;
+
+	hash = iptcc_hash_mix(hash_entry_head(r->entry),
+			      (unsigned long)r->chain);
+	hash = iptcc_hash_mix(hash, r->type);
+
+	switch (r->type) {
+	case IPTCC_R_JUMP:
+		hash = iptcc_hash_mix(hash, (unsigned long)r->jump);
+		break;
+	case IPTCC_R_STANDARD:
+		hash = iptcc_hash_mix(hash,
+			((STRUCT_STANDARD_TARGET *)t)->verdict);
+		break;
+	case IPTCC_R_MODULE:
+		hash = iptcc_hash_mix(hash, t->u.target_size);
+		for (p = t->u.user.name; *p; p++)
+			hash = iptcc_hash_mix(hash, (unsigned char)*p);
+		break;
+	case IPTCC_R_FALLTHROUGH:
+		break;
+	}
+
+	return hash;
+}
+
+static void iptcc_rule_hash_grow(struct xtc_handle *h)
+{
+	struct rule_head **new, *r, *next;
+	unsigned int i, sz = h->rule_hash_sz * 2;
+
+	new = calloc(sz, sizeof(*new));
+	if (!new)
+		return;
+
+	for (i = 0; i < h->rule_hash_sz; i++) {
+		for (r = h->rule_hash[i]; r; r = next) {
+			next = r->hash_next;
+			r->hash_next = new[r->hash & (sz - 1)];
+			new[r->hash & (sz - 1)] = r;
+		}
+	}
+
+	free(h->rule_hash);
+	h->rule_hash = new;
+	h->rule_hash_sz = sz;
+}
+
+static void iptcc_rule_hash_add(struct xtc_handle *h, struct rule_head *r)
+{
+	unsigned int b;
+
+	if (h->rule_hash_cnt >= h->rule_hash_sz)
+		iptcc_rule_hash_grow(h);
+
+	r->hash = iptcc_hash_rule(r);
+	b = r->hash & (h->rule_hash_sz - 1);
+	r->hash_next = h->rule_hash[b];
+	h->rule_hash[b] = r;
+	r->hashed = 1;
+	h->rule_hash_cnt++;
+}
+
+static void iptcc_rule_hash_del(struct xtc_handle *h, struct rule_head *r)
+{
+	struct rule_head **pr;
+
+	for (pr = &h->rule_hash[r->hash & (h->rule_hash_sz - 1)]; *pr;
+	     pr = &(*pr)->hash_next) {
+		if (*pr == r) {
+			*pr = r->hash_next;
+			r->hashed = 0;
+			h->rule_hash_cnt--;
+			return;
+		}
+	}
+}
+
+
 /**********************************************************************
  * iptc cache utility functions (iptcc_*)
  **********************************************************************/
@@ -718,81 +892,20 @@ iptcc_find_chain_by_offset(struct xtc_handle *handle, unsigned int offset)
 static struct chain_head *
 iptcc_find_label(const char *name, struct xtc_handle *handle)
 {
-	struct list_head *pos;
-	struct list_head *list_start_pos;
-	unsigned int i=0;
-	int res;
-
-	if (list_empty(&handle->chains))
-		return NULL;
+	struct chain_head *c;
 
-	/* First look at builtin chains */
-	list_for_each(pos, &handle->chains) {
-		struct chain_head *c = list_entry(pos, struct chain_head, list);
-		if (!iptcc_is_builtin(c))
-			break;
+	c = handle->chain_hash[iptcc_hash_name(name) & (handle->chain_hash_sz - 1)];
+	for (; c; c = c->hash_next) {
 		if (!strcmp(c->name, name))
 			return c;
 	}
 
-	/* Find a smart place to start the search via chain index */
-  	//list_start_pos = iptcc_linearly_search_chain_index(name, handle);
-  	list_start_pos = iptcc_bsearch_chain_index(name, &i, handle);
-
-	/* Handel if bsearch bails out early */
-	if (list_start_pos == &handle->chains) {
-		list_start_pos = pos;
-	}
-#ifdef DEBUG
-	else {
-		/* Verify result of bsearch against linearly index search */
-		struct list_head *test_pos;
-		struct chain_head *test_c, *tmp_c;
-		test_pos = iptcc_linearly_search_chain_index(name, handle);
-		if (list_start_pos != test_pos) {
-			debug("BUG in chain_index search\n");
-			test_c=list_entry(test_pos,      struct chain_head,list);
-			tmp_c =list_entry(list_start_pos,struct chain_head,list);
-			debug("Verify search found:\n");
-			debug(" Chain:%s\n", test_c->name);
-			debug("BSearch found:\n");
-			debug(" Chain:%s\n", tmp_c->name);
-			exit(42);
-		}
-	}
-#endif
-
-	/* Initial/special case, no user defined chains */
-	if (handle->num_chains == 0)
-		return NULL;
-
-	/* Start searching through the chain list */
-	list_for_each(pos, list_start_pos->prev) {
-		struct chain_head *c = list_entry(pos, struct chain_head, list);
-		res = strcmp(c->name, name);
-		debug("List search name:%s == %s res:%d\n", name, c->name, res);
-		if (res==0)
-			return c;
-
-		/* We can stop earlier as we know list is sorted */
-		if (res>0 && !iptcc_is_builtin(c)) { /* Walked too far*/
-			debug(" Not in list, walked too far, sorted list\n");
-			return NULL;
-		}
-
-		/* Stop on wrap around, if list head is reached */
-		if (pos == &handle->chains) {
-			debug("Stop, list head reached\n");
-			return NULL;
-		}
-	}
-
-	debug("List search NOT found name:%s\n", name);
+	debug("Hash search NOT found name:%s\n", name);
 	return NULL;
 }
 
 /* called when rule is to be removed from cache */
-static void iptcc_delete_rule(struct rule_head *r)
+static void iptcc_delete_rule(struct xtc_handle *h, struct rule_head *r)
 {
 	DEBUGP("deleting rule %p (offset %u)\n", r, r->offset);
 	/* clean up reference count of called chain */
@@ -800,6 +913,9 @@ static void iptcc_delete_rule(struct rule_head *r)
 	    && r->jump)
 		r->jump->references--;
 
+	if (r->hashed)
+		iptcc_rule_hash_del(h, r);
+
 	list_del(&r->list);
 	free(r);
 }
@@ -838,7 +954,7 @@ static int __iptcc_p_del_policy(struct xtc_handle *h, unsigned int num)
 		h->chain_iterator_cur->foot_offset = pr->offset;
 
 		/* delete rule from cache */
-		iptcc_delete_rule(pr);
+		iptcc_delete_rule(h, pr);
 		h->chain_iterator_cur->num_rules--;
 
 		return 1;
@@ -853,6 +969,16 @@ static void iptc_insert_chain(struct xtc_handle *h, struct chain_head *c)
 	struct list_head  *list_start_pos;
 	unsigned int i=1;
 
+	/* Chains often come in sorted (iptables-restore), so first see
+	 * if the chain simply goes last.  This needs no index update. */
+	if (!c->hooknum && !list_empty(&h->chains)) {
+		tmp = list_entry(h->chains.prev, struct chain_head, list);
+		if (iptcc_is_builtin(tmp) || strcmp(c->name, tmp->name) > 0) {
+			list_add_tail(&c->list, &h->chains);
+			return;
+		}
+	}
+
 	/* Find a smart place to start the insert search */
   	list_start_pos = iptcc_bsearch_chain_index(c->name, &i, h);
 
@@ -900,6 +1026,7 @@ static void __iptcc_p_add_chain(struct xtc_handle *h, struct chain_head *c,
 
 	c->head_offset = offset;
 	c->index = *num;
+	iptcc_chain_hash_add(h, c);
 
 	/* Chains from kernel are already sorted, as they are inserted
 	 * sorted. But there exists an issue when shifting to 1.4.0
@@ -1070,16 +1197,21 @@ static int parse_table(struct xtc_handle *h)
 			struct chain_head *lc;
 			STRUCT_STANDARD_TARGET *t;
 
-			if (r->type != IPTCC_R_JUMP)
-				continue;
+			if (r->type == IPTCC_R_JUMP) {
+				t = (STRUCT_STANDARD_TARGET *)GET_TARGET(r->entry);
+				lc = iptcc_find_chain_by_offset(h, t->verdict);
+				if (!lc)
+					return -1;
+				r->jump = lc;
+				lc->references++;
+			}
 
-			t = (STRUCT_STANDARD_TARGET *)GET_TARGET(r->entry);
-			lc = iptcc_find_chain_by_offset(h, t->verdict);
-			if (!lc)
-				return -1;
-			r->jump = lc;
-			lc->references++;
+			iptcc_rule_hash_add(h, r);
 		}
+
+		/* Chain is exactly as the kernel gave it to us */
+		c->dirty = 0;
+		c->blob_offset = c->head_offset;
 	}
 
 	return 1;
@@ -1139,6 +1271,34 @@ static inline int iptcc_compile_rule (struct xtc_handle *h, STRUCT_REPLACE *repl
 	return 1;
 }
 
+/* copy an unchanged chain from the previous blob, fixing up the
+ * verdicts that depend on where it and its jump targets now are */
+static int iptcc_copy_chain(struct xtc_handle *h, STRUCT_REPLACE *repl, struct chain_head *c)
+{
+	struct rule_head *r;
+	STRUCT_STANDARD_TARGET *t;
+
+	memcpy((char *)repl->entries + c->head_offset,
+	       iptcb_get_entry(h, c->blob_offset),
+	       c->foot_offset + IPTCB_CHAIN_FOOT_SIZE - c->head_offset);
+
+	if (iptcc_is_builtin(c)) {
+		repl->hook_entry[c->hooknum-1] = c->head_offset;
+		repl->underflow[c->hooknum-1] = c->foot_offset;
+	}
+
+	list_for_each_entry(r, &c->rules, list) {
+		t = (STRUCT_STANDARD_TARGET *)
+			GET_TARGET((STRUCT_ENTRY *)((char *)repl->entries + r->offset));
+		if (r->type == IPTCC_R_JUMP)
+			t->verdict = r->jump->head_offset + IPTCB_CHAIN_START_SIZE;
+		else if (r->type == IPTCC_R_FALLTHROUGH)
+			t->verdict = r->offset + r->size;
+	}
+
+	return 0;
+}
+
 /* compile chain from cache into blob */
 static int iptcc_compile_chain(struct xtc_handle *h, STRUCT_REPLACE *repl, struct chain_head *c)
 {
@@ -1147,6 +1307,9 @@ static int iptcc_compile_chain(struct xtc_handle *h, STRUCT_REPLACE *repl, struc
 	struct iptcb_chain_start *head;
 	struct iptcb_chain_foot *foot;
 
+	if (!c->dirty)
+		return iptcc_copy_chain(h, repl, c);
+
 	/* only user-defined chains have heaer */
 	if (!iptcc_is_builtin(c)) {
 		/* put chain header in place */
@@ -1296,8 +1459,24 @@ alloc_handle(const char *tablename, unsigned int size, unsigned int num_rules)
 	strcpy(h->entries->name, tablename);
 	h->entries->size = size;
 
+	h->chain_hash_sz = IPTCC_HASH_MIN_SZ;
+	h->chain_hash = calloc(h->chain_hash_sz, sizeof(*h->chain_hash));
+	if (!h->chain_hash)
+		goto out_free_entries;
+
+	h->rule_hash_sz = IPTCC_HASH_MIN_SZ;
+	while (h->rule_hash_sz < num_rules)
+		h->rule_hash_sz *= 2;
+	h->rule_hash = calloc(h->rule_hash_sz, sizeof(*h->rule_hash));
+	if (!h->rule_hash)
+		goto out_free_chain_hash;
+
 	return h;
 
+out_free_chain_hash:
+	free(h->chain_hash);
+out_free_entries:
+	free(h->entries);
 out_free_handle:
 	free(h);
 
@@ -1405,6 +1584,8 @@ TC_FREE(struct xtc_handle *h)
 
 	iptcc_chain_index_free(h);
 
+	free(h->chain_hash);
+	free(h->rule_hash);
 	free(h->entries);
 	free(h);
 }
@@ -1795,8 +1976,9 @@ TC_INSERT_ENTRY(const IPT_CHAINLABEL chain,
 
 	list_add_tail(&r->list, prev);
 	c->num_rules++;
+	iptcc_rule_hash_add(handle, r);
 
-	set_changed(handle);
+	set_chain_changed(handle, c);
 
 	return 1;
 }
@@ -1844,9 +2026,10 @@ TC_REPLACE_ENTRY(const IPT_CHAINLABEL chain,
 	}
 
 	list_add(&r->list, &old->list);
-	iptcc_delete_rule(old);
+	iptcc_rule_hash_add(handle, r);
+	iptcc_delete_rule(handle, old);
 
-	set_changed(handle);
+	set_chain_changed(handle, c);
 
 	return 1;
 }
@@ -1885,8 +2068,9 @@ TC_APPEND_ENTRY(const IPT_CHAINLABEL chain,
 
 	list_add_tail(&r->list, &c->rules);
 	c->num_rules++;
+	iptcc_rule_hash_add(handle, r);
 
-	set_changed(handle);
+	set_chain_changed(handle, c);
 
 	return 1;
 }
@@ -1966,7 +2150,8 @@ static int delete_entry(const IPT_CHAINLABEL chain, const STRUCT_ENTRY *origfw,
 			bool dry_run)
 {
 	struct chain_head *c;
-	struct rule_head *r, *i;
+	struct rule_head *r, *i, *found;
+	unsigned int hash, matches;
 
 	iptc_fn = TC_DELETE_ENTRY;
 	if (!(c = iptcc_find_label(chain, handle))) {
@@ -1997,42 +2182,68 @@ static int delete_entry(const IPT_CHAINLABEL chain, const STRUCT_ENTRY *origfw,
 			r->jump->references--;
 	}
 
-	list_for_each_entry(i, &c->rules, list) {
+	/* Look in the rule's hash bucket first.  Only if more than one
+	 * rule in the chain matches, walk the chain to find the first. */
+	found = NULL;
+	matches = 0;
+	hash = iptcc_hash_rule(r);
+	for (i = handle->rule_hash[hash & (handle->rule_hash_sz - 1)];
+	     i; i = i->hash_next) {
 		unsigned char *mask;
 
-		mask = is_same(r->entry, i->entry, matchmask);
-		if (!mask)
+		if (i->hash != hash || i->chain != c)
 			continue;
 
-		if (!target_same(r, i, mask))
+		mask = is_same(r->entry, i->entry, matchmask);
+		if (!mask || !target_same(r, i, mask))
 			continue;
 
-		/* if we are just doing a dry run, we simply skip the rest */
-		if (dry_run){
-			free(r);
-			return 1;
-		}
+		found = i;
+		if (++matches > 1)
+			break;
+	}
+
+	if (matches > 1) {
+		list_for_each_entry(i, &c->rules, list) {
+			unsigned char *mask;
+
+			mask = is_same(r->entry, i->entry, matchmask);
+			if (!mask)
+				continue;
 
-		/* If we are about to delete the rule that is the
-		 * current iterator, move rule iterator back.  next
-		 * pointer will then point to real next node */
-		if (i == handle->rule_iterator_cur) {
-			handle->rule_iterator_cur =
-				list_entry(handle->rule_iterator_cur->list.prev,
-					   struct rule_head, list);
+			if (!target_same(r, i, mask))
+				continue;
+
+			found = i;
+			break;
 		}
+	}
 
-		c->num_rules--;
-		iptcc_delete_rule(i);
+	free(r);
 
-		set_changed(handle);
-		free(r);
+	if (!found) {
+		errno = ENOENT;
+		return 0;
+	}
+
+	/* if we are just doing a dry run, we simply skip the rest */
+	if (dry_run)
 		return 1;
+
+	/* If we are about to delete the rule that is the
+	 * current iterator, move rule iterator back.  next
+	 * pointer will then point to real next node */
+	if (found == handle->rule_iterator_cur) {
+		handle->rule_iterator_cur =
+			list_entry(handle->rule_iterator_cur->list.prev,
+				   struct rule_head, list);
 	}
 
-	free(r);
-	errno = ENOENT;
-	return 0;
+	c->num_rules--;
+	iptcc_delete_rule(handle, found);
+
+	set_chain_changed(handle, c);
+	return 1;
 }
 
 /* check whether a specified rule is present */
@@ -2088,9 +2299,9 @@ TC_DELETE_NUM_ENTRY(const IPT_CHAINLABEL chain,
 	}
 
 	c->num_rules--;
-	iptcc_delete_rule(r);
+	iptcc_delete_rule(handle, r);
 
-	set_changed(handle);
+	set_chain_changed(handle, c);
 
 	return 1;
 }
@@ -2109,12 +2320,12 @@ TC_FLUSH_ENTRIES(const IPT_CHAINLABEL chain, struct xtc_handle *handle)
 	}
 
 	list_for_each_entry_safe(r, tmp, &c->rules, list) {
-		iptcc_delete_rule(r);
+		iptcc_delete_rule(handle, r);
 	}
 
 	c->num_rules = 0;
 
-	set_changed(handle);
+	set_chain_changed(handle, c);
 
 	return 1;
 }
@@ -2272,16 +2483,19 @@ TC_CREATE_CHAIN(const IPT_CHAINLABEL chain, struct xtc_handle *handle)
 
 	DEBUGP("Creating chain `%s'\n", chain);
 	iptc_insert_chain(handle, c); /* Insert sorted */
+	iptcc_chain_hash_add(handle, c);
 
 	/* Inserting chains don't change the correctness of the chain
 	 * index (except if its smaller than index[0], but that
 	 * handled by iptc_insert_chain).  It only causes longer lists
 	 * in the buckets. Thus, only rebuild chain index when the
-	 * capacity is exceed with CHAIN_INDEX_INSERT_MAX chains.
+	 * capacity is exceed with CHAIN_INDEX_INSERT_MAX chains, or
+	 * with as many chains as it has, so that creating many chains
+	 * doesn't rebuild the index over and over.
 	 */
 	capacity = handle->chain_index_sz * CHAIN_INDEX_BUCKET_LEN;
 	exceeded = handle->num_chains - capacity;
-	if (exceeded > CHAIN_INDEX_INSERT_MAX) {
+	if (exceeded > CHAIN_INDEX_INSERT_MAX && exceeded > capacity) {
 		debug("Capacity(%d) exceeded(%d) rebuild (chains:%d)\n",
 		      capacity, exceeded, handle->num_chains);
 		iptcc_chain_index_rebuild(handle);
@@ -2357,6 +2571,7 @@ TC_DELETE_CHAIN(const IPT_CHAINLABEL chain, struct xtc_handle *handle)
 
 	//list_del(&c->list); /* Done in iptcc_chain_index_delete_chain() */
 	iptcc_chain_index_delete_chain(c, handle);
+	iptcc_chain_hash_del(handle, c);
 	free(c);
 
 	DEBUGP("chain `%s' deleted\n", chain);
@@ -2398,14 +2613,16 @@ int TC_RENAME_CHAIN(const IPT_CHAINLABEL oldname,
 
 	/* This only unlinks "c" from the list, thus no free(c) */
 	iptcc_chain_index_delete_chain(c, handle);
+	iptcc_chain_hash_del(handle, c);
 
 	/* Change the name of the chain */
 	strncpy(c->name, newname, sizeof(IPT_CHAINLABEL));
 
 	/* Insert sorted into to list again */
 	iptc_insert_chain(handle, c);
+	iptcc_chain_hash_add(handle, c);
 
-	set_changed(handle);
+	set_chain_changed(handle, c);
 
 	return 1;
 }
@@ -2450,7 +2667,7 @@ TC_SET_POLICY(const IPT_CHAINLABEL chain,
 		c->counter_map.maptype = COUNTER_MAP_NOMAP;
 	}
 
-	set_changed(handle);
+	set_chain_changed(handle, c);
 
 	return 1;
 }
@@ -2521,6 +2738,223 @@ static void counters_map_set(STRUCT_COUNTERS_INFO *newcounters,
 }
 
 
+/* Compare two entries as the kernel hands them back: it fills in the
+ * counters and the chain bits in comefrom itself, and only copies the
+ * names of matches and targets up to their terminating NUL.  Unless
+ * `data' is set, match and target data are not compared either: before
+ * 4.11 the kernel copies back the private state some of them keep there
+ * (the master pointer of limit, hashlimit's table, quota2's counter), so
+ * it never reads back as it was written. */
+static int iptcc_entry_same(const STRUCT_ENTRY *a, const STRUCT_ENTRY *b,
+			    int data)
+{
+	const STRUCT_ENTRY_MATCH *ma, *mb;
+	const STRUCT_ENTRY_TARGET *ta, *tb;
+	unsigned int off;
+
+	if (memcmp(a, b, offsetof(STRUCT_ENTRY, comefrom)) != 0)
+		return 0;
+
+	for (off = sizeof(STRUCT_ENTRY); off < a->target_offset;
+	     off += ma->u.match_size) {
+		ma = (void *)a + off;
+		mb = (void *)b + off;
+		if (ma->u.match_size != mb->u.match_size
+		    || strcmp(ma->u.user.name, mb->u.user.name) != 0
+		    || ma->u.user.revision != mb->u.user.revision
+		    || (data && memcmp(ma->data, mb->data,
+				       ma->u.match_size - sizeof(*ma)) != 0))
+			return 0;
+	}
+
+	ta = (void *)a + a->target_offset;
+	tb = (void *)b + b->target_offset;
+	return ta->u.target_size == tb->u.target_size
+	       && strcmp(ta->u.user.name, tb->u.user.name) == 0
+	       && ta->u.user.revision == tb->u.user.revision
+	       && (!data || memcmp(ta->data, tb->data,
+				   ta->u.target_size - sizeof(*ta)) == 0);
+}
+
+/* Read the entries of the table `info' describes, or NULL */
+static STRUCT_GET_ENTRIES *iptcc_read_entries(struct xtc_handle *h,
+					      const STRUCT_GETINFO *info)
+{
+	STRUCT_GET_ENTRIES *entries;
+	socklen_t s;
+
+	entries = malloc(sizeof(STRUCT_GET_ENTRIES) + info->size);
+	if (!entries) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	strcpy(entries->name, info->name);
+	entries->size = info->size;
+	s = sizeof(STRUCT_GET_ENTRIES) + info->size;
+	if (getsockopt(h->sockfd, TC_IPPROTO, SO_GET_ENTRIES, entries,
+		       &s) < 0) {
+		free(entries);
+		return NULL;
+	}
+
+	return entries;
+}
+
+/* A handle which has been committed is kept in sync with what it put
+ * into the kernel, so it can be modified and committed again without
+ * TC_FREE/TC_INIT.  Nothing tells us if somebody else has replaced the
+ * table meanwhile, so read it back and compare it with the blob the
+ * clean chains are copied from: fail with EAGAIN rather than silently
+ * undo their changes.  That blob is itself what the kernel handed back
+ * right after our replace (see iptcc_commit_sync()), so kernel private
+ * state in match and target data compares equal until the rule is
+ * replaced by somebody else.
+ */
+static int iptcc_table_unchanged(struct xtc_handle *h)
+{
+	STRUCT_GETINFO info;
+	STRUCT_GET_ENTRIES *entries;
+	STRUCT_ENTRY *a, *b;
+	socklen_t s = sizeof(info);
+	unsigned int i, off;
+	int same;
+
+	strcpy(info.name, h->info.name);
+	if (getsockopt(h->sockfd, TC_IPPROTO, SO_GET_INFO, &info, &s) < 0)
+		return 0;
+
+	if (info.num_entries != h->info.num_entries
+	    || info.size != h->info.size
+	    || info.size != h->entries->size)
+		goto changed;
+
+	for (i = 0; i < NUMHOOKS; i++) {
+		if (!(h->info.valid_hooks & (1 << i)))
+			continue;
+		if (info.hook_entry[i] != h->info.hook_entry[i]
+		    || info.underflow[i] != h->info.underflow[i])
+			goto changed;
+	}
+
+	entries = iptcc_read_entries(h, &info);
+	if (!entries)
+		return 0;
+
+	for (off = 0; off < info.size; off += a->next_offset) {
+		a = (void *)entries->entrytable + off;
+		b = iptcb_offset2entry(h, off);
+		if (!iptcc_entry_same(a, b, 1))
+			break;
+	}
+	same = off == info.size;
+	free(entries);
+
+	if (same)
+		return 1;
+
+changed:
+	errno = EAGAIN;
+	return 0;
+}
+
+/* Read back the table just installed from `repl'.  Its layout must be
+ * the one we sent, since the chains are about to point into it; only
+ * match and target data may differ (see iptcc_entry_same()). */
+static STRUCT_GET_ENTRIES *iptcc_read_back(struct xtc_handle *h,
+					   STRUCT_REPLACE *repl)
+{
+	STRUCT_GET_ENTRIES *entries;
+	STRUCT_GETINFO info;
+	STRUCT_ENTRY *a, *b;
+	unsigned int off;
+
+	strcpy(info.name, h->info.name);
+	info.size = repl->size;
+	entries = iptcc_read_entries(h, &info);
+	if (!entries)
+		return NULL;
+
+	for (off = 0; off < repl->size; off += a->next_offset) {
+		a = (void *)entries->entrytable + off;
+		b = (void *)repl->entries + off;
+		if (a->next_offset != b->next_offset
+		    || !iptcc_entry_same(a, b, 0))
+			break;
+	}
+	if (off != repl->size) {
+		free(entries);
+		return NULL;
+	}
+
+	return entries;
+}
+
+/* The kernel now holds the table in `repl', with the counters in
+ * `newcounters': make the cache describe that table, as if it had
+ * just been read by TC_INIT. */
+static void iptcc_commit_sync(struct xtc_handle *h, STRUCT_REPLACE *repl,
+			      STRUCT_COUNTERS_INFO *newcounters)
+{
+	STRUCT_GET_ENTRIES *entries;
+	struct chain_head *c;
+	struct rule_head *r;
+	unsigned int i;
+	int clean = 1;
+
+	/* Keep the table as the kernel hands it back, so that the next
+	 * COMMIT compares like with like.  If it can't be read back, or
+	 * somebody replaced it already, keep what we sent: that COMMIT
+	 * then fails with EAGAIN instead of trusting a stale blob. */
+	entries = iptcc_read_back(h, repl);
+	if (!entries) {
+		entries = malloc(sizeof(STRUCT_GET_ENTRIES) + repl->size);
+		if (entries) {
+			strcpy(entries->name, h->info.name);
+			entries->size = repl->size;
+			memcpy(entries->entrytable, repl->entries, repl->size);
+		}
+	}
+	if (entries) {
+		free(h->entries);
+		h->entries = entries;
+	} else {
+		/* Old blob is useless now, so compile everything next time */
+		clean = 0;
+	}
+
+	h->info.num_entries = repl->num_entries;
+	h->info.size = repl->size;
+	for (i = 0; i < NUMHOOKS; i++) {
+		if (!(h->info.valid_hooks & (1 << i)))
+			continue;
+		h->info.hook_entry[i] = repl->hook_entry[i];
+		h->info.underflow[i] = repl->underflow[i];
+	}
+
+	list_for_each_entry(c, &h->chains, list) {
+		if (iptcc_is_builtin(c)) {
+			c->counters = newcounters->counters[c->foot_index];
+			c->counter_map.maptype = COUNTER_MAP_NORMAL_MAP;
+			c->counter_map.mappos = c->foot_index;
+		}
+
+		list_for_each_entry(r, &c->rules, list) {
+			r->entry->counters = newcounters->counters[r->index];
+			r->counter_map.maptype = COUNTER_MAP_NORMAL_MAP;
+			r->counter_map.mappos = r->index;
+		}
+
+		c->dirty = !clean;
+		c->blob_offset = c->head_offset;
+	}
+
+	/* Chains are pushed to the kernel sorted */
+	h->sorted_offsets = 1;
+	h->changed = 0;
+	h->committed = 1;
+}
+
 int
 TC_COMMIT(struct xtc_handle *handle)
 {
@@ -2540,6 +2974,9 @@ TC_COMMIT(struct xtc_handle *handle)
 	if (!handle->changed)
 		goto finished;
 
+	if (handle->committed && !iptcc_table_unchanged(handle))
+		goto out_zero;
+
 	new_number = iptcc_compile_table_prep(handle, &new_size);
 	if (new_number < 0) {
 		errno = ENOMEM;
@@ -2681,6 +3118,9 @@ TC_COMMIT(struct xtc_handle *handle)
 
 	ret = setsockopt(handle->sockfd, TC_IPPROTO, SO_SET_ADD_COUNTERS,
 			 newcounters, counterlen);
+
+	/* The new table is in place even if the counters failed */
+	iptcc_commit_sync(handle, repl, newcounters);
 	if (ret < 0)
 		goto out_free_newcounters;
 
@@ -2734,6 +3174,8 @@ TC_STRERROR(int err)
 	      "Bad built-in chain name" },
 	    { TC_SET_POLICY, EINVAL,
 	      "Bad policy name" },
+	    { TC_COMMIT, EAGAIN,
+	      "Table was changed meanwhile, read it again" },
 
 	    { NULL, 0, "Incompatible with this kernel" },
 	    { NULL, ENOPROTOOPT, "iptables who? (do you need to insmod?)" },
@@ -0,0 +1,158 @@
+/*
+ * iptc_bench: measure how the latency of adding one rule grows with
+ * the size of the table, with a fresh libiptc handle per change (what
+ * every iptables invocation does) and with one long-lived handle.
+ *
+ * The rules go into a chain of their own, which nothing jumps to, and
+ * are removed again at the end.  Still, run it in a scratch network
+ * namespace:  unshare -n ./iptc_bench 1000 10000 50000
+ *
+ * This program is distributed under the terms of GNU GPL v2
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <libiptc/libiptc.h>
+
+#define BENCH_ROUNDS	20
+
+static const xt_chainlabel bench_chain = "iptc-bench";
+
+struct bench_rule {
+	struct ipt_entry e;
+	struct xt_standard_target t;
+};
+
+static void fail(const char *what)
+{
+	fprintf(stderr, "iptc_bench: %s: %s\n", what, iptc_strerror(errno));
+	exit(1);
+}
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static const struct ipt_entry *make_rule(unsigned int n)
+{
+	static struct bench_rule r;
+
+	memset(&r, 0, sizeof(r));
+	r.e.ip.src.s_addr = htonl(0x0a000000 | (n & 0xffffff));
+	r.e.ip.smsk.s_addr = 0xffffffff;
+	r.e.target_offset = XT_ALIGN(sizeof(struct ipt_entry));
+	r.e.next_offset = r.e.target_offset +
+			  XT_ALIGN(sizeof(struct xt_standard_target));
+	r.t.target.u.user.target_size =
+		XT_ALIGN(sizeof(struct xt_standard_target));
+	strcpy(r.t.target.u.user.name, IPTC_LABEL_ACCEPT);
+
+	return &r.e;
+}
+
+/* grow the bench chain to `size' rules in one commit */
+static void fill(unsigned int *rules, unsigned int size)
+{
+	struct xtc_handle *h;
+
+	if (!(h = iptc_init("filter")))
+		fail("init");
+	if (!iptc_is_chain(bench_chain, h) && !iptc_create_chain(bench_chain, h))
+		fail("create chain");
+	for (; *rules < size; (*rules)++)
+		if (!iptc_append_entry(bench_chain, make_rule(*rules), h))
+			fail("append");
+	if (!iptc_commit(h))
+		fail("commit");
+	iptc_free(h);
+}
+
+static double oneshot(unsigned int *rules)
+{
+	struct xtc_handle *h;
+	double start = now_ms();
+	int i;
+
+	for (i = 0; i < BENCH_ROUNDS; i++) {
+		if (!(h = iptc_init("filter")))
+			fail("init");
+		if (!iptc_append_entry(bench_chain, make_rule((*rules)++), h))
+			fail("append");
+		if (!iptc_commit(h))
+			fail("commit");
+		iptc_free(h);
+	}
+
+	return (now_ms() - start) / BENCH_ROUNDS;
+}
+
+static double longlived(unsigned int *rules)
+{
+	struct xtc_handle *h;
+	double start;
+	int i;
+
+	if (!(h = iptc_init("filter")))
+		fail("init");
+
+	start = now_ms();
+	for (i = 0; i < BENCH_ROUNDS; i++) {
+		if (!iptc_append_entry(bench_chain, make_rule((*rules)++), h))
+			fail("append");
+		if (!iptc_commit(h))
+			fail("commit");
+	}
+	start = (now_ms() - start) / BENCH_ROUNDS;
+
+	iptc_free(h);
+	return start;
+}
+
+static void cleanup(void)
+{
+	struct xtc_handle *h;
+
+	if (!(h = iptc_init("filter")))
+		fail("init");
+	if (iptc_is_chain(bench_chain, h)) {
+		if (!iptc_flush_entries(bench_chain, h) ||
+		    !iptc_delete_chain(bench_chain, h) ||
+		    !iptc_commit(h))
+			fail("cleanup");
+	}
+	iptc_free(h);
+}
+
+int main(int argc, char *argv[])
+{
+	static const unsigned int sizes[] = { 1000, 10000, 50000 };
+	unsigned int rules = 0, size;
+	int i, n;
+
+	cleanup();
+
+	n = argc > 1 ? argc - 1 : sizeof(sizes) / sizeof(sizes[0]);
+	printf("%10s %14s %14s\n", "rules", "oneshot ms", "long-lived ms");
+
+	for (i = 0; i < n; i++) {
+		double a, b;
+
+		size = argc > 1 ? strtoul(argv[i + 1], NULL, 0) : sizes[i];
+		if (size > rules)
+			fill(&rules, size);
+
+		a = oneshot(&rules);
+		b = longlived(&rules);
+		printf("%10u %14.3f %14.3f\n", size, a, b);
+	}
+
+	cleanup();
+	return 0;
+}
@@ -572,7 +572,20 @@ enum MHD_FLAG
    * kernel >= 3.6.  On other systems, using this option cases #MHD_start_daemon
    * to fail.
    */
-  MHD_USE_TCP_FASTOPEN = 16384
+  MHD_USE_TCP_FASTOPEN = 16384,
+
+  /**
+   * Give each thread of the pool (see #MHD_OPTION_THREAD_POOL_SIZE)
+   * its own listen socket, all bound to the same address with
+   * SO_REUSEPORT.  The kernel then spreads new connections over the
+   * threads instead of waking all of them for each connection.  This
+   * option is only available on Linux with a kernel >= 3.9 and only
+   * if MHD creates the listen socket itself; otherwise
+   * #MHD_start_daemon fails.  Implies allowing reuse of the listening
+   * address (see #MHD_OPTION_LISTENING_ADDRESS_REUSE).
+   * Best combined with #MHD_USE_EPOLL_LINUX_ONLY.
+   */
+  MHD_USE_LISTEN_SOCKET_PER_THREAD = 32768
 
 };
 
@@ -883,7 +896,16 @@ enum MHD_OPTION
    * pointer to a closure to pass to the request completed callback.
    * The second pointer maybe NULL.
    */
-  MHD_OPTION_NOTIFY_CONNECTION = 27
+  MHD_OPTION_NOTIFY_CONNECTION = 27,
+
+  /**
+   * Maximum length of the queue of connections waiting to be accepted,
+   * as passed to listen().  This option should be followed by an
+   * `unsigned int` argument.  The default is SOMAXCONN; the kernel may
+   * silently cap the value further (see net.core.somaxconn on Linux).
+   * Only used if MHD creates the listen socket.
+   */
+  MHD_OPTION_LISTEN_BACKLOG_SIZE = 28
 
 };
 
@@ -2050,6 +2072,79 @@ MHD_create_response_from_fd_at_offset (size_t size,
 				       off_t offset);
 
 
+/**
+ * A piece of response data for #MHD_create_response_from_iovec.
+ */
+struct MHD_IoVec
+{
+  /**
+   * The start of the piece; not modified by MHD.
+   */
+  const void *iov_base;
+
+  /**
+   * Size of the piece in bytes.
+   */
+  size_t iov_len;
+};
+
+
+/**
+ * Create a response object whose data is made of several pieces of
+ * memory that MHD does not copy.  The same pieces may be referenced
+ * by any number of responses (i.e. cached, immutable buffers), and
+ * the response object can be extended with header information and
+ * then be used any number of times.  Unless TLS is used, the header
+ * and the data are handed to the kernel together with a single
+ * `sendmsg()` call whenever possible.
+ *
+ * @param iov the pieces of the response data, in order; the array
+ *        itself is copied, the memory it points to must remain
+ *        valid and unchanged until @a free_cb is called
+ * @param iovcnt number of elements in @a iov
+ * @param free_cb called with @a cls when the response is destroyed
+ *        (to release the pieces), may be NULL
+ * @param cls extra argument to @a free_cb
+ * @return NULL on error (i.e. invalid arguments, out of memory)
+ * @ingroup response
+ */
+_MHD_EXTERN struct MHD_Response *
+MHD_create_response_from_iovec (const struct MHD_IoVec *iov,
+                                unsigned int iovcnt,
+                                MHD_ContentReaderFreeCallback free_cb,
+                                void *cls);
+
+
+/**
+ * Create a response object from a file that is mapped into memory
+ * once and then sent like a response from
+ * #MHD_create_response_from_iovec.  Meant for files that are served
+ * over and over: create the response once and queue it for every
+ * request.  Unlike responses from #MHD_create_response_from_fd this
+ * avoids reading the file for every request when `sendfile()` cannot
+ * be used (i.e. with TLS), and header and data are sent together.
+ * If the file cannot be mapped, or is shorter than @a offset plus
+ * @a size, this falls back to #MHD_create_response_from_fd_at_offset.
+ *
+ * @param size size of the data portion of the response
+ * @param fd file descriptor referring to a file on disk with the
+ *        data; will be closed by MHD (when the response is destroyed
+ *        at the latest); the file must not be truncated while the
+ *        response exists
+ * @param offset offset of the data in the file;
+ *        Be careful! `off_t` may have been compiled to be a
+ *        64-bit variable for MHD, in which case your application
+ *        also has to be compiled using the same options! Read
+ *        the MHD manual for more details.
+ * @return NULL on error (i.e. invalid arguments, out of memory)
+ * @ingroup response
+ */
+_MHD_EXTERN struct MHD_Response *
+MHD_create_response_from_fd_mapped (size_t size,
+                                    int fd,
+                                    off_t offset);
+
+
 #if 0
 /**
  * Enumeration for actions MHD should perform on the underlying socket
@@ -44,6 +44,18 @@
 #include <windows.h>
 #endif /* _WIN32 && MHD_W32_MUTEX_ */
 
+#ifndef LINUX
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+#endif
+
+/**
+ * Maximum number of pieces of an iovec-backed response we hand
+ * to one sendmsg() call.
+ */
+#define MHD_IOV_MAX 64
+
 
 /**
  * Message to transmit when http 1.1 request is received
@@ -1735,6 +1747,105 @@ do_write (struct MHD_Connection *connection)
 }
 
 
+/**
+ * Try writing the unsent part of the write buffer (the response
+ * header) together with the unsent part of the data of an
+ * iovec-backed response to the socket.  Without TLS both go out
+ * with a single sendmsg() call, straight from where they are.
+ *
+ * @param connection connection we're processing
+ * @return #MHD_YES if something changed,
+ *         #MHD_NO if we were interrupted
+ */
+static int
+do_write_iov (struct MHD_Connection *connection)
+{
+  struct MHD_Response *response = connection->response;
+  size_t header_left;
+  uint64_t pos;
+  unsigned int i;
+  ssize_t ret;
+
+  header_left = connection->write_buffer_append_offset - connection->write_buffer_send_offset;
+  /* find the piece holding the first unsent byte */
+  pos = connection->response_write_position;
+  for (i = 0; i < response->data_iovcnt; i++)
+    {
+      if (pos < response->data_iov[i].iov_len)
+        break;
+      pos -= response->data_iov[i].iov_len;
+    }
+#if !defined(WINDOWS) || defined(CYGWIN)
+  if (0 == (connection->daemon->options & MHD_USE_SSL))
+    {
+      struct iovec vec[MHD_IOV_MAX];
+      struct msghdr msg;
+      size_t want = 0;
+      unsigned int n = 0;
+
+      if (0 != header_left)
+        {
+          vec[n].iov_base = &connection->write_buffer[connection->write_buffer_send_offset];
+          vec[n].iov_len = header_left;
+          want += vec[n++].iov_len;
+        }
+      for (; (i < response->data_iovcnt) && (n < MHD_IOV_MAX); i++)
+        {
+          vec[n].iov_base = (char *) response->data_iov[i].iov_base + pos;
+          vec[n].iov_len = response->data_iov[i].iov_len - pos;
+          want += vec[n++].iov_len;
+          pos = 0;
+        }
+      memset (&msg, 0, sizeof (msg));
+      msg.msg_iov = vec;
+      msg.msg_iovlen = n;
+      ret = sendmsg (connection->socket_fd, &msg, MSG_NOSIGNAL);
+#if EPOLL_SUPPORT
+      if (ret < (ssize_t) want)
+        {
+          /* partial write --- no longer write-ready */
+          connection->epoll_state &= ~MHD_EPOLL_STATE_WRITE_READY;
+        }
+#endif
+      /* see send_param_adapter() */
+      if ( (-1 == ret) && (0 == errno) )
+        errno = ECONNRESET;
+    }
+  else
+#endif
+  if (0 != header_left)
+    ret = connection->send_cls (connection,
+                                &connection->write_buffer
+                                [connection->write_buffer_send_offset],
+                                header_left);
+  else
+    ret = connection->send_cls (connection,
+                                (const char *) response->data_iov[i].iov_base + pos,
+                                response->data_iov[i].iov_len - pos);
+  if (ret < 0)
+    {
+      const int err = MHD_socket_errno_;
+      if ((EINTR == err) || (EAGAIN == err) || (EWOULDBLOCK == err))
+        return MHD_NO;
+#if HAVE_MESSAGES
+      MHD_DLOG (connection->daemon,
+                "Failed to send data: %s\n",
+                MHD_socket_last_strerr_ ());
+#endif
+      CONNECTION_CLOSE_ERROR (connection, NULL);
+      return MHD_YES;
+    }
+  if ((size_t) ret <= header_left)
+    {
+      connection->write_buffer_send_offset += ret;
+      return MHD_YES;
+    }
+  connection->write_buffer_send_offset += header_left;
+  connection->response_write_position += ret - header_left;
+  return MHD_YES;
+}
+
+
 /**
  * Check if we are done sending the write-buffer.
  * If so, transition into "next_state".
@@ -2117,7 +2228,12 @@ MHD_connection_handle_write (struct MHD_Connection *connection)
           EXTRA_CHECK (0);
           break;
         case MHD_CONNECTION_HEADERS_SENDING:
-          do_write (connection);
+          /* the data of an iovec-backed response goes out right
+             behind the header */
+          if (NULL != connection->response->data_iov)
+            do_write_iov (connection);
+          else
+            do_write (connection);
 	  if (connection->state != MHD_CONNECTION_HEADERS_SENDING)
  	     break;
           check_write_done (connection, MHD_CONNECTION_HEADERS_SENT);
@@ -2127,6 +2243,15 @@ MHD_connection_handle_write (struct MHD_Connection *connection)
           break;
         case MHD_CONNECTION_NORMAL_BODY_READY:
           response = connection->response;
+          if (NULL != response->data_iov)
+            {
+              do_write_iov (connection);
+              if ( (MHD_CONNECTION_NORMAL_BODY_READY == connection->state) &&
+                   (connection->response_write_position ==
+                    response->total_size) )
+                connection->state = MHD_CONNECTION_FOOTERS_SENT; /* have no footers */
+              break;
+            }
           if (NULL != response->crc)
             (void) MHD_mutex_lock_ (&response->mutex);
           if (MHD_YES != try_ready_normal_body (connection))
@@ -2256,6 +2381,29 @@ cleanup_connection (struct MHD_Connection *connection)
 }
 
 
+/**
+ * Set or clear TCP_CORK on the connection's socket, unless it
+ * already is in the desired state.
+ *
+ * @param connection connection to (un)cork
+ * @param on #MHD_YES to cork, #MHD_NO to uncork and flush
+ */
+static void
+connection_set_cork (struct MHD_Connection *connection,
+                     int on)
+{
+#if HAVE_DECL_TCP_CORK
+  const int val = (MHD_YES == on) ? 1 : 0;
+
+  if (connection->sk_corked == on)
+    return;
+  setsockopt (connection->socket_fd, IPPROTO_TCP, TCP_CORK, &val,
+              sizeof (val));
+  connection->sk_corked = on;
+#endif
+}
+
+
 /**
  * This function was created to handle per-connection processing that
  * has to happen even if the socket cannot be read or written to.
@@ -2476,15 +2624,9 @@ MHD_connection_handle_idle (struct MHD_Connection *connection)
               continue;
             }
           connection->state = MHD_CONNECTION_HEADERS_SENDING;
-
-#if HAVE_DECL_TCP_CORK
-          /* starting header send, set TCP cork */
-          {
-            const int val = 1;
-            setsockopt (connection->socket_fd, IPPROTO_TCP, TCP_CORK, &val,
-                        sizeof (val));
-          }
-#endif
+          /* starting header send, set TCP cork (still set if this
+             answers a pipelined request) */
+          connection_set_cork (connection, MHD_YES);
           break;
         case MHD_CONNECTION_HEADERS_SENDING:
           /* no default action */
@@ -2501,7 +2643,10 @@ MHD_connection_handle_idle (struct MHD_Connection *connection)
         case MHD_CONNECTION_NORMAL_BODY_UNREADY:
           if (NULL != connection->response->crc)
             (void) MHD_mutex_lock_ (&connection->response->mutex);
-          if (0 == connection->response->total_size)
+          /* nothing (left) to send, i.e. empty body, HEAD request or
+             all of it went out together with the header */
+          if (connection->response_write_position ==
+              connection->response->total_size)
             {
               if (NULL != connection->response->crc)
                 (void) MHD_mutex_unlock_ (&connection->response->mutex);
@@ -2559,14 +2704,9 @@ MHD_connection_handle_idle (struct MHD_Connection *connection)
           /* no default action */
           break;
         case MHD_CONNECTION_FOOTERS_SENT:
-#if HAVE_DECL_TCP_CORK
-          /* done sending, uncork */
-          {
-            const int val = 0;
-            setsockopt (connection->socket_fd, IPPROTO_TCP, TCP_CORK, &val,
-                        sizeof (val));
-          }
-#endif
+          /* done sending; we uncork at the end of this function, once
+             there is no further pipelined request to answer, so that
+             the responses share segments */
           end =
             MHD_get_response_header (connection->response,
 				     MHD_HTTP_HEADER_CONNECTION);
@@ -2648,6 +2788,10 @@ MHD_connection_handle_idle (struct MHD_Connection *connection)
       return MHD_YES;
     }
   MHD_connection_update_event_loop_info (connection);
+  /* nothing more to send right now, flush what we have */
+  if ( (MHD_YES == connection->sk_corked) &&
+       (MHD_EVENT_LOOP_INFO_WRITE != connection->event_loop_info) )
+    connection_set_cork (connection, MHD_NO);
 #if EPOLL_SUPPORT
   switch (connection->event_loop_info)
     {
@@ -91,6 +91,15 @@
 #define MHD_TCP_FASTOPEN_QUEUE_SIZE_DEFAULT 10
 #endif
 
+#ifndef SO_REUSEPORT
+#ifdef LINUX
+/* Supported since Linux 3.9, but often not present (or commented out)
+   in the headers at this time; but 15 is reserved for this and
+   thus should be safe to use. */
+#define SO_REUSEPORT 15
+#endif
+#endif
+
 /**
  * Print extra messages with reasons for closing
  * sockets? (only adds non-error messages).
@@ -2802,6 +2811,9 @@ MHD_epoll (struct MHD_Daemon *daemon,
 #endif
 	  return MHD_NO;
 	}
+      /* only wait for the first batch; the events we already have
+         must be processed before we may block again */
+      timeout_ms = 0;
       for (i=0;i<(unsigned int) num_events;i++)
 	{
 	  if (NULL == events[i].data.ptr)
@@ -3085,12 +3097,19 @@ MHD_quiesce_daemon (struct MHD_Daemon *daemon)
 	  {
 	    if (0 != epoll_ctl (daemon->worker_pool[i].epoll_fd,
 				EPOLL_CTL_DEL,
-				ret,
+				(MHD_INVALID_SOCKET != daemon->worker_pool[i].worker_socket_fd)
+				? daemon->worker_pool[i].worker_socket_fd
+				: ret,
 				NULL))
 	      MHD_PANIC ("Failed to remove listen FD from epoll set\n");
 	    daemon->worker_pool[i].listen_socket_in_epoll = MHD_NO;
 	  }
 #endif
+	/* the application only gets the master's socket back; stop
+	   the kernel from queueing connections on the workers' own
+	   ones, they are closed by MHD_stop_daemon() */
+	if (MHD_INVALID_SOCKET != daemon->worker_pool[i].worker_socket_fd)
+	  (void) shutdown (daemon->worker_pool[i].worker_socket_fd, SHUT_RDWR);
       }
   daemon->socket_fd = MHD_INVALID_SOCKET;
 #if EPOLL_SUPPORT
@@ -3352,6 +3371,9 @@ parse_options_va (struct MHD_Daemon *daemon,
 	case MHD_OPTION_LISTENING_ADDRESS_REUSE:
 	  daemon->listening_address_reuse = va_arg (ap, unsigned int) ? 1 : -1;
 	  break;
+        case MHD_OPTION_LISTEN_BACKLOG_SIZE:
+          daemon->listen_backlog_size = va_arg (ap, unsigned int);
+          break;
 	case MHD_OPTION_ARRAY:
 	  oa = va_arg (ap, struct MHD_OptionItem*);
 	  i = 0;
@@ -3378,6 +3400,7 @@ parse_options_va (struct MHD_Daemon *daemon,
 		case MHD_OPTION_THREAD_POOL_SIZE:
                 case MHD_OPTION_TCP_FASTOPEN_QUEUE_SIZE:
 		case MHD_OPTION_LISTENING_ADDRESS_REUSE:
+		case MHD_OPTION_LISTEN_BACKLOG_SIZE:
 		  if (MHD_YES != parse_options (daemon,
 						servaddr,
 						opt,
@@ -3509,6 +3532,150 @@ create_socket (struct MHD_Daemon *daemon,
 }
 
 
+/**
+ * Open another listen socket bound to the same address as the
+ * daemon's, for a worker of the thread pool to accept connections
+ * on (see #MHD_USE_LISTEN_SOCKET_PER_THREAD).
+ *
+ * @param daemon master daemon, its listen socket must be bound
+ *        with SO_REUSEPORT
+ * @return the new non-blocking listen socket,
+ *         #MHD_INVALID_SOCKET on error
+ */
+static MHD_socket
+create_worker_listen_socket (struct MHD_Daemon *daemon)
+{
+#if defined(SO_REUSEPORT) && ! defined(_WIN32)
+#if HAVE_INET6
+  struct sockaddr_in6 addrstorage;
+#else
+  struct sockaddr_in addrstorage;
+#endif
+  struct sockaddr *addr = (struct sockaddr *) &addrstorage;
+  socklen_t addrlen = sizeof (addrstorage);
+  const int on = 1;
+  int sk_flags;
+  MHD_socket fd;
+
+  /* also picks up the port the kernel chose if we were given port 0 */
+  if (0 != getsockname (daemon->socket_fd, addr, &addrlen))
+    {
+#if HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Call to getsockname failed: %s\n",
+                MHD_socket_last_strerr_ ());
+#endif
+      return MHD_INVALID_SOCKET;
+    }
+  fd = create_socket (daemon,
+                      (0 != (daemon->options & MHD_USE_IPv6)) ? PF_INET6 : PF_INET,
+                      SOCK_STREAM, 0);
+  if (MHD_INVALID_SOCKET == fd)
+    {
+#if HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Call to socket failed: %s\n",
+                MHD_socket_last_strerr_ ());
+#endif
+      return MHD_INVALID_SOCKET;
+    }
+  if (0 > setsockopt (fd,
+                      SOL_SOCKET,
+                      SO_REUSEPORT,
+                      (void*)&on, sizeof (on)))
+    {
+#if HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "setsockopt failed: %s\n",
+                MHD_socket_last_strerr_ ());
+#endif
+      goto close_and_fail;
+    }
+#if defined(IPPROTO_IPV6) && defined(IPV6_V6ONLY)
+  if (0 != (daemon->options & MHD_USE_IPv6))
+    {
+      const int v6only = (MHD_USE_DUAL_STACK != (daemon->options & MHD_USE_DUAL_STACK));
+
+      if (0 > setsockopt (fd,
+                          IPPROTO_IPV6, IPV6_V6ONLY,
+                          &v6only, sizeof (v6only)))
+        {
+#if HAVE_MESSAGES
+          MHD_DLOG (daemon,
+                    "setsockopt failed: %s\n",
+                    MHD_socket_last_strerr_ ());
+#endif
+        }
+    }
+#endif
+  if (-1 == bind (fd, addr, addrlen))
+    {
+#if HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Failed to bind worker socket to port %u: %s\n",
+                (unsigned int) daemon->port,
+                MHD_socket_last_strerr_ ());
+#endif
+      goto close_and_fail;
+    }
+#ifdef TCP_FASTOPEN
+  if ( (0 != (daemon->options & MHD_USE_TCP_FASTOPEN)) &&
+       (0 != setsockopt (fd,
+                         IPPROTO_TCP, TCP_FASTOPEN,
+                         &daemon->fastopen_queue_size,
+                         sizeof (daemon->fastopen_queue_size))) )
+    {
+#if HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "setsockopt failed: %s\n",
+                MHD_socket_last_strerr_ ());
+#endif
+    }
+#endif
+  /* accept must be non-blocking, as for the shared socket */
+  sk_flags = fcntl (fd, F_GETFL);
+  if ( (sk_flags < 0) ||
+       (0 != fcntl (fd, F_SETFL, sk_flags | O_NONBLOCK)) )
+    {
+#if HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Failed to make listen socket non-blocking: %s\n",
+                MHD_socket_last_strerr_ ());
+#endif
+      goto close_and_fail;
+    }
+  if ( (fd >= FD_SETSIZE) &&
+       (0 == (daemon->options & (MHD_USE_POLL | MHD_USE_EPOLL_LINUX_ONLY))) )
+    {
+#if HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Socket descriptor larger than FD_SETSIZE: %d > %d\n",
+                fd,
+                FD_SETSIZE);
+#endif
+      goto close_and_fail;
+    }
+  if (listen (fd, daemon->listen_backlog_size) < 0)
+    {
+#if HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Failed to listen for connections: %s\n",
+                MHD_socket_last_strerr_ ());
+#endif
+      goto close_and_fail;
+    }
+  return fd;
+
+ close_and_fail:
+  if (0 != MHD_socket_close_ (fd))
+    MHD_PANIC ("close failed\n");
+  return MHD_INVALID_SOCKET;
+#else
+  return MHD_INVALID_SOCKET;
+#endif
+}
+
+
 #if EPOLL_SUPPORT
 /**
  * Setup epoll() FD for the daemon and initialize it to listen
@@ -3647,6 +3814,10 @@ MHD_start_daemon_va (unsigned int flags,
 #ifndef TCP_FASTOPEN
   if (0 != (flags & MHD_USE_TCP_FASTOPEN))
     return NULL;
+#endif
+#if ! defined(SO_REUSEPORT) || defined(_WIN32)
+  if (0 != (flags & MHD_USE_LISTEN_SOCKET_PER_THREAD))
+    return NULL;
 #endif
   if (NULL == dh)
     return NULL;
@@ -3658,7 +3829,9 @@ MHD_start_daemon_va (unsigned int flags,
 #endif
   /* try to open listen socket */
   daemon->socket_fd = MHD_INVALID_SOCKET;
+  daemon->worker_socket_fd = MHD_INVALID_SOCKET;
   daemon->listening_address_reuse = 0;
+  daemon->listen_backlog_size = SOMAXCONN;
   daemon->options = flags;
 #if WINDOWS
   /* Winsock is broken with respect to 'shutdown';
@@ -3777,6 +3950,21 @@ MHD_start_daemon_va (unsigned int flags,
       goto free_and_fail;
     }
 
+  if (0 != (flags & MHD_USE_LISTEN_SOCKET_PER_THREAD))
+    {
+      if ( (MHD_INVALID_SOCKET != daemon->socket_fd) ||
+           (0 != (flags & MHD_USE_NO_LISTEN_SOCKET)) ||
+           (daemon->listening_address_reuse < 0) )
+        {
+#if HAVE_MESSAGES
+          MHD_DLOG (daemon,
+                    "MHD_USE_LISTEN_SOCKET_PER_THREAD requires MHD to create a reusable listen socket\n");
+#endif
+          goto free_and_fail;
+        }
+      daemon->listening_address_reuse = 1;
+    }
+
   if ( (MHD_USE_SUSPEND_RESUME == (flags & MHD_USE_SUSPEND_RESUME)) &&
        (0 != (flags & MHD_USE_THREAD_PER_CONNECTION)) )
     {
@@ -3856,14 +4044,6 @@ MHD_start_daemon_va (unsigned int flags,
               goto free_and_fail;
             }
 #else
-#ifndef SO_REUSEPORT
-#ifdef LINUX
-/* Supported since Linux 3.9, but often not present (or commented out)
-   in the headers at this time; but 15 is reserved for this and
-   thus should be safe to use. */
-#define SO_REUSEPORT 15
-#endif
-#endif
 #ifdef SO_REUSEPORT
           if (0 > setsockopt (socket_fd,
                               SOL_SOCKET,
@@ -4026,7 +4206,7 @@ MHD_start_daemon_va (unsigned int flags,
 	    }
 	}
 #endif
-      if (listen (socket_fd, 32) < 0)
+      if (listen (socket_fd, daemon->listen_backlog_size) < 0)
 	{
 #if HAVE_MESSAGES
           MHD_DLOG (daemon,
@@ -4198,6 +4378,17 @@ MHD_start_daemon_va (unsigned int flags,
           d->worker_pool_size = 0;
           d->worker_pool = NULL;
 
+          /* The first worker keeps using the master's socket, the
+             others open their own next to it */
+          if ( (0 != (flags & MHD_USE_LISTEN_SOCKET_PER_THREAD)) &&
+               (i > 0) )
+            {
+              d->worker_socket_fd = create_worker_listen_socket (daemon);
+              if (MHD_INVALID_SOCKET == d->worker_socket_fd)
+                goto thread_failed;
+              d->socket_fd = d->worker_socket_fd;
+            }
+
           if ( (MHD_USE_SUSPEND_RESUME == (flags & MHD_USE_SUSPEND_RESUME)) &&
                (0 != MHD_pipe_ (d->wpipe)) )
             {
@@ -4275,6 +4466,11 @@ thread_failed:
      MHD_stop_daemon (as we do below) doesn't work here since it
      assumes a 0-sized thread pool means we had been in the default
      MHD_USE_SELECT_INTERNALLY mode. */
+  if ( (NULL != daemon->worker_pool) &&
+       (i < daemon->worker_pool_size) &&
+       (MHD_INVALID_SOCKET != daemon->worker_pool[i].worker_socket_fd) &&
+       (0 != MHD_socket_close_ (daemon->worker_pool[i].worker_socket_fd)) )
+    MHD_PANIC ("close failed\n");
   if (0 == i)
     {
       if ( (MHD_INVALID_SOCKET != socket_fd) &&
@@ -4446,6 +4642,11 @@ MHD_stop_daemon (struct MHD_Daemon *daemon)
 	{
 	  daemon->worker_pool[i].shutdown = MHD_YES;
 	  daemon->worker_pool[i].socket_fd = MHD_INVALID_SOCKET;
+#ifdef HAVE_LISTEN_SHUTDOWN
+	  if ( (MHD_INVALID_PIPE_ == daemon->wpipe[1]) &&
+	       (MHD_INVALID_SOCKET != daemon->worker_pool[i].worker_socket_fd) )
+	    (void) shutdown (daemon->worker_pool[i].worker_socket_fd, SHUT_RDWR);
+#endif
 #if EPOLL_SUPPORT
 	  if ( (0 != (daemon->options & MHD_USE_EPOLL_LINUX_ONLY)) &&
 	       (-1 != daemon->worker_pool[i].epoll_fd) &&
@@ -4496,6 +4697,9 @@ MHD_stop_daemon (struct MHD_Daemon *daemon)
 	  if (0 != MHD_join_thread_ (daemon->worker_pool[i].pid))
 	      MHD_PANIC ("Failed to join a thread\n");
 	  close_all_connections (&daemon->worker_pool[i]);
+	  if ( (MHD_INVALID_SOCKET != daemon->worker_pool[i].worker_socket_fd) &&
+	       (0 != MHD_socket_close_ (daemon->worker_pool[i].worker_socket_fd)) )
+	    MHD_PANIC ("close failed\n");
 	  (void) MHD_mutex_destroy_ (&daemon->worker_pool[i].cleanup_connection_mutex);
 #if EPOLL_SUPPORT
 	  if ( (-1 != daemon->worker_pool[i].epoll_fd) &&
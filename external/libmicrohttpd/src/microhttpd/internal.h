@@ -311,6 +311,17 @@ struct MHD_Response
    */
   unsigned int reference_count;
 
+  /**
+   * Pieces of the data if this response is iovec-backed (see
+   * #MHD_create_response_from_iovec), NULL otherwise.
+   */
+  struct MHD_IoVec *data_iov;
+
+  /**
+   * Number of elements in @e data_iov.
+   */
+  unsigned int data_iovcnt;
+
   /**
    * File-descriptor if this response is FD-backed.
    */
@@ -862,6 +873,13 @@ struct MHD_Connection
    */
   int suspended;
 
+  /**
+   * Is TCP_CORK currently set on the socket?  Stays set between
+   * pipelined responses so that they go out in as few segments as
+   * possible.
+   */
+  int sk_corked;
+
   /**
    * Is the connection wanting to resume?
    */
@@ -1116,6 +1134,19 @@ struct MHD_Daemon
    */
   MHD_socket socket_fd;
 
+  /**
+   * Listen socket this worker opened for itself (see
+   * #MHD_USE_LISTEN_SOCKET_PER_THREAD), to be closed by the master
+   * when the pool is stopped.  #MHD_INVALID_SOCKET if the daemon
+   * uses the master's listen socket.
+   */
+  MHD_socket worker_socket_fd;
+
+  /**
+   * Backlog passed to listen().
+   */
+  unsigned int listen_backlog_size;
+
   /**
    * Whether to allow/disallow/ignore reuse of listening address.
    * The semantics is the following:
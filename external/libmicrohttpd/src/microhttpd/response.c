@@ -25,6 +25,7 @@
  */
 
 #include "internal.h"
+#include <limits.h>
 #include "response.h"
 
 #if defined(_WIN32) && defined(MHD_W32_MUTEX_)
@@ -398,6 +399,150 @@ MHD_create_response_from_fd (size_t size,
 }
 
 
+/**
+ * Create a response object whose data is made of several pieces of
+ * memory that MHD does not copy.  The same pieces may be referenced
+ * by any number of responses, and the response object can be
+ * extended with header information and then be used any number of
+ * times.
+ *
+ * @param iov the pieces of the response data, in order; the array
+ *        itself is copied, the memory it points to must remain
+ *        valid and unchanged until @a free_cb is called
+ * @param iovcnt number of elements in @a iov
+ * @param free_cb called with @a cls when the response is destroyed
+ *        (to release the pieces), may be NULL
+ * @param cls extra argument to @a free_cb
+ * @return NULL on error (i.e. invalid arguments, out of memory)
+ * @ingroup response
+ */
+struct MHD_Response *
+MHD_create_response_from_iovec (const struct MHD_IoVec *iov,
+                                unsigned int iovcnt,
+                                MHD_ContentReaderFreeCallback free_cb,
+                                void *cls)
+{
+  struct MHD_Response *response;
+  uint64_t total_size;
+  unsigned int i;
+
+  if ( (NULL == iov) && (0 != iovcnt) )
+    return NULL;
+#if SIZE_MAX <= UINT_MAX
+  /* only then can the size of the allocation below overflow */
+  if (iovcnt >= (SIZE_MAX - sizeof (struct MHD_Response)) / sizeof (struct MHD_IoVec))
+    return NULL;
+#endif
+  if (NULL == (response = malloc (sizeof (struct MHD_Response) +
+                                  iovcnt * sizeof (struct MHD_IoVec))))
+    return NULL;
+  memset (response, 0, sizeof (struct MHD_Response));
+  response->fd = -1;
+  response->data_iov = (struct MHD_IoVec *) &response[1];
+  if (MHD_YES != MHD_mutex_create_ (&response->mutex))
+    {
+      free (response);
+      return NULL;
+    }
+  /* leave out empty pieces, so that the send path never has to
+     skip them */
+  total_size = 0;
+  for (i = 0; i < iovcnt; i++)
+    {
+      if (0 == iov[i].iov_len)
+        continue;
+      response->data_iov[response->data_iovcnt++] = iov[i];
+      total_size += iov[i].iov_len;
+    }
+  response->crfc = free_cb;
+  response->crc_cls = cls;
+  response->reference_count = 1;
+  response->total_size = total_size;
+  return response;
+}
+
+
+#if defined(MAP_SHARED) && !defined(_WIN32)
+/**
+ * Destroy the context of a mapped file response.  Unmaps the file.
+ *
+ * @param cls pointer to the response
+ */
+static void
+unmap_callback (void *cls)
+{
+  struct MHD_Response *response = cls;
+  uintptr_t start = (uintptr_t) response->data_iov[0].iov_base;
+  size_t delta = start % (uintptr_t) sysconf (_SC_PAGESIZE);
+
+  (void) munmap ((void *) (start - delta),
+                 response->data_iov[0].iov_len + delta);
+}
+#endif
+
+
+/**
+ * Create a response object from a file that is mapped into memory
+ * once and then sent like a response from
+ * #MHD_create_response_from_iovec.  If the file cannot be mapped,
+ * or is shorter than @a offset plus @a size, this falls back to
+ * #MHD_create_response_from_fd_at_offset.
+ *
+ * @param size size of the data portion of the response
+ * @param fd file descriptor referring to a file on disk with the
+ *        data; will be closed by MHD (when the response is destroyed
+ *        at the latest); the file must not be truncated while the
+ *        response exists
+ * @param offset offset of the data in the file
+ * @return NULL on error (i.e. invalid arguments, out of memory)
+ * @ingroup response
+ */
+struct MHD_Response *
+MHD_create_response_from_fd_mapped (size_t size,
+                                    int fd,
+                                    off_t offset)
+{
+#if defined(MAP_SHARED) && !defined(_WIN32)
+  struct MHD_Response *response;
+  struct MHD_IoVec iov;
+  struct stat st;
+  void *map;
+  size_t delta;
+
+  if ( (0 == size) || (offset < 0) )
+    return MHD_create_response_from_fd_at_offset (size, fd, offset);
+  /* touching a mapped page past the end of the file raises SIGBUS,
+     while reading it just comes up short */
+  if ( (0 != fstat (fd, &st)) ||
+       (! S_ISREG (st.st_mode)) ||
+       ((uint64_t) st.st_size < (uint64_t) offset) ||
+       ((uint64_t) st.st_size - (uint64_t) offset < size) )
+    return MHD_create_response_from_fd_at_offset (size, fd, offset);
+  /* mmap() wants a page aligned offset */
+  delta = (size_t) (offset % sysconf (_SC_PAGESIZE));
+  if (size > SIZE_MAX - delta)
+    return NULL;
+  map = mmap (NULL, size + delta, PROT_READ, MAP_SHARED, fd, offset - delta);
+  if (MAP_FAILED == map)
+    return MHD_create_response_from_fd_at_offset (size, fd, offset);
+  iov.iov_base = (const char *) map + delta;
+  iov.iov_len = size;
+  response = MHD_create_response_from_iovec (&iov, 1, &unmap_callback, NULL);
+  if (NULL == response)
+    {
+      (void) munmap (map, size + delta);
+      return NULL;
+    }
+  response->crc_cls = response;
+  /* the mapping stays valid without the descriptor */
+  (void) close (fd);
+  return response;
+#else
+  return MHD_create_response_from_fd_at_offset (size, fd, offset);
+#endif
+}
+
+
 /**
  * Create a response object.  The response object can be extended with
  * header information and then be used any number of times.
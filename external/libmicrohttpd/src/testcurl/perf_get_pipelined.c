@@ -0,0 +1,526 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2015 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 2, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file perf_get_pipelined.c
+ * @brief benchmark keep-alive and pipelined GET operations on
+ *        many (up to 10k) concurrent connections against the
+ *        epoll thread pool, with one shared listen socket and
+ *        with a listen socket per thread.
+ *        libcurl cannot pipeline, so the client here is a small
+ *        epoll loop speaking HTTP/1.1 over plain sockets; it runs
+ *        in a separate process on the same machine, so as with
+ *        the other perf_ tests only the relative scores between
+ *        MHD versions are meaningful.
+ */
+
+#include "MHD_config.h"
+#include "platform.h"
+#include <microhttpd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "gauger.h"
+
+#if EPOLL_SUPPORT
+#include <sys/epoll.h>
+#include <netinet/tcp.h>
+#endif
+
+#if defined(CPU_COUNT) && (CPU_COUNT+0) < 2
+#undef CPU_COUNT
+#endif
+#if !defined(CPU_COUNT)
+#define CPU_COUNT 2
+#endif
+
+/**
+ * How many connections do we keep open (fewer if we
+ * are not allowed to open that many file descriptors)?
+ */
+#define CONNECTIONS 10000
+
+/**
+ * How many requests do we send on each connection before
+ * waiting for the responses, when pipelining?
+ */
+#define DEPTH 16
+
+/**
+ * How many requests do we do for each test in total
+ * (at least one batch per connection)?
+ */
+#define REQUESTS 200000
+
+/**
+ * Body of our response.
+ */
+#define BODY "/hello_world"
+
+/**
+ * Request we send.
+ */
+#define REQUEST "GET /hello_world HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n"
+
+/**
+ * Response to return (re-used).
+ */
+static struct MHD_Response *response;
+
+/**
+ * Number of connections we use.
+ */
+static unsigned int conns;
+
+
+#if EPOLL_SUPPORT
+
+/**
+ * State of one client connection.
+ */
+struct Conn
+{
+  /**
+   * Socket of the connection.
+   */
+  int fd;
+
+  /**
+   * Batches of requests still to send.
+   */
+  unsigned int batches;
+
+  /**
+   * Responses still missing from the current batch.
+   */
+  unsigned int pending;
+
+  /**
+   * When the current batch was sent (in us).
+   */
+  unsigned long long sent;
+
+  /**
+   * Bytes in @e buf.
+   */
+  size_t off;
+
+  /**
+   * Partially received responses.
+   */
+  char buf[2048];
+};
+
+
+/**
+ * Get the current timestamp
+ *
+ * @return current time in us
+ */
+static unsigned long long
+now ()
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return (((unsigned long long) tv.tv_sec * 1000000LL) +
+	  (unsigned long long) tv.tv_usec);
+}
+
+
+static int
+cmp_latency (const void *a, const void *b)
+{
+  unsigned long long la = *(const unsigned long long *) a;
+  unsigned long long lb = *(const unsigned long long *) b;
+
+  return (la > lb) - (la < lb);
+}
+
+
+/**
+ * Send the next batch of requests on a connection.
+ *
+ * @param c connection to use
+ * @param depth number of requests to send
+ * @return 0 on success
+ */
+static int
+send_batch (struct Conn *c, unsigned int depth)
+{
+  char req[DEPTH * sizeof (REQUEST)];
+  size_t len = 0;
+  unsigned int i;
+
+  for (i = 0; i < depth; i++)
+    {
+      memcpy (&req[len], REQUEST, strlen (REQUEST));
+      len += strlen (REQUEST);
+    }
+  c->sent = now ();
+  c->pending = depth;
+  c->batches--;
+  /* a fresh socket buffer always takes a few hundred bytes */
+  if (len != (size_t) send (c->fd, req, len, MSG_NOSIGNAL))
+    {
+      fprintf (stderr, "send failed: %s\n", strerror (errno));
+      return 1;
+    }
+  return 0;
+}
+
+
+/**
+ * Take complete responses out of the connection's buffer.
+ *
+ * @param c connection to check
+ * @param lat where to store the latency of each response
+ * @param nlat number of latencies stored so far, updated
+ * @return 0 on success
+ */
+static int
+parse_responses (struct Conn *c,
+		 unsigned long long *lat,
+		 unsigned int *nlat)
+{
+  unsigned long long t = now ();
+  const char *end;
+  size_t len;
+
+  while (c->pending > 0)
+    {
+      end = memmem (c->buf, c->off, "\r\n\r\n", 4);
+      if (NULL == end)
+	return 0;
+      len = end - c->buf + 4 + strlen (BODY);
+      if (c->off < len)
+	return 0;
+      if (0 != strncmp (c->buf, "HTTP/1.1 200 ", strlen ("HTTP/1.1 200 ")))
+	{
+	  fprintf (stderr, "unexpected response: %.*s\n", (int) c->off, c->buf);
+	  return 1;
+	}
+      memmove (c->buf, &c->buf[len], c->off - len);
+      c->off -= len;
+      c->pending--;
+      lat[(*nlat)++] = t - c->sent;
+    }
+  return 0;
+}
+
+
+/**
+ * Open the connections and run the requests against the daemon on
+ * the given port; report requests/s and the 99th percentile latency.
+ *
+ * @param port port of the daemon
+ * @param depth how many requests to pipeline on each connection
+ * @param desc description of the threading mode we used
+ * @return 0 on success
+ */
+static int
+run_client (int port, unsigned int depth, const char *desc)
+{
+  struct sockaddr_in sa;
+  struct epoll_event ev;
+  struct epoll_event events[128];
+  struct Conn *cs;
+  struct Conn *c;
+  unsigned long long *lat;
+  unsigned long long start_time;
+  unsigned long long elapsed;
+  unsigned int batches;
+  unsigned int nlat;
+  unsigned int total;
+  unsigned int open;
+  unsigned int active;
+  unsigned int i;
+  int efd;
+  int n;
+  int err;
+  socklen_t len;
+  ssize_t got;
+  double rps;
+  char mode[64];
+
+  batches = REQUESTS / (conns * depth);
+  if (0 == batches)
+    batches = 1;
+  total = conns * depth * batches;
+  cs = calloc (conns, sizeof (struct Conn));
+  lat = malloc (total * sizeof (unsigned long long));
+  efd = epoll_create1 (EPOLL_CLOEXEC);
+  if ( (NULL == cs) || (NULL == lat) || (-1 == efd) )
+    return 1;
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (port);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+
+  /* connect everything first, that is not what we measure */
+  for (i = 0; i < conns; i++)
+    {
+      c = &cs[i];
+      c->fd = socket (PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      if (-1 == c->fd)
+	{
+	  fprintf (stderr, "socket failed: %s\n", strerror (errno));
+	  return 1;
+	}
+      if ( (0 != connect (c->fd, (struct sockaddr *) &sa, sizeof (sa))) &&
+	   (EINPROGRESS != errno) )
+	{
+	  fprintf (stderr, "connect failed: %s\n", strerror (errno));
+	  return 1;
+	}
+      ev.events = EPOLLOUT;
+      ev.data.ptr = c;
+      if (0 != epoll_ctl (efd, EPOLL_CTL_ADD, c->fd, &ev))
+	return 1;
+    }
+  open = 0;
+  while (open < conns)
+    {
+      n = epoll_wait (efd, events, 128, 10000);
+      if (n <= 0)
+	{
+	  fprintf (stderr, "timeout connecting\n");
+	  return 1;
+	}
+      for (i = 0; i < (unsigned int) n; i++)
+	{
+	  c = events[i].data.ptr;
+	  len = sizeof (err);
+	  if ( (0 != getsockopt (c->fd, SOL_SOCKET, SO_ERROR, &err, &len)) ||
+	       (0 != err) )
+	    {
+	      fprintf (stderr, "connect failed: %s\n", strerror (err));
+	      return 1;
+	    }
+	  ev.events = EPOLLIN;
+	  ev.data.ptr = c;
+	  if (0 != epoll_ctl (efd, EPOLL_CTL_MOD, c->fd, &ev))
+	    return 1;
+	  open++;
+	}
+    }
+
+  nlat = 0;
+  active = conns;
+  start_time = now ();
+  for (i = 0; i < conns; i++)
+    {
+      cs[i].batches = batches;
+      if (0 != send_batch (&cs[i], depth))
+	return 1;
+    }
+  while (active > 0)
+    {
+      n = epoll_wait (efd, events, 128, 10000);
+      if (n <= 0)
+	{
+	  fprintf (stderr,
+		   "timeout waiting for responses (%u connections active)\n",
+		   active);
+	  return 1;
+	}
+      for (i = 0; i < (unsigned int) n; i++)
+	{
+	  c = events[i].data.ptr;
+	  while (1)
+	    {
+	      got = recv (c->fd, &c->buf[c->off], sizeof (c->buf) - c->off, 0);
+	      if (got <= 0)
+		break;
+	      c->off += got;
+	      if (0 != parse_responses (c, lat, &nlat))
+		return 1;
+	      if (sizeof (c->buf) == c->off)
+		return 1;
+	    }
+	  if (0 == got)
+	    {
+	      fprintf (stderr, "connection closed by server\n");
+	      return 1;
+	    }
+	  if (EAGAIN != errno)
+	    {
+	      fprintf (stderr, "recv failed: %s\n", strerror (errno));
+	      return 1;
+	    }
+	  if (0 != c->pending)
+	    continue;
+	  if (0 == c->batches)
+	    active--;
+	  else if (0 != send_batch (c, depth))
+	    return 1;
+	}
+    }
+  elapsed = now () - start_time;
+
+  qsort (lat, nlat, sizeof (unsigned long long), &cmp_latency);
+  rps = ((double) nlat * 1000000.0) / ((double) elapsed);
+  snprintf (mode, sizeof (mode), "%s, %u connections", desc, conns);
+  fprintf (stderr,
+	   "%s GETs using %s: %f requests/s, 99%% within %f ms\n",
+	   (1 == depth) ? "Keep-alive" : "Pipelined",
+	   mode,
+	   rps,
+	   lat[(nlat * 99) / 100] / 1000.0);
+  GAUGER (mode,
+	  (1 == depth) ? "Keep-alive GETs" : "Pipelined GETs",
+	  rps,
+	  "requests/s");
+  GAUGER (mode,
+	  (1 == depth) ? "Keep-alive GET p99 latency" : "Pipelined GET p99 latency",
+	  lat[(nlat * 99) / 100] / 1000.0,
+	  "ms");
+  for (i = 0; i < conns; i++)
+    close (cs[i].fd);
+  close (efd);
+  free (lat);
+  free (cs);
+  return 0;
+}
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data, size_t *upload_data_size,
+          void **unused)
+{
+  static int ptr;
+  const char *me = cls;
+  int ret;
+
+  if (0 != strcmp (me, method))
+    return MHD_NO;              /* unexpected method */
+  if (&ptr != *unused)
+    {
+      *unused = &ptr;
+      return MHD_YES;
+    }
+  *unused = NULL;
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  if (ret == MHD_NO)
+    abort ();
+  return ret;
+}
+
+
+/**
+ * Run the client in a child process, keep-alive first, then
+ * pipelined.
+ *
+ * @param port port of the daemon
+ * @param desc description of the threading mode we used
+ * @return 0 on success
+ */
+static int
+do_gets (int port, const char *desc)
+{
+  pid_t pid;
+  int status;
+
+  pid = fork ();
+  if (pid == -1)
+    abort ();
+  if (pid == 0)
+    _exit ( (0 != run_client (port, 1, desc)) ||
+	    (0 != run_client (port, DEPTH, desc)) );
+  status = 1;
+  waitpid (pid, &status, 0);
+  return 0 != status;
+}
+
+
+static int
+testPoolGet (unsigned int flags, const char *desc)
+{
+  struct MHD_Daemon *d;
+  const union MHD_DaemonInfo *dinfo;
+  struct sockaddr_in sa;
+  socklen_t len = sizeof (sa);
+  int ret;
+
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_EPOLL_LINUX_ONLY |
+			MHD_USE_DEBUG | flags,
+                        0, NULL, NULL, &ahc_echo, "GET",
+                        MHD_OPTION_THREAD_POOL_SIZE, CPU_COUNT,
+                        /* the limit is split evenly over the threads,
+                           the connections need not be */
+                        MHD_OPTION_CONNECTION_LIMIT, conns * CPU_COUNT,
+                        MHD_OPTION_CONNECTION_MEMORY_LIMIT, (size_t) 8192,
+			MHD_OPTION_END);
+  if (d == NULL)
+    return 16;
+  dinfo = MHD_get_daemon_info (d, MHD_DAEMON_INFO_LISTEN_FD);
+  if ( (NULL == dinfo) ||
+       (0 != getsockname (dinfo->listen_fd, (struct sockaddr *) &sa, &len)) )
+    {
+      MHD_stop_daemon (d);
+      return 32;
+    }
+  ret = do_gets (ntohs (sa.sin_port), desc);
+  MHD_stop_daemon (d);
+  return ret ? 64 : 0;
+}
+
+#endif
+
+
+int
+main (int argc, char *const *argv)
+{
+  unsigned int errorCount = 0;
+#if EPOLL_SUPPORT
+  struct rlimit rl;
+
+  /* client and server run in different processes, each needs one
+     descriptor per connection plus a few; the server may still hold
+     the connections of the previous run for a moment */
+  if (0 != getrlimit (RLIMIT_NOFILE, &rl))
+    return 2;
+  rl.rlim_cur = rl.rlim_max;
+  (void) setrlimit (RLIMIT_NOFILE, &rl);
+  if (0 != getrlimit (RLIMIT_NOFILE, &rl))
+    return 2;
+  conns = CONNECTIONS;
+  if (rl.rlim_cur < 2 * conns + 64)
+    conns = (rl.rlim_cur > 192) ? (rl.rlim_cur - 64) / 2 : 64;
+  response = MHD_create_response_from_buffer (strlen (BODY),
+					      BODY,
+					      MHD_RESPMEM_PERSISTENT);
+  errorCount += testPoolGet (0, "epoll thread pool");
+  errorCount += testPoolGet (MHD_USE_LISTEN_SOCKET_PER_THREAD,
+			     "epoll thread pool, listen socket per thread");
+  MHD_destroy_response (response);
+  if (errorCount != 0)
+    fprintf (stderr, "Error (code: %u)\n", errorCount);
+  return errorCount != 0;       /* 0 == pass */
+#else
+  return 77;                    /* skip, the client needs epoll */
+#endif
+}
@@ -0,0 +1,275 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2007, 2009 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 2, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_get_iovec.c
+ * @brief  Testcase for libmicrohttpd responses from an iovec and
+ *         from a mapped file
+ * @author Christian Grothoff
+ */
+
+#include "MHD_config.h"
+#include "platform.h"
+#include "platform_interface.h"
+#include <curl/curl.h>
+#include <microhttpd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <fcntl.h>
+
+#ifndef WINDOWS
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#if defined(CPU_COUNT) && (CPU_COUNT+0) < 2
+#undef CPU_COUNT
+#endif
+#if !defined(CPU_COUNT)
+#define CPU_COUNT 2
+#endif
+
+/**
+ * Size of the body; large enough to need several writes.
+ */
+#define BODY_SIZE (1024 * 1024 + 17)
+
+/**
+ * Number of pieces the iovec body is split into; more than
+ * fit into one sendmsg() call.
+ */
+#define PIECES 100
+
+/**
+ * Offset into the file of the mapped body; deliberately not
+ * page aligned.
+ */
+#define FILE_OFFSET 1000
+
+static char *sourcefile;
+
+static char *body;
+
+static int freed;
+
+static int oneone;
+
+struct CBC
+{
+  char *buf;
+  size_t pos;
+  size_t size;
+};
+
+static size_t
+copyBuffer (void *ptr, size_t size, size_t nmemb, void *ctx)
+{
+  struct CBC *cbc = ctx;
+
+  if (cbc->pos + size * nmemb > cbc->size)
+    return 0;                   /* overflow */
+  memcpy (&cbc->buf[cbc->pos], ptr, size * nmemb);
+  cbc->pos += size * nmemb;
+  return size * nmemb;
+}
+
+
+static void
+free_cb (void *cls)
+{
+  if (cls != body)
+    abort ();
+  freed++;
+}
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data, size_t *upload_data_size,
+          void **unused)
+{
+  static int ptr;
+  const char *me = cls;
+  struct MHD_Response *response;
+  struct MHD_IoVec iov[PIECES];
+  unsigned int i;
+  int ret;
+  int fd;
+
+  if (0 != strcmp (me, method))
+    return MHD_NO;              /* unexpected method */
+  if (&ptr != *unused)
+    {
+      *unused = &ptr;
+      return MHD_YES;
+    }
+  *unused = NULL;
+  if (0 == strcmp (url, "/mapped"))
+    {
+      fd = open (sourcefile, O_RDONLY);
+      if (fd == -1)
+        {
+          fprintf (stderr, "Failed to open `%s': %s\n",
+                   sourcefile,
+                   MHD_strerror_ (errno));
+          exit (1);
+        }
+      response = MHD_create_response_from_fd_mapped (BODY_SIZE, fd,
+                                                     FILE_OFFSET);
+    }
+  else
+    {
+      for (i = 0; i < PIECES; i++)
+        {
+          iov[i].iov_base = &body[i * (BODY_SIZE / PIECES)];
+          iov[i].iov_len = BODY_SIZE / PIECES;
+        }
+      iov[PIECES - 1].iov_len += BODY_SIZE % PIECES;
+      response = MHD_create_response_from_iovec (iov, PIECES,
+                                                 &free_cb, body);
+    }
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  if (ret == MHD_NO)
+    abort ();
+  return ret;
+}
+
+
+static int
+testGet (unsigned int flags, int port, const char *url)
+{
+  struct MHD_Daemon *d;
+  CURL *c;
+  char u[64];
+  struct CBC cbc;
+  CURLcode errornum;
+  int ret;
+
+  cbc.buf = malloc (BODY_SIZE + 1);
+  cbc.size = BODY_SIZE + 1;
+  cbc.pos = 0;
+  if (0 != (flags & MHD_USE_THREAD_PER_CONNECTION))
+    d = MHD_start_daemon (flags | MHD_USE_DEBUG,
+                          port, NULL, NULL, &ahc_echo, "GET",
+                          MHD_OPTION_END);
+  else
+    d = MHD_start_daemon (flags | MHD_USE_DEBUG,
+                          port, NULL, NULL, &ahc_echo, "GET",
+                          MHD_OPTION_THREAD_POOL_SIZE, CPU_COUNT,
+                          MHD_OPTION_END);
+  if (d == NULL)
+    {
+      free (cbc.buf);
+      return 1;
+    }
+  snprintf (u, sizeof (u), "http://127.0.0.1:%d%s", port, url);
+  c = curl_easy_init ();
+  curl_easy_setopt (c, CURLOPT_URL, u);
+  curl_easy_setopt (c, CURLOPT_WRITEFUNCTION, &copyBuffer);
+  curl_easy_setopt (c, CURLOPT_WRITEDATA, &cbc);
+  curl_easy_setopt (c, CURLOPT_FAILONERROR, 1);
+  curl_easy_setopt (c, CURLOPT_TIMEOUT, 150L);
+  curl_easy_setopt (c, CURLOPT_CONNECTTIMEOUT, 150L);
+  if (oneone)
+    curl_easy_setopt (c, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+  else
+    curl_easy_setopt (c, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_0);
+  /* NOTE: use of CONNECTTIMEOUT without also
+     setting NOSIGNAL results in really weird
+     crashes on my system! */
+  curl_easy_setopt (c, CURLOPT_NOSIGNAL, 1);
+  ret = 0;
+  if (CURLE_OK != (errornum = curl_easy_perform (c)))
+    {
+      fprintf (stderr,
+               "curl_easy_perform failed: `%s'\n",
+               curl_easy_strerror (errornum));
+      ret = 2;
+    }
+  curl_easy_cleanup (c);
+  MHD_stop_daemon (d);
+  if ( (0 == ret) &&
+       (cbc.pos != BODY_SIZE) )
+    ret = 4;
+  if ( (0 == ret) &&
+       (0 != memcmp (body, cbc.buf, BODY_SIZE)) )
+    ret = 8;
+  free (cbc.buf);
+  return ret;
+}
+
+
+int
+main (int argc, char *const *argv)
+{
+  unsigned int errorCount = 0;
+  const char *tmp;
+  FILE *f;
+  size_t i;
+
+  if ( (NULL == (tmp = getenv ("TMPDIR"))) &&
+       (NULL == (tmp = getenv ("TMP"))) &&
+       (NULL == (tmp = getenv ("TEMP"))) )
+    tmp = "/tmp";
+  sourcefile = malloc (strlen (tmp) + 32);
+  sprintf (sourcefile,
+	   "%s/%s",
+	   tmp,
+	   "test-mhd-iovec");
+  body = malloc (BODY_SIZE);
+  for (i = 0; i < BODY_SIZE; i++)
+    body[i] = (char) (i * 7 + i / 251);
+  f = fopen (sourcefile, "w");
+  if (NULL == f)
+    {
+      fprintf (stderr, "failed to write test file\n");
+      free (body);
+      free (sourcefile);
+      return 1;
+    }
+  for (i = 0; i < FILE_OFFSET; i++)
+    fputc ('x', f);
+  fwrite (body, BODY_SIZE, 1, f);
+  fclose (f);
+  oneone = (NULL != strrchr (argv[0], (int) '/')) ?
+    (NULL != strstr (strrchr (argv[0], (int) '/'), "11")) : 0;
+  if (0 != curl_global_init (CURL_GLOBAL_WIN32))
+    return 2;
+  errorCount += testGet (MHD_USE_SELECT_INTERNALLY, 11080, "/iovec");
+  errorCount += 16 * testGet (MHD_USE_THREAD_PER_CONNECTION, 1081, "/iovec");
+  errorCount += 256 * testGet (MHD_USE_SELECT_INTERNALLY, 1082, "/mapped");
+  errorCount += 4096 * testGet (MHD_USE_THREAD_PER_CONNECTION, 1083, "/mapped");
+  if (freed != 2)
+    errorCount += 65536;
+  if (errorCount != 0)
+    fprintf (stderr, "Error (code: %u)\n", errorCount);
+  curl_global_cleanup ();
+  unlink (sourcefile);
+  free (sourcefile);
+  free (body);
+  return errorCount != 0;       /* 0 == pass */
+}
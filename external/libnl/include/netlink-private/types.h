@@ -106,6 +106,8 @@ struct nl_cache_mngr
 	struct nl_sock *	cm_sock;
 	struct nl_sock *	cm_sync_sock;
 	struct nl_cache_assoc *	cm_assocs;
+	char *			cm_rbuf;
+	size_t			cm_rbufsize;
 };
 
 struct nl_parser_param;
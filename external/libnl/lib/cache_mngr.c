@@ -40,6 +40,9 @@
 /** @cond SKIP */
 #define NASSOC_INIT		16
 #define NASSOC_EXPAND		8
+
+/* datagrams read per recvmmsg() call by nl_cache_mngr_data_ready() */
+#define NL_MNGR_RECV_BATCH	16
 /** @endcond */
 
 static int include_cb(struct nl_object *obj, struct nl_parser_param *p)
@@ -64,32 +67,19 @@ static int include_cb(struct nl_object *obj, struct nl_parser_param *p)
 		return nl_cache_include(ca->ca_cache, obj, ca->ca_change, ca->ca_change_data);
 }
 
-static int event_input(struct nl_msg *msg, void *arg)
+static int event_parse(struct nl_cache_mngr *mngr, struct nlmsghdr *nlh)
 {
-	struct nl_cache_mngr *mngr = arg;
-	int protocol = nlmsg_get_proto(msg);
-	int type = nlmsg_hdr(msg)->nlmsg_type;
 	struct nl_cache_ops *ops;
 	int i, n;
 	struct nl_parser_param p = {
 		.pp_cb = include_cb,
 	};
 
-	NL_DBG(2, "Cache manager %p, handling new message %p as event\n",
-	       mngr, msg);
-#ifdef NL_DEBUG
-	if (nl_debug >= 4)
-		nl_msg_dump(msg, stderr);
-#endif
-
-	if (mngr->cm_protocol != protocol)
-		BUG();
-
 	for (i = 0; i < mngr->cm_nassocs; i++) {
 		if (mngr->cm_assocs[i].ca_cache) {
 			ops = mngr->cm_assocs[i].ca_cache->c_ops;
 			for (n = 0; ops->co_msgtypes[n].mt_id >= 0; n++)
-				if (ops->co_msgtypes[n].mt_id == type)
+				if (ops->co_msgtypes[n].mt_id == nlh->nlmsg_type)
 					goto found;
 		}
 	}
@@ -98,10 +88,27 @@ static int event_input(struct nl_msg *msg, void *arg)
 
 found:
 	NL_DBG(2, "Associated message %p to cache %p\n",
-	       msg, mngr->cm_assocs[i].ca_cache);
+	       nlh, mngr->cm_assocs[i].ca_cache);
 	p.pp_arg = &mngr->cm_assocs[i];
 
-	return nl_cache_parse(ops, NULL, nlmsg_hdr(msg), &p);
+	return nl_cache_parse(ops, NULL, nlh, &p);
+}
+
+static int event_input(struct nl_msg *msg, void *arg)
+{
+	struct nl_cache_mngr *mngr = arg;
+
+	NL_DBG(2, "Cache manager %p, handling new message %p as event\n",
+	       mngr, msg);
+#ifdef NL_DEBUG
+	if (nl_debug >= 4)
+		nl_msg_dump(msg, stderr);
+#endif
+
+	if (mngr->cm_protocol != nlmsg_get_proto(msg))
+		BUG();
+
+	return event_parse(mngr, nlmsg_hdr(msg));
 }
 
 /**
@@ -401,6 +408,157 @@ int nl_cache_mngr_poll(struct nl_cache_mngr *mngr, int timeout)
 	return nl_cache_mngr_data_ready(mngr);
 }
 
+/*
+ * Notifications were dropped, either by the kernel because the socket
+ * receive buffer overflowed or because a datagram did not fit into the
+ * receive buffer. Bring all caches back in line with a dump; the change
+ * callbacks are invoked for whatever differs from the cached state.
+ */
+static int mngr_resync(struct nl_cache_mngr *mngr)
+{
+	struct nl_cache_assoc *ca;
+	int i, err;
+
+	NL_DBG(1, "Cache manager %p, notifications lost, resyncing\n", mngr);
+
+	for (i = 0; i < mngr->cm_nassocs; i++) {
+		ca = &mngr->cm_assocs[i];
+		if (!ca->ca_cache)
+			continue;
+
+		err = nl_cache_resync(mngr->cm_sync_sock, ca->ca_cache,
+				      ca->ca_change, ca->ca_change_data);
+		if (err < 0)
+			return err;
+	}
+
+	return 0;
+}
+
+/*
+ * The socket callbacks may only be bypassed if nobody hooked into the
+ * receive path, nl_recvmsgs() is used otherwise. It is also used with
+ * NL_MSG_PEEK, which has nl_recv() size its buffer to fit any message.
+ */
+static int mngr_can_batch(struct nl_cache_mngr *mngr)
+{
+	struct nl_sock *sk = mngr->cm_sock;
+	struct nl_cb *cb = sk->s_cb;
+
+	return !cb->cb_recvmsgs_ow && !cb->cb_recv_ow &&
+	       !cb->cb_set[NL_CB_MSG_IN] && !cb->cb_set[NL_CB_INVALID] &&
+	       !(sk->s_flags & (NL_SOCK_PASSCRED | NL_MSG_PEEK));
+}
+
+static int mngr_recv_batch(struct nl_cache_mngr *mngr)
+{
+	struct mmsghdr msgs[NL_MNGR_RECV_BATCH];
+	struct iovec iov[NL_MNGR_RECV_BATCH];
+	struct sockaddr_nl nla[NL_MNGR_RECV_BATCH];
+	struct nlmsghdr *hdr;
+	size_t bufsize, truncated = 0;
+	int i, n, len, err, lost = 0, nread = 0;
+
+	/* Slots are as large as the buffer nl_recv() would use, or larger
+	 * if datagrams had to be truncated before. */
+	bufsize = mngr->cm_sock->s_bufsize ? : getpagesize() * 4;
+	if (!mngr->cm_rbuf || bufsize > mngr->cm_rbufsize) {
+		if (bufsize < mngr->cm_rbufsize)
+			bufsize = mngr->cm_rbufsize;
+		free(mngr->cm_rbuf);
+		mngr->cm_rbuf = malloc(NL_MNGR_RECV_BATCH * bufsize);
+		if (!mngr->cm_rbuf) {
+			mngr->cm_rbufsize = 0;
+			return -NLE_NOMEM;
+		}
+		mngr->cm_rbufsize = bufsize;
+	}
+
+	for (i = 0; i < NL_MNGR_RECV_BATCH; i++) {
+		iov[i].iov_base = mngr->cm_rbuf + i * mngr->cm_rbufsize;
+		iov[i].iov_len = mngr->cm_rbufsize;
+	}
+
+	for (;;) {
+		memset(msgs, 0, sizeof(msgs));
+		for (i = 0; i < NL_MNGR_RECV_BATCH; i++) {
+			msgs[i].msg_hdr.msg_name = &nla[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(nla[i]);
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		/* MSG_TRUNC makes msg_len the full size of the datagram */
+		n = recvmmsg(nl_socket_get_fd(mngr->cm_sock), msgs,
+			     NL_MNGR_RECV_BATCH, MSG_TRUNC, NULL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			if (errno == ENOBUFS) {
+				lost = 1;
+				continue;
+			}
+			return -nl_syserr2nlerr(errno);
+		}
+		if (n == 0)
+			break;
+
+		NL_DBG(2, "Cache manager %p, recvmmsg read %d datagrams\n",
+		       mngr, n);
+
+		for (i = 0; i < n; i++) {
+			if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+				if (msgs[i].msg_len > truncated)
+					truncated = msgs[i].msg_len;
+				lost = 1;
+				continue;
+			}
+
+			hdr = iov[i].iov_base;
+			len = msgs[i].msg_len;
+			for (; nlmsg_ok(hdr, len); hdr = nlmsg_next(hdr, &len)) {
+				nread++;
+
+				if (hdr->nlmsg_type == NLMSG_OVERRUN) {
+					lost = 1;
+					continue;
+				}
+				if (hdr->nlmsg_type < NLMSG_MIN_TYPE)
+					continue;
+
+				/* The cache misses this change now, have the
+				 * resync below pick it up */
+				err = event_parse(mngr, hdr);
+				if (err < 0) {
+					NL_DBG(1, "Cache manager %p, dropping "
+					       "event: %s\n", mngr,
+					       nl_geterror(err));
+					lost = 1;
+				}
+			}
+		}
+
+		if (n < NL_MNGR_RECV_BATCH)
+			break;
+	}
+
+	/* Make room for datagrams of this size next time */
+	if (truncated > mngr->cm_rbufsize) {
+		NL_DBG(1, "Cache manager %p, growing receive slots to %zu "
+		       "bytes\n", mngr, truncated);
+		free(mngr->cm_rbuf);
+		mngr->cm_rbuf = NULL;
+		mngr->cm_rbufsize = truncated;
+	}
+
+	if (lost && (err = mngr_resync(mngr)) < 0)
+		return err;
+
+	return nread;
+}
+
 /**
  * Receive available event notifications
  * @arg mngr		Cache manager
@@ -410,7 +568,12 @@ int nl_cache_mngr_poll(struct nl_cache_mngr *mngr, int timeout)
  * if nl_cache_mngr_poll() is not used.
  *
  * The function will process messages until there is no more data to
- * be read from the socket.
+ * be read from the socket. Notifications are read in batches of several
+ * datagrams per system call unless message peeking is enabled or callbacks
+ * have been installed on the socket's receive path. If notifications were
+ * lost because the socket receive buffer overflowed, or could not be
+ * applied, all caches are resynced and the change callbacks are invoked
+ * for the differences.
  *
  * @see nl_cache_mngr_poll()
  *
@@ -424,6 +587,9 @@ int nl_cache_mngr_data_ready(struct nl_cache_mngr *mngr)
 	NL_DBG(2, "Cache manager %p, reading new data from fd %d\n",
 	       mngr, nl_socket_get_fd(mngr->cm_sock));
 
+	if (mngr_can_batch(mngr))
+		return mngr_recv_batch(mngr);
+
 	cb = nl_cb_clone(mngr->cm_sock->s_cb);
 	if (cb == NULL)
 		return -NLE_NOMEM;
@@ -517,6 +683,7 @@ void nl_cache_mngr_free(struct nl_cache_mngr *mngr)
 	}
 
 	free(mngr->cm_assocs);
+	free(mngr->cm_rbuf);
 
 	NL_DBG(1, "Cache manager %p freed\n", mngr);
 
@@ -36,6 +36,9 @@ LOCAL_SRC_FILES:= \
 	$(LIBVNCSERVER_ROOT)/libvncserver/font.c \
 	$(LIBVNCSERVER_ROOT)/libvncserver/draw.c \
 	$(LIBVNCSERVER_ROOT)/libvncserver/selbox.c \
+	$(LIBVNCSERVER_ROOT)/libvncserver/tilediff.c \
+	$(LIBVNCSERVER_ROOT)/libvncserver/simd.c \
+	$(LIBVNCSERVER_ROOT)/libvncserver/enccache.c \
 	$(LIBVNCSERVER_ROOT)/common/d3des.c \
 	$(LIBVNCSERVER_ROOT)/common/vncauth.c \
 	$(LIBVNCSERVER_ROOT)/libvncserver/cargs.c \
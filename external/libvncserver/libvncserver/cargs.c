@@ -36,6 +36,11 @@ rfbUsage(void)
                                                              "(default 40)\n");
     fprintf(stderr, "-deferptrupdate time   time in ms to defer pointer updates"
                                                            " (default none)\n");
+    fprintf(stderr, "-encoderthreads n      encode updates for different clients in n threads\n");
+    fprintf(stderr, "-detectchanges         find modified areas by comparing with a copy\n"
+                    "                       of the framebuffer\n");
+    fprintf(stderr, "-shareencodings        encode each rectangle once for all clients\n"
+                    "                       with the same encoding settings\n");
     fprintf(stderr, "-desktop name          VNC desktop name (default \"LibVNCServer\")\n");
     fprintf(stderr, "-alwaysshared          always treat new clients as shared\n");
     fprintf(stderr, "-nevershared           never treat new clients as shared\n");
@@ -141,6 +146,16 @@ rfbProcessArguments(rfbScreenInfoPtr rfbScreen,int* argc, char *argv[])
 		return FALSE;
 	    }
             rfbScreen->deferPtrUpdateTime = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-encoderthreads") == 0) {  /* -encoderthreads n */
+            if (i + 1 >= *argc) {
+		rfbUsage();
+		return FALSE;
+	    }
+            rfbScreen->encoderThreads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-detectchanges") == 0) {
+            rfbScreen->detectModifications = TRUE;
+        } else if (strcmp(argv[i], "-shareencodings") == 0) {
+            rfbScreen->shareEncodings = TRUE;
         } else if (strcmp(argv[i], "-desktop") == 0) {  /* -desktop desktop-name */
             if (i + 1 >= *argc) {
 		rfbUsage();
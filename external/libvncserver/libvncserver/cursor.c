@@ -46,6 +46,9 @@ rfbSendCursorShape(rfbClientPtr cl)
 
     /* TODO: scale the cursor data to the correct size */
 
+    /* With encoder threads several clients get here at once, and the
+       conversions below replace the source of the shared cursor. */
+    LOCK(cl->screen->cursorMutex);
     pCursor = cl->screen->getCursorPtr(cl);
     /*if(!pCursor) return TRUE;*/
 
@@ -68,6 +71,7 @@ rfbSendCursorShape(rfbClientPtr cl)
     }
 
     if (pCursor == NULL) {
+	UNLOCK(cl->screen->cursorMutex);
 	if (cl->ublen + sz_rfbFramebufferUpdateRectHeader > UPDATE_BUF_SIZE ) {
 	    if (!rfbSendUpdateBuf(cl))
 		return FALSE;
@@ -96,12 +100,15 @@ rfbSendCursorShape(rfbClientPtr cl)
 
     if ( cl->ublen + sz_rfbFramebufferUpdateRectHeader +
 	 sz_rfbXCursorColors + maskBytes + dataBytes > UPDATE_BUF_SIZE ) {
-	if (!rfbSendUpdateBuf(cl))
+	if (!rfbSendUpdateBuf(cl)) {
+	    UNLOCK(cl->screen->cursorMutex);
 	    return FALSE;
+	}
     }
 
     if ( cl->ublen + sz_rfbFramebufferUpdateRectHeader +
 	 sz_rfbXCursorColors + maskBytes + dataBytes > UPDATE_BUF_SIZE ) {
+	UNLOCK(cl->screen->cursorMutex);
 	return FALSE;		/* FIXME. */
     }
 
@@ -162,6 +169,7 @@ rfbSendCursorShape(rfbClientPtr cl)
 	    cl->updateBuf[cl->ublen++] = (char)bitmapByte;
 	}
     }
+    UNLOCK(cl->screen->cursorMutex);
 
     /* Send everything we have prepared in the cl->updateBuf[]. */
     rfbStatRecordEncodingSent(cl, (cl->useRichCursorEncoding ? rfbEncodingRichCursor : rfbEncodingXCursor), 
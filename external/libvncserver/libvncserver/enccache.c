@@ -0,0 +1,419 @@
+/*
+ * enccache.c - share encoded rectangles between clients.
+ *
+ * When several clients watch the same screen with the same encoding
+ * settings, every rectangle of an update used to be encoded once per
+ * client.  With rfbScreen->shareEncodings set, the bytes the encoder
+ * writes for a rectangle are recorded while they go out to the first
+ * client, and sent as they are to every other client asking for the same
+ * rectangle, until the framebuffer is modified again.
+ *
+ * Only encodings whose output depends on nothing but the pixels and the
+ * client's settings can be shared: raw, RRE, CoRRE, hextile, ultra and
+ * tight.  Tight does so because its zlib streams are reset for every
+ * rectangle while the cache is in use (see tight.c).  Zlib, ZRLE and
+ * ZYWRLE compress a whole connection into one zlib stream, which the
+ * protocol gives no way to reset, so they are always encoded per client.
+ */
+
+/*
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+#include <string.h>
+#include <rfb/rfb.h>
+#include "private.h"
+
+/* never keep more than this many bytes of encoded rectangles */
+#define RECT_CACHE_MAX_BYTES (16 * 1024 * 1024)
+/* number of hash buckets, a power of two */
+#define RECT_CACHE_BUCKETS 1024
+
+typedef struct {
+    rfbScreenInfoPtr scaledScreen;
+    int encoding;
+    rfbPixelFormat format;
+    int x, y, w, h;
+    int compressLevel, qualityLevel, subsampLevel;
+    rfbBool lastRect;
+    int correMaxWidth, correMaxHeight;
+} rfbRectCacheKey;
+
+typedef struct rfbEncodedRect {
+    struct rfbEncodedRect *hashNext;	/* same bucket */
+    struct rfbEncodedRect *prev, *next;	/* most recently used first */
+    unsigned int hash;
+    rfbRectCacheKey key;
+    unsigned long serial;
+    int refs;
+    char *data;
+    int len, size;
+} rfbEncodedRect;
+
+typedef struct rfbRectCache {
+    MUTEX(mutex);
+    /* bumped whenever the framebuffer changes */
+    unsigned long serial;
+    rfbEncodedRect *buckets[RECT_CACHE_BUCKETS];
+    rfbEncodedRect *head, *tail;
+    size_t bytes;
+} rfbRectCache;
+
+void
+rfbRectCacheInit(rfbScreenInfoPtr screen)
+{
+    rfbRectCache *cache;
+
+    if (screen->rectCache)
+        return;
+    cache = (rfbRectCache *)calloc(1, sizeof(rfbRectCache));
+    if (!cache) {
+        rfbErr("rfbRectCacheInit: out of memory\n");
+        return;
+    }
+    INIT_MUTEX(cache->mutex);
+    screen->rectCache = cache;
+}
+
+static void
+ReleaseEncodedRect(rfbEncodedRect *e)
+{
+    if (--e->refs > 0)
+        return;
+    free(e->data);
+    free(e);
+}
+
+void
+rfbRectCacheInvalidate(rfbScreenInfoPtr screen)
+{
+    rfbRectCache *cache = screen->rectCache;
+    rfbEncodedRect *e, *next;
+
+    if (!cache)
+        return;
+
+    LOCK(cache->mutex);
+    cache->serial++;
+    for (e = cache->head; e; e = next) {
+        next = e->next;
+        ReleaseEncodedRect(e);
+    }
+    memset(cache->buckets, 0, sizeof(cache->buckets));
+    cache->head = cache->tail = NULL;
+    cache->bytes = 0;
+    UNLOCK(cache->mutex);
+}
+
+void
+rfbRectCacheFree(rfbScreenInfoPtr screen)
+{
+    rfbRectCache *cache = screen->rectCache;
+
+    if (!cache)
+        return;
+    rfbRectCacheInvalidate(screen);
+    TINI_MUTEX(cache->mutex);
+    free(cache);
+    screen->rectCache = NULL;
+}
+
+/*
+ * Fill in everything the encoded bytes of this rectangle depend on.
+ * Returns FALSE if they depend on more than that.
+ */
+
+static rfbBool
+MakeKey(rfbClientPtr cl, int x, int y, int w, int h, rfbRectCacheKey *key)
+{
+    memset(key, 0, sizeof(*key));
+
+    switch (cl->preferredEncoding) {
+    case -1:
+    case rfbEncodingRaw:
+        key->encoding = rfbEncodingRaw;
+        break;
+    case rfbEncodingCoRRE:
+        key->correMaxWidth = cl->correMaxWidth;
+        key->correMaxHeight = cl->correMaxHeight;
+        /* fall through */
+    case rfbEncodingRRE:
+    case rfbEncodingHextile:
+    case rfbEncodingUltra:
+        key->encoding = cl->preferredEncoding;
+        break;
+#if defined(LIBVNCSERVER_HAVE_LIBJPEG) && (defined(LIBVNCSERVER_HAVE_LIBZ) || defined(LIBVNCSERVER_HAVE_LIBPNG))
+    case rfbEncodingTight:
+#ifdef LIBVNCSERVER_HAVE_LIBPNG
+    case rfbEncodingTightPng:
+#endif
+        key->encoding = cl->preferredEncoding;
+        key->compressLevel = cl->tightCompressLevel;
+        key->qualityLevel = cl->turboQualityLevel;
+        key->subsampLevel = cl->turboSubsampLevel;
+        key->lastRect = cl->enableLastRectEncoding;
+        break;
+#endif
+    default:
+        return FALSE;
+    }
+
+    /* colour maps and a cursor drawn into the framebuffer are per client */
+    if (!cl->format.trueColour)
+        return FALSE;
+    if (!cl->enableCursorShapeUpdates && cl->screen->cursor)
+        return FALSE;
+
+    key->scaledScreen = cl->scaledScreen;
+    key->format = cl->format;
+    key->format.pad1 = 0;
+    key->format.pad2 = 0;
+    key->x = x;
+    key->y = y;
+    key->w = w;
+    key->h = h;
+    return TRUE;
+}
+
+/* FNV-1a over the key; MakeKey() zeroes the padding */
+
+static unsigned int
+HashKey(const rfbRectCacheKey *key)
+{
+    const unsigned char *p = (const unsigned char *)key;
+    unsigned int hash = 2166136261u;
+    size_t i;
+
+    for (i = 0; i < sizeof(*key); i++) {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * The entries are found through the hash buckets; the list only keeps
+ * them in the order they were used, so that the least recently used ones
+ * are dropped first when the cache is full.  All of these expect the
+ * cache mutex to be held.
+ */
+
+static rfbEncodedRect *
+FindEncodedRect(rfbRectCache *cache, const rfbRectCacheKey *key,
+                unsigned int hash)
+{
+    rfbEncodedRect *e;
+
+    for (e = cache->buckets[hash & (RECT_CACHE_BUCKETS - 1)]; e; e = e->hashNext)
+        if (e->hash == hash && memcmp(&e->key, key, sizeof(*key)) == 0)
+            return e;
+    return NULL;
+}
+
+static void
+UnlinkUsed(rfbRectCache *cache, rfbEncodedRect *e)
+{
+    if (e->prev)
+        e->prev->next = e->next;
+    else
+        cache->head = e->next;
+    if (e->next)
+        e->next->prev = e->prev;
+    else
+        cache->tail = e->prev;
+}
+
+static void
+LinkUsed(rfbRectCache *cache, rfbEncodedRect *e)
+{
+    e->prev = NULL;
+    e->next = cache->head;
+    if (cache->head)
+        cache->head->prev = e;
+    else
+        cache->tail = e;
+    cache->head = e;
+}
+
+static void
+DropEncodedRect(rfbRectCache *cache, rfbEncodedRect *e)
+{
+    rfbEncodedRect **p = &cache->buckets[e->hash & (RECT_CACHE_BUCKETS - 1)];
+
+    while (*p != e)
+        p = &(*p)->hashNext;
+    *p = e->hashNext;
+    UnlinkUsed(cache, e);
+    cache->bytes -= e->len;
+    ReleaseEncodedRect(e);
+}
+
+static rfbBool
+AppendEncodedRect(rfbEncodedRect *e, const char *buf, int len)
+{
+    char *data;
+    int size;
+
+    if (e->len + len > e->size) {
+        size = e->size ? e->size : UPDATE_BUF_SIZE;
+        while (size < e->len + len)
+            size *= 2;
+        data = (char *)realloc(e->data, size);
+        if (!data)
+            return FALSE;
+        e->data = data;
+        e->size = size;
+    }
+    memcpy(e->data + e->len, buf, len);
+    e->len += len;
+    return TRUE;
+}
+
+static rfbBool
+SendEncodedRect(rfbClientPtr cl, rfbEncodedRect *e)
+{
+    const char *data = e->data;
+    int len = e->len, n;
+
+    while (len > 0) {
+        if (cl->ublen == UPDATE_BUF_SIZE && !rfbSendUpdateBuf(cl))
+            return FALSE;
+        n = UPDATE_BUF_SIZE - cl->ublen;
+        if (n > len)
+            n = len;
+        memcpy(&cl->updateBuf[cl->ublen], data, n);
+        cl->ublen += n;
+        data += n;
+        len -= n;
+    }
+
+    rfbStatRecordEncodingSent(cl, e->key.encoding, e->len,
+                              sz_rfbFramebufferUpdateRectHeader +
+                              e->key.w * e->key.h * (cl->format.bitsPerPixel / 8));
+    return TRUE;
+}
+
+/*
+ * Called by rfbSendFramebufferUpdate() before encoding a rectangle.
+ * Returns 1 if the rectangle was sent from the cache, -1 if sending it
+ * failed, and 0 if it has to be encoded.  In the last case the encoder's
+ * output is recorded until rfbRectCacheStore() is called.
+ */
+
+int
+rfbRectCacheSend(rfbClientPtr cl, int x, int y, int w, int h)
+{
+    rfbRectCache *cache = cl->screen->rectCache;
+    rfbRectCacheKey key;
+    rfbEncodedRect *e;
+    unsigned long serial;
+    unsigned int hash;
+    rfbBool ok;
+
+    if (!MakeKey(cl, x, y, w, h, &key))
+        return 0;
+    hash = HashKey(&key);
+
+    LOCK(cache->mutex);
+    e = FindEncodedRect(cache, &key, hash);
+    if (e) {
+        UnlinkUsed(cache, e);
+        LinkUsed(cache, e);
+        /* don't hold the lock while writing to a possibly slow client */
+        e->refs++;
+        UNLOCK(cache->mutex);
+        ok = SendEncodedRect(cl, e);
+        LOCK(cache->mutex);
+        ReleaseEncodedRect(e);
+        UNLOCK(cache->mutex);
+        return ok ? 1 : -1;
+    }
+    serial = cache->serial;
+    UNLOCK(cache->mutex);
+
+    e = (rfbEncodedRect *)calloc(1, sizeof(rfbEncodedRect));
+    if (!e)
+        return 0;
+    /* keys are compared with memcmp(), padding included */
+    memcpy(&e->key, &key, sizeof(key));
+    e->hash = hash;
+    e->serial = serial;
+    e->refs = 1;
+    cl->encodedRect = e;
+    cl->encodedRectStart = cl->ublen;
+    return 0;
+}
+
+/*
+ * Called by rfbSendUpdateBuf() before the update buffer is written out,
+ * to save the part of it that belongs to the rectangle being recorded.
+ */
+
+void
+rfbRectCacheFlush(rfbClientPtr cl)
+{
+    rfbEncodedRect *e = cl->encodedRect;
+
+    if (!AppendEncodedRect(e, &cl->updateBuf[cl->encodedRectStart],
+                           cl->ublen - cl->encodedRectStart))
+        rfbRectCacheAbort(cl);
+    else
+        cl->encodedRectStart = 0;
+}
+
+void
+rfbRectCacheStore(rfbClientPtr cl)
+{
+    rfbRectCache *cache = cl->screen->rectCache;
+    rfbEncodedRect *e = cl->encodedRect;
+    rfbEncodedRect **bucket;
+
+    if (!e)
+        return;
+    cl->encodedRect = NULL;
+
+    if (!AppendEncodedRect(e, &cl->updateBuf[cl->encodedRectStart],
+                           cl->ublen - cl->encodedRectStart)) {
+        ReleaseEncodedRect(e);
+        return;
+    }
+
+    LOCK(cache->mutex);
+    /* the framebuffer may have changed while we were encoding */
+    if (e->serial != cache->serial || e->len > RECT_CACHE_MAX_BYTES ||
+        FindEncodedRect(cache, &e->key, e->hash)) {
+        UNLOCK(cache->mutex);
+        ReleaseEncodedRect(e);
+        return;
+    }
+    while (cache->bytes + e->len > RECT_CACHE_MAX_BYTES)
+        DropEncodedRect(cache, cache->tail);
+    bucket = &cache->buckets[e->hash & (RECT_CACHE_BUCKETS - 1)];
+    e->hashNext = *bucket;
+    *bucket = e;
+    LinkUsed(cache, e);
+    cache->bytes += e->len;
+    UNLOCK(cache->mutex);
+}
+
+void
+rfbRectCacheAbort(rfbClientPtr cl)
+{
+    if (!cl->encodedRect)
+        return;
+    ReleaseEncodedRect(cl->encodedRect);
+    cl->encodedRect = NULL;
+}
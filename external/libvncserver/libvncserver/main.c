@@ -269,6 +269,8 @@ void rfbScheduleCopyRegion(rfbScreenInfoPtr rfbScreen,sraRegionPtr copyRegion,in
    rfbClientIteratorPtr iterator;
    rfbClientPtr cl;
 
+   rfbRectCacheInvalidate(rfbScreen);
+
    iterator=rfbGetClientIterator(rfbScreen);
    while((cl=rfbClientIteratorNext(iterator))) {
      LOCK(cl->updateMutex);
@@ -401,6 +403,8 @@ void rfbMarkRegionAsModified(rfbScreenInfoPtr screen,sraRegionPtr modRegion)
    rfbClientIteratorPtr iterator;
    rfbClientPtr cl;
 
+   rfbRectCacheInvalidate(screen);
+
    iterator=rfbGetClientIterator(screen);
    while((cl=rfbClientIteratorNext(iterator))) {
      LOCK(cl->updateMutex);
@@ -436,6 +440,29 @@ void rfbMarkRectAsModified(rfbScreenInfoPtr screen,int x1,int y1,int x2,int y2)
    sraRgnDestroy(region);
 }
 
+/*
+ * Send a framebuffer update and add the time it took to the client's
+ * encoding time.
+ */
+
+static rfbBool
+rfbSendTimedUpdate(rfbClientPtr cl, sraRegionPtr updateRegion)
+{
+    struct timeval start, end;
+    long long usec;
+    rfbBool result;
+
+    gettimeofday(&start,NULL);
+    result = rfbSendFramebufferUpdate(cl, updateRegion);
+    gettimeofday(&end,NULL);
+
+    usec = (end.tv_sec-start.tv_sec)*1000000LL + (end.tv_usec-start.tv_usec);
+    if (usec > 0) /* not at midnight */
+        cl->encodeTime += usec;
+
+    return result;
+}
+
 #ifdef LIBVNCSERVER_HAVE_LIBPTHREAD
 #include <unistd.h>
 
@@ -494,7 +521,7 @@ clientOutput(void *data)
         /* Now actually send the update. */
 	rfbIncrClientRef(cl);
         LOCK(cl->sendMutex);
-        rfbSendFramebufferUpdate(cl, updateRegion);
+        rfbSendTimedUpdate(cl, updateRegion);
         UNLOCK(cl->sendMutex);
 	rfbDecrClientRef(cl);
 
@@ -572,29 +599,18 @@ listenerRun(void *data)
     struct sockaddr_storage peer;
     rfbClientPtr cl = NULL;
     socklen_t len;
-    fd_set listen_fds;  /* temp file descriptor list for select() */
+    int listen_fd;
 
     /* TODO: this thread wont die by restarting the server */
     /* TODO: HTTP is not handled */
     while (1) {
         client_fd = -1;
-        FD_ZERO(&listen_fds);
-	if(screen->listenSock >= 0) 
-	  FD_SET(screen->listenSock, &listen_fds);
-	if(screen->listen6Sock >= 0) 
-	  FD_SET(screen->listen6Sock, &listen_fds);
-
-        if (select(screen->maxFd+1, &listen_fds, NULL, NULL, NULL) == -1) {
-            rfbLogPerror("listenerRun: error in select");
+        if ((listen_fd = rfbWaitForListenSock(screen)) < 0)
             return NULL;
-        }
-	
+
 	/* there is something on the listening sockets, handle new connections */
 	len = sizeof (peer);
-	if (FD_ISSET(screen->listenSock, &listen_fds)) 
-	    client_fd = accept(screen->listenSock, (struct sockaddr*)&peer, &len);
-	else if (FD_ISSET(screen->listen6Sock, &listen_fds))
-	    client_fd = accept(screen->listen6Sock, (struct sockaddr*)&peer, &len);
+	client_fd = accept(listen_fd, (struct sockaddr*)&peer, &len);
 
 	if(client_fd >= 0)
 	  cl = rfbNewClient(screen,client_fd);
@@ -610,6 +626,185 @@ rfbStartOnHoldClient(rfbClientPtr cl)
     pthread_create(&cl->client_thread, NULL, clientInput, (void *)cl);
 }
 
+/* the encoders keep their scratch buffers in thread local storage */
+#if LIBVNCSERVER_HAVE_TLS && defined(__linux__)
+#define LIBVNCSERVER_ENCODER_POOL
+#endif
+
+#ifdef LIBVNCSERVER_ENCODER_POOL
+
+/*
+ * Encoder threads for rfbProcessEvents(): the clients due an update are
+ * queued and rfbProcessEvents() waits until all of them are sent, so a
+ * client is never encoded by two threads at once, nor freed while one
+ * of them encodes it.
+ */
+
+struct rfbEncoderPool {
+    MUTEX(mutex);
+    COND(workCond);
+    COND(doneCond);
+    rfbClientPtr *queue;
+    int queueSize, queued, next;
+    int busy;			/* clients queued or being sent */
+    rfbClientPtr *later;	/* sent by rfbEncoderPoolWait() itself */
+    int laterSize, nLater;
+    int nThreads;
+    pthread_t *threads;
+    rfbBool stop;
+};
+
+static void *
+encoderThread(void *data)
+{
+    struct rfbEncoderPool *pool = (struct rfbEncoderPool *)data;
+    rfbClientPtr cl;
+
+    LOCK(pool->mutex);
+    while (1) {
+	while (pool->next == pool->queued && !pool->stop)
+	    WAIT(pool->workCond, pool->mutex);
+	if (pool->next == pool->queued)
+	    break;
+	cl = pool->queue[pool->next++];
+	UNLOCK(pool->mutex);
+
+	LOCK(cl->sendMutex);
+	rfbSendTimedUpdate(cl, cl->modifiedRegion);
+	UNLOCK(cl->sendMutex);
+
+	LOCK(pool->mutex);
+	if (--pool->busy == 0)
+	    TSIGNAL(pool->doneCond);
+    }
+    UNLOCK(pool->mutex);
+
+    return NULL;
+}
+
+static void
+rfbEncoderPoolStop(struct rfbEncoderPool *pool)
+{
+    int i;
+
+    LOCK(pool->mutex);
+    pool->stop = TRUE;
+    pthread_cond_broadcast(&pool->workCond);
+    UNLOCK(pool->mutex);
+
+    for (i = 0; i < pool->nThreads; i++)
+	pthread_join(pool->threads[i], NULL);
+
+    TINI_COND(pool->workCond);
+    TINI_COND(pool->doneCond);
+    TINI_MUTEX(pool->mutex);
+    free(pool->threads);
+    free(pool->queue);
+    free(pool->later);
+    free(pool);
+}
+
+static struct rfbEncoderPool *
+rfbEncoderPoolStart(int nThreads)
+{
+    struct rfbEncoderPool *pool = calloc(1, sizeof(*pool));
+
+    if (!pool || !(pool->threads = calloc(nThreads, sizeof(pthread_t)))) {
+	free(pool);
+	return NULL;
+    }
+
+    INIT_MUTEX(pool->mutex);
+    INIT_COND(pool->workCond);
+    INIT_COND(pool->doneCond);
+
+    for (; pool->nThreads < nThreads; pool->nThreads++)
+	if (pthread_create(&pool->threads[pool->nThreads], NULL,
+			   encoderThread, pool) != 0)
+	    break;
+
+    if (pool->nThreads == 0) {
+	rfbEncoderPoolStop(pool);
+	return NULL;
+    }
+
+    rfbLog("Encoding updates with %d threads\n", pool->nThreads);
+    return pool;
+}
+
+/*
+ * Clients without cursor shape updates get the cursor drawn into the
+ * shared framebuffer for as long as they are encoded, which would show
+ * up in what the threads are reading.  They are kept back and sent by
+ * rfbEncoderPoolWait() once the threads are done.
+ */
+
+static rfbBool
+rfbEncoderPoolQueueLater(struct rfbEncoderPool *pool, rfbClientPtr cl)
+{
+    if (pool->nLater == pool->laterSize) {
+	int size = pool->laterSize ? 2 * pool->laterSize : 16;
+	rfbClientPtr *later = realloc(pool->later, size * sizeof(rfbClientPtr));
+
+	if (!later)
+	    return FALSE;
+	pool->later = later;
+	pool->laterSize = size;
+    }
+    pool->later[pool->nLater++] = cl;
+
+    return TRUE;
+}
+
+static rfbBool
+rfbEncoderPoolQueue(struct rfbEncoderPool *pool, rfbClientPtr cl)
+{
+    if (!cl->enableCursorShapeUpdates)
+	return rfbEncoderPoolQueueLater(pool, cl);
+
+    LOCK(pool->mutex);
+    if (pool->queued == pool->queueSize) {
+	int size = pool->queueSize ? 2 * pool->queueSize : 16;
+	rfbClientPtr *queue = realloc(pool->queue, size * sizeof(rfbClientPtr));
+
+	if (!queue) {
+	    UNLOCK(pool->mutex);
+	    return FALSE;
+	}
+	pool->queue = queue;
+	pool->queueSize = size;
+    }
+    pool->queue[pool->queued++] = cl;
+    pool->busy++;
+    TSIGNAL(pool->workCond);
+    UNLOCK(pool->mutex);
+
+    return TRUE;
+}
+
+static void
+rfbEncoderPoolWait(struct rfbEncoderPool *pool)
+{
+    rfbClientPtr cl;
+    int i;
+
+    LOCK(pool->mutex);
+    while (pool->busy)
+	WAIT(pool->doneCond, pool->mutex);
+    pool->queued = pool->next = 0;
+    UNLOCK(pool->mutex);
+
+    for (i = 0; i < pool->nLater; i++) {
+	cl = pool->later[i];
+	LOCK(cl->sendMutex);
+	rfbSendTimedUpdate(cl, cl->modifiedRegion);
+	UNLOCK(cl->sendMutex);
+    }
+    pool->nLater = 0;
+}
+
+#endif
+
 #else
 
 void 
@@ -817,6 +1012,8 @@ rfbScreenInfoPtr rfbGetScreen(int* argc,char** argv,
      logMutex_initialized = 1;
    }
 
+   rfbSimdInit();
+
 
    if(width&3)
      rfbErr("WARNING: Width (%d) is not a multiple of 4. VncViewer has problems with that.\n",width);
@@ -879,6 +1076,13 @@ rfbScreenInfoPtr rfbGetScreen(int* argc,char** argv,
 
    screen->permitFileTransfer = FALSE;
 
+   screen->epollFd = -1;
+   screen->encoderThreads = 0;
+   screen->detectModifications = FALSE;
+   screen->shadowFrameBuffer = NULL;
+   screen->shareEncodings = FALSE;
+   screen->rectCache = NULL;
+
    if(!rfbProcessArguments(screen,argc,argv)) {
      free(screen);
      return NULL;
@@ -968,6 +1172,13 @@ void rfbNewFramebuffer(rfbScreenInfoPtr screen, char *framebuffer,
 
   screen->frameBuffer = framebuffer;
 
+  /* the shadow copy is taken again by the next rfbDetectModifications() */
+  if (screen->shadowFrameBuffer) {
+    free(screen->shadowFrameBuffer);
+    screen->shadowFrameBuffer = NULL;
+  }
+  rfbRectCacheInvalidate(screen);
+
   /* Adjust pointer position if necessary */
 
   if (screen->cursorX >= width)
@@ -1016,9 +1227,18 @@ void rfbScreenCleanup(rfbScreenInfoPtr screen)
   }
   rfbReleaseClientIterator(i);
     
+#ifdef LIBVNCSERVER_ENCODER_POOL
+  if(screen->encoderPool)
+    rfbEncoderPoolStop(screen->encoderPool);
+#endif
+  if(screen->epollFd!=-1)
+    close(screen->epollFd);
+  rfbRectCacheFree(screen);
+
 #define FREE_IF(x) if(screen->x) free(screen->x)
   FREE_IF(colourMap.data.bytes);
   FREE_IF(underCursorBuffer);
+  FREE_IF(shadowFrameBuffer);
   TINI_MUTEX(screen->cursorMutex);
   if(screen->cursor && screen->cursor->cleanup)
     rfbFreeCursor(screen->cursor);
@@ -1051,6 +1271,8 @@ void rfbInitServer(rfbScreenInfoPtr screen)
 #endif
   rfbInitSockets(screen);
   rfbHttpInitSockets(screen);
+  if(screen->shareEncodings)
+    rfbRectCacheInit(screen);
 #ifndef WIN32
   if(screen->ignoreSIGPIPE)
     signal(SIGPIPE,SIG_IGN);
@@ -1089,6 +1311,22 @@ void gettimeofday(struct timeval* tv,char* dummy)
 }
 #endif
 
+static void
+rfbSendOrQueueUpdate(rfbClientPtr cl, struct rfbEncoderPool *pool)
+{
+#ifdef LIBVNCSERVER_ENCODER_POOL
+  if(pool && rfbEncoderPoolQueue(pool,cl))
+    return;
+  /* out of memory: the threads must not run while this one is sent */
+  if(pool)
+    rfbEncoderPoolWait(pool);
+#endif
+  rfbSendTimedUpdate(cl,cl->modifiedRegion);
+}
+
+static rfbBool
+rfbUpdateClientWithPool(rfbClientPtr cl, struct rfbEncoderPool *pool);
+
 rfbBool
 rfbProcessEvents(rfbScreenInfoPtr screen,long usec)
 {
@@ -1104,10 +1342,35 @@ rfbProcessEvents(rfbScreenInfoPtr screen,long usec)
   rfbCheckFds(screen,usec);
   rfbHttpCheckFds(screen);
 
+  if(screen->detectModifications)
+    rfbDetectModifications(screen);
+
+  if(screen->encoderThreads>0 && !screen->encoderPool) {
+#ifdef LIBVNCSERVER_ENCODER_POOL
+    screen->encoderPool=rfbEncoderPoolStart(screen->encoderThreads);
+#else
+    rfbErr("Can't use encoder threads, encoders are not thread safe here\n");
+#endif
+    if(!screen->encoderPool)
+      screen->encoderThreads=0;
+  }
+
+#ifdef LIBVNCSERVER_ENCODER_POOL
+  if(screen->encoderPool) {
+    /* hand out all updates, then wait before anyone can be cleaned up */
+    i = rfbGetClientIteratorWithClosed(screen);
+    for(cl=rfbClientIteratorHead(i);cl;cl=rfbClientIteratorNext(i))
+      result = rfbUpdateClientWithPool(cl,screen->encoderPool);
+    rfbReleaseClientIterator(i);
+    rfbEncoderPoolWait(screen->encoderPool);
+  }
+#endif
+
   i = rfbGetClientIteratorWithClosed(screen);
   cl=rfbClientIteratorHead(i);
   while(cl) {
-    result = rfbUpdateClient(cl);
+    if(!screen->encoderPool)
+      result = rfbUpdateClient(cl);
     clPrev=cl;
     cl=rfbClientIteratorNext(i);
     if(clPrev->sock==-1) {
@@ -1122,6 +1385,12 @@ rfbProcessEvents(rfbScreenInfoPtr screen,long usec)
 
 rfbBool
 rfbUpdateClient(rfbClientPtr cl)
+{
+  return rfbUpdateClientWithPool(cl,NULL);
+}
+
+static rfbBool
+rfbUpdateClientWithPool(rfbClientPtr cl, struct rfbEncoderPool *pool)
 {
   struct timeval tv;
   rfbBool result=FALSE;
@@ -1131,7 +1400,7 @@ rfbUpdateClient(rfbClientPtr cl)
         !sraRgnEmpty(cl->requestedRegion)) {
       result=TRUE;
       if(screen->deferUpdateTime == 0) {
-          rfbSendFramebufferUpdate(cl,cl->modifiedRegion);
+          rfbSendOrQueueUpdate(cl,pool);
       } else if(cl->startDeferring.tv_usec == 0) {
         gettimeofday(&cl->startDeferring,NULL);
         if(cl->startDeferring.tv_usec == 0)
@@ -1143,7 +1412,7 @@ rfbUpdateClient(rfbClientPtr cl)
                +(tv.tv_usec-cl->startDeferring.tv_usec)/1000)
              > screen->deferUpdateTime) {
           cl->startDeferring.tv_usec = 0;
-          rfbSendFramebufferUpdate(cl,cl->modifiedRegion);
+          rfbSendOrQueueUpdate(cl,pool);
         }
       }
     }
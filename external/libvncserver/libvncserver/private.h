@@ -7,10 +7,40 @@ void rfbShowCursor(rfbClientPtr cl);
 void rfbHideCursor(rfbClientPtr cl);
 void rfbRedrawAfterHideCursor(rfbClientPtr cl,sraRegionPtr updateRegion);
 
+/* from enccache.c */
+
+void rfbRectCacheInit(rfbScreenInfoPtr screen);
+void rfbRectCacheFree(rfbScreenInfoPtr screen);
+void rfbRectCacheInvalidate(rfbScreenInfoPtr screen);
+int rfbRectCacheSend(rfbClientPtr cl, int x, int y, int w, int h);
+void rfbRectCacheFlush(rfbClientPtr cl);
+void rfbRectCacheStore(rfbClientPtr cl);
+void rfbRectCacheAbort(rfbClientPtr cl);
+
 /* from main.c */
 
 rfbClientPtr rfbClientIteratorHead(rfbClientIteratorPtr i);
 
+/* from simd.c */
+
+void rfbSimdInit(void);
+rfbTranslateFnType rfbSimdTranslateFn(rfbPixelFormat *in, rfbPixelFormat *out);
+/* number of pixels from p on, up to n, which equal c after masking */
+extern int (*rfbSameRun8)(const uint8_t *p, int n, uint8_t c);
+extern int (*rfbSameRun16)(const uint16_t *p, int n, uint16_t c, uint16_t mask);
+extern int (*rfbSameRun32)(const uint32_t *p, int n, uint32_t c, uint32_t mask);
+/* the same for pixels equal to c0 or c1; adds the number of c0s to *n0 */
+extern int (*rfbTwoColourRun16)(const uint16_t *p, int n, uint16_t c0,
+                                uint16_t c1, uint16_t mask, int *n0);
+extern int (*rfbTwoColourRun32)(const uint32_t *p, int n, uint32_t c0,
+                                uint32_t c1, uint32_t mask, int *n0);
+
+/* from sockets.c */
+
+void rfbWatchSock(rfbScreenInfoPtr rfbScreen, int sock, rfbClientPtr cl);
+void rfbUnwatchSock(rfbScreenInfoPtr rfbScreen, int sock);
+int rfbWaitForListenSock(rfbScreenInfoPtr rfbScreen);
+
 /* from tight.c */
 
 #ifdef LIBVNCSERVER_HAVE_LIBZ
@@ -366,8 +366,7 @@ rfbNewTCPOrUDPClient(rfbScreenInfoPtr rfbScreen,
 	return NULL;
       }
 
-      FD_SET(sock,&(rfbScreen->allFds));
-		rfbScreen->maxFd = max(sock,rfbScreen->maxFd);
+      rfbWatchSock(rfbScreen,sock,cl);
 
       INIT_MUTEX(cl->outputMutex);
       INIT_MUTEX(cl->refCountMutex);
@@ -575,8 +574,9 @@ rfbClientConnectionGone(rfbClientPtr cl)
     free(cl->beforeEncBuf);
     free(cl->afterEncBuf);
 
-    if(cl->sock>=0)
-       FD_CLR(cl->sock,&(cl->screen->allFds));
+    if(cl->sock>=0) {
+       rfbUnwatchSock(cl->screen,cl->sock);
+    }
 
     cl->clientGoneHook(cl);
 
@@ -3092,6 +3092,14 @@ rfbSendFramebufferUpdate(rfbClientPtr cl,
         if (cl->screen!=cl->scaledScreen)
             rfbScaledCorrection(cl->screen, cl->scaledScreen, &x, &y, &w, &h, "rfbSendFramebufferUpdate");
 
+        if (cl->screen->rectCache) {
+            int sent = rfbRectCacheSend(cl, x, y, w, h);
+            if (sent < 0)
+                goto updateFailed;
+            if (sent > 0)
+                continue;
+        }
+
         switch (cl->preferredEncoding) {
 	case -1:
         case rfbEncodingRaw:
@@ -3138,6 +3146,7 @@ rfbSendFramebufferUpdate(rfbClientPtr cl,
 #endif
 #endif
         }
+        rfbRectCacheStore(cl);
     }
     if (i) {
         sraRgnReleaseIterator(i);
@@ -3151,6 +3160,7 @@ rfbSendFramebufferUpdate(rfbClientPtr cl,
     if (!rfbSendUpdateBuf(cl)) {
 updateFailed:
 	result = FALSE;
+	rfbRectCacheAbort(cl);
     }
 
     if (!cl->enableCursorShapeUpdates) {
@@ -3381,6 +3391,9 @@ rfbSendUpdateBuf(rfbClientPtr cl)
     if(cl->sock<0)
       return FALSE;
 
+    if (cl->encodedRect)
+      rfbRectCacheFlush(cl);
+
     if (rfbWriteExact(cl, cl->updateBuf, cl->ublen) < 0) {
         rfbLogPerror("rfbSendUpdateBuf: write");
         rfbCloseClient(cl);
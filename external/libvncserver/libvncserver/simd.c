@@ -0,0 +1,753 @@
+/*
+ * simd.c - SSE2, AVX2 and NEON versions of the pixel loops which take
+ * most of the time when encoding a typical desktop: translating 32 bit
+ * pixels into a 16 or 8 bit client format, and the scans tight.c does to
+ * find solid areas and to count the colours of a rectangle.
+ *
+ * SSE2 and NEON are used whenever the compiler targets them.  AVX2 is
+ * compiled in with GCC or clang on x86 and picked at run time if the CPU
+ * has it.  Everything else falls back to plain C.
+ */
+
+/*
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+#include <rfb/rfb.h>
+#include "private.h"
+
+#if defined(__SSE2__)
+#define SIMD_SSE2
+#include <emmintrin.h>
+#if defined(__clang__) || \
+    (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)))
+#define SIMD_AVX2
+#include <immintrin.h>
+#define AVX2 __attribute__((target("avx2")))
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+rfbBool rfbUseSIMD = TRUE;
+
+
+/*
+ * Plain C versions.  The vector versions below compare whole vectors and
+ * leave the vector which ends the run to these.
+ */
+
+static int
+SameRun8C(const uint8_t *p, int n, uint8_t c)
+{
+    int i;
+
+    for (i = 0; i < n && p[i] == c; i++);
+    return i;
+}
+
+#define DEFINE_RUN_FUNCTIONS_C(bpp)                                     \
+                                                                        \
+static int                                                              \
+SameRun##bpp##C(const uint##bpp##_t *p, int n, uint##bpp##_t c,         \
+                uint##bpp##_t mask)                                     \
+{                                                                       \
+    int i;                                                              \
+                                                                        \
+    for (i = 0; i < n && (p[i] & mask) == c; i++);                      \
+    return i;                                                           \
+}                                                                       \
+                                                                        \
+static int                                                              \
+TwoColourRun##bpp##C(const uint##bpp##_t *p, int n, uint##bpp##_t c0,   \
+                     uint##bpp##_t c1, uint##bpp##_t mask, int *n0)     \
+{                                                                       \
+    uint##bpp##_t v;                                                    \
+    int i;                                                              \
+                                                                        \
+    for (i = 0; i < n; i++) {                                           \
+        v = p[i] & mask;                                                \
+        if (v == c0)                                                    \
+            (*n0)++;                                                    \
+        else if (v != c1)                                               \
+            break;                                                      \
+    }                                                                   \
+    return i;                                                           \
+}
+
+DEFINE_RUN_FUNCTIONS_C(16)
+DEFINE_RUN_FUNCTIONS_C(32)
+
+
+/*
+ * Translation of 32 bit pixels with 8 bit channels.  A channel value c is
+ * scaled to (c * outMax + 127) / 255, which is what the lookup tables set
+ * up in tableinittctemplate.c hold; the division is done as
+ * (v + 1 + (v >> 8)) >> 8, which is exact for every v that can occur here
+ * and fits in 16 bit lanes.  Pixels left over at the end of a line are
+ * looked up in the tables.
+ */
+
+typedef struct {
+    int inShift[3];
+    int outMax[3];
+    int outShift[3];
+    rfbBool swap;
+} TranslateParams;
+
+static rfbBool
+GetTranslateParams(rfbPixelFormat *in, rfbPixelFormat *out,
+                   TranslateParams *p)
+{
+    int inMax[3], i, bits;
+
+    inMax[0] = in->redMax;
+    inMax[1] = in->greenMax;
+    inMax[2] = in->blueMax;
+    p->inShift[0] = in->redShift;
+    p->inShift[1] = in->greenShift;
+    p->inShift[2] = in->blueShift;
+    p->outMax[0] = out->redMax;
+    p->outMax[1] = out->greenMax;
+    p->outMax[2] = out->blueMax;
+    p->outShift[0] = out->redShift;
+    p->outShift[1] = out->greenShift;
+    p->outShift[2] = out->blueShift;
+    p->swap = out->bitsPerPixel == 16 && out->bigEndian != in->bigEndian;
+
+    if (in->bitsPerPixel != 32 || !in->trueColour || !out->trueColour ||
+        (out->bitsPerPixel != 16 && out->bitsPerPixel != 8))
+        return FALSE;
+
+    for (i = 0; i < 3; i++) {
+        if (inMax[i] != 255 || p->inShift[i] > 24)
+            return FALSE;
+        if (p->outMax[i] < 1 || p->outMax[i] > 255)
+            return FALSE;
+        for (bits = 0; (p->outMax[i] >> bits) != 0; bits++);
+        if (p->outShift[i] + bits > out->bitsPerPixel)
+            return FALSE;
+    }
+    return TRUE;
+}
+
+#define TABLE_LOOKUP(OUT_T, t, pix, p)                                  \
+        (((OUT_T *)(t))[((pix) >> (p)->inShift[0]) & 0xff] |            \
+         ((OUT_T *)(t))[256 + (((pix) >> (p)->inShift[1]) & 0xff)] |    \
+         ((OUT_T *)(t))[512 + (((pix) >> (p)->inShift[2]) & 0xff)])
+
+#ifdef SIMD_SSE2
+
+static inline __m128i
+ScaleChannelSSE2(__m128i a, __m128i b, __m128i inShift, __m128i outMax,
+                 __m128i outShift)
+{
+    const __m128i ff = _mm_set1_epi32(0xff);
+    __m128i c, v;
+
+    c = _mm_packs_epi32(_mm_and_si128(_mm_srl_epi32(a, inShift), ff),
+                        _mm_and_si128(_mm_srl_epi32(b, inShift), ff));
+    v = _mm_add_epi16(_mm_mullo_epi16(c, outMax), _mm_set1_epi16(127));
+    v = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(v, _mm_set1_epi16(1)),
+                                     _mm_srli_epi16(v, 8)), 8);
+    return _mm_sll_epi16(v, outShift);
+}
+
+static inline void
+Translate32SSE2(char *table, rfbPixelFormat *in, rfbPixelFormat *out,
+                char *iptr, char *optr, int bytesBetweenInputLines,
+                int width, int height, int outBytes)
+{
+    TranslateParams p;
+    __m128i inShift[3], outMax[3], outShift[3], a, b, v;
+    uint32_t *ip;
+    uint8_t *op = (uint8_t *)optr;
+    int i, x;
+
+    GetTranslateParams(in, out, &p);
+    for (i = 0; i < 3; i++) {
+        inShift[i] = _mm_cvtsi32_si128(p.inShift[i]);
+        outMax[i] = _mm_set1_epi16(p.outMax[i]);
+        outShift[i] = _mm_cvtsi32_si128(p.outShift[i]);
+    }
+
+    while (height > 0) {
+        ip = (uint32_t *)iptr;
+        for (x = 0; x + 8 <= width; x += 8) {
+            a = _mm_loadu_si128((const __m128i *)(ip + x));
+            b = _mm_loadu_si128((const __m128i *)(ip + x + 4));
+            v = _mm_or_si128(
+                    _mm_or_si128(ScaleChannelSSE2(a, b, inShift[0], outMax[0], outShift[0]),
+                                 ScaleChannelSSE2(a, b, inShift[1], outMax[1], outShift[1])),
+                    ScaleChannelSSE2(a, b, inShift[2], outMax[2], outShift[2]));
+            if (outBytes == 2) {
+                if (p.swap)
+                    v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+                _mm_storeu_si128((__m128i *)(op + x * 2), v);
+            } else {
+                _mm_storel_epi64((__m128i *)(op + x), _mm_packus_epi16(v, v));
+            }
+        }
+        for (; x < width; x++) {
+            if (outBytes == 2)
+                ((uint16_t *)op)[x] = TABLE_LOOKUP(uint16_t, table, ip[x], &p);
+            else
+                op[x] = TABLE_LOOKUP(uint8_t, table, ip[x], &p);
+        }
+        iptr += bytesBetweenInputLines;
+        op += width * outBytes;
+        height--;
+    }
+}
+
+static void
+Translate32to16SSE2(char *table, rfbPixelFormat *in, rfbPixelFormat *out,
+                    char *iptr, char *optr, int bytesBetweenInputLines,
+                    int width, int height)
+{
+    Translate32SSE2(table, in, out, iptr, optr, bytesBetweenInputLines,
+                    width, height, 2);
+}
+
+static void
+Translate32to8SSE2(char *table, rfbPixelFormat *in, rfbPixelFormat *out,
+                   char *iptr, char *optr, int bytesBetweenInputLines,
+                   int width, int height)
+{
+    Translate32SSE2(table, in, out, iptr, optr, bytesBetweenInputLines,
+                    width, height, 1);
+}
+
+static int
+SameRun8SSE2(const uint8_t *p, int n, uint8_t c)
+{
+    __m128i vc = _mm_set1_epi8((char)c);
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16)
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(
+                _mm_loadu_si128((const __m128i *)(p + i)), vc)) != 0xffff)
+            break;
+    return i + SameRun8C(p + i, n - i, c);
+}
+
+static int
+SameRun16SSE2(const uint16_t *p, int n, uint16_t c, uint16_t mask)
+{
+    __m128i vc = _mm_set1_epi16((short)c), vm = _mm_set1_epi16((short)mask);
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8)
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(
+                _mm_loadu_si128((const __m128i *)(p + i)), vm), vc)) != 0xffff)
+            break;
+    return i + SameRun16C(p + i, n - i, c, mask);
+}
+
+static int
+SameRun32SSE2(const uint32_t *p, int n, uint32_t c, uint32_t mask)
+{
+    __m128i vc = _mm_set1_epi32((int)c), vm = _mm_set1_epi32((int)mask);
+    int i;
+
+    for (i = 0; i + 4 <= n; i += 4)
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(
+                _mm_loadu_si128((const __m128i *)(p + i)), vm), vc)) != 0xffff)
+            break;
+    return i + SameRun32C(p + i, n - i, c, mask);
+}
+
+static int
+TwoColourRun16SSE2(const uint16_t *p, int n, uint16_t c0, uint16_t c1,
+                   uint16_t mask, int *n0)
+{
+    __m128i vc0 = _mm_set1_epi16((short)c0), vc1 = _mm_set1_epi16((short)c1);
+    __m128i vm = _mm_set1_epi16((short)mask), v;
+    int i, m0, m1;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        v = _mm_and_si128(_mm_loadu_si128((const __m128i *)(p + i)), vm);
+        m0 = _mm_movemask_epi8(_mm_cmpeq_epi16(v, vc0));
+        m1 = _mm_movemask_epi8(_mm_cmpeq_epi16(v, vc1));
+        if ((m0 | m1) != 0xffff)
+            break;
+        *n0 += __builtin_popcount(m0) / 2;
+    }
+    return i + TwoColourRun16C(p + i, n - i, c0, c1, mask, n0);
+}
+
+static int
+TwoColourRun32SSE2(const uint32_t *p, int n, uint32_t c0, uint32_t c1,
+                   uint32_t mask, int *n0)
+{
+    __m128i vc0 = _mm_set1_epi32((int)c0), vc1 = _mm_set1_epi32((int)c1);
+    __m128i vm = _mm_set1_epi32((int)mask), v;
+    int i, m0, m1;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        v = _mm_and_si128(_mm_loadu_si128((const __m128i *)(p + i)), vm);
+        m0 = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, vc0)));
+        m1 = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, vc1)));
+        if ((m0 | m1) != 0xf)
+            break;
+        *n0 += __builtin_popcount(m0);
+    }
+    return i + TwoColourRun32C(p + i, n - i, c0, c1, mask, n0);
+}
+
+#endif /* SIMD_SSE2 */
+
+#ifdef SIMD_AVX2
+
+static inline AVX2 __m256i
+ScaleChannelAVX2(__m256i a, __m256i b, __m128i inShift, __m256i outMax,
+                 __m128i outShift)
+{
+    const __m256i ff = _mm256_set1_epi32(0xff);
+    __m256i c, v;
+
+    /* packing works within 128 bit lanes; fixed up by the caller */
+    c = _mm256_packs_epi32(_mm256_and_si256(_mm256_srl_epi32(a, inShift), ff),
+                           _mm256_and_si256(_mm256_srl_epi32(b, inShift), ff));
+    v = _mm256_add_epi16(_mm256_mullo_epi16(c, outMax), _mm256_set1_epi16(127));
+    v = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(v, _mm256_set1_epi16(1)),
+                                           _mm256_srli_epi16(v, 8)), 8);
+    return _mm256_sll_epi16(v, outShift);
+}
+
+static inline AVX2 void
+Translate32AVX2(char *table, rfbPixelFormat *in, rfbPixelFormat *out,
+                char *iptr, char *optr, int bytesBetweenInputLines,
+                int width, int height, int outBytes)
+{
+    TranslateParams p;
+    __m128i inShift[3], outShift[3];
+    __m256i outMax[3], a, b, v;
+    uint32_t *ip;
+    uint8_t *op = (uint8_t *)optr;
+    int i, x;
+
+    GetTranslateParams(in, out, &p);
+    for (i = 0; i < 3; i++) {
+        inShift[i] = _mm_cvtsi32_si128(p.inShift[i]);
+        outMax[i] = _mm256_set1_epi16(p.outMax[i]);
+        outShift[i] = _mm_cvtsi32_si128(p.outShift[i]);
+    }
+
+    while (height > 0) {
+        ip = (uint32_t *)iptr;
+        for (x = 0; x + 16 <= width; x += 16) {
+            a = _mm256_loadu_si256((const __m256i *)(ip + x));
+            b = _mm256_loadu_si256((const __m256i *)(ip + x + 8));
+            v = _mm256_or_si256(
+                    _mm256_or_si256(ScaleChannelAVX2(a, b, inShift[0], outMax[0], outShift[0]),
+                                    ScaleChannelAVX2(a, b, inShift[1], outMax[1], outShift[1])),
+                    ScaleChannelAVX2(a, b, inShift[2], outMax[2], outShift[2]));
+            v = _mm256_permute4x64_epi64(v, 0xd8);
+            if (outBytes == 2) {
+                if (p.swap)
+                    v = _mm256_or_si256(_mm256_slli_epi16(v, 8),
+                                        _mm256_srli_epi16(v, 8));
+                _mm256_storeu_si256((__m256i *)(op + x * 2), v);
+            } else {
+                v = _mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), 0x08);
+                _mm_storeu_si128((__m128i *)(op + x), _mm256_castsi256_si128(v));
+            }
+        }
+        for (; x < width; x++) {
+            if (outBytes == 2)
+                ((uint16_t *)op)[x] = TABLE_LOOKUP(uint16_t, table, ip[x], &p);
+            else
+                op[x] = TABLE_LOOKUP(uint8_t, table, ip[x], &p);
+        }
+        iptr += bytesBetweenInputLines;
+        op += width * outBytes;
+        height--;
+    }
+}
+
+static AVX2 void
+Translate32to16AVX2(char *table, rfbPixelFormat *in, rfbPixelFormat *out,
+                    char *iptr, char *optr, int bytesBetweenInputLines,
+                    int width, int height)
+{
+    Translate32AVX2(table, in, out, iptr, optr, bytesBetweenInputLines,
+                    width, height, 2);
+}
+
+static AVX2 void
+Translate32to8AVX2(char *table, rfbPixelFormat *in, rfbPixelFormat *out,
+                   char *iptr, char *optr, int bytesBetweenInputLines,
+                   int width, int height)
+{
+    Translate32AVX2(table, in, out, iptr, optr, bytesBetweenInputLines,
+                    width, height, 1);
+}
+
+static AVX2 int
+SameRun8AVX2(const uint8_t *p, int n, uint8_t c)
+{
+    __m256i vc = _mm256_set1_epi8((char)c);
+    int i;
+
+    for (i = 0; i + 32 <= n; i += 32)
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+                _mm256_loadu_si256((const __m256i *)(p + i)), vc)) != -1)
+            break;
+    return i + SameRun8C(p + i, n - i, c);
+}
+
+static AVX2 int
+SameRun16AVX2(const uint16_t *p, int n, uint16_t c, uint16_t mask)
+{
+    __m256i vc = _mm256_set1_epi16((short)c), vm = _mm256_set1_epi16((short)mask);
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16)
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi16(_mm256_and_si256(
+                _mm256_loadu_si256((const __m256i *)(p + i)), vm), vc)) != -1)
+            break;
+    return i + SameRun16C(p + i, n - i, c, mask);
+}
+
+static AVX2 int
+SameRun32AVX2(const uint32_t *p, int n, uint32_t c, uint32_t mask)
+{
+    __m256i vc = _mm256_set1_epi32((int)c), vm = _mm256_set1_epi32((int)mask);
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8)
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(_mm256_and_si256(
+                _mm256_loadu_si256((const __m256i *)(p + i)), vm), vc)) != -1)
+            break;
+    return i + SameRun32C(p + i, n - i, c, mask);
+}
+
+static AVX2 int
+TwoColourRun16AVX2(const uint16_t *p, int n, uint16_t c0, uint16_t c1,
+                   uint16_t mask, int *n0)
+{
+    __m256i vc0 = _mm256_set1_epi16((short)c0), vc1 = _mm256_set1_epi16((short)c1);
+    __m256i vm = _mm256_set1_epi16((short)mask), v;
+    int i;
+    unsigned int m0, m1;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        v = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(p + i)), vm);
+        m0 = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi16(v, vc0));
+        m1 = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi16(v, vc1));
+        if ((m0 | m1) != 0xffffffffU)
+            break;
+        *n0 += __builtin_popcount(m0) / 2;
+    }
+    return i + TwoColourRun16C(p + i, n - i, c0, c1, mask, n0);
+}
+
+static AVX2 int
+TwoColourRun32AVX2(const uint32_t *p, int n, uint32_t c0, uint32_t c1,
+                   uint32_t mask, int *n0)
+{
+    __m256i vc0 = _mm256_set1_epi32((int)c0), vc1 = _mm256_set1_epi32((int)c1);
+    __m256i vm = _mm256_set1_epi32((int)mask), v;
+    int i, m0, m1;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        v = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(p + i)), vm);
+        m0 = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v, vc0)));
+        m1 = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v, vc1)));
+        if ((m0 | m1) != 0xff)
+            break;
+        *n0 += __builtin_popcount(m0);
+    }
+    return i + TwoColourRun32C(p + i, n - i, c0, c1, mask, n0);
+}
+
+#endif /* SIMD_AVX2 */
+
+#ifdef SIMD_NEON
+
+static inline int
+AllSetNEON(uint32x4_t m)
+{
+    uint64x2_t t = vreinterpretq_u64_u32(m);
+
+    return (vgetq_lane_u64(t, 0) & vgetq_lane_u64(t, 1)) == ~(uint64_t)0;
+}
+
+static inline uint32_t
+SumNEON(uint32x4_t v)
+{
+    return vgetq_lane_u32(v, 0) + vgetq_lane_u32(v, 1) +
+           vgetq_lane_u32(v, 2) + vgetq_lane_u32(v, 3);
+}
+
+static inline uint16x8_t
+ScaleChannelNEON(uint32x4_t a, uint32x4_t b, int32x4_t inShift,
+                 uint16x8_t outMax, int16x8_t outShift)
+{
+    const uint32x4_t ff = vdupq_n_u32(0xff);
+    uint16x8_t c, v;
+
+    c = vcombine_u16(vmovn_u32(vandq_u32(vshlq_u32(a, inShift), ff)),
+                     vmovn_u32(vandq_u32(vshlq_u32(b, inShift), ff)));
+    v = vmlaq_u16(vdupq_n_u16(127), c, outMax);
+    v = vshrq_n_u16(vaddq_u16(vaddq_u16(v, vdupq_n_u16(1)),
+                              vshrq_n_u16(v, 8)), 8);
+    return vshlq_u16(v, outShift);
+}
+
+static inline void
+Translate32NEON(char *table, rfbPixelFormat *in, rfbPixelFormat *out,
+                char *iptr, char *optr, int bytesBetweenInputLines,
+                int width, int height, int outBytes)
+{
+    TranslateParams p;
+    int32x4_t inShift[3];
+    uint16x8_t outMax[3], v;
+    int16x8_t outShift[3];
+    uint32x4_t a, b;
+    uint32_t *ip;
+    uint8_t *op = (uint8_t *)optr;
+    int i, x;
+
+    GetTranslateParams(in, out, &p);
+    for (i = 0; i < 3; i++) {
+        /* vshlq shifts right by negative amounts */
+        inShift[i] = vdupq_n_s32(-p.inShift[i]);
+        outMax[i] = vdupq_n_u16(p.outMax[i]);
+        outShift[i] = vdupq_n_s16(p.outShift[i]);
+    }
+
+    while (height > 0) {
+        ip = (uint32_t *)iptr;
+        for (x = 0; x + 8 <= width; x += 8) {
+            a = vld1q_u32(ip + x);
+            b = vld1q_u32(ip + x + 4);
+            v = vorrq_u16(vorrq_u16(ScaleChannelNEON(a, b, inShift[0], outMax[0], outShift[0]),
+                                    ScaleChannelNEON(a, b, inShift[1], outMax[1], outShift[1])),
+                          ScaleChannelNEON(a, b, inShift[2], outMax[2], outShift[2]));
+            if (outBytes == 2) {
+                if (p.swap)
+                    v = vreinterpretq_u16_u8(vrev16q_u8(vreinterpretq_u8_u16(v)));
+                vst1q_u16((uint16_t *)(op + x * 2), v);
+            } else {
+                vst1_u8(op + x, vmovn_u16(v));
+            }
+        }
+        for (; x < width; x++) {
+            if (outBytes == 2)
+                ((uint16_t *)op)[x] = TABLE_LOOKUP(uint16_t, table, ip[x], &p);
+            else
+                op[x] = TABLE_LOOKUP(uint8_t, table, ip[x], &p);
+        }
+        iptr += bytesBetweenInputLines;
+        op += width * outBytes;
+        height--;
+    }
+}
+
+static void
+Translate32to16NEON(char *table, rfbPixelFormat *in, rfbPixelFormat *out,
+                    char *iptr, char *optr, int bytesBetweenInputLines,
+                    int width, int height)
+{
+    Translate32NEON(table, in, out, iptr, optr, bytesBetweenInputLines,
+                    width, height, 2);
+}
+
+static void
+Translate32to8NEON(char *table, rfbPixelFormat *in, rfbPixelFormat *out,
+                   char *iptr, char *optr, int bytesBetweenInputLines,
+                   int width, int height)
+{
+    Translate32NEON(table, in, out, iptr, optr, bytesBetweenInputLines,
+                    width, height, 1);
+}
+
+static int
+SameRun8NEON(const uint8_t *p, int n, uint8_t c)
+{
+    uint8x16_t vc = vdupq_n_u8(c);
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16)
+        if (!AllSetNEON(vreinterpretq_u32_u8(vceqq_u8(vld1q_u8(p + i), vc))))
+            break;
+    return i + SameRun8C(p + i, n - i, c);
+}
+
+static int
+SameRun16NEON(const uint16_t *p, int n, uint16_t c, uint16_t mask)
+{
+    uint16x8_t vc = vdupq_n_u16(c), vm = vdupq_n_u16(mask);
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8)
+        if (!AllSetNEON(vreinterpretq_u32_u16(
+                vceqq_u16(vandq_u16(vld1q_u16(p + i), vm), vc))))
+            break;
+    return i + SameRun16C(p + i, n - i, c, mask);
+}
+
+static int
+SameRun32NEON(const uint32_t *p, int n, uint32_t c, uint32_t mask)
+{
+    uint32x4_t vc = vdupq_n_u32(c), vm = vdupq_n_u32(mask);
+    int i;
+
+    for (i = 0; i + 4 <= n; i += 4)
+        if (!AllSetNEON(vceqq_u32(vandq_u32(vld1q_u32(p + i), vm), vc)))
+            break;
+    return i + SameRun32C(p + i, n - i, c, mask);
+}
+
+static int
+TwoColourRun16NEON(const uint16_t *p, int n, uint16_t c0, uint16_t c1,
+                   uint16_t mask, int *n0)
+{
+    uint16x8_t vc0 = vdupq_n_u16(c0), vc1 = vdupq_n_u16(c1);
+    uint16x8_t vm = vdupq_n_u16(mask), v, m0;
+    uint32x4_t count = vdupq_n_u32(0);
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        v = vandq_u16(vld1q_u16(p + i), vm);
+        m0 = vceqq_u16(v, vc0);
+        if (!AllSetNEON(vreinterpretq_u32_u16(vorrq_u16(m0, vceqq_u16(v, vc1)))))
+            break;
+        count = vpadalq_u16(count, vshrq_n_u16(m0, 15));
+    }
+    *n0 += SumNEON(count);
+    return i + TwoColourRun16C(p + i, n - i, c0, c1, mask, n0);
+}
+
+static int
+TwoColourRun32NEON(const uint32_t *p, int n, uint32_t c0, uint32_t c1,
+                   uint32_t mask, int *n0)
+{
+    uint32x4_t vc0 = vdupq_n_u32(c0), vc1 = vdupq_n_u32(c1);
+    uint32x4_t vm = vdupq_n_u32(mask), v, m0;
+    uint32x4_t count = vdupq_n_u32(0);
+    int i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        v = vandq_u32(vld1q_u32(p + i), vm);
+        m0 = vceqq_u32(v, vc0);
+        if (!AllSetNEON(vorrq_u32(m0, vceqq_u32(v, vc1))))
+            break;
+        count = vaddq_u32(count, vshrq_n_u32(m0, 31));
+    }
+    *n0 += SumNEON(count);
+    return i + TwoColourRun32C(p + i, n - i, c0, c1, mask, n0);
+}
+
+#endif /* SIMD_NEON */
+
+
+/*
+ * The versions in use.  They start out as the best ones the compiler
+ * targets unconditionally, rfbSimdInit() may pick others.
+ */
+
+#if defined(SIMD_SSE2)
+#define BEST(name) name##SSE2
+#elif defined(SIMD_NEON)
+#define BEST(name) name##NEON
+#endif
+
+#ifdef BEST
+static rfbTranslateFnType translate32to16 = BEST(Translate32to16);
+static rfbTranslateFnType translate32to8 = BEST(Translate32to8);
+int (*rfbSameRun8)(const uint8_t *, int, uint8_t) = BEST(SameRun8);
+int (*rfbSameRun16)(const uint16_t *, int, uint16_t, uint16_t) = BEST(SameRun16);
+int (*rfbSameRun32)(const uint32_t *, int, uint32_t, uint32_t) = BEST(SameRun32);
+int (*rfbTwoColourRun16)(const uint16_t *, int, uint16_t, uint16_t, uint16_t, int *) =
+    BEST(TwoColourRun16);
+int (*rfbTwoColourRun32)(const uint32_t *, int, uint32_t, uint32_t, uint32_t, int *) =
+    BEST(TwoColourRun32);
+#else
+static rfbTranslateFnType translate32to16 = NULL;
+static rfbTranslateFnType translate32to8 = NULL;
+int (*rfbSameRun8)(const uint8_t *, int, uint8_t) = SameRun8C;
+int (*rfbSameRun16)(const uint16_t *, int, uint16_t, uint16_t) = SameRun16C;
+int (*rfbSameRun32)(const uint32_t *, int, uint32_t, uint32_t) = SameRun32C;
+int (*rfbTwoColourRun16)(const uint16_t *, int, uint16_t, uint16_t, uint16_t, int *) =
+    TwoColourRun16C;
+int (*rfbTwoColourRun32)(const uint32_t *, int, uint32_t, uint32_t, uint32_t, int *) =
+    TwoColourRun32C;
+#endif
+
+#define USE(name, suffix)                                               \
+    do {                                                                \
+        translate32to16 = Translate32to16##suffix;                      \
+        translate32to8 = Translate32to8##suffix;                        \
+        rfbSameRun8 = SameRun8##suffix;                                 \
+        rfbSameRun16 = SameRun16##suffix;                               \
+        rfbSameRun32 = SameRun32##suffix;                               \
+        rfbTwoColourRun16 = TwoColourRun16##suffix;                     \
+        rfbTwoColourRun32 = TwoColourRun32##suffix;                     \
+        name = #suffix;                                                 \
+    } while (0)
+
+/*
+ * Pick the versions to use, according to rfbUseSIMD and the CPU we run
+ * on.  Called by rfbGetScreen().
+ */
+
+void
+rfbSimdInit(void)
+{
+    const char *name = "C";
+
+    translate32to16 = NULL;
+    translate32to8 = NULL;
+    rfbSameRun8 = SameRun8C;
+    rfbSameRun16 = SameRun16C;
+    rfbSameRun32 = SameRun32C;
+    rfbTwoColourRun16 = TwoColourRun16C;
+    rfbTwoColourRun32 = TwoColourRun32C;
+
+    if (rfbUseSIMD) {
+#if defined(SIMD_SSE2)
+        USE(name, SSE2);
+#if defined(SIMD_AVX2)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            USE(name, AVX2);
+#endif
+#elif defined(SIMD_NEON)
+        USE(name, NEON);
+#endif
+    }
+
+    rfbLog("Using %s pixel loops\n", name);
+}
+
+/*
+ * Returns a vectorised function translating from in to out, or NULL if
+ * there is none for this pair of formats.
+ */
+
+rfbTranslateFnType
+rfbSimdTranslateFn(rfbPixelFormat *in, rfbPixelFormat *out)
+{
+    TranslateParams p;
+
+    if (!rfbUseSIMD || !GetTranslateParams(in, out, &p))
+        return NULL;
+    return out->bitsPerPixel == 16 ? translate32to16 : translate32to8;
+}
@@ -72,6 +72,10 @@
 #ifdef LIBVNCSERVER_HAVE_UNISTD_H
 #include <unistd.h>
 #endif
+#ifdef LIBVNCSERVER_HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#include <poll.h>
+#endif
 
 #ifdef LIBVNCSERVER_WITH_WEBSOCKETS
 #include "rfbssl.h"
@@ -91,6 +95,8 @@ struct timeval
 
 #include <errno.h>
 
+#include "private.h"
+
 #ifdef USE_LIBWRAP
 #include <syslog.h>
 #include <tcpd.h>
@@ -122,6 +128,80 @@ int deny_severity=LOG_WARNING;
 int rfbMaxClientWait = 20000;   /* time (ms) after which we decide client has
                                    gone away - needed to stop us hanging */
 
+/*
+ * The sockets the event loop waits on: registered with the screen's
+ * epoll instance if there is one, kept in allFds for select() if not.
+ * Client sockets carry their client, the screen's own sockets NULL.
+ */
+
+void
+rfbWatchSock(rfbScreenInfoPtr rfbScreen, int sock, rfbClientPtr cl)
+{
+#ifdef LIBVNCSERVER_HAVE_SYS_EPOLL_H
+    struct epoll_event ev;
+
+    if (rfbScreen->epollFd != -1) {
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = cl;
+	if (epoll_ctl(rfbScreen->epollFd, EPOLL_CTL_ADD, sock, &ev) < 0 &&
+	    (errno != EEXIST ||
+	     epoll_ctl(rfbScreen->epollFd, EPOLL_CTL_MOD, sock, &ev) < 0))
+	    rfbLogPerror("rfbWatchSock: epoll_ctl");
+	return;
+    }
+#endif
+    FD_SET(sock, &(rfbScreen->allFds));
+    rfbScreen->maxFd = max(sock, rfbScreen->maxFd);
+}
+
+void
+rfbUnwatchSock(rfbScreenInfoPtr rfbScreen, int sock)
+{
+#ifdef LIBVNCSERVER_HAVE_SYS_EPOLL_H
+    struct epoll_event ev;
+
+    if (rfbScreen->epollFd != -1) {
+	/* pre-2.6.9 kernels want a non-NULL event even for EPOLL_CTL_DEL */
+	memset(&ev, 0, sizeof(ev));
+	epoll_ctl(rfbScreen->epollFd, EPOLL_CTL_DEL, sock, &ev);
+	return;
+    }
+#endif
+    FD_CLR(sock, &(rfbScreen->allFds));
+    if (sock == rfbScreen->maxFd)
+	while (rfbScreen->maxFd > 0
+	       && !FD_ISSET(rfbScreen->maxFd, &(rfbScreen->allFds)))
+	    rfbScreen->maxFd--;
+}
+
+static void
+rfbEpollInit(rfbScreenInfoPtr rfbScreen)
+{
+#ifdef LIBVNCSERVER_HAVE_SYS_EPOLL_H
+    rfbClientIteratorPtr i;
+    rfbClientPtr cl;
+
+    if (rfbScreen->epollFd != -1)
+	return;
+
+    if ((rfbScreen->epollFd = epoll_create(16)) < 0) {
+	rfbLogPerror("rfbInitSockets: epoll_create, falling back to select");
+	rfbScreen->epollFd = -1;
+	return;
+    }
+
+    /* clients kept across rfbShutdownSockets() move over from allFds */
+    FD_ZERO(&(rfbScreen->allFds));
+    rfbScreen->maxFd = 0;
+    i = rfbGetClientIterator(rfbScreen);
+    while((cl = rfbClientIteratorNext(i)))
+	if (cl->sock != -1)
+	    rfbWatchSock(rfbScreen, cl->sock, cl);
+    rfbReleaseClientIterator(i);
+#endif
+}
+
 /*
  * rfbInitSockets sets up the TCP and UDP sockets to listen for RFB
  * connections.  It does nothing if called again.
@@ -138,6 +218,8 @@ rfbInitSockets(rfbScreenInfoPtr rfbScreen)
 
     rfbScreen->socketState = RFB_SOCKET_READY;
 
+    rfbEpollInit(rfbScreen);
+
     if (rfbScreen->inetdSock != -1) {
 	const int one = 1;
 
@@ -151,8 +233,7 @@ rfbInitSockets(rfbScreenInfoPtr rfbScreen)
 	}
 
     	FD_ZERO(&(rfbScreen->allFds));
-    	FD_SET(rfbScreen->inetdSock, &(rfbScreen->allFds));
-    	rfbScreen->maxFd = rfbScreen->inetdSock;
+    	rfbWatchSock(rfbScreen, rfbScreen->inetdSock, NULL);
 	return;
     }
 
@@ -174,8 +255,7 @@ rfbInitSockets(rfbScreenInfoPtr rfbScreen)
         }
 
         rfbLog("Autoprobing selected TCP port %d\n", rfbScreen->port);
-        FD_SET(rfbScreen->listenSock, &(rfbScreen->allFds));
-        rfbScreen->maxFd = rfbScreen->listenSock;
+        rfbWatchSock(rfbScreen, rfbScreen->listenSock, NULL);
 
 #ifdef LIBVNCSERVER_IPv6
         rfbLog("Autoprobing TCP6 port \n");
@@ -192,8 +272,7 @@ rfbInitSockets(rfbScreenInfoPtr rfbScreen)
         }
 
         rfbLog("Autoprobing selected TCP6 port %d\n", rfbScreen->ipv6port);
-	FD_SET(rfbScreen->listen6Sock, &(rfbScreen->allFds));
-	rfbScreen->maxFd = max((int)rfbScreen->listen6Sock,rfbScreen->maxFd);
+	rfbWatchSock(rfbScreen, rfbScreen->listen6Sock, NULL);
 #endif
     }
     else
@@ -207,8 +286,7 @@ rfbInitSockets(rfbScreenInfoPtr rfbScreen)
       }
       rfbLog("Listening for VNC connections on TCP port %d\n", rfbScreen->port);  
   
-      FD_SET(rfbScreen->listenSock, &(rfbScreen->allFds));
-      rfbScreen->maxFd = rfbScreen->listenSock;
+      rfbWatchSock(rfbScreen, rfbScreen->listenSock, NULL);
 	    }
 
 #ifdef LIBVNCSERVER_IPv6
@@ -219,8 +297,7 @@ rfbInitSockets(rfbScreenInfoPtr rfbScreen)
       }
       rfbLog("Listening for VNC connections on TCP6 port %d\n", rfbScreen->ipv6port);  
 	
-      FD_SET(rfbScreen->listen6Sock, &(rfbScreen->allFds));
-      rfbScreen->maxFd = max((int)rfbScreen->listen6Sock,rfbScreen->maxFd);
+      rfbWatchSock(rfbScreen, rfbScreen->listen6Sock, NULL);
 	    }
 #endif
 
@@ -235,8 +312,7 @@ rfbInitSockets(rfbScreenInfoPtr rfbScreen)
 	}
 	rfbLog("Listening for VNC connections on TCP port %d\n", rfbScreen->port);  
 
-	FD_SET(rfbScreen->udpSock, &(rfbScreen->allFds));
-	rfbScreen->maxFd = max((int)rfbScreen->udpSock,rfbScreen->maxFd);
+	rfbWatchSock(rfbScreen, rfbScreen->udpSock, NULL);
     }
 }
 
@@ -248,30 +324,238 @@ void rfbShutdownSockets(rfbScreenInfoPtr rfbScreen)
     rfbScreen->socketState = RFB_SOCKET_SHUTDOWN;
 
     if(rfbScreen->inetdSock>-1) {
+	rfbUnwatchSock(rfbScreen, rfbScreen->inetdSock);
 	closesocket(rfbScreen->inetdSock);
-	FD_CLR(rfbScreen->inetdSock,&rfbScreen->allFds);
 	rfbScreen->inetdSock=-1;
     }
 
     if(rfbScreen->listenSock>-1) {
+	rfbUnwatchSock(rfbScreen, rfbScreen->listenSock);
 	closesocket(rfbScreen->listenSock);
-	FD_CLR(rfbScreen->listenSock,&rfbScreen->allFds);
 	rfbScreen->listenSock=-1;
     }
 
     if(rfbScreen->listen6Sock>-1) {
+	rfbUnwatchSock(rfbScreen, rfbScreen->listen6Sock);
 	closesocket(rfbScreen->listen6Sock);
-	FD_CLR(rfbScreen->listen6Sock,&rfbScreen->allFds);
 	rfbScreen->listen6Sock=-1;
     }
 
     if(rfbScreen->udpSock>-1) {
+	rfbUnwatchSock(rfbScreen, rfbScreen->udpSock);
 	closesocket(rfbScreen->udpSock);
-	FD_CLR(rfbScreen->udpSock,&rfbScreen->allFds);
 	rfbScreen->udpSock=-1;
     }
+
+    if(rfbScreen->epollFd>-1) {
+	rfbClientIteratorPtr i;
+	rfbClientPtr cl;
+
+	close(rfbScreen->epollFd);
+	rfbScreen->epollFd=-1;
+
+	/* clients kept open go back to allFds */
+	i = rfbGetClientIterator(rfbScreen);
+	while((cl = rfbClientIteratorNext(i)))
+	    if (cl->sock != -1)
+		rfbWatchSock(rfbScreen, cl->sock, cl);
+	rfbReleaseClientIterator(i);
+    }
+}
+
+static rfbBool rfbAcceptConnection(rfbScreenInfoPtr rfbScreen, int listenSock);
+
+/*
+ * Handle a datagram waiting on the UDP socket.  Returns -1 on error.
+ */
+
+static int
+rfbProcessUDPSock(rfbScreenInfoPtr rfbScreen)
+{
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    char buf[6];
+
+    if(!rfbScreen->udpClient)
+	rfbNewUDPClient(rfbScreen);
+    if (recvfrom(rfbScreen->udpSock, buf, 1, MSG_PEEK,
+		(struct sockaddr *)&addr, &addrlen) < 0) {
+	rfbLogPerror("rfbCheckFds: UDP: recvfrom");
+	rfbDisconnectUDPSock(rfbScreen);
+	rfbScreen->udpSockConnected = FALSE;
+    } else {
+	if (!rfbScreen->udpSockConnected ||
+		(memcmp(&addr, &rfbScreen->udpRemoteAddr, addrlen) != 0))
+	{
+	    /* new remote end */
+	    rfbLog("rfbCheckFds: UDP: got connection\n");
+
+	    memcpy(&rfbScreen->udpRemoteAddr, &addr, addrlen);
+	    rfbScreen->udpSockConnected = TRUE;
+
+	    if (connect(rfbScreen->udpSock,
+			(struct sockaddr *)&addr, addrlen) < 0) {
+		rfbLogPerror("rfbCheckFds: UDP: connect");
+		rfbDisconnectUDPSock(rfbScreen);
+		return -1;
+	    }
+
+	    rfbNewUDPConnection(rfbScreen,rfbScreen->udpSock);
+	}
+
+	rfbProcessUDPInput(rfbScreen);
+    }
+
+    return 0;
+}
+
+/*
+ * Handle the listening and UDP sockets marked in fds.  Returns how many
+ * of them were handled or -1 on error.
+ */
+
+static int
+rfbProcessScreenFds(rfbScreenInfoPtr rfbScreen, fd_set *fds)
+{
+    int handled = 0;
+
+    if (rfbScreen->listenSock != -1 && FD_ISSET(rfbScreen->listenSock, fds)) {
+
+	if (!rfbAcceptConnection(rfbScreen, rfbScreen->listenSock))
+            return -1;
+
+	handled++;
+    }
+
+    if (rfbScreen->listen6Sock != -1 && FD_ISSET(rfbScreen->listen6Sock, fds)) {
+
+	if (!rfbAcceptConnection(rfbScreen, rfbScreen->listen6Sock))
+            return -1;
+
+	handled++;
+    }
+
+    if ((rfbScreen->udpSock != -1) && FD_ISSET(rfbScreen->udpSock, fds)) {
+	if (rfbProcessUDPSock(rfbScreen) < 0)
+	    return -1;
+
+	handled++;
+    }
+
+    return handled;
+}
+
+#ifdef LIBVNCSERVER_HAVE_SYS_EPOLL_H
+
+#define RFB_EPOLL_EVENTS 64
+
+static rfbBool
+rfbEpollReady(struct epoll_event *events, int nfds, rfbClientPtr cl)
+{
+    int n;
+
+    for (n = 0; n < nfds; n++)
+	if (events[n].data.ptr == cl)
+	    return TRUE;
+    return FALSE;
+}
+
+/*
+ * The screen's own sockets are registered without a client, so the
+ * event does not say which one it is.  Ask poll(), which unlike select()
+ * does not care how high the descriptors are.
+ */
+
+static int
+rfbProcessScreenSocksEpoll(rfbScreenInfoPtr rfbScreen)
+{
+    struct pollfd pfd[3];
+    int n, npfd = 0;
+
+    if (rfbScreen->listenSock != -1)
+	pfd[npfd++].fd = rfbScreen->listenSock;
+    if (rfbScreen->listen6Sock != -1)
+	pfd[npfd++].fd = rfbScreen->listen6Sock;
+    if (rfbScreen->udpSock != -1)
+	pfd[npfd++].fd = rfbScreen->udpSock;
+    for (n = 0; n < npfd; n++) {
+	pfd[n].events = POLLIN;
+	pfd[n].revents = 0;
+    }
+
+    if (npfd == 0 || poll(pfd, npfd, 0) <= 0)
+	return 0;
+
+    for (n = 0; n < npfd; n++) {
+	if (!(pfd[n].revents & POLLIN))
+	    continue;
+	if (pfd[n].fd == rfbScreen->udpSock) {
+	    if (rfbProcessUDPSock(rfbScreen) < 0)
+		return -1;
+	} else if (!rfbAcceptConnection(rfbScreen, pfd[n].fd)) {
+	    return -1;
+	}
+    }
+    return 0;
 }
 
+/*
+ * rfbCheckFds for screens with an epoll instance: the cost of a call no
+ * longer grows with the highest file descriptor, and ready clients are
+ * found from the events.  The clients are still walked once per call,
+ * but only to find those in the middle of sending a file.
+ */
+
+static int
+rfbCheckFdsEpoll(rfbScreenInfoPtr rfbScreen, long usec)
+{
+    struct epoll_event events[RFB_EPOLL_EVENTS];
+    rfbClientIteratorPtr i;
+    rfbClientPtr cl;
+    int nfds, n, result = 0;
+
+    do {
+	nfds = epoll_wait(rfbScreen->epollFd, events, RFB_EPOLL_EVENTS,
+			  (usec + 999) / 1000);
+	if (nfds < 0) {
+	    if (errno != EINTR)
+		rfbLogPerror("rfbCheckFds: epoll_wait");
+	    return -1;
+	}
+
+	result += nfds;
+
+	for (n = 0; n < nfds; n++)
+	    if (events[n].data.ptr == NULL)
+		break;
+	if (n < nfds && rfbProcessScreenSocksEpoll(rfbScreen) < 0)
+	    return -1;
+
+	for (n = 0; n < nfds; n++) {
+	    cl = events[n].data.ptr;
+	    if (cl && cl->sock != -1 && !cl->onHold)
+		rfbProcessClientMessage(cl);
+	}
+
+	/* rfbSendFileTransferChunk() would do nothing for the others */
+	i = rfbGetClientIterator(rfbScreen);
+	while((cl = rfbClientIteratorNext(i))) {
+	    if (cl->onHold || cl->sock == -1 ||
+		cl->fileTransfer.fd == -1 || !cl->fileTransfer.sending)
+		continue;
+	    if (!rfbEpollReady(events, nfds, cl))
+		rfbSendFileTransferChunk(cl);
+	}
+	rfbReleaseClientIterator(i);
+
+	if (nfds == 0)
+	    return result;
+    } while(rfbScreen->handleEventsEagerly);
+    return result;
+}
+
+#endif
+
 /*
  * rfbCheckFds is called from ProcessInputEvents to check for input on the RFB
  * socket(s).  If there is input to process, the appropriate function in the
@@ -282,12 +566,9 @@ void rfbShutdownSockets(rfbScreenInfoPtr rfbScreen)
 int
 rfbCheckFds(rfbScreenInfoPtr rfbScreen,long usec)
 {
-    int nfds;
+    int nfds, n;
     fd_set fds;
     struct timeval tv;
-    struct sockaddr_in addr;
-    socklen_t addrlen = sizeof(addr);
-    char buf[6];
     rfbClientIteratorPtr i;
     rfbClientPtr cl;
     int result = 0;
@@ -297,6 +578,11 @@ rfbCheckFds(rfbScreenInfoPtr rfbScreen,long usec)
 	rfbScreen->inetdInitDone = TRUE;
     }
 
+#ifdef LIBVNCSERVER_HAVE_SYS_EPOLL_H
+    if (rfbScreen->epollFd != -1)
+	return rfbCheckFdsEpoll(rfbScreen, usec);
+#endif
+
     do {
 	memcpy((char *)&fds, (char *)&(rfbScreen->allFds), sizeof(fd_set));
 	tv.tv_sec = 0;
@@ -326,61 +612,10 @@ rfbCheckFds(rfbScreenInfoPtr rfbScreen,long usec)
 
 	result += nfds;
 
-	if (rfbScreen->listenSock != -1 && FD_ISSET(rfbScreen->listenSock, &fds)) {
-
-	    if (!rfbProcessNewConnection(rfbScreen))
-                return -1;
-
-	    FD_CLR(rfbScreen->listenSock, &fds);
-	    if (--nfds == 0)
-		return result;
-	}
-
-	if (rfbScreen->listen6Sock != -1 && FD_ISSET(rfbScreen->listen6Sock, &fds)) {
-
-	    if (!rfbProcessNewConnection(rfbScreen))
-                return -1;
-
-	    FD_CLR(rfbScreen->listen6Sock, &fds);
-	    if (--nfds == 0)
-		return result;
-	}
-
-	if ((rfbScreen->udpSock != -1) && FD_ISSET(rfbScreen->udpSock, &fds)) {
-	    if(!rfbScreen->udpClient)
-		rfbNewUDPClient(rfbScreen);
-	    if (recvfrom(rfbScreen->udpSock, buf, 1, MSG_PEEK,
-			(struct sockaddr *)&addr, &addrlen) < 0) {
-		rfbLogPerror("rfbCheckFds: UDP: recvfrom");
-		rfbDisconnectUDPSock(rfbScreen);
-		rfbScreen->udpSockConnected = FALSE;
-	    } else {
-		if (!rfbScreen->udpSockConnected ||
-			(memcmp(&addr, &rfbScreen->udpRemoteAddr, addrlen) != 0))
-		{
-		    /* new remote end */
-		    rfbLog("rfbCheckFds: UDP: got connection\n");
-
-		    memcpy(&rfbScreen->udpRemoteAddr, &addr, addrlen);
-		    rfbScreen->udpSockConnected = TRUE;
-
-		    if (connect(rfbScreen->udpSock,
-				(struct sockaddr *)&addr, addrlen) < 0) {
-			rfbLogPerror("rfbCheckFds: UDP: connect");
-			rfbDisconnectUDPSock(rfbScreen);
-			return -1;
-		    }
-
-		    rfbNewUDPConnection(rfbScreen,rfbScreen->udpSock);
-		}
-
-		rfbProcessUDPInput(rfbScreen);
-	    }
-
-	    FD_CLR(rfbScreen->udpSock, &fds);
-	    if (--nfds == 0)
-		return result;
-	}
+	if ((n = rfbProcessScreenFds(rfbScreen, &fds)) < 0)
+	    return -1;
+	if ((nfds -= n) == 0)
+	    return result;
 
 	i = rfbGetClientIterator(rfbScreen);
 	while((cl = rfbClientIteratorNext(i))) {
@@ -401,8 +636,52 @@ rfbCheckFds(rfbScreenInfoPtr rfbScreen,long usec)
     return result;
 }
 
+/*
+ * Find a listening socket with a connection waiting, blocking until there
+ * is one.  Returns -1 on error.
+ */
+
+int
+rfbWaitForListenSock(rfbScreenInfoPtr rfbScreen)
+{
+    fd_set listen_fds;
+    int maxSock = max((int)rfbScreen->listenSock, (int)rfbScreen->listen6Sock);
+
+    /* with one socket, accept() does the waiting */
+    if (rfbScreen->listenSock < 0 || rfbScreen->listen6Sock < 0)
+	return maxSock;
+
+    if (maxSock >= FD_SETSIZE) {
+	rfbErr("rfbWaitForListenSock: socket %d is beyond FD_SETSIZE\n", maxSock);
+	return -1;
+    }
+
+    FD_ZERO(&listen_fds);
+    FD_SET(rfbScreen->listenSock, &listen_fds);
+    FD_SET(rfbScreen->listen6Sock, &listen_fds);
+    if (select(maxSock+1, &listen_fds, NULL, NULL, NULL) == -1) {
+      rfbLogPerror("rfbWaitForListenSock: error in select");
+      return -1;
+    }
+    if (FD_ISSET(rfbScreen->listen6Sock, &listen_fds))
+      return rfbScreen->listen6Sock;
+    return rfbScreen->listenSock;
+}
+
 rfbBool
 rfbProcessNewConnection(rfbScreenInfoPtr rfbScreen)
+{
+    /* We know that at least one of the listening sockets has a
+       connection pending, so this should not block for too long! */
+    int listenSock = rfbWaitForListenSock(rfbScreen);
+
+    if (listenSock < 0)
+      return FALSE;
+    return rfbAcceptConnection(rfbScreen, listenSock);
+}
+
+static rfbBool
+rfbAcceptConnection(rfbScreenInfoPtr rfbScreen, int listenSock)
 {
     const int one = 1;
     int sock = -1;
@@ -412,27 +691,8 @@ rfbProcessNewConnection(rfbScreenInfoPtr rfbScreen)
     struct sockaddr_in addr;
 #endif
     socklen_t addrlen = sizeof(addr);
-    fd_set listen_fds; 
-    int chosen_listen_sock = -1;
-
-    /* Do another select() call to find out which listen socket
-       has an incoming connection pending. We know that at least 
-       one of them has, so this should not block for too long! */
-    FD_ZERO(&listen_fds);  
-    if(rfbScreen->listenSock >= 0) 
-      FD_SET(rfbScreen->listenSock, &listen_fds);
-    if(rfbScreen->listen6Sock >= 0) 
-      FD_SET(rfbScreen->listen6Sock, &listen_fds);
-    if (select(rfbScreen->maxFd+1, &listen_fds, NULL, NULL, NULL) == -1) {
-      rfbLogPerror("rfbProcessNewConnection: error in select");
-      return FALSE;
-    }
-    if (rfbScreen->listenSock >= 0 && FD_ISSET(rfbScreen->listenSock, &listen_fds))
-      chosen_listen_sock = rfbScreen->listenSock;
-    if (rfbScreen->listen6Sock >= 0 && FD_ISSET(rfbScreen->listen6Sock, &listen_fds))
-      chosen_listen_sock = rfbScreen->listen6Sock;
 
-    if ((sock = accept(chosen_listen_sock,
+    if ((sock = accept(listenSock,
 		       (struct sockaddr *)&addr, &addrlen)) < 0) {
       rfbLogPerror("rfbCheckFds: accept");
       return FALSE;
@@ -500,11 +760,7 @@ rfbCloseClient(rfbClientPtr cl)
     if (cl->sock != -1)
 #endif
       {
-	FD_CLR(cl->sock,&(cl->screen->allFds));
-	if(cl->sock==cl->screen->maxFd)
-	  while(cl->screen->maxFd>0
-		&& !FD_ISSET(cl->screen->maxFd,&(cl->screen->allFds)))
-	    cl->screen->maxFd--;
+	rfbUnwatchSock(cl->screen,cl->sock);
 #ifdef LIBVNCSERVER_WITH_WEBSOCKETS
 	if (cl->sslctx)
 	    rfbssl_destroy(cl);
@@ -554,8 +810,10 @@ rfbConnect(rfbScreenInfoPtr rfbScreen,
     }
 
     /* AddEnabledDevice(sock); */
-    FD_SET(sock, &rfbScreen->allFds);
-    rfbScreen->maxFd = max(sock,rfbScreen->maxFd);
+    if (rfbScreen->epollFd == -1) {
+	FD_SET(sock, &rfbScreen->allFds);
+	rfbScreen->maxFd = max(sock,rfbScreen->maxFd);
+    }
 
     return sock;
 }
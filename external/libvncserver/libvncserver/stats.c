@@ -353,6 +353,11 @@ int rfbStatGetEncodingCountRcvd(rfbClientPtr cl, uint32_t type)
       if (ptr->type==type) return ptr->rcvdCount;
   return 0;
 }
+uint64_t rfbStatGetEncodeTime(rfbClientPtr cl)
+{
+    if (cl==NULL) return 0;
+    return cl->encodeTime;
+}
 
 
 
@@ -373,6 +378,7 @@ void rfbResetStats(rfbClientPtr cl)
         cl->statMsgList = ptr->Next;
         free(ptr);
     }
+    cl->encodeTime = 0;
 }
 
 
@@ -433,6 +439,9 @@ void rfbPrintStats(rfbClientPtr cl)
         savings = 100.0 - ((totalBytes/totalBytesIfRaw)*100.0);
     rfbLog(" %-20.20s: %6d | %9.0f/%9.0f (%5.1f%%)\n",
             "TOTALS", totalRects, totalBytes,totalBytesIfRaw, savings);
+    if (cl->encodeTime>0)
+        rfbLog(" %-20.20s: %9.1f ms (%.1f kB/s)\n", "encoding time",
+            cl->encodeTime/1000.0, totalBytes/1.024/cl->encodeTime*1000.0);
 
     totalRects=0.0;
     totalBytes=0.0;
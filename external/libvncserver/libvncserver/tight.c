@@ -52,6 +52,13 @@
 #define MIN_SOLID_SUBRECT_SIZE  2048
 #define MAX_SPLIT_TILE_SIZE       16
 
+/*
+ * With the shared encoding cache each rectangle has to decode on its own,
+ * so every zlib stream is reset whenever it is used.
+ */
+#define STREAM_RESET(cl, streamId) \
+    ((cl)->screen->rectCache ? 1 << (streamId) : 0)
+
 /*
  * There is so much access of the Tight encoding static data buffers
  * that we resort to using thread local storage instead of having
@@ -584,7 +591,7 @@ CheckSolidTile##bpp(rfbClientPtr cl, int x, int y, int w, int h,              \
 {                                                                             \
     uint##bpp##_t *fbptr;                                                     \
     uint##bpp##_t colorValue;                                                 \
-    int dx, dy;                                                               \
+    int dy;                                                                   \
                                                                               \
     fbptr = (uint##bpp##_t *)&cl->scaledScreen->frameBuffer                   \
         [y * cl->scaledScreen->paddedWidthInBytes + x * (bpp/8)];             \
@@ -594,10 +601,8 @@ CheckSolidTile##bpp(rfbClientPtr cl, int x, int y, int w, int h,              \
         return FALSE;                                                         \
                                                                               \
     for (dy = 0; dy < h; dy++) {                                              \
-        for (dx = 0; dx < w; dx++) {                                          \
-            if (colorValue != fbptr[dx])                                      \
-                return FALSE;                                                 \
-        }                                                                     \
+        if (SAME_RUN##bpp(fbptr, w, colorValue, ~0) < w)                      \
+            return FALSE;                                                     \
         fbptr = (uint##bpp##_t *)((uint8_t *)fbptr                            \
                  + cl->scaledScreen->paddedWidthInBytes);                     \
     }                                                                         \
@@ -606,6 +611,11 @@ CheckSolidTile##bpp(rfbClientPtr cl, int x, int y, int w, int h,              \
     return TRUE;                                                              \
 }
 
+/* the vectorised scans from simd.c, with a common signature */
+#define SAME_RUN8(p, n, c, mask) rfbSameRun8(p, n, c)
+#define SAME_RUN16(p, n, c, mask) rfbSameRun16(p, n, c, mask)
+#define SAME_RUN32(p, n, c, mask) rfbSameRun32(p, n, c, mask)
+
 DEFINE_CHECK_SOLID_FUNCTION(8)
 DEFINE_CHECK_SOLID_FUNCTION(16)
 DEFINE_CHECK_SOLID_FUNCTION(32)
@@ -857,7 +867,8 @@ SendMonoRect(rfbClientPtr cl,
         cl->updateBuf[cl->ublen++] =
             (char)((rfbTightNoZlib | rfbTightExplicitFilter) << 4);
     else
-        cl->updateBuf[cl->ublen++] = (streamId | rfbTightExplicitFilter) << 4;
+        cl->updateBuf[cl->ublen++] = (streamId | rfbTightExplicitFilter) << 4 |
+                                     STREAM_RESET(cl, streamId);
     cl->updateBuf[cl->ublen++] = rfbTightFilterPalette;
     cl->updateBuf[cl->ublen++] = 1;
 
@@ -933,7 +944,8 @@ SendIndexedRect(rfbClientPtr cl,
         cl->updateBuf[cl->ublen++] =
             (char)((rfbTightNoZlib | rfbTightExplicitFilter) << 4);
     else
-        cl->updateBuf[cl->ublen++] = (streamId | rfbTightExplicitFilter) << 4;
+        cl->updateBuf[cl->ublen++] = (streamId | rfbTightExplicitFilter) << 4 |
+                                     STREAM_RESET(cl, streamId);
     cl->updateBuf[cl->ublen++] = rfbTightFilterPalette;
     cl->updateBuf[cl->ublen++] = (char)(paletteNumColors - 1);
 
@@ -1008,7 +1020,7 @@ SendFullColorRect(rfbClientPtr cl,
         cl->tightEncoding != rfbEncodingTightPng)
         cl->updateBuf[cl->ublen++] = (char)(rfbTightNoZlib << 4);
     else
-        cl->updateBuf[cl->ublen++] = 0x00;  /* stream id = 0, no flushing, no filter */
+        cl->updateBuf[cl->ublen++] = STREAM_RESET(cl, streamId);  /* stream id = 0, no filter */
     rfbStatRecordEncodingSentAdd(cl, cl->tightEncoding, 1);
 
     if (usePixelFormat24) {
@@ -1057,6 +1069,9 @@ CompressData(rfbClientPtr cl,
 
         cl->zsActive[streamId] = TRUE;
         cl->zsLevel[streamId] = zlibLevel;
+    } else if (cl->screen->rectCache) {
+        if (deflateReset(pz) != Z_OK)
+            return FALSE;
     }
 
     /* Prepare buffer pointers. */
@@ -1133,7 +1148,7 @@ FillPalette8(int count)
     paletteNumColors = 0;
 
     c0 = data[0];
-    for (i = 1; i < count && data[i] == c0; i++);
+    i = 1 + rfbSameRun8(data + 1, count - 1, c0);
     if (i == count) {
         paletteNumColors = 1;
         return;                 /* Solid rectangle */
@@ -1175,7 +1190,7 @@ FillPalette##bpp(int count) {                                           \
     int i, n0, n1, ni;                                                  \
                                                                         \
     c0 = data[0];                                                       \
-    for (i = 1; i < count && data[i] == c0; i++);                       \
+    i = 1 + rfbSameRun##bpp(data + 1, count - 1, c0, ~0);               \
     if (i >= count) {                                                   \
         paletteNumColors = 1;   /* Solid rectangle */                   \
         return;                                                         \
@@ -1189,15 +1204,10 @@ FillPalette##bpp(int count) {                                           \
     n0 = i;                                                             \
     c1 = data[i];                                                       \
     n1 = 0;                                                             \
-    for (i++; i < count; i++) {                                         \
-        ci = data[i];                                                   \
-        if (ci == c0) {                                                 \
-            n0++;                                                       \
-        } else if (ci == c1) {                                          \
-            n1++;                                                       \
-        } else                                                          \
-            break;                                                      \
-    }                                                                   \
+    i++;                                                                \
+    ni = rfbTwoColourRun##bpp(data + i, count - i, c1, c0, ~0, &n1);    \
+    n0 += ni - n1;                                                      \
+    i += ni;                                                            \
     if (i >= count) {                                                   \
         if (n0 > n1) {                                                  \
             monoBackground = (uint32_t)c0;                              \
@@ -1214,16 +1224,15 @@ FillPalette##bpp(int count) {                                           \
     PaletteInsert (c0, (uint32_t)n0, bpp);                              \
     PaletteInsert (c1, (uint32_t)n1, bpp);                              \
                                                                         \
-    ni = 1;                                                             \
-    for (i++; i < count; i++) {                                         \
-        if (data[i] == ci) {                                            \
-            ni++;                                                       \
-        } else {                                                        \
-            if (!PaletteInsert (ci, (uint32_t)ni, bpp))                 \
-                return;                                                 \
-            ci = data[i];                                               \
-            ni = 1;                                                     \
-        }                                                               \
+    ci = data[i];                                                       \
+    for (;;) {                                                          \
+        ni = 1 + rfbSameRun##bpp(data + i + 1, count - i - 1, ci, ~0);  \
+        i += ni;                                                        \
+        if (i >= count)                                                 \
+            break;                                                      \
+        if (!PaletteInsert (ci, (uint32_t)ni, bpp))                     \
+            return;                                                     \
+        ci = data[i];                                                   \
     }                                                                   \
     PaletteInsert (ci, (uint32_t)ni, bpp);                              \
 }
@@ -1238,7 +1247,7 @@ FastFillPalette##bpp(rfbClientPtr cl, uint##bpp##_t *data, int w,       \
                      int pitch, int h)                                  \
 {                                                                       \
     uint##bpp##_t c0, c1, ci, mask, c0t, c1t, cit;                      \
-    int i, j, i2 = 0, j2, n0, n1, ni;                                   \
+    int i, j, i2 = 0, j2, n0, n1, ni, run;                              \
                                                                         \
     if (cl->translateFn != rfbTranslateNone) {                          \
         mask = cl->screen->serverFormat.redMax                          \
@@ -1251,12 +1260,10 @@ FastFillPalette##bpp(rfbClientPtr cl, uint##bpp##_t *data, int w,       \
                                                                         \
     c0 = data[0] & mask;                                                \
     for (j = 0; j < h; j++) {                                           \
-        for (i = 0; i < w; i++) {                                       \
-            if ((data[j * pitch + i] & mask) != c0)                     \
-                goto done;                                              \
-        }                                                               \
+        i = rfbSameRun##bpp(&data[j * pitch], w, c0, mask);             \
+        if (i < w)                                                      \
+            break;                                                      \
     }                                                                   \
-    done:                                                               \
     if (j >= h) {                                                       \
         paletteNumColors = 1;   /* Solid rectangle */                   \
         return;                                                         \
@@ -1271,18 +1278,17 @@ FastFillPalette##bpp(rfbClientPtr cl, uint##bpp##_t *data, int w,       \
     n1 = 0;                                                             \
     i++;  if (i >= w) {i = 0;  j++;}                                    \
     for (j2 = j; j2 < h; j2++) {                                        \
-        for (i2 = i; i2 < w; i2++) {                                    \
+        ni = rfbTwoColourRun##bpp(&data[j2 * pitch + i], w - i,         \
+                                  c1, c0, mask, &n1);                   \
+        n0 += ni;                                                       \
+        i2 = i + ni;                                                    \
+        if (i2 < w) {                                                   \
             ci = data[j2 * pitch + i2] & mask;                          \
-            if (ci == c0) {                                             \
-                n0++;                                                   \
-            } else if (ci == c1) {                                      \
-                n1++;                                                   \
-            } else                                                      \
-                goto done2;                                             \
+            break;                                                      \
         }                                                               \
         i = 0;                                                          \
     }                                                                   \
-    done2:                                                              \
+    n0 -= n1;                                                           \
     (*cl->translateFn)(cl->translateLookupTable,                        \
                        &cl->screen->serverFormat, &cl->format,          \
                        (char *)&c0, (char *)&c0t, bpp/8, 1, 1);         \
@@ -1309,18 +1315,19 @@ FastFillPalette##bpp(rfbClientPtr cl, uint##bpp##_t *data, int w,       \
     i2++;  if (i2 >= w) {i2 = 0;  j2++;}                                \
     for (j = j2; j < h; j++) {                                          \
         for (i = i2; i < w; i++) {                                      \
-            if ((data[j * pitch + i] & mask) == ci) {                   \
-                ni++;                                                   \
-            } else {                                                    \
-                (*cl->translateFn)(cl->translateLookupTable,            \
-                                   &cl->screen->serverFormat,           \
-                                   &cl->format, (char *)&ci,            \
-                                   (char *)&cit, bpp/8, 1, 1);          \
-                if (!PaletteInsert (cit, (uint32_t)ni, bpp))            \
-                    return;                                             \
-                ci = data[j * pitch + i] & mask;                        \
-                ni = 1;                                                 \
-            }                                                           \
+            run = rfbSameRun##bpp(&data[j * pitch + i], w - i, ci, mask); \
+            ni += run;                                                  \
+            i += run;                                                   \
+            if (i >= w)                                                 \
+                break;                                                  \
+            (*cl->translateFn)(cl->translateLookupTable,                \
+                               &cl->screen->serverFormat,               \
+                               &cl->format, (char *)&ci,                \
+                               (char *)&cit, bpp/8, 1, 1);              \
+            if (!PaletteInsert (cit, (uint32_t)ni, bpp))                \
+                return;                                                 \
+            ci = data[j * pitch + i] & mask;                            \
+            ni = 1;                                                     \
         }                                                               \
         i2 = 0;                                                         \
     }                                                                   \
@@ -0,0 +1,131 @@
+/*
+ * tilediff.c - find modified parts of the framebuffer by comparing it
+ * with a shadow copy, for servers that cannot tell what they changed.
+ */
+
+/*
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+#include <string.h>
+#include <rfb/rfb.h>
+#include <rfb/rfbregion.h>
+#include "scale.h"
+
+#define TILE_SIZE 32
+
+/*
+ * The framebuffer is scanned one row of tiles at a time.  Most scanlines
+ * of a typical screen do not change between two calls, so every scanline
+ * is first compared as a whole; memcmp() is vectorised by the C library,
+ * which makes this pass run at memory speed.  Only scanlines which differ
+ * are compared tile by tile, and only the tiles which differ are copied
+ * into the shadow: a pixel written after it was compared is then either
+ * part of a tile that is sent anyway or found by the next call.
+ */
+
+rfbBool
+rfbDetectModifications(rfbScreenInfoPtr screen)
+{
+    int bpp = screen->bitsPerPixel / 8;
+    int stride = screen->paddedWidthInBytes;
+    int lineBytes = screen->width * bpp;
+    int tileBytes = TILE_SIZE * bpp;
+    int tilesPerRow = (screen->width + TILE_SIZE - 1) / TILE_SIZE;
+    int tx, ty, y, x1, off, len;
+    char *fb, *shadow, *dirty;
+    rfbBool rowDirty;
+    sraRegionPtr region, tiles;
+    sraRectangleIterator *i;
+    sraRect rect;
+
+    if (!screen->frameBuffer)
+        return FALSE;
+
+    if (!screen->shadowFrameBuffer) {
+        screen->shadowFrameBuffer = malloc(stride * screen->height);
+        if (!screen->shadowFrameBuffer) {
+            rfbErr("rfbDetectModifications: out of memory\n");
+            return FALSE;
+        }
+        memcpy(screen->shadowFrameBuffer, screen->frameBuffer,
+               stride * screen->height);
+        return FALSE;
+    }
+
+    dirty = malloc(tilesPerRow);
+    if (!dirty)
+        return FALSE;
+    region = sraRgnCreate();
+
+    for (ty = 0; ty < screen->height; ty += TILE_SIZE) {
+        memset(dirty, 0, tilesPerRow);
+        rowDirty = FALSE;
+
+        for (y = ty; y < ty + TILE_SIZE && y < screen->height; y++) {
+            fb = screen->frameBuffer + y * stride;
+            shadow = screen->shadowFrameBuffer + y * stride;
+            if (memcmp(fb, shadow, lineBytes) == 0)
+                continue;
+
+            for (tx = 0; tx < tilesPerRow; tx++) {
+                off = tx * tileBytes;
+                len = lineBytes - off < tileBytes ? lineBytes - off : tileBytes;
+                if (dirty[tx] || memcmp(fb + off, shadow + off, len) != 0) {
+                    memcpy(shadow + off, fb + off, len);
+                    dirty[tx] = TRUE;
+                }
+            }
+            rowDirty = TRUE;
+        }
+
+        if (!rowDirty)
+            continue;
+
+        /* merge runs of modified tiles into one rectangle */
+        for (tx = 0; tx < tilesPerRow; tx++) {
+            if (!dirty[tx])
+                continue;
+            x1 = tx;
+            while (tx + 1 < tilesPerRow && dirty[tx + 1])
+                tx++;
+            tiles = sraRgnCreateRect(x1 * TILE_SIZE, ty,
+                        (tx + 1) * TILE_SIZE < screen->width ?
+                        (tx + 1) * TILE_SIZE : screen->width,
+                        ty + TILE_SIZE < screen->height ?
+                        ty + TILE_SIZE : screen->height);
+            sraRgnOr(region, tiles);
+            sraRgnDestroy(tiles);
+        }
+    }
+    free(dirty);
+
+    if (sraRgnEmpty(region)) {
+        sraRgnDestroy(region);
+        return FALSE;
+    }
+
+    if (screen->scaledScreenNext) {
+        i = sraRgnGetIterator(region);
+        while (sraRgnIteratorNext(i, &rect))
+            rfbScaledScreenUpdate(screen, rect.x1, rect.y1, rect.x2, rect.y2);
+        sraRgnReleaseIterator(i);
+    }
+
+    rfbMarkRegionAsModified(screen, region);
+    sraRgnDestroy(region);
+    return TRUE;
+}
@@ -25,6 +25,7 @@
 
 #include <rfb/rfb.h>
 #include <rfb/rfbregion.h>
+#include "private.h"
 
 static void PrintPixelFormat(rfbPixelFormat *pf);
 static rfbBool rfbSetClientColourMapBGR233(rfbClientPtr cl);
@@ -244,6 +245,8 @@ rfbTranslateNone(char *table, rfbPixelFormat *in, rfbPixelFormat *out,
 rfbBool
 rfbSetTranslateFunction(rfbClientPtr cl)
 {
+    rfbTranslateFnType simdFn;
+
     rfbLog("Pixel format for client %s:\n",cl->host);
     PrintPixelFormat(&cl->format);
 
@@ -345,6 +348,11 @@ rfbSetTranslateFunction(rfbClientPtr cl)
         (*rfbInitTrueColourRGBTablesFns
             [BPP2OFFSET(cl->format.bitsPerPixel)]) (&cl->translateLookupTable,
                                              &(cl->screen->serverFormat), &cl->format);
+
+        /* vectorised versions compute the tables' values without them */
+        simdFn = rfbSimdTranslateFn(&cl->screen->serverFormat, &cl->format);
+        if (simdFn)
+            cl->translateFn = simdFn;
     }
 
     return TRUE;
@@ -389,6 +389,23 @@ typedef struct _rfbScreenInfo
     SOCKET listen6Sock;
     int http6Port;
     SOCKET httpListen6Sock;
+    /** epoll instance watching the sockets in allFds, -1 if select() is used */
+    int epollFd;
+    /** if not zero, rfbProcessEvents() hands framebuffer updates to this
+     * many threads, so that updates for different clients are encoded in
+     * parallel. Set it before the first call to rfbProcessEvents(). */
+    int encoderThreads;
+    struct rfbEncoderPool *encoderPool;
+    /** if TRUE, rfbProcessEvents() finds modified areas itself by comparing
+     * the framebuffer with a shadow copy, see rfbDetectModifications() */
+    rfbBool detectModifications;
+    char *shadowFrameBuffer;
+    /** if TRUE, rectangles encoded for one client are kept until the
+     * framebuffer changes and sent as they are to other clients using the
+     * same encoding, pixel format and encoding levels. Set it before
+     * rfbInitServer(). */
+    rfbBool shareEncodings;
+    struct rfbRectCache *rectCache;
 } rfbScreenInfo, *rfbScreenInfoPtr;
 
 
@@ -695,6 +712,12 @@ typedef struct _rfbClientRec {
     wsCtx     *wsctx;
     char *wspath;                          /* Requests path component */
 #endif
+
+    /** microseconds spent encoding and sending framebuffer updates */
+    uint64_t encodeTime;
+    /** rectangle being recorded for the shared encoding cache */
+    struct rfbEncodedRect *encodedRect;
+    int encodedRectStart;
 } rfbClientRec, *rfbClientPtr;
 
 /**
@@ -989,6 +1012,20 @@ extern int rfbSelectBox(rfbScreenInfoPtr rfbScreen,
 			rfbPixel foreColour, rfbPixel backColour,
 			int border,SelectionChangedHookPtr selChangedHook);
 
+/* tilediff.c */
+
+/** compare the framebuffer with a shadow copy in tiles of 32x32 pixels and
+   mark the tiles that changed as modified. The first call only takes the
+   copy. Returns TRUE if anything changed. */
+extern rfbBool rfbDetectModifications(rfbScreenInfoPtr rfbScreen);
+
+/* simd.c */
+
+/** use SSE2, AVX2 or NEON for pixel translation and the tight encoder's
+   colour analysis where available. Read by rfbGetScreen() and whenever a
+   client's pixel format is set. */
+extern rfbBool rfbUseSIMD;
+
 /* cargs.c */
 
 extern void rfbUsage(void);
@@ -1083,6 +1120,8 @@ extern int rfbStatGetMessageCountSent(rfbClientPtr cl, uint32_t type);
 extern int rfbStatGetMessageCountRcvd(rfbClientPtr cl, uint32_t type);
 extern int rfbStatGetEncodingCountSent(rfbClientPtr cl, uint32_t type);
 extern int rfbStatGetEncodingCountRcvd(rfbClientPtr cl, uint32_t type);
+/* Time spent in rfbSendFramebufferUpdate() in microseconds */
+extern uint64_t rfbStatGetEncodeTime(rfbClientPtr cl);
 
 /** Set which version you want to advertise 3.3, 3.6, 3.7 and 3.8 are currently supported*/
 extern void rfbSetProtocolVersion(rfbScreenInfoPtr rfbScreen, int major_, int minor_);
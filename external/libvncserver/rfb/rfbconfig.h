@@ -329,6 +329,11 @@
 /* Use the system libvncserver build environment for x11vnc. */
 /* #undef LIBVNCSERVER_HAVE_SYSTEM_LIBVNCSERVER */
 
+/* Define to 1 if you have the <sys/epoll.h> header file. */
+#ifndef LIBVNCSERVER_HAVE_SYS_EPOLL_H 
+#define LIBVNCSERVER_HAVE_SYS_EPOLL_H  1 
+#endif
+
 /* Define to 1 if you have the <sys/ioctl.h> header file. */
 /* #undef LIBVNCSERVER_HAVE_SYS_IOCTL_H */
 
@@ -36,6 +36,9 @@
 /* Define to 1 if you have the <sys/endian.h> header file. */
 #cmakedefine LIBVNCSERVER_HAVE_SYS_ENDIAN_H 1
 
+/* Define to 1 if you have the <sys/epoll.h> header file. */
+#cmakedefine LIBVNCSERVER_HAVE_SYS_EPOLL_H  1 
+
 /* Define to 1 if you have the <sys/socket.h> header file. */
 #cmakedefine LIBVNCSERVER_HAVE_SYS_SOCKET_H  1 
 
@@ -54,6 +57,9 @@
 /* Define to 1 if you have the <unistd.h> header file. */
 #cmakedefine LIBVNCSERVER_HAVE_UNISTD_H  1 
 
+/* Define to 1 if compiler supports __thread */
+#cmakedefine LIBVNCSERVER_HAVE_TLS  1 
+
 /* Need a typedef for in_addr_t */
 #cmakedefine LIBVNCSERVER_NEED_INADDR_T 1
 
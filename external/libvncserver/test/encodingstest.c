@@ -43,8 +43,17 @@ static const int width=400,height=300;
 static unsigned int statistics[2][NUMBER_OF_ENCODINGS_TO_TEST];
 static unsigned int totalFailed,totalCount;
 static unsigned int countGotUpdate;
+static rfbBool* gotUpdate;
+static time_t lastUpdate;
 static MUTEX(statisticsMutex);
 
+/* with -clients n, n clients are started for every encoding */
+static int clientsPerEncoding=1,numberOfClients;
+/* with -cursors, clients take cursor shape updates and the cursor keeps
+ * changing; every other client asks for XCursor instead of RichCursor */
+static rfbBool testCursors;
+static unsigned int cursorChanges;
+
 static void initStatistics(void) {
 	memset(statistics[0],0,sizeof(int)*NUMBER_OF_ENCODINGS_TO_TEST);
 	memset(statistics[1],0,sizeof(int)*NUMBER_OF_ENCODINGS_TO_TEST);
@@ -53,7 +62,7 @@ static void initStatistics(void) {
 }
 
 
-static void updateStatistics(int encodingIndex,rfbBool failed) {
+static void updateStatistics(int encodingIndex,int clientIndex,rfbBool failed) {
 	LOCK(statisticsMutex);
 	if(failed) {
 		statistics[1][encodingIndex]++;
@@ -61,7 +70,12 @@ static void updateStatistics(int encodingIndex,rfbBool failed) {
 	}
 	statistics[0][encodingIndex]++;
 	totalCount++;
-	countGotUpdate++;
+	/* count every client once until the next change is drawn */
+	if(!gotUpdate[clientIndex]) {
+		gotUpdate[clientIndex]=TRUE;
+		countGotUpdate++;
+	}
+	lastUpdate=time(NULL);
 	UNLOCK(statisticsMutex);
 }
 
@@ -75,7 +89,8 @@ static rfbBool doFramebuffersMatch(rfbScreenInfo* server,rfbClient* client,
 {
 	int i,j,k;
 	unsigned int total=0,diff=0;
-	if(server->width!=client->width || server->height!=client->height)
+	if(server->width!=client->width || server->height!=client->height
+	   || !client->frameBuffer)
 		return FALSE;
 	LOCK(frameBufferMutex);
 	/* TODO: write unit test for colour transformation, use here, too */
@@ -111,8 +126,11 @@ static rfbBool resize(rfbClient* cl) {
 
 typedef struct clientData {
 	int encodingIndex;
+	int index;
 	rfbScreenInfo* server;
 	char* display;
+	rfbBool xCursor;
+	int cursorWidth,cursorHeight;
 } clientData;
 
 static void update(rfbClient* client,int x,int y,int w,int h) {
@@ -131,29 +149,62 @@ static void update(rfbClient* client,int x,int y,int w,int h) {
 #endif
 }
 
-static void update_finished(rfbClient* client) {
-	clientData* cd=(clientData*)client->clientData;
+static int maxDeltaFor(int encodingIndex) {
         int maxDelta=0;
 
 #ifdef LIBVNCSERVER_HAVE_LIBZ
-	if(testEncodings[cd->encodingIndex].id==rfbEncodingZYWRLE)
+	if(testEncodings[encodingIndex].id==rfbEncodingZYWRLE)
 		maxDelta=5;
 #ifdef LIBVNCSERVER_HAVE_LIBJPEG
-	if(testEncodings[cd->encodingIndex].id==rfbEncodingTight)
+	if(testEncodings[encodingIndex].id==rfbEncodingTight)
 		maxDelta=5;
 #endif
 #endif
-	updateStatistics(cd->encodingIndex,
-			!doFramebuffersMatch(cd->server,client,maxDelta));
+	return maxDelta;
+}
+
+static void update_finished(rfbClient* client) {
+	clientData* cd=(clientData*)client->clientData;
+
+	updateStatistics(cd->encodingIndex,cd->index,
+			!doFramebuffersMatch(cd->server,client,
+				maxDeltaFor(cd->encodingIndex)));
 }
 
 
+static void got_cursor_shape(rfbClient* client,int xhot,int yhot,
+		int width,int height,int bytesPerPixel) {
+	clientData* cd=(clientData*)client->clientData;
+
+	cd->cursorWidth=width;
+	cd->cursorHeight=height;
+}
+
+/* libvncclient always asks for both cursor encodings, and the server
+ * then uses RichCursor; ask again without it */
+static rfbBool sendXCursorEncodings(rfbClient* client) {
+	clientData* cd=(clientData*)client->clientData;
+	char buf[sz_rfbSetEncodingsMsg+4*4];
+	rfbSetEncodingsMsg* se=(rfbSetEncodingsMsg*)buf;
+	uint32_t* encs=(uint32_t*)&buf[sz_rfbSetEncodingsMsg];
+
+	se->type=rfbSetEncodings;
+	se->pad=0;
+	se->nEncodings=rfbClientSwap16IfLE(4);
+	encs[0]=rfbClientSwap32IfLE(testEncodings[cd->encodingIndex].id);
+	encs[1]=rfbClientSwap32IfLE(rfbEncodingQualityLevel0+client->appData.qualityLevel);
+	encs[2]=rfbClientSwap32IfLE(rfbEncodingCompressLevel0+client->appData.compressLevel);
+	encs[3]=rfbClientSwap32IfLE(rfbEncodingXCursor);
+	return WriteToRFBServer(client,buf,sizeof(buf));
+}
+
 static void* clientLoop(void* data) {
 	rfbClient* client=(rfbClient*)data;
 	clientData* cd=(clientData*)client->clientData;
 
 	client->appData.encodingsString=strdup(testEncodings[cd->encodingIndex].str);
 	client->appData.qualityLevel = 7; /* ZYWRLE fails the test with standard settings */
+	client->appData.useRemoteCursor = testCursors && !cd->xCursor;
 
 	sleep(1);
 	rfbClientLog("Starting client (encoding %s, display %s)\n",
@@ -162,7 +213,11 @@ static void* clientLoop(void* data) {
 	if(!rfbInitClient(client,NULL,NULL)) {
 		rfbClientErr("Had problems starting client (encoding %s)\n",
 				testEncodings[cd->encodingIndex].str);
-		updateStatistics(cd->encodingIndex,TRUE);
+		updateStatistics(cd->encodingIndex,cd->index,TRUE);
+		return NULL;
+	}
+	if(cd->xCursor && !sendXCursorEncodings(client)) {
+		updateStatistics(cd->encodingIndex,cd->index,TRUE);
 		return NULL;
 	}
 	while(1) {
@@ -170,16 +225,20 @@ static void* clientLoop(void* data) {
 			if(!HandleRFBServerMessage(client))
 				break;
 	}
+	return NULL;
+}
+
+static void freeClient(rfbClient* client) {
 	free(((clientData*)client->clientData)->display);
 	free(client->clientData);
 	client->clientData = NULL;
 	if(client->frameBuffer)
 		free(client->frameBuffer);
 	rfbClientCleanup(client);
-	return NULL;
 }
 
-static pthread_t all_threads[NUMBER_OF_ENCODINGS_TO_TEST];
+static pthread_t* all_threads;
+static rfbClient** clients;
 static int thread_counter;
 
 static void startClient(int encodingIndex,rfbScreenInfo* server) {
@@ -190,18 +249,48 @@ static void startClient(int encodingIndex,rfbScreenInfo* server) {
 	client->MallocFrameBuffer=resize;
 	client->GotFrameBufferUpdate=update;
 	client->FinishedFrameBufferUpdate=update_finished;
+	client->GotCursorShape=got_cursor_shape;
 
 	cd=(clientData*)client->clientData;
 	cd->encodingIndex=encodingIndex;
+	cd->index=thread_counter;
+	cd->xCursor=testCursors && thread_counter%2;
 	cd->server=server;
 	cd->display=(char*)malloc(6);
 	sprintf(cd->display,":%d",server->port-5900);
 
+	clients[thread_counter]=client;
 	pthread_create(&all_threads[thread_counter++],NULL,clientLoop,(void*)client);
 }
 
 /* Here begin the server functions */
 
+/* a random cursor which has either only the X or only the rich source,
+ * so that sending it needs a conversion for half of the clients */
+
+static void changeCursor(rfbScreenInfo* server)
+{
+	char source[32*32],mask[32*32];
+	rfbCursorPtr c;
+	int i,w=8+rand()%25,h=8+rand()%25;
+
+	for(i=0;i<w*h;i++) {
+		source[i]=rand()%2?'x':' ';
+		mask[i]=rand()%4?'x':' ';
+	}
+	mask[0]='x';
+	c=rfbMakeXCursor(w,h,source,mask);
+	c->xhot=rand()%w;
+	c->yhot=rand()%h;
+	if(cursorChanges++%2) {
+		rfbMakeRichCursorFromXCursor(server,c);
+		free(c->source);
+		c->source=NULL;
+		c->cleanupSource=FALSE;
+	}
+	rfbSetCursor(server,c);
+}
+
 static void idle(rfbScreenInfo* server)
 {
 	int c;
@@ -209,15 +298,17 @@ static void idle(rfbScreenInfo* server)
 
 	LOCK(statisticsMutex);
 #ifdef ALL_AT_ONCE
-	goForward=(countGotUpdate==NUMBER_OF_ENCODINGS_TO_TEST);
+	goForward=(countGotUpdate==numberOfClients);
 #else
-	goForward=(countGotUpdate==1);
+	goForward=(countGotUpdate==clientsPerEncoding);
 #endif
-
+	if(goForward) {
+		countGotUpdate=0;
+		memset(gotUpdate,0,numberOfClients*sizeof(rfbBool));
+	}
 	UNLOCK(statisticsMutex);
 	if(!goForward)
 	  return;
-	countGotUpdate=0;
 
 	LOCK(frameBufferMutex);
 	{
@@ -232,13 +323,18 @@ static void idle(rfbScreenInfo* server)
 				for(j=y1;j<y2;j++)
 					server->frameBuffer[i*4+c+j*server->paddedWidthInBytes]=255*(i-x1+j-y1)/(x2-x1+y2-y1);
 		}
-		rfbMarkRectAsModified(server,x1,y1,x2,y2);
+		/* with -detectchanges, rfbProcessEvents() has to find it */
+		if(!server->detectModifications)
+			rfbMarkRectAsModified(server,x1,y1,x2,y2);
 
 #ifdef VERY_VERBOSE
 		rfbLog("Sent update (%d,%d)-(%d,%d)\n",x1,y1,x2,y2);
 #endif
 	}
 	UNLOCK(frameBufferMutex);
+
+	if(testCursors && rand()%10==0)
+		changeCursor(server);
 }
 
 /* log function (to show what messages are from the client) */
@@ -265,7 +361,99 @@ rfbTestLog(const char *format, ...)
 	va_end(args);
 }
 
-/* the main function */
+/* the cursor the client got last must be the server's current one */
+
+static rfbBool doCursorsMatch(rfbScreenInfo* server,rfbClient* client)
+{
+	clientData* cd=(clientData*)client->clientData;
+	rfbCursorPtr c=server->cursor;
+	int i,j,w=(c->width+7)/8;
+	unsigned char bit;
+	uint32_t* pixels=(uint32_t*)client->rcSource;
+
+	if(cd->cursorWidth!=c->width || cd->cursorHeight!=c->height
+	   || !client->rcSource || !client->rcMask)
+		return FALSE;
+	if(!cd->xCursor && !c->richSource)
+		return FALSE;
+	for(j=0;j<c->height;j++)
+		for(i=0,bit=0x80;i<c->width;i++,bit=(bit&1)?0x80:bit>>1) {
+			if(!(c->mask[j*w+i/8]&bit)!=!client->rcMask[j*c->width+i])
+				return FALSE;
+			/* RichCursor: the colour bytes, as in doFramebuffersMatch() */
+			if(!cd->xCursor && memcmp(client->rcSource+(j*c->width+i)*4,
+					c->richSource+(j*c->width+i)*4,3))
+				return FALSE;
+			/* XCursor: white where the source bit is set, else black */
+			if(cd->xCursor && (!c->source
+			   || !(c->source[j*w+i/8]&bit)!=!pixels[j*c->width+i]))
+				return FALSE;
+		}
+	return TRUE;
+}
+
+/* wait until that many clients got an update since the last change was
+ * drawn, and then no client got one for two seconds */
+
+static void waitUntilQuiet(rfbScreenInfo* server,unsigned int clientsToWaitFor)
+{
+	time_t t;
+
+	LOCK(statisticsMutex);
+	lastUpdate=time(NULL);
+	UNLOCK(statisticsMutex);
+	t=time(NULL);
+	while(time(NULL)-t<30) {
+		rfbBool quiet;
+
+		rfbProcessEvents(server,100000);
+
+		LOCK(statisticsMutex);
+		quiet=(countGotUpdate>=clientsToWaitFor && time(NULL)-lastUpdate>=2);
+		UNLOCK(statisticsMutex);
+		if(quiet)
+			break;
+	}
+}
+
+/* check that every client ended up with the server's framebuffer */
+
+static void checkClients(rfbScreenInfo* server)
+{
+	int i;
+
+	waitUntilQuiet(server,0);
+
+	for(i=0;i<thread_counter;i++) {
+		clientData* cd=(clientData*)clients[i]->clientData;
+
+		if(!doFramebuffersMatch(server,clients[i],
+					maxDeltaFor(cd->encodingIndex))) {
+			rfbLog("%s encoding, client %d: framebuffer does not match\n",
+					testEncodings[cd->encodingIndex].str,
+					i%clientsPerEncoding+1);
+			LOCK(statisticsMutex);
+			statistics[1][cd->encodingIndex]++;
+			totalFailed++;
+			UNLOCK(statisticsMutex);
+		}
+		if(testCursors && !doCursorsMatch(server,clients[i])) {
+			rfbLog("%s encoding, client %d: %s does not match\n",
+					testEncodings[cd->encodingIndex].str,
+					i%clientsPerEncoding+1,
+					cd->xCursor?"XCursor":"RichCursor");
+			LOCK(statisticsMutex);
+			statistics[1][cd->encodingIndex]++;
+			totalFailed++;
+			UNLOCK(statisticsMutex);
+		}
+	}
+}
+
+/* the main function; options not taken by rfbGetScreen() are
+ *   -clients n   start n clients per encoding (default 1)
+ *   -cursors     test cursor shape updates, see testCursors
+ */
 
 int main(int argc,char** argv)
 {
@@ -281,8 +469,30 @@ int main(int argc,char** argv)
         if(!server)
           return 0;
 
+	for(i=1;i<argc;i++)
+		if(!strcmp(argv[i],"-clients") && i+1<argc)
+			clientsPerEncoding=atoi(argv[++i]);
+		else if(!strcmp(argv[i],"-cursors"))
+			testCursors=TRUE;
+		else {
+			rfbErr("Unknown option %s\n",argv[i]);
+			return 1;
+		}
+	if(clientsPerEncoding<1)
+		clientsPerEncoding=1;
+	numberOfClients=clientsPerEncoding*NUMBER_OF_ENCODINGS_TO_TEST;
+	all_threads=malloc(numberOfClients*sizeof(pthread_t));
+	clients=malloc(numberOfClients*sizeof(rfbClient*));
+	gotUpdate=calloc(numberOfClients,sizeof(rfbBool));
+
 	server->frameBuffer=malloc(400*300*4);
 	server->cursor=NULL;
+	if(testCursors) {
+		/* keep the cursor off screen, where drawing it changes nothing */
+		server->cursorX=server->width+64;
+		server->cursorY=server->height+64;
+		changeCursor(server);
+	}
 	for(j=0;j<400*300*4;j++)
 		server->frameBuffer[j]=j;
 	rfbInitServer(server);
@@ -296,7 +506,14 @@ int main(int argc,char** argv)
 	/* Initialize clients */
 	for(i=0;i<NUMBER_OF_ENCODINGS_TO_TEST;i++)
 #endif
-		startClient(i,server);
+		for(j=0;j<clientsPerEncoding;j++)
+			startClient(i,server);
+
+#ifdef ALL_AT_ONCE
+	/* a client may get more than one full update when it connects; the
+	 * last of them must not arrive after the first change is drawn */
+	waitUntilQuiet(server,numberOfClients);
+#endif
 
 	t=time(NULL);
 	/* test 20 seconds */
@@ -306,6 +523,9 @@ int main(int argc,char** argv)
 
 		rfbProcessEvents(server,1);
 	}
+#ifdef ALL_AT_ONCE
+	checkClients(server);
+#endif
 	rfbLog("%d failed, %d received\n",totalFailed,totalCount);
 #ifndef ALL_AT_ONCE
 	{
@@ -321,8 +541,13 @@ int main(int argc,char** argv)
 	/* shut down server, disconnecting all clients */
 	rfbShutdownServer(server, TRUE);
 
-	for(i=0;i<thread_counter;i++)
+	for(i=0;i<thread_counter;i++) {
 		pthread_join(all_threads[i], NULL);
+		freeClient(clients[i]);
+	}
+	free(all_threads);
+	free(clients);
+	free(gotUpdate);
 
 	free(server->frameBuffer);
 	rfbScreenCleanup(server);
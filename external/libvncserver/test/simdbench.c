@@ -0,0 +1,347 @@
+/*
+ * simdbench - compare the plain C and the vectorised (simd.c) pixel loops.
+ *
+ * Translates frames from the server's 32 bit format to 16 and 8 bit client
+ * formats and encodes them with lossless tight, once with rfbUseSIMD off
+ * and once with it on, checks that both produce the same bytes, and prints
+ * how fast each was.  The frames are Windows bitmaps given on the command
+ * line, e.g. screen captures, or a few synthesised ones resembling a
+ * desktop, a terminal and a photo.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <rfb/rfb.h>
+#if defined(LIBVNCSERVER_HAVE_LIBZ) && defined(LIBVNCSERVER_HAVE_LIBJPEG)
+#include <zlib.h>
+#define HAVE_TIGHT
+#endif
+#include "./bmp.h"
+#include "./tjutil.h"
+
+static double benchTime = 0.5;
+
+typedef struct {
+	const char *name;
+	rfbPixelFormat format;
+} format_t;
+
+static const format_t formats[] = {
+	{ "rgbx", { 32, 24, 0, 1, 255, 255, 255, 0, 8, 16, 0, 0 } },
+	{ "rgb565", { 16, 16, 0, 1, 31, 63, 31, 11, 5, 0, 0, 0 } },
+	{ "rgb565be", { 16, 16, 1, 1, 31, 63, 31, 11, 5, 0, 0, 0 } },
+	{ "bgr555", { 16, 15, 0, 1, 31, 31, 31, 0, 5, 10, 0, 0 } },
+	{ "bgr233", { 8, 8, 0, 1, 7, 7, 3, 0, 3, 6, 0, 0 } },
+	{ NULL }
+};
+
+typedef struct {
+	char *name;
+	int width, height;
+	unsigned char *pixels;
+} frame_t;
+
+
+/* synthesised frames */
+
+static uint32_t
+rgb(int r, int g, int b)
+{
+	return (uint32_t)r | ((uint32_t)g << 8) | ((uint32_t)b << 16);
+}
+
+static void
+fillRect(uint32_t *fb, int width, int x, int y, int w, int h, uint32_t c)
+{
+	int i, j;
+
+	for (j = y; j < y + h; j++)
+		for (i = x; i < x + w; i++)
+			fb[j * width + i] = c;
+}
+
+/* rows of random 6x12 glyphs */
+static void
+drawText(uint32_t *fb, int width, int x, int y, int w, int h,
+	 uint32_t fg, uint32_t bg)
+{
+	int i, j, cx, cy;
+	unsigned int glyph;
+
+	fillRect(fb, width, x, y, w, h, bg);
+	for (cy = y + 2; cy + 12 <= y + h; cy += 14)
+		for (cx = x + 2; cx + 6 <= x + w - 2; cx += 6) {
+			if (rand() % 8 == 0)
+				continue;
+			for (j = 1; j < 10; j++) {
+				glyph = rand();
+				for (i = 0; i < 5; i++)
+					if (glyph & (1 << i))
+						fb[(cy + j) * width + cx + i] = fg;
+			}
+		}
+}
+
+static void
+drawWindow(uint32_t *fb, int width, int x, int y, int w, int h)
+{
+	int i;
+
+	for (i = 0; i < w; i++)
+		fillRect(fb, width, x + i, y, 1, 20,
+			 rgb(40 + 100 * i / w, 60 + 100 * i / w, 160));
+	fillRect(fb, width, x, y + 20, w, h - 20, rgb(236, 233, 216));
+	drawText(fb, width, x + 8, y + 28, w - 16, h - 36,
+		 rgb(0, 0, 0), rgb(255, 255, 255));
+}
+
+static frame_t *
+synthFrame(const char *name, int width, int height)
+{
+	frame_t *f = calloc(1, sizeof(frame_t));
+	uint32_t *fb;
+	int x, y, i;
+
+	f->name = strdup(name);
+	f->width = width;
+	f->height = height;
+	f->pixels = malloc(width * height * 4);
+	fb = (uint32_t *)f->pixels;
+	srand(1);
+
+	if (strcmp(name, "desktop") == 0) {
+		fillRect(fb, width, 0, 0, width, height, rgb(58, 110, 165));
+		for (i = 0; i < 12; i++)
+			fillRect(fb, width, 16, 16 + i * 60, 32, 32,
+				 rgb(rand() % 256, rand() % 256, rand() % 256));
+		drawWindow(fb, width, 100, 60, width / 2, height / 2);
+		drawWindow(fb, width, width / 3, height / 3,
+			   width / 2, height / 2);
+		fillRect(fb, width, 0, height - 28, width, 28, rgb(212, 208, 200));
+	} else if (strcmp(name, "terminal") == 0) {
+		drawText(fb, width, 0, 0, width, height,
+			 rgb(0, 255, 0), rgb(0, 0, 0));
+	} else {
+		for (y = 0; y < height; y++)
+			for (x = 0; x < width; x++)
+				fb[y * width + x] =
+				    rgb((x * 255 / width + rand() % 8) & 255,
+					(y * 255 / height + rand() % 8) & 255,
+					((x + y) * 127 / (width + height) +
+					 rand() % 8) & 255);
+	}
+	return f;
+}
+
+static frame_t *
+loadFrame(char *filename)
+{
+	frame_t *f = calloc(1, sizeof(frame_t));
+
+	f->name = filename;
+	if (loadbmp(filename, &f->pixels, &f->width, &f->height,
+		    BMP_RGBX, 1, 0) == -1) {
+		fprintf(stderr, "%s: %s\n", filename, bmpgeterr());
+		exit(1);
+	}
+	return f;
+}
+
+
+/* a client writing to a file instead of a socket */
+
+static rfbClientPtr
+newClient(rfbScreenInfoPtr screen, const rfbPixelFormat *format, FILE *out)
+{
+	rfbClientPtr cl = calloc(1, sizeof(rfbClientRec));
+
+	cl->screen = cl->scaledScreen = screen;
+	cl->sock = out ? fileno(out) : -1;
+	cl->host = strdup("simdbench");
+	cl->format = *format;
+	cl->tightCompressLevel = 1;
+	cl->turboQualityLevel = -1;
+	INIT_MUTEX(cl->outputMutex);
+	if (!rfbSetTranslateFunction(cl)) {
+		fprintf(stderr, "cannot translate to this format\n");
+		exit(1);
+	}
+	return cl;
+}
+
+static void
+freeClient(rfbClientPtr cl)
+{
+#ifdef HAVE_TIGHT
+	int i;
+
+	for (i = 0; i < 4; i++)
+		if (cl->zsActive[i])
+			deflateEnd(&cl->zsStruct[i]);
+#endif
+	rfbResetStats(cl);
+	TINI_MUTEX(cl->outputMutex);
+	free(cl->translateLookupTable);
+	free(cl->host);
+	free(cl);
+}
+
+
+/* one run of all benchmarks with rfbUseSIMD set to simd */
+
+typedef struct {
+	double translate[sizeof(formats) / sizeof(formats[0])];
+	double tight[sizeof(formats) / sizeof(formats[0])];
+	char *translated[sizeof(formats) / sizeof(formats[0])];
+	char *encoded[sizeof(formats) / sizeof(formats[0])];
+	long encodedLen[sizeof(formats) / sizeof(formats[0])];
+} result_t;
+
+static double
+mpixels(frame_t *f, int iter, double t)
+{
+	return (double)f->width * f->height * iter / t / 1000000.;
+}
+
+#ifdef HAVE_TIGHT
+static void
+encodeTight(rfbClientPtr cl, frame_t *f)
+{
+	lseek(cl->sock, 0, SEEK_SET);
+	if (!rfbSendRectEncodingTight(cl, 0, 0, f->width, f->height) ||
+	    !rfbSendUpdateBuf(cl)) {
+		fprintf(stderr, "tight encoding failed\n");
+		exit(1);
+	}
+}
+#endif
+
+static void
+runBenchmarks(frame_t *f, rfbBool simd, result_t *r)
+{
+	rfbScreenInfoPtr screen;
+	rfbClientPtr cl;
+	const format_t *fmt;
+	FILE *out;
+	double start, t;
+	int argc = 0, iter, k;
+
+	rfbUseSIMD = simd;
+	screen = rfbGetScreen(&argc, NULL, f->width, f->height, 8, 3, 4);
+	screen->frameBuffer = (char *)f->pixels;
+
+	for (fmt = formats, k = 0; fmt->name; fmt++, k++) {
+		cl = newClient(screen, &fmt->format, NULL);
+		r->translated[k] = malloc(f->width * f->height * 4);
+		start = gettime();
+		iter = 0;
+		do {
+			(*cl->translateFn)(cl->translateLookupTable,
+					   &screen->serverFormat, &cl->format,
+					   screen->frameBuffer, r->translated[k],
+					   screen->paddedWidthInBytes,
+					   f->width, f->height);
+			iter++;
+		} while ((t = gettime() - start) < benchTime);
+		r->translate[k] = mpixels(f, iter, t);
+		freeClient(cl);
+
+#ifdef HAVE_TIGHT
+		/* keep the output of a fresh client, later ones depend on the
+		   state of its zlib streams */
+		out = tmpfile();
+		cl = newClient(screen, &fmt->format, out);
+		encodeTight(cl, f);
+		r->encodedLen[k] = lseek(cl->sock, 0, SEEK_CUR);
+		r->encoded[k] = malloc(r->encodedLen[k]);
+		if (pread(cl->sock, r->encoded[k], r->encodedLen[k], 0) !=
+		    r->encodedLen[k]) {
+			fprintf(stderr, "cannot read back encoded data\n");
+			exit(1);
+		}
+		start = gettime();
+		iter = 0;
+		do {
+			encodeTight(cl, f);
+			iter++;
+		} while ((t = gettime() - start) < benchTime);
+		r->tight[k] = mpixels(f, iter, t);
+		fclose(out);
+		freeClient(cl);
+#endif
+	}
+
+	screen->frameBuffer = NULL;
+	rfbScreenCleanup(screen);
+}
+
+int
+main(int argc, char **argv)
+{
+	static char *synth[] = { "desktop", "terminal", "photo" };
+	frame_t **frames;
+	int nFrames, i, k, bytes, errors = 0;
+	result_t c, v;
+	frame_t *f;
+
+	while (argc > 1 && argv[1][0] == '-') {
+		if (strcmp(argv[1], "-time") == 0 && argc > 2) {
+			benchTime = atof(argv[2]);
+			argc -= 2;
+			argv += 2;
+		} else {
+			fprintf(stderr, "usage: %s [-time seconds] [file.bmp ...]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+
+	rfbLogEnable(FALSE);
+
+	nFrames = argc > 1 ? argc - 1 : 3;
+	frames = malloc(nFrames * sizeof(frame_t *));
+	for (i = 0; i < nFrames; i++)
+		frames[i] = argc > 1 ? loadFrame(argv[i + 1])
+				     : synthFrame(synth[i], 1280, 1024);
+
+	printf("%-12s %-9s %14s %14s %8s %14s %14s %8s\n", "frame", "format",
+	       "translate C", "translate SIMD", "speedup",
+	       "tight C", "tight SIMD", "speedup");
+	for (i = 0; i < nFrames; i++) {
+		f = frames[i];
+		runBenchmarks(f, FALSE, &c);
+		runBenchmarks(f, TRUE, &v);
+
+		for (k = 0; formats[k].name; k++) {
+			bytes = f->width * f->height * formats[k].format.bitsPerPixel / 8;
+			if (memcmp(c.translated[k], v.translated[k], bytes) != 0) {
+				printf("%s %s: translated pixels differ\n",
+				       f->name, formats[k].name);
+				errors++;
+			}
+#ifdef HAVE_TIGHT
+			if (c.encodedLen[k] != v.encodedLen[k] ||
+			    memcmp(c.encoded[k], v.encoded[k], c.encodedLen[k]) != 0) {
+				printf("%s %s: tight output differs\n",
+				       f->name, formats[k].name);
+				errors++;
+			}
+			free(c.encoded[k]);
+			free(v.encoded[k]);
+#endif
+			printf("%-12s %-9s %10.1f Mp/s %10.1f Mp/s %7.2fx "
+			       "%10.1f Mp/s %10.1f Mp/s %7.2fx\n",
+			       f->name, formats[k].name,
+			       c.translate[k], v.translate[k],
+			       v.translate[k] / c.translate[k],
+			       c.tight[k], v.tight[k],
+			       c.tight[k] ? v.tight[k] / c.tight[k] : 0.);
+			free(c.translated[k]);
+			free(v.translated[k]);
+		}
+	}
+
+	return errors ? 1 : 0;
+}
@@ -26,6 +26,7 @@
 #endif
 
 #include "XmlRpcClient.h"
+#include "XmlRpcClientPool.h"
 #include "XmlRpcException.h"
 #include "XmlRpcServer.h"
 #include "XmlRpcServerMethod.h"
@@ -38,14 +38,29 @@ XmlRpcClient::XmlRpcClient(const char* host, int port, const char* uri/*=0*/)
   _connectionState = NO_CONNECTION;
   _executing = false;
   _eof = false;
+  _serverClose = false;
+  _dispatch = &_disp;
+  _maxBatch = 32;
+  _multicall = true;
+  _delivering = false;
 
   // Default to keeping the connection open until an explicit close is done
   setKeepOpen();
 }
 
 
+// Calls that are still pending fail
 XmlRpcClient::~XmlRpcClient()
 {
+  if (getPendingCalls() > 0)
+  {
+    _dispatch->removeSource(this);
+    std::vector<AsyncCall> calls(_inFlight);
+    calls.insert(calls.end(), _queued.begin(), _queued.end());
+    _inFlight.clear();
+    _queued.clear();
+    failCalls(calls);
+  }
 }
 
 // Close the owned fd
@@ -54,8 +69,9 @@ XmlRpcClient::close()
 {
   XmlRpcUtil::log(4, "XmlRpcClient::close: fd %d.", getfd());
   _connectionState = NO_CONNECTION;
-  _disp.exit();
-  _disp.removeSource(this);
+  if (_executing)
+    _disp.exit();
+  (_executing ? &_disp : _dispatch)->removeSource(this);
   XmlRpcSource::close();
 }
 
@@ -79,7 +95,7 @@ XmlRpcClient::execute(const char* method, XmlRpcValue const& params, XmlRpcValue
   // This is not a thread-safe operation, if you want to do multithreading, use separate
   // clients for each thread. If you want to protect yourself from multiple threads
   // accessing the same client, replace this code with a real mutex.
-  if (_executing)
+  if (_executing || getPendingCalls() > 0)
     return false;
 
   _executing = true;
@@ -106,10 +122,162 @@ XmlRpcClient::execute(const char* method, XmlRpcValue const& params, XmlRpcValue
   return true;
 }
 
+// Queue an asynchronous call. If no request is in progress the call is
+// sent right away, otherwise it goes out with the next batch.
+bool
+XmlRpcClient::executeAsync(const char* method, XmlRpcValue const& params, XmlRpcCallback* callback)
+{
+  XmlRpcUtil::log(1, "XmlRpcClient::executeAsync: method %s (%d calls pending).", method, getPendingCalls());
+
+  if (_executing)
+    return false;
+
+  // Calls made from a callback go out once the callbacks are done
+  _queued.push_back(AsyncCall(method, params, callback));
+  if (_inFlight.empty() && ! _delivering)
+    sendQueued();
+  return true;
+}
+
+
+// Generate a request for the next batch of queued calls and make sure
+// there is a connection to send it on.
+unsigned
+XmlRpcClient::sendQueued()
+{
+  int nCalls = _multicall ? int(_queued.size()) : 1;
+  if (nCalls > _maxBatch)
+    nCalls = _maxBatch;
+  _inFlight.assign(_queued.begin(), _queued.begin() + nCalls);
+  _queued.erase(_queued.begin(), _queued.begin() + nCalls);
+
+  bool ok;
+  if (nCalls == 1)
+    ok = generateRequest(_inFlight[0]._method.c_str(), _inFlight[0]._params);
+  else
+  {
+    // system.multicall takes an array of {methodName, params} structs
+    XmlRpcValue calls;
+    calls.setSize(nCalls);
+    for (int i=0; i<nCalls; ++i)
+    {
+      calls[i]["methodName"] = _inFlight[i]._method;
+      XmlRpcValue& callParams = calls[i]["params"];
+      if (_inFlight[i]._params.getType() == XmlRpcValue::TypeArray)
+        callParams = _inFlight[i]._params;
+      else if (_inFlight[i]._params.valid())
+        callParams[0] = _inFlight[i]._params;
+      else
+        callParams.setSize(0);
+    }
+    XmlRpcValue params;
+    params[0] = calls;
+    ok = generateRequest("system.multicall", params);
+  }
+  XmlRpcUtil::log(3, "XmlRpcClient::sendQueued: sending %d calls, %d still queued.", nCalls, int(_queued.size()));
+
+  _sendAttempts = 0;
+  if ( ! ok || ! setupConnection())
+  {
+    // Nothing can be sent on this client, including calls made by the
+    // callbacks of the failed calls
+    std::vector<AsyncCall> calls;
+    calls.swap(_inFlight);
+    while ( ! calls.empty())
+    {
+      calls.insert(calls.end(), _queued.begin(), _queued.end());
+      _queued.clear();
+      failCalls(calls);
+      calls.clear();
+      calls.insert(calls.end(), _queued.begin(), _queued.end());
+      _queued.clear();
+    }
+    return 0;
+  }
+  return XmlRpcDispatch::WritableEvent | XmlRpcDispatch::Exception;
+}
+
+
+// The response to the calls in flight has been read. Deliver the results
+// and send the next batch.
+unsigned
+XmlRpcClient::completeInFlight()
+{
+  std::vector<AsyncCall> calls;
+  calls.swap(_inFlight);
+
+  XmlRpcValue result;
+  _isFault = false;
+  bool ok = parseResponse(result);
+
+  ClearFlagOnExit cf(_delivering);
+  _delivering = true;
+  if ( ! ok)
+    failCalls(calls);
+  else if (calls.size() == 1)
+    calls[0]._callback->complete(true, _isFault, result);
+  else if (_isFault)
+  {
+    // The server does not do multicall. Send the calls one at a time.
+    XmlRpcUtil::log(2, "XmlRpcClient::completeInFlight: system.multicall failed, not batching calls.");
+    _multicall = false;
+    _queued.insert(_queued.begin(), calls.begin(), calls.end());
+  }
+  else if (result.getType() != XmlRpcValue::TypeArray || result.size() != int(calls.size()))
+  {
+    XmlRpcUtil::error("Error in XmlRpcClient::completeInFlight: invalid system.multicall response.");
+    failCalls(calls);
+  }
+  else
+  {
+    // Each result is a one element array, or a fault struct
+    for (unsigned i=0; i<calls.size(); ++i)
+      if (result[i].getType() == XmlRpcValue::TypeArray && result[i].size() == 1)
+        calls[i]._callback->complete(true, false, result[i][0]);
+      else
+        calls[i]._callback->complete(true, true, result[i]);
+  }
+  _delivering = false;
+
+  return _queued.empty() ? 0 : sendQueued();
+}
+
+
+void
+XmlRpcClient::failCalls(std::vector<AsyncCall>& calls)
+{
+  bool wasDelivering = _delivering;
+  _delivering = true;
+  XmlRpcValue none;
+  for (unsigned i=0; i<calls.size(); ++i)
+    calls[i]._callback->complete(false, false, none);
+  _delivering = wasDelivering;
+}
+
+
 // XmlRpcSource interface implementation
-// Handle server responses. Called by the event dispatcher during execute.
+// Handle server responses. Called by the event dispatcher.
 unsigned
 XmlRpcClient::handleEvent(unsigned eventType)
+{
+  unsigned events = handleIO(eventType);
+  if (events != 0 || _inFlight.empty())
+    return events;
+
+  // The asynchronous request is done: either the response has been read or
+  // the connection failed, in which case only the calls in flight fail.
+  if (_connectionState == IDLE)
+    return completeInFlight();
+
+  std::vector<AsyncCall> calls;
+  calls.swap(_inFlight);
+  failCalls(calls);
+  return _queued.empty() ? 0 : sendQueued();
+}
+
+
+unsigned
+XmlRpcClient::handleIO(unsigned eventType)
 {
   if (eventType == XmlRpcDispatch::Exception)
   {
@@ -142,10 +310,11 @@ bool
 XmlRpcClient::setupConnection()
 {
   // If an error occurred last time through, or if the server closed the connection, close our end
-  if ((_connectionState != NO_CONNECTION && _connectionState != IDLE) || _eof)
+  if ((_connectionState != NO_CONNECTION && _connectionState != IDLE) || _eof || _serverClose)
     close();
 
   _eof = false;
+  _serverClose = false;
   if (_connectionState == NO_CONNECTION)
     if (! doConnect()) 
       return false;
@@ -155,8 +324,10 @@ XmlRpcClient::setupConnection()
   _bytesWritten = 0;
 
   // Notify the dispatcher to listen on this source (calls handleEvent when the socket is writable)
-  _disp.removeSource(this);       // Make sure nothing is left over
-  _disp.addSource(this, XmlRpcDispatch::WritableEvent | XmlRpcDispatch::Exception);
+  // execute() always runs the client's own dispatcher
+  XmlRpcDispatch* disp = _executing ? &_disp : _dispatch;
+  disp->removeSource(this);       // Make sure nothing is left over
+  disp->addSource(this, XmlRpcDispatch::WritableEvent | XmlRpcDispatch::Exception);
 
   return true;
 }
@@ -209,14 +380,14 @@ XmlRpcClient::generateRequest(const char* methodName, XmlRpcValue const& params)
     {
       for (int i=0; i<params.size(); ++i) {
         body += PARAM_TAG;
-        body += params[i].toXml();
+        params[i].toXml(body);
         body += PARAM_ETAG;
       }
     }
     else
     {
       body += PARAM_TAG;
-      body += params.toXml();
+      params.toXml(body);
       body += PARAM_ETAG;
     }
       
@@ -307,10 +478,14 @@ XmlRpcClient::readHeader()
   char *ep = hp + _header.length();   // End of string
   char *bp = 0;                       // Start of body
   char *lp = 0;                       // Start of content-length value
+  char *kp = 0;                       // Start of connection value
 
   for (char *cp = hp; (bp == 0) && (cp < ep); ++cp) {
     if ((ep - cp > 16) && (strncasecmp(cp, "Content-length: ", 16) == 0))
       lp = cp + 16;
+    else if ((ep - cp > 11) && (cp == hp || cp[-1] == '\n') &&
+             (strncasecmp(cp, "Connection:", 11) == 0))
+      kp = cp + 11;
     else if ((ep - cp > 4) && (strncmp(cp, "\r\n\r\n", 4) == 0))
       bp = cp + 4;
     else if ((ep - cp > 2) && (strncmp(cp, "\n\n", 2) == 0))
@@ -334,6 +509,22 @@ XmlRpcClient::readHeader()
     return false;   // We could try to figure it out by parsing as we read, but for now...
   }
 
+  // Look for a "close" token in the Connection header's value only, not
+  // in other headers or as part of a longer token
+  bool closing = false;
+  while (kp != 0 && kp < ep && *kp != '\r' && *kp != '\n') {
+    while (kp < ep && (*kp == ' ' || *kp == '\t' || *kp == ','))
+      ++kp;
+    char *tp = kp;
+    while (kp < ep && strchr(" \t\r\n,", *kp) == 0)
+      ++kp;
+    if (kp - tp == 5 && strncasecmp(tp, "close", 5) == 0)
+      closing = true;
+  }
+
+  // Reconnect for the next request rather than finding out it was closed
+  _serverClose = closing || (strncmp(hp, "HTTP/1.0", 8) == 0);
+
   _contentLength = atoi(lp);
   if (_contentLength <= 0) {
     XmlRpcUtil::error("Error in XmlRpcClient::readHeader: Invalid Content-length specified (%d).", _contentLength);
@@ -10,16 +10,28 @@
 
 
 #ifndef MAKEDEPEND
+# include <deque>
 # include <string>
+# include <vector>
 #endif
 
 #include "XmlRpcDispatch.h"
 #include "XmlRpcSource.h"
+#include "XmlRpcValue.h"
 
 namespace XmlRpc {
 
-  // Arguments and results are represented by XmlRpcValues
-  class XmlRpcValue;
+  //! Receives the result of an asynchronous call. \see XmlRpcClient::executeAsync
+  class XmlRpcCallback {
+  public:
+    virtual ~XmlRpcCallback() {}
+
+    //! Called from the dispatcher when the call completes.
+    //!  @param ok False if no response was received (the connection failed)
+    //!  @param isFault True if result is a fault response
+    //!  @param result The result value
+    virtual void complete(bool ok, bool isFault, XmlRpcValue& result) = 0;
+  };
 
   //! A class to send XML RPC requests to a server and return the results.
   class XmlRpcClient : public XmlRpcSource {
@@ -60,6 +72,29 @@ namespace XmlRpc {
     //! Returns true if the result of the last execute() was a fault response.
     bool isFault() const { return _isFault; }
 
+    //! Queue a call to the named procedure and return without waiting for
+    //! the response. callback->complete() is called from the dispatcher
+    //! once the result arrives. Calls queued while an earlier request is
+    //! outstanding are sent together as one system.multicall request.
+    //!  @return false if the call could not be queued, in which case the
+    //!   callback is not called. This happens during a synchronous execute().
+    bool executeAsync(const char* method, XmlRpcValue const& params, XmlRpcCallback* callback);
+
+    //! Number of asynchronous calls that have not completed yet
+    int getPendingCalls() const { return int(_queued.size() + _inFlight.size()); }
+
+    //! Have the client's asynchronous calls driven by disp rather than by its
+    //! own dispatcher. Must be called while no calls are pending.
+    void setDispatch(XmlRpcDispatch* disp) { _dispatch = disp ? disp : &_disp; }
+
+    //! The dispatcher driving asynchronous calls. Run its work() method to
+    //! process them; it returns once no calls are left.
+    XmlRpcDispatch* getDispatch() const { return _dispatch; }
+
+    //! Specify the largest number of calls batched into one system.multicall
+    //! request (1 disables batching).
+    void setMaxBatch(int maxBatch) { _maxBatch = (maxBatch > 0) ? maxBatch : 1; }
+
 
     // XmlRpcSource interface implementation
     //! Close the connection
@@ -82,6 +117,25 @@ namespace XmlRpc {
     virtual bool readResponse();
     virtual bool parseResponse(XmlRpcValue& result);
 
+    // Read/write the connection for the current request
+    unsigned handleIO(unsigned eventType);
+
+    // Asynchronous calls
+    struct AsyncCall {
+      AsyncCall(const char* method, XmlRpcValue const& params, XmlRpcCallback* callback) :
+        _method(method), _params(params), _callback(callback) {}
+      std::string _method;
+      XmlRpcValue _params;
+      XmlRpcCallback* _callback;
+    };
+
+    // Send the next batch of queued calls. Returns the events to monitor.
+    unsigned sendQueued();
+    // Deliver the results of the calls in flight. Returns the events to monitor.
+    unsigned completeInFlight();
+    // Complete calls with a failure
+    void failCalls(std::vector<AsyncCall>& calls);
+
     // Possible IO states for the connection
     enum ClientConnectionState { NO_CONNECTION, CONNECTING, WRITE_REQUEST, READ_HEADER, READ_RESPONSE, IDLE };
     ClientConnectionState _connectionState;
@@ -109,6 +163,9 @@ namespace XmlRpc {
     // True if the server closed the connection
     bool _eof;
 
+    // True if the server said it will close the connection after the response
+    bool _serverClose;
+
     // True if a fault response was returned by the server
     bool _isFault;
 
@@ -118,6 +175,22 @@ namespace XmlRpc {
     // Event dispatcher
     XmlRpcDispatch _disp;
 
+    // The dispatcher monitoring the connection (normally _disp)
+    XmlRpcDispatch* _dispatch;
+
+    // Calls waiting to be sent, and the calls of the request in progress
+    std::deque<AsyncCall> _queued;
+    std::vector<AsyncCall> _inFlight;
+
+    // Largest number of calls sent in one request
+    int _maxBatch;
+
+    // Cleared if the server does not implement system.multicall
+    bool _multicall;
+
+    // True while callbacks are being called
+    bool _delivering;
+
   };	// class XmlRpcClient
 
 }	// namespace XmlRpc
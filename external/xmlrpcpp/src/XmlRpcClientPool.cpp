@@ -0,0 +1,103 @@
+
+#include "XmlRpcClientPool.h"
+#include "XmlRpcUtil.h"
+
+using namespace XmlRpc;
+
+
+XmlRpcClientPool::XmlRpcClientPool(XmlRpcDispatch* disp, int maxConnections) :
+  _disp(disp), _maxConnections(maxConnections > 0 ? maxConnections : 1), _maxBatch(32)
+{
+}
+
+
+XmlRpcClientPool::~XmlRpcClientPool()
+{
+  close();
+}
+
+
+void
+XmlRpcClientPool::close()
+{
+  for (ClientMap::iterator it=_clients.begin(); it!=_clients.end(); ++it)
+    for (unsigned i=0; i<it->second.size(); ++i)
+    {
+      it->second[i]->close();
+      delete it->second[i];
+    }
+  _clients.clear();
+}
+
+
+// Prefer an idle connection, then a new one, then the least busy one. A
+// synchronous call needs a connection with nothing pending; if all
+// maxConnections are busy there is none to give it.
+XmlRpcClient*
+XmlRpcClientPool::getClient(const char* host, int port, bool needIdle)
+{
+  ClientList& clients = _clients[std::make_pair(std::string(host), port)];
+
+  XmlRpcClient* best = 0;
+  for (unsigned i=0; i<clients.size(); ++i)
+  {
+    if (clients[i]->getPendingCalls() == 0)
+      return clients[i];
+    if (best == 0 || clients[i]->getPendingCalls() < best->getPendingCalls())
+      best = clients[i];
+  }
+
+  if (int(clients.size()) < _maxConnections)
+  {
+    XmlRpcUtil::log(2, "XmlRpcClientPool::getClient: connection %d to %s:%d.", int(clients.size())+1, host, port);
+    XmlRpcClient* client = new XmlRpcClient(host, port);
+    client->setDispatch(_disp);
+    client->setMaxBatch(_maxBatch);
+    clients.push_back(client);
+    return client;
+  }
+  return needIdle ? 0 : best;
+}
+
+
+bool
+XmlRpcClientPool::executeAsync(const char* host, int port, const char* method,
+                               XmlRpcValue const& params, XmlRpcCallback* callback)
+{
+  return getClient(host, port, false)->executeAsync(method, params, callback);
+}
+
+
+bool
+XmlRpcClientPool::execute(const char* host, int port, const char* method,
+                          XmlRpcValue const& params, XmlRpcValue& result)
+{
+  XmlRpcClient* client = getClient(host, port, true);
+  if ( ! client)
+  {
+    XmlRpcUtil::error("XmlRpcClientPool::execute: all %d connections to %s:%d are busy.", _maxConnections, host, port);
+    return false;
+  }
+  return client->execute(method, params, result);
+}
+
+
+int
+XmlRpcClientPool::getPendingCalls() const
+{
+  int n = 0;
+  for (ClientMap::const_iterator it=_clients.begin(); it!=_clients.end(); ++it)
+    for (unsigned i=0; i<it->second.size(); ++i)
+      n += it->second[i]->getPendingCalls();
+  return n;
+}
+
+
+void
+XmlRpcClientPool::setMaxBatch(int maxBatch)
+{
+  _maxBatch = maxBatch;
+  for (ClientMap::iterator it=_clients.begin(); it!=_clients.end(); ++it)
+    for (unsigned i=0; i<it->second.size(); ++i)
+      it->second[i]->setMaxBatch(maxBatch);
+}
@@ -0,0 +1,71 @@
+
+#ifndef _XMLRPCCLIENTPOOL_H_
+#define _XMLRPCCLIENTPOOL_H_
+//
+// XmlRpc++ Copyright (c) 2002-2003 by Chris Morley
+//
+#if defined(_MSC_VER)
+# pragma warning(disable:4786)    // identifier was truncated in debug info
+#endif
+
+#ifndef MAKEDEPEND
+# include <map>
+# include <string>
+# include <vector>
+#endif
+
+#include "XmlRpcClient.h"
+
+namespace XmlRpc {
+
+  //! Keep-alive client connections shared by the callers of a process,
+  //! keyed by server host and port. Asynchronous calls are spread over up to
+  //! maxConnections connections per server; calls queued behind a busy
+  //! connection are batched into a system.multicall request.
+  class XmlRpcClientPool {
+  public:
+    //! Constructor
+    //!  @param disp The dispatcher that drives the asynchronous calls
+    //!  @param maxConnections The most connections to open to one server
+    XmlRpcClientPool(XmlRpcDispatch* disp, int maxConnections = 4);
+
+    //! Destructor. Calls still pending fail.
+    ~XmlRpcClientPool();
+
+    //! Queue a call to the named procedure on the server at host:port.
+    //! callback->complete() is called from the dispatcher.
+    //! \see XmlRpcClient::executeAsync
+    bool executeAsync(const char* host, int port, const char* method,
+                      XmlRpcValue const& params, XmlRpcCallback* callback);
+
+    //! Execute a call synchronously on an idle connection to host:port.
+    //! Fails if all maxConnections connections have calls pending.
+    //! \see XmlRpcClient::execute
+    bool execute(const char* host, int port, const char* method,
+                 XmlRpcValue const& params, XmlRpcValue& result);
+
+    //! Number of asynchronous calls that have not completed yet
+    int getPendingCalls() const;
+
+    //! Specify the largest number of calls batched into one request
+    void setMaxBatch(int maxBatch);
+
+    //! Close all connections. Calls still pending fail.
+    void close();
+
+  protected:
+    // Pick the client to use for the next call to host:port
+    XmlRpcClient* getClient(const char* host, int port, bool needIdle);
+
+    XmlRpcDispatch* _disp;
+    int _maxConnections;
+    int _maxBatch;
+
+    typedef std::vector<XmlRpcClient*> ClientList;
+    typedef std::map<std::pair<std::string, int>, ClientList> ClientMap;
+    ClientMap _clients;
+  };
+
+}	// namespace XmlRpc
+
+#endif	// _XMLRPCCLIENTPOOL_H_
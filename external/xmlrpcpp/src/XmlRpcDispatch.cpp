@@ -7,30 +7,58 @@
 
 #if defined(_WINDOWS)
 # include <winsock2.h>
-
-# define USE_FTIME
-# if defined(_MSC_VER)
-#  define timeb _timeb
-#  define ftime _ftime
-# endif
 #else
-# include <sys/time.h>
+# include <errno.h>
+# include <unistd.h>
 #endif  // _WINDOWS
 
+#if defined(XMLRPC_USE_EPOLL)
+# include <sys/epoll.h>
+#endif
+
 
 using namespace XmlRpc;
 
 
+#if defined(XMLRPC_USE_EPOLL)
+// Maximum number of events collected by one epoll_wait call
+static const int MAX_EPOLL_EVENTS = 256;
+
+// Translate a source event mask into epoll events. Sources are level-triggered
+// (like select) unless they drain their fd and asked for edge triggering.
+static unsigned
+epollEvents(XmlRpcSource* source, unsigned mask)
+{
+  unsigned events = source->getEdgeTriggered() ? unsigned(EPOLLET) : 0;
+  if (mask & XmlRpcDispatch::ReadableEvent) events |= EPOLLIN;
+  if (mask & XmlRpcDispatch::WritableEvent) events |= EPOLLOUT;
+  if (mask & XmlRpcDispatch::Exception)     events |= EPOLLPRI;
+  return events;
+}
+#endif
+
+
 XmlRpcDispatch::XmlRpcDispatch()
 {
   _endTime = -1.0;
   _doClear = false;
   _inWork = false;
+  _nextId = 0;
+  _epollFd = -1;
+#if defined(XMLRPC_USE_EPOLL)
+  _epollFd = epoll_create1(EPOLL_CLOEXEC);
+  if (_epollFd < 0)
+    XmlRpcUtil::error("XmlRpcDispatch: epoll_create1 failed (%d), using select.", errno);
+#endif
 }
 
 
 XmlRpcDispatch::~XmlRpcDispatch()
 {
+#if defined(XMLRPC_USE_EPOLL)
+  if (_epollFd >= 0)
+    ::close(_epollFd);
+#endif
 }
 
 // Monitor this source for the specified events and call its event handler
@@ -38,19 +66,49 @@ XmlRpcDispatch::~XmlRpcDispatch()
 void
 XmlRpcDispatch::addSource(XmlRpcSource* source, unsigned mask)
 {
-  _sources.push_back(MonitoredSource(source, mask));
+  if (_sourceMap.find(source) != _sourceMap.end())
+  {
+    setSourceEvents(source, mask);
+    return;
+  }
+
+  int fd = source->getfd();
+  _sourceMap[source] = _sources.insert(_sources.end(), MonitoredSource(source, mask, fd, _nextId++));
+
+#if defined(XMLRPC_USE_EPOLL)
+  if (_epollFd >= 0)
+  {
+    struct epoll_event ev;
+    ev.events = epollEvents(source, mask);
+    ev.data.ptr = source;
+    if (epoll_ctl(_epollFd, EPOLL_CTL_ADD, fd, &ev) != 0)
+      XmlRpcUtil::error("XmlRpcDispatch::addSource: could not add fd %d (%d).", fd, errno);
+  }
+#endif
 }
 
 // Stop monitoring this source. Does not close the source.
 void
 XmlRpcDispatch::removeSource(XmlRpcSource* source)
 {
-  for (SourceList::iterator it=_sources.begin(); it!=_sources.end(); ++it)
-    if (it->getSource() == source)
-    {
-      _sources.erase(it);
-      break;
-    }
+  SourceMap::iterator mi = _sourceMap.find(source);
+  if (mi == _sourceMap.end())
+    return;
+
+#if defined(XMLRPC_USE_EPOLL)
+  // If the source has since closed (or replaced) the registered fd, the
+  // kernel has already dropped the registration and the fd number may now
+  // belong to someone else.
+  int fd = mi->second->getfd();
+  if (_epollFd >= 0 && fd >= 0 && fd == source->getfd())
+  {
+    struct epoll_event ev;    // Non-null for kernels before 2.6.9
+    epoll_ctl(_epollFd, EPOLL_CTL_DEL, fd, &ev);
+  }
+#endif
+
+  _sources.erase(mi->second);
+  _sourceMap.erase(mi);
 }
 
 
@@ -58,15 +116,47 @@ XmlRpcDispatch::removeSource(XmlRpcSource* source)
 void 
 XmlRpcDispatch::setSourceEvents(XmlRpcSource* source, unsigned eventMask)
 {
-  for (SourceList::iterator it=_sources.begin(); it!=_sources.end(); ++it)
-    if (it->getSource() == source)
-    {
-      it->getMask() = eventMask;
-      break;
-    }
+  SourceMap::iterator mi = _sourceMap.find(source);
+  if (mi == _sourceMap.end())
+    return;
+
+  mi->second->getMask() = eventMask;
+
+#if defined(XMLRPC_USE_EPOLL)
+  // Modifying the registration also re-arms an edge trigger, so events
+  // that became pending before the mask changed are not lost.
+  if (_epollFd >= 0)
+  {
+    struct epoll_event ev;
+    ev.events = epollEvents(source, eventMask);
+    ev.data.ptr = source;
+    if (epoll_ctl(_epollFd, EPOLL_CTL_MOD, mi->second->getfd(), &ev) != 0)
+      XmlRpcUtil::error("XmlRpcDispatch::setSourceEvents: could not modify fd %d (%d).",
+                        mi->second->getfd(), errno);
+  }
+#endif
 }
 
 
+// Schedule a TimerEvent for this source
+void
+XmlRpcDispatch::addTimer(XmlRpcSource* source, double delay)
+{
+  _timers.insert(TimerQueue::value_type(getTime() + delay, Timer(source, delay)));
+}
+
+// Cancel pending timers for this source
+void
+XmlRpcDispatch::removeTimer(XmlRpcSource* source)
+{
+  for (TimerQueue::iterator it=_timers.begin(); it!=_timers.end(); )
+  {
+    TimerQueue::iterator thisIt = it++;
+    if (thisIt->second._src == source)
+      _timers.erase(thisIt);
+  }
+}
+
 
 // Watch current set of sources and process events
 void
@@ -78,79 +168,22 @@ XmlRpcDispatch::work(double timeout)
   _inWork = true;
 
   // Only work while there is something to monitor
-  while (_sources.size() > 0) {
-
-    // Construct the sets of descriptors we are interested in
-    fd_set inFd, outFd, excFd;
-	  FD_ZERO(&inFd);
-	  FD_ZERO(&outFd);
-	  FD_ZERO(&excFd);
-
-    int maxFd = -1;     // Not used on windows
-    SourceList::iterator it;
-    for (it=_sources.begin(); it!=_sources.end(); ++it) {
-      int fd = it->getSource()->getfd();
-      if (it->getMask() & ReadableEvent) FD_SET(fd, &inFd);
-      if (it->getMask() & WritableEvent) FD_SET(fd, &outFd);
-      if (it->getMask() & Exception)     FD_SET(fd, &excFd);
-      if (it->getMask() && fd > maxFd)   maxFd = fd;
-    }
+  while (_sources.size() > 0 || _timers.size() > 0) {
 
-    // Check for events
-    int nEvents;
-    if (timeout < 0.0)
-      nEvents = select(maxFd+1, &inFd, &outFd, &excFd, NULL);
-    else 
+    // Wait for and process events
+    bool ok = (_epollFd >= 0) ? waitEpoll(getWaitTime()) : waitSelect(getWaitTime());
+    if ( ! ok)
     {
-      struct timeval tv;
-      tv.tv_sec = (int)floor(timeout);
-      tv.tv_usec = ((int)floor(1000000.0 * (timeout-floor(timeout)))) % 1000000;
-      nEvents = select(maxFd+1, &inFd, &outFd, &excFd, &tv);
-    }
-
-    if (nEvents < 0)
-    {
-      XmlRpcUtil::error("Error in XmlRpcDispatch::work: error in select (%d).", nEvents);
       _inWork = false;
       return;
     }
 
-    // Process events
-    for (it=_sources.begin(); it != _sources.end(); )
-    {
-      SourceList::iterator thisIt = it++;
-      XmlRpcSource* src = thisIt->getSource();
-      int fd = src->getfd();
-      unsigned newMask = (unsigned) -1;
-      if (fd <= maxFd) {
-        // If you select on multiple event types this could be ambiguous
-        if (FD_ISSET(fd, &inFd))
-          newMask &= src->handleEvent(ReadableEvent);
-        if (FD_ISSET(fd, &outFd))
-          newMask &= src->handleEvent(WritableEvent);
-        if (FD_ISSET(fd, &excFd))
-          newMask &= src->handleEvent(Exception);
-
-        if ( ! newMask) {
-          _sources.erase(thisIt);  // Stop monitoring this one
-          if ( ! src->getKeepOpen())
-            src->close();
-        } else if (newMask != (unsigned) -1) {
-          thisIt->getMask() = newMask;
-        }
-      }
-    }
+    fireTimers();
 
     // Check whether to clear all sources
     if (_doClear)
     {
-      SourceList closeList = _sources;
-      _sources.clear();
-      for (SourceList::iterator it=closeList.begin(); it!=closeList.end(); ++it) {
-	XmlRpcSource *src = it->getSource();
-        src->close();
-      }
-
+      clearSources();
       _doClear = false;
     }
 
@@ -163,6 +196,188 @@ XmlRpcDispatch::work(double timeout)
 }
 
 
+// Seconds to wait for events: until the end time or the next timer,
+// whichever comes first (-1 implies wait forever)
+double
+XmlRpcDispatch::getWaitTime()
+{
+  if (_endTime < 0.0 && _timers.empty())
+    return -1.0;
+
+  double now = getTime();
+  double wait = (_endTime < 0.0) ? -1.0 : _endTime - now;
+  if ( ! _timers.empty())
+  {
+    double timerWait = _timers.begin()->first - now;
+    if (wait < 0.0 || timerWait < wait)
+      wait = timerWait;
+  }
+  return (wait < 0.0) ? 0.0 : wait;
+}
+
+
+// Wait for events with select and dispatch them
+bool
+XmlRpcDispatch::waitSelect(double timeout)
+{
+  // Construct the sets of descriptors we are interested in
+  fd_set inFd, outFd, excFd;
+  FD_ZERO(&inFd);
+  FD_ZERO(&outFd);
+  FD_ZERO(&excFd);
+
+  int maxFd = -1;     // Not used on windows
+  SourceList::iterator it;
+  for (it=_sources.begin(); it!=_sources.end(); ++it) {
+    int fd = it->getSource()->getfd();
+    if (it->getMask() & ReadableEvent) FD_SET(fd, &inFd);
+    if (it->getMask() & WritableEvent) FD_SET(fd, &outFd);
+    if (it->getMask() & Exception)     FD_SET(fd, &excFd);
+    if (it->getMask() && fd > maxFd)   maxFd = fd;
+  }
+
+  // Check for events
+  int nEvents;
+  if (timeout < 0.0)
+    nEvents = select(maxFd+1, &inFd, &outFd, &excFd, NULL);
+  else 
+  {
+    struct timeval tv;
+    tv.tv_sec = (int)floor(timeout);
+    tv.tv_usec = ((int)floor(1000000.0 * (timeout-floor(timeout)))) % 1000000;
+    nEvents = select(maxFd+1, &inFd, &outFd, &excFd, &tv);
+  }
+
+  if (nEvents < 0)
+  {
+    XmlRpcUtil::error("Error in XmlRpcDispatch::work: error in select (%d).", nEvents);
+    return false;
+  }
+
+  // Process events. Collect the ready sources first since handlers may
+  // add or remove sources.
+  ReadyList ready;
+  for (it=_sources.begin(); it != _sources.end(); ++it)
+  {
+    int fd = it->getSource()->getfd();
+    if (fd > maxFd) continue;
+
+    unsigned events = 0;
+    if (FD_ISSET(fd, &inFd))  events |= ReadableEvent;
+    if (FD_ISSET(fd, &outFd)) events |= WritableEvent;
+    if (FD_ISSET(fd, &excFd)) events |= Exception;
+    if (events)
+      ready.push_back(ReadySource(it->getSource(), it->getId(), events));
+  }
+
+  for (ReadyList::iterator ri=ready.begin(); ri != ready.end(); ++ri)
+    dispatchEvents(*ri);
+
+  return true;
+}
+
+
+// Wait for events with epoll and dispatch them
+bool
+XmlRpcDispatch::waitEpoll(double timeout)
+{
+#if defined(XMLRPC_USE_EPOLL)
+  struct epoll_event events[MAX_EPOLL_EVENTS];
+  int msTimeout = (timeout < 0.0) ? -1 : (int)ceil(1000.0 * timeout);
+
+  int nEvents = epoll_wait(_epollFd, events, MAX_EPOLL_EVENTS, msTimeout);
+  if (nEvents < 0)
+  {
+    if (errno == EINTR)
+      return true;
+    XmlRpcUtil::error("Error in XmlRpcDispatch::work: error in epoll_wait (%d).", errno);
+    return false;
+  }
+
+  // Resolve the events against the source map before any handler runs.
+  // A handler may delete a source that has another event in this batch and
+  // a new source may then be added at the same address; the registration
+  // id keeps the stale event from reaching it.
+  ReadyList ready;
+  for (int i=0; i<nEvents; ++i)
+  {
+    SourceMap::iterator mi = _sourceMap.find((XmlRpcSource*) events[i].data.ptr);
+    if (mi == _sourceMap.end())
+      continue;
+
+    // Errors and hangups are reported as readable/writable, like select
+    unsigned mask = 0;
+    if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))  mask |= ReadableEvent;
+    if (events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) mask |= WritableEvent;
+    if (events[i].events & EPOLLPRI)                         mask |= Exception;
+    ready.push_back(ReadySource(mi->first, mi->second->getId(), mask));
+  }
+
+  for (ReadyList::iterator ri=ready.begin(); ri != ready.end(); ++ri)
+    dispatchEvents(*ri);
+  return true;
+#else
+  (void) timeout;
+  return false;
+#endif
+}
+
+
+// Call the source's event handler for each ready event it is interested in
+void
+XmlRpcDispatch::dispatchEvents(const ReadySource& rs)
+{
+  static const unsigned eventTypes[] = { ReadableEvent, WritableEvent, Exception };
+
+  XmlRpcSource* src = rs._src;
+  unsigned ready = rs._events;
+  unsigned newMask = (unsigned) -1;
+  for (int i=0; i<3 && newMask; ++i)
+  {
+    // An earlier handler may have removed this source, or removed it and
+    // added another one at the same address
+    SourceMap::iterator mi = _sourceMap.find(src);
+    if (mi == _sourceMap.end() || mi->second->getId() != rs._id)
+      return;
+
+    // If you select on multiple event types this could be ambiguous
+    if (ready & mi->second->getMask() & eventTypes[i])
+      newMask &= src->handleEvent(eventTypes[i]);
+  }
+
+  // The handler may have removed the source itself
+  SourceMap::iterator mi = _sourceMap.find(src);
+  if (mi == _sourceMap.end() || mi->second->getId() != rs._id)
+    return;
+
+  if ( ! newMask) {
+    removeSource(src);  // Stop monitoring this one
+    if ( ! src->getKeepOpen())
+      src->close();
+  } else if (newMask != (unsigned) -1 && newMask != mi->second->getMask()) {
+    setSourceEvents(src, newMask);
+  }
+}
+
+
+// Call the handlers of expired timers
+void
+XmlRpcDispatch::fireTimers()
+{
+  if (_timers.empty())
+    return;
+
+  double now = getTime();
+  while ( ! _timers.empty() && _timers.begin()->first <= now)
+  {
+    Timer t = _timers.begin()->second;
+    _timers.erase(_timers.begin());
+    if (t._src->handleEvent(TimerEvent))
+      _timers.insert(TimerQueue::value_type(now + t._delay, t));
+  }
+}
+
+
 // Exit from work routine. Presumably this will be called from
 // one of the source event handlers.
 void
@@ -178,31 +393,28 @@ XmlRpcDispatch::clear()
   if (_inWork)
     _doClear = true;  // Finish reporting current events before clearing
   else
-  {
-    SourceList closeList = _sources;
-    _sources.clear();
-    for (SourceList::iterator it=closeList.begin(); it!=closeList.end(); ++it)
-      it->getSource()->close();
-  }
+    clearSources();
 }
 
 
-double
-XmlRpcDispatch::getTime()
+// Stop monitoring and close all sources
+void
+XmlRpcDispatch::clearSources()
 {
-#ifdef USE_FTIME
-  struct timeb	tbuff;
+  SourceList closeList = _sources;
+  for (SourceList::iterator it=closeList.begin(); it!=closeList.end(); ++it)
+    removeSource(it->getSource());
+  _timers.clear();
+
+  for (SourceList::iterator it=closeList.begin(); it!=closeList.end(); ++it)
+    it->getSource()->close();
+}
 
-  ftime(&tbuff);
-  return ((double) tbuff.time + ((double)tbuff.millitm / 1000.0) +
-	  ((double) tbuff.timezone * 60));
-#else
-  struct timeval	tv;
-  struct timezone	tz;
 
-  gettimeofday(&tv, &tz);
-  return (tv.tv_sec + tv.tv_usec / 1000000.0);
-#endif /* USE_FTIME */
+double
+XmlRpcDispatch::getTime()
+{
+  return XmlRpcUtil::getTime();
 }
 
 
@@ -10,6 +10,14 @@
 
 #ifndef MAKEDEPEND
 # include <list>
+# include <map>
+#endif
+
+// On linux the dispatcher uses epoll with persistent registrations, which
+// are level-triggered unless the source asks for edge triggering (see
+// XmlRpcSource::setEdgeTriggered). Define XMLRPC_NO_EPOLL to fall back to select().
+#if defined(__linux__) && !defined(XMLRPC_NO_EPOLL)
+# define XMLRPC_USE_EPOLL
 #endif
 
 namespace XmlRpc {
@@ -29,7 +37,8 @@ namespace XmlRpc {
     enum EventType {
       ReadableEvent = 1,    //!< data available to read
       WritableEvent = 2,    //!< connected/data can be written without blocking
-      Exception     = 4     //!< uh oh
+      Exception     = 4,    //!< uh oh
+      TimerEvent    = 8     //!< a timer set with addTimer has expired
     };
     
     //! Monitor this source for the event types specified by the event mask
@@ -45,6 +54,15 @@ namespace XmlRpc {
     //! Modify the types of events to watch for on this source
     void setSourceEvents(XmlRpcSource* source, unsigned eventMask);
 
+    //! Call the source's event handler with TimerEvent after the specified
+    //! delay (in seconds). If the handler returns non-zero the timer is
+    //! re-armed with the same delay, otherwise it is discarded.
+    //!  @param source The source to notify
+    //!  @param delay Seconds until the timer expires
+    void addTimer(XmlRpcSource* source, double delay);
+
+    //! Cancel all pending timers for this source.
+    void removeTimer(XmlRpcSource* source);
 
     //! Watch current set of sources and process events for the specified
     //! duration (in ms, -1 implies wait forever, or until exit is called)
@@ -58,16 +76,27 @@ namespace XmlRpc {
 
   protected:
 
-    // helper
+    // helpers
     double getTime();
+    double getWaitTime();
+    bool waitSelect(double timeout);
+    bool waitEpoll(double timeout);
+    struct ReadySource;
+    void dispatchEvents(const ReadySource& rs);
+    void fireTimers();
+    void clearSources();
 
     // A source to monitor and what to monitor it for
     struct MonitoredSource {
-      MonitoredSource(XmlRpcSource* src, unsigned mask) : _src(src), _mask(mask) {}
+      MonitoredSource(XmlRpcSource* src, unsigned mask, int fd, unsigned id) : _src(src), _mask(mask), _fd(fd), _id(id) {}
       XmlRpcSource* getSource() const { return _src; }
       unsigned& getMask() { return _mask; }
+      int getfd() const { return _fd; }
+      unsigned getId() const { return _id; }
       XmlRpcSource* _src;
       unsigned _mask;
+      int _fd;        // The fd registered with epoll
+      unsigned _id;   // Tells this registration apart from a later one at the same address
     };
 
     // A list of sources to monitor
@@ -76,6 +105,36 @@ namespace XmlRpc {
     // Sources being monitored
     SourceList _sources;
 
+    // Index of the monitored sources so add/remove/modify don't walk the list
+    typedef std::map< XmlRpcSource*, SourceList::iterator > SourceMap;
+    SourceMap _sourceMap;
+
+    // Id given to the next source added
+    unsigned _nextId;
+
+    // A source found ready by the last wait, and the events it is ready for
+    struct ReadySource {
+      ReadySource(XmlRpcSource* src, unsigned id, unsigned events) : _src(src), _id(id), _events(events) {}
+      XmlRpcSource* _src;
+      unsigned _id;
+      unsigned _events;
+    };
+    typedef std::list< ReadySource > ReadyList;
+
+    // A pending timer
+    struct Timer {
+      Timer(XmlRpcSource* src, double delay) : _src(src), _delay(delay) {}
+      XmlRpcSource* _src;
+      double _delay;
+    };
+
+    // Pending timers, ordered by expiry time
+    typedef std::multimap< double, Timer > TimerQueue;
+    TimerQueue _timers;
+
+    // epoll instance, or -1 when select() is used
+    int _epollFd;
+
     // When work should stop (-1 implies wait forever, or until exit is called)
     double _endTime;
 
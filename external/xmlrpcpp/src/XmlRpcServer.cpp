@@ -10,11 +10,14 @@
 using namespace XmlRpc;
 
 
-XmlRpcServer::XmlRpcServer()
+XmlRpcServer::XmlRpcServer() : _mailbox(&_disp)
 {
   _introspectionEnabled = false;
   _listMethods = 0;
   _methodHelp = 0;
+  _pool = 0;
+  _nextDispatchThread = 0;
+  setEdgeTriggered();   // Accepts until there are no more pending connections
 }
 
 
@@ -64,6 +67,48 @@ XmlRpcServer::findMethod(const std::string& name) const
 }
 
 
+// Run methods on worker threads and connection IO on dispatch threads
+bool
+XmlRpcServer::enableThreading(int nWorkers, int nDispatchThreads, int maxQueued)
+{
+  if (_pool)
+    return true;
+
+  // Requests would be queued to a pool that never runs them
+  if (nWorkers <= 0)
+  {
+    XmlRpcUtil::error("XmlRpcServer::enableThreading: need at least one worker (got %d).", nWorkers);
+    return false;
+  }
+
+  if ( ! _mailbox.open())
+    return false;
+
+  _pool = new XmlRpcThreadPool;
+  if ( ! _pool->start(nWorkers, maxQueued))
+  {
+    delete _pool;
+    _pool = 0;
+    return false;
+  }
+
+  for (int i=0; i<nDispatchThreads; ++i)
+  {
+    XmlRpcDispatchThread* t = new XmlRpcDispatchThread;
+    if ( ! t->start())
+    {
+      delete t;
+      break;
+    }
+    _dispatchThreads.push_back(t);
+  }
+
+  XmlRpcUtil::log(2, "XmlRpcServer::enableThreading: %d workers, %d dispatch threads",
+                  nWorkers, int(_dispatchThreads.size()));
+  return true;
+}
+
+
 // Create a socket, bind to the specified port, and
 // set it in listen mode to make it available for clients.
 bool 
@@ -139,27 +184,44 @@ XmlRpcServer::handleEvent(unsigned /* mask */)
 }
 
 
-// Accept a client connection request and create a connection to
-// handle method calls from the client.
+// Accept client connection requests and create a connection to
+// handle method calls from each client. The dispatcher may report
+// readiness edge-triggered, so all pending requests are accepted.
 void
 XmlRpcServer::acceptConnection()
 {
-  int s = XmlRpcSocket::accept(this->getfd());
-  XmlRpcUtil::log(2, "XmlRpcServer::acceptConnection: socket %d", s);
-  if (s < 0)
-  {
-    //this->close();
-    XmlRpcUtil::error("XmlRpcServer::acceptConnection: Could not accept connection (%s).", XmlRpcSocket::getErrorMsg().c_str());
-  }
-  else if ( ! XmlRpcSocket::setNonBlocking(s))
+  for (;;)
   {
-    XmlRpcSocket::close(s);
-    XmlRpcUtil::error("XmlRpcServer::acceptConnection: Could not set socket to non-blocking input mode (%s).", XmlRpcSocket::getErrorMsg().c_str());
-  }
-  else  // Notify the dispatcher to listen for input on this source when we are in work()
-  {
-    XmlRpcUtil::log(2, "XmlRpcServer::acceptConnection: creating a connection");
-    _disp.addSource(this->createConnection(s), XmlRpcDispatch::ReadableEvent);
+    int s = XmlRpcSocket::accept(this->getfd());
+    XmlRpcUtil::log(2, "XmlRpcServer::acceptConnection: socket %d", s);
+    if (s < 0)
+    {
+      //this->close();
+      if ( ! XmlRpcSocket::nonFatalError())
+        XmlRpcUtil::error("XmlRpcServer::acceptConnection: Could not accept connection (%s).", XmlRpcSocket::getErrorMsg().c_str());
+      break;
+    }
+    else if ( ! XmlRpcSocket::setNonBlocking(s))
+    {
+      XmlRpcSocket::close(s);
+      XmlRpcUtil::error("XmlRpcServer::acceptConnection: Could not set socket to non-blocking input mode (%s).", XmlRpcSocket::getErrorMsg().c_str());
+    }
+    else if ( ! _dispatchThreads.empty())  // Hand the connection to a dispatch thread
+    {
+      XmlRpcUtil::log(2, "XmlRpcServer::acceptConnection: creating a connection");
+      XmlRpcServerConnection* c = this->createConnection(s);
+      XmlRpcDispatchMailbox* mailbox = _dispatchThreads[_nextDispatchThread++ % _dispatchThreads.size()]->getMailbox();
+      c->setMailbox(mailbox);
+      mailbox->post(c, XmlRpcDispatch::ReadableEvent);
+    }
+    else  // Notify the dispatcher to listen for input on this source when we are in work()
+    {
+      XmlRpcUtil::log(2, "XmlRpcServer::acceptConnection: creating a connection");
+      XmlRpcServerConnection* c = this->createConnection(s);
+      if (_pool)
+        c->setMailbox(&_mailbox);
+      _disp.addSource(c, XmlRpcDispatch::ReadableEvent);
+    }
   }
 }
 
@@ -173,10 +235,22 @@ XmlRpcServer::createConnection(int s)
 }
 
 
+// Called from the thread dispatching the connection
 void 
 XmlRpcServer::removeConnection(XmlRpcServerConnection* sc)
 {
-  _disp.removeSource(sc);
+  if (sc->getMailbox())
+    sc->getMailbox()->getDispatch()->removeSource(sc);
+  else
+    _disp.removeSource(sc);
+}
+
+
+// Queue a request for the worker threads
+bool
+XmlRpcServer::queueRequest(XmlRpcServerConnection* sc)
+{
+  return _pool && sc->getMailbox() && _pool->submit(sc);
 }
 
 
@@ -184,7 +258,11 @@ XmlRpcServer::removeConnection(XmlRpcServerConnection* sc)
 void 
 XmlRpcServer::exit()
 {
-  _disp.exit();
+  // Methods run on worker threads, so wake the dispatcher up
+  if (_pool)
+    _mailbox.postExit();
+  else
+    _disp.exit();
 }
 
 
@@ -192,11 +270,62 @@ XmlRpcServer::exit()
 void 
 XmlRpcServer::shutdown()
 {
+  // Finish the queued requests before their connections are destroyed
+  if (_pool)
+  {
+    _pool->stop();
+    for (unsigned i=0; i<_dispatchThreads.size(); ++i)
+      delete _dispatchThreads[i];
+    _dispatchThreads.clear();
+    delete _pool;
+    _pool = 0;
+  }
+
   // This closes and destroys all connections as well as closing this socket
   _disp.clear();
 }
 
 
+// Account for a method call
+void
+XmlRpcServer::recordCall(XmlRpcServerMethod* method, double seconds)
+{
+  // Without workers methods only run on the dispatching thread
+  if (_pool)
+    _statsLock.acquire();
+  MethodStats& ms = _stats[method->name()];
+  ++ms._calls;
+  ms._totalTime += seconds;
+  if (seconds > ms._maxTime)
+    ms._maxTime = seconds;
+  if (_pool)
+    _statsLock.release();
+}
+
+
+void
+XmlRpcServer::getStats(XmlRpcValue& result)
+{
+  {
+    XmlRpcMutex::Lock lock(_statsLock);
+    for (StatsMap::iterator it=_stats.begin(); it != _stats.end(); ++it)
+    {
+      XmlRpcValue& ms = result[it->first];
+      ms["calls"] = it->second._calls;
+      ms["totalTime"] = it->second._totalTime;
+      ms["maxTime"] = it->second._maxTime;
+    }
+  }
+
+  if (_pool)
+  {
+    result["queueDepth"] = _pool->getQueueDepth();
+    result["maxQueueDepth"] = _pool->getMaxQueueDepth();
+    result["queueTime"] = _pool->getQueueTime();
+  }
+}
+
+
 // Introspection support
 static const std::string LIST_METHODS("system.listMethods");
 static const std::string METHOD_HELP("system.methodHelp");
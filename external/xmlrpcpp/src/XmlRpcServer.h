@@ -11,10 +11,12 @@
 #ifndef MAKEDEPEND
 # include <map>
 # include <string>
+# include <vector>
 #endif
 
 #include "XmlRpcDispatch.h"
 #include "XmlRpcSource.h"
+#include "XmlRpcThreadPool.h"
 
 namespace XmlRpc {
 
@@ -52,6 +54,16 @@ namespace XmlRpc {
     //! Look up a method by name
     XmlRpcServerMethod* findMethod(const std::string& name) const;
 
+    //! Execute methods on a pool of worker threads instead of the thread
+    //! calling work(), and optionally spread client connections over
+    //! additional dispatch threads. Methods must not be added or removed
+    //! while the server is working, and must be safe to run concurrently.
+    //!  @param nWorkers Number of threads executing methods, at least 1
+    //!  @param nDispatchThreads Number of threads (besides the one calling work())
+    //!  performing client connection IO. 0 leaves all IO to work().
+    //!  @param maxQueued Maximum number of requests waiting for a worker
+    bool enableThreading(int nWorkers, int nDispatchThreads = 0, int maxQueued = 1024);
+
     //! Create a socket, bind to the specified port, and
     //! set it in listen mode to make it available for clients.
     bool bindAndListen(int port, int backlog = 5);
@@ -68,6 +80,18 @@ namespace XmlRpc {
     //! Introspection support
     void listMethods(XmlRpcValue& result);
 
+    //! Call statistics: a struct with a member per method that has been called
+    //! (a struct of calls, totalTime and maxTime in seconds) and, for threaded
+    //! servers, queueDepth, maxQueueDepth and queueTime.
+    void getStats(XmlRpcValue& result);
+
+    //! Account for a call of method that took the specified time (in seconds).
+    void recordCall(XmlRpcServerMethod* method, double seconds);
+
+    //! Queue a connection's request for a worker thread. Returns false if
+    //! the server is not threaded, in which case the connection executes it.
+    bool queueRequest(XmlRpcServerConnection* connection);
+
     // XmlRpcSource interface implementation
 
     //! Handle client connection requests
@@ -98,6 +122,24 @@ namespace XmlRpc {
     XmlRpcServerMethod* _listMethods;
     XmlRpcServerMethod* _methodHelp;
 
+    // Per-method call statistics
+    struct MethodStats {
+      MethodStats() : _calls(0), _totalTime(0.0), _maxTime(0.0) {}
+      int _calls;
+      double _totalTime;
+      double _maxTime;
+    };
+    typedef std::map< std::string, MethodStats > StatsMap;
+    StatsMap _stats;
+    XmlRpcMutex _statsLock;
+
+    // Threaded servers: workers executing methods, the mailbox through which
+    // they hand connections back to _disp, and extra dispatch threads
+    XmlRpcThreadPool* _pool;
+    XmlRpcDispatchMailbox _mailbox;
+    std::vector< XmlRpcDispatchThread* > _dispatchThreads;
+    unsigned _nextDispatchThread;
+
   };
 } // namespace XmlRpc
 
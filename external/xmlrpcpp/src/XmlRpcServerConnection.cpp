@@ -34,6 +34,8 @@ XmlRpcServerConnection::XmlRpcServerConnection(int fd, XmlRpcServer* server, boo
   _server = server;
   _connectionState = READ_HEADER;
   _keepAlive = true;
+  _mailbox = 0;
+  setEdgeTriggered();   // nbRead/nbWrite go on until the socket would block
 }
 
 
@@ -48,7 +50,7 @@ XmlRpcServerConnection::~XmlRpcServerConnection()
 // and reading the rpc request. Return true to continue to monitor
 // the socket for events, false to remove it from the dispatcher.
 unsigned
-XmlRpcServerConnection::handleEvent(unsigned /*eventType*/)
+XmlRpcServerConnection::handleEvent(unsigned eventType)
 {
   if (_connectionState == READ_HEADER)
     if ( ! readHeader()) return 0;
@@ -56,6 +58,25 @@ XmlRpcServerConnection::handleEvent(unsigned /*eventType*/)
   if (_connectionState == READ_REQUEST)
     if ( ! readRequest()) return 0;
 
+  // Hand complete requests to the server's worker threads, if any. The
+  // socket is not monitored while the worker runs: pipelined input or an
+  // EOF would otherwise report it ready on every wait. The worker posts the
+  // connection back to its dispatcher for WritableEvent once the response
+  // is ready, which registers it again.
+  if (_connectionState == WRITE_RESPONSE && _response.length() == 0 &&
+      _server->queueRequest(this)) {
+    _connectionState = EXECUTE_REQUEST;
+    _mailbox->getDispatch()->removeSource(this);
+    return XmlRpcDispatch::ReadableEvent;   // Ignored, the source is gone
+  }
+
+  if (_connectionState == EXECUTE_REQUEST) {
+    if (eventType != XmlRpcDispatch::WritableEvent)
+      return XmlRpcDispatch::ReadableEvent;
+    _connectionState = WRITE_RESPONSE;
+    _bytesWritten = 0;
+  }
+
   if (_connectionState == WRITE_RESPONSE)
     if ( ! writeResponse()) return 0;
 
@@ -185,17 +206,19 @@ XmlRpcServerConnection::writeResponse()
   }
 
   // Try to write the response
-  if ( ! XmlRpcSocket::nbWrite(this->getfd(), _response, &_bytesWritten)) {
+  if ( ! XmlRpcSocket::nbWrite(this->getfd(), _responseHeader, _response, &_bytesWritten)) {
     XmlRpcUtil::error("XmlRpcServerConnection::writeResponse: write error (%s).",XmlRpcSocket::getErrorMsg().c_str());
     return false;
   }
-  XmlRpcUtil::log(3, "XmlRpcServerConnection::writeResponse: wrote %d of %d bytes.", _bytesWritten, _response.length());
+  int responseLength = int(_responseHeader.length() + _response.length());
+  XmlRpcUtil::log(3, "XmlRpcServerConnection::writeResponse: wrote %d of %d bytes.", _bytesWritten, responseLength);
 
   // Prepare to read the next request
-  if (_bytesWritten == int(_response.length())) {
-    _header = "";
-    _request = "";
-    _response = "";
+  if (_bytesWritten == responseLength) {
+    _header.clear();
+    _request.clear();
+    _responseHeader.clear();
+    _response.clear();
     _connectionState = READ_HEADER;
   }
 
@@ -217,7 +240,7 @@ XmlRpcServerConnection::executeRequest()
          ! executeMulticall(methodName, params, resultValue))
       generateFaultResponse(methodName + ": unknown method name");
     else
-      generateResponse(resultValue.toXml());
+      generateResponse(resultValue);
 
   } catch (const XmlRpcException& fault) {
     XmlRpcUtil::log(2, "XmlRpcServerConnection::executeRequest: fault %s.",
@@ -240,7 +263,7 @@ XmlRpcServerConnection::parseRequest(XmlRpcValue& params)
   {
     int nArgs = 0;
     while (XmlRpcUtil::nextTagIs(PARAM_TAG, _request, &offset)) {
-      params[nArgs++] = XmlRpcValue(_request, &offset);
+      params[nArgs++].fromXml(_request, &offset);   // Parse in place
       (void) XmlRpcUtil::nextTagIs(PARAM_ETAG, _request, &offset);
     }
 
@@ -259,7 +282,14 @@ XmlRpcServerConnection::executeMethod(const std::string& methodName,
 
   if ( ! method) return false;
 
-  method->execute(params, result);
+  double start = XmlRpcUtil::getTime();
+  try {
+    method->execute(params, result);
+  } catch (...) {
+    _server->recordCall(method, XmlRpcUtil::getTime() - start);
+    throw;
+  }
+  _server->recordCall(method, XmlRpcUtil::getTime() - start);
 
   // Ensure a valid result value
   if ( ! result.valid())
@@ -327,29 +357,46 @@ XmlRpcServerConnection::generateResponse(std::string const& resultXml)
   const char RESPONSE_2[] =
     "\r\n</param></params></methodResponse>\r\n";
 
-  std::string body = RESPONSE_1 + resultXml + RESPONSE_2;
-  std::string header = generateHeader(body);
+  _response.clear();
+  _response += RESPONSE_1;
+  _response += resultXml;
+  _response += RESPONSE_2;
+  generateHeader();
+  XmlRpcUtil::log(5, "XmlRpcServerConnection::generateResponse:\n%s\n", _response.c_str()); 
+}
+
+// Create a response from a result value, without an intermediate xml string
+void
+XmlRpcServerConnection::generateResponse(XmlRpcValue const& result)
+{
+  const char RESPONSE_1[] = 
+    "<?xml version=\"1.0\"?>\r\n"
+    "<methodResponse><params><param>\r\n\t";
+  const char RESPONSE_2[] =
+    "\r\n</param></params></methodResponse>\r\n";
 
-  _response = header + body;
+  _response.clear();
+  _response += RESPONSE_1;
+  result.toXml(_response);
+  _response += RESPONSE_2;
+  generateHeader();
   XmlRpcUtil::log(5, "XmlRpcServerConnection::generateResponse:\n%s\n", _response.c_str()); 
 }
 
-// Prepend http headers
-std::string
-XmlRpcServerConnection::generateHeader(std::string const& body)
+// Generate the http headers for the response body
+void
+XmlRpcServerConnection::generateHeader()
 {
-  std::string header = 
+  _responseHeader.clear();
+  _responseHeader += 
     "HTTP/1.1 200 OK\r\n"
     "Server: ";
-  header += XMLRPC_VERSION;
-  header += "\r\n"
+  _responseHeader += XMLRPC_VERSION;
+  _responseHeader += "\r\n"
     "Content-Type: text/xml\r\n"
     "Content-length: ";
-
-  char buffLen[40];
-  sprintf(buffLen,"%d\r\n\r\n", (int)body.size());
-
-  return header + buffLen;
+  XmlRpcUtil::appendInt(_responseHeader, int(_response.size()));
+  _responseHeader += "\r\n\r\n";
 }
 
 
@@ -365,9 +412,10 @@ XmlRpcServerConnection::generateFaultResponse(std::string const& errorMsg, int e
   XmlRpcValue faultStruct;
   faultStruct[FAULTCODE] = errorCode;
   faultStruct[FAULTSTRING] = errorMsg;
-  std::string body = RESPONSE_1 + faultStruct.toXml() + RESPONSE_2;
-  std::string header = generateHeader(body);
-
-  _response = header + body;
+  _response.clear();
+  _response += RESPONSE_1;
+  faultStruct.toXml(_response);
+  _response += RESPONSE_2;
+  generateHeader();
 }
 
@@ -20,6 +20,7 @@ namespace XmlRpc {
   // The server waits for client connections and provides methods
   class XmlRpcServer;
   class XmlRpcServerMethod;
+  class XmlRpcDispatchMailbox;
 
   //! A class to handle XML RPC requests from a particular client
   class XmlRpcServerConnection : public XmlRpcSource {
@@ -48,7 +49,15 @@ namespace XmlRpc {
     //!   @param eventType Type of IO event that occurred. @see XmlRpcDispatch::EventType.
     virtual unsigned handleEvent(unsigned eventType);
 
+    //! The mailbox of the dispatcher monitoring this connection, if the
+    //! server runs methods on worker threads.
+    XmlRpcDispatchMailbox* getMailbox() const { return _mailbox; }
+    //! Specify the mailbox of the dispatcher monitoring this connection.
+    void setMailbox(XmlRpcDispatchMailbox* mailbox) { _mailbox = mailbox; }
+
   protected:
+    // Worker threads call executeRequest
+    friend class XmlRpcThreadPool;
 
     bool readHeader();
     bool readRequest();
@@ -68,15 +77,19 @@ namespace XmlRpc {
 
     // Construct a response from the result XML.
     void generateResponse(std::string const& resultXml);
+    // Construct a response by serializing the result directly into the response body.
+    void generateResponse(XmlRpcValue const& result);
     void generateFaultResponse(std::string const& msg, int errorCode = -1);
-    std::string generateHeader(std::string const& body);
+    // Set the http headers for the response body.
+    void generateHeader();
 
 
     // The XmlRpc server that accepted this connection
     XmlRpcServer* _server;
 
-    // Possible IO states for the connection
-    enum ServerConnectionState { READ_HEADER, READ_REQUEST, WRITE_RESPONSE };
+    // Possible IO states for the connection. While EXECUTE_REQUEST a worker
+    // thread owns the request and response buffers.
+    enum ServerConnectionState { READ_HEADER, READ_REQUEST, EXECUTE_REQUEST, WRITE_RESPONSE };
     ServerConnectionState _connectionState;
 
     // Request headers
@@ -88,7 +101,10 @@ namespace XmlRpc {
     // Request body
     std::string _request;
 
-    // Response
+    // Response http headers and body. These are written out together but
+    // kept apart so the body can be built in place; both buffers keep
+    // their capacity from one request to the next.
+    std::string _responseHeader;
     std::string _response;
 
     // Number of bytes of the response written so far
@@ -96,6 +112,9 @@ namespace XmlRpc {
 
     // Whether to keep the current client connection open for further requests
     bool _keepAlive;
+
+    // Mailbox of the dispatcher that owns this connection (threaded servers)
+    XmlRpcDispatchMailbox* _mailbox;
   };
 } // namespace XmlRpc
 
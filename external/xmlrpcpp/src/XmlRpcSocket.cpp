@@ -18,6 +18,7 @@ extern "C" {
 # include <stdio.h>
 # include <sys/types.h>
 # include <sys/socket.h>
+# include <sys/uio.h>
 # include <netinet/in.h>
 # include <netdb.h>
 # include <errno.h>
@@ -54,8 +55,8 @@ static void initWinSock()
 
 
 // These errors are not considered fatal for an IO operation; the operation will be re-tried.
-static inline bool
-nonFatalError()
+bool
+XmlRpcSocket::nonFatalError()
 {
   int err = XmlRpcSocket::getError();
   return (err == EINPROGRESS || err == EAGAIN || err == EWOULDBLOCK || err == EINTR);
@@ -229,6 +230,49 @@ XmlRpcSocket::nbWrite(int fd, std::string& s, int *bytesSoFar)
 }
 
 
+// Write two buffers as one stream. Where writev is available both go out in
+// a single system call (and so usually a single segment).
+bool
+XmlRpcSocket::nbWrite(int fd, std::string const& s1, std::string const& s2, int *bytesSoFar)
+{
+  int len1 = int(s1.length());
+  int nToWrite = len1 + int(s2.length()) - *bytesSoFar;
+  bool wouldBlock = false;
+
+  while ( nToWrite > 0 && ! wouldBlock ) {
+#if defined(_WINDOWS)
+    int n = (*bytesSoFar < len1) ?
+      send(fd, s1.data() + *bytesSoFar, len1 - *bytesSoFar, 0) :
+      send(fd, s2.data() + (*bytesSoFar - len1), nToWrite, 0);
+#else
+    struct iovec iov[2];
+    int niov = 0;
+    if (*bytesSoFar < len1) {
+      iov[niov].iov_base = const_cast<char*>(s1.data()) + *bytesSoFar;
+      iov[niov++].iov_len = len1 - *bytesSoFar;
+      iov[niov].iov_base = const_cast<char*>(s2.data());
+      iov[niov++].iov_len = s2.length();
+    } else {
+      iov[niov].iov_base = const_cast<char*>(s2.data()) + (*bytesSoFar - len1);
+      iov[niov++].iov_len = nToWrite;
+    }
+    int n = int(writev(fd, iov, niov));
+#endif
+    XmlRpcUtil::log(5, "XmlRpcSocket::nbWrite: send/writev returned %d.", n);
+
+    if (n > 0) {
+      *bytesSoFar += n;
+      nToWrite -= n;
+    } else if (nonFatalError()) {
+      wouldBlock = true;
+    } else {
+      return false;   // Error
+    }
+  }
+  return true;
+}
+
+
 // Returns last errno
 int 
 XmlRpcSocket::getError()
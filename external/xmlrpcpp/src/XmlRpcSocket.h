@@ -33,6 +33,10 @@ namespace XmlRpc {
     //! Write text to the specified socket. Returns false on error.
     static bool nbWrite(int socket, std::string& s, int *bytesSoFar);
 
+    //! Write s1 followed by s2 to the specified socket, without copying them
+    //! into one buffer. bytesSoFar counts bytes of both. Returns false on error.
+    static bool nbWrite(int socket, std::string const& s1, std::string const& s2, int *bytesSoFar);
+
 
     // The next four methods are appropriate for servers.
 
@@ -57,6 +61,9 @@ namespace XmlRpc {
     //! Returns last errno
     static int getError();
 
+    //! Returns true if the last error just means the operation would block
+    static bool nonFatalError();
+
     //! Returns message corresponding to last error
     static std::string getErrorMsg();
 
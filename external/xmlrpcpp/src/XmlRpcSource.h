@@ -31,10 +31,17 @@ namespace XmlRpc {
     //! Specify whether the file descriptor should be kept open if it is no longer monitored.
     void setKeepOpen(bool b=true) { _keepOpen = b; }
 
+    //! Return whether readiness may be reported edge-triggered.
+    bool getEdgeTriggered() const { return _edgeTriggered; }
+    //! Specify whether readiness may be reported edge-triggered. Only for
+    //! sources whose handler reads or writes until the operation would
+    //! block; must be set before the source is added to a dispatcher.
+    void setEdgeTriggered(bool b=true) { _edgeTriggered = b; }
+
     //! Close the owned fd. If deleteOnClose was specified at construction, the object is deleted.
     virtual void close();
 
-    //! Return true to continue monitoring this source
+    //! Return true to continue monitoring this source.
     virtual unsigned handleEvent(unsigned eventType) = 0;
 
   private:
@@ -49,6 +56,9 @@ namespace XmlRpc {
 
     // In the client, keep connections open if you intend to make multiple calls.
     bool _keepOpen;
+
+    // Whether the handler drains the fd, so that epoll may report it edge-triggered
+    bool _edgeTriggered;
   };
 } // namespace XmlRpc
 
@@ -0,0 +1,395 @@
+
+#include "XmlRpcThreadPool.h"
+#include "XmlRpcServerConnection.h"
+#include "XmlRpcSocket.h"
+#include "XmlRpcUtil.h"
+
+#ifndef MAKEDEPEND
+# include <errno.h>
+# if ! defined(_WINDOWS)
+#  include <fcntl.h>
+#  include <unistd.h>
+# endif
+#endif
+
+using namespace XmlRpc;
+
+
+#if defined(XMLRPC_THREADS)
+
+XmlRpcMutex::XmlRpcMutex()  { pthread_mutex_init(&_mutex, 0); }
+XmlRpcMutex::~XmlRpcMutex() { pthread_mutex_destroy(&_mutex); }
+void XmlRpcMutex::acquire() { pthread_mutex_lock(&_mutex); }
+void XmlRpcMutex::release() { pthread_mutex_unlock(&_mutex); }
+
+#else
+
+XmlRpcMutex::XmlRpcMutex()  {}
+XmlRpcMutex::~XmlRpcMutex() {}
+void XmlRpcMutex::acquire() {}
+void XmlRpcMutex::release() {}
+
+#endif  // XMLRPC_THREADS
+
+
+XmlRpcDispatchMailbox::XmlRpcDispatchMailbox(XmlRpcDispatch* disp) :
+  XmlRpcSource(-1, false), _disp(disp), _writeFd(-1), _exit(false), _clear(false)
+{
+  setEdgeTriggered();   // handleEvent empties the pipe
+}
+
+
+XmlRpcDispatchMailbox::~XmlRpcDispatchMailbox()
+{
+  close();
+}
+
+
+// Create the wakeup pipe and start monitoring it
+bool
+XmlRpcDispatchMailbox::open()
+{
+#if defined(XMLRPC_THREADS)
+  int fds[2];
+  if (pipe(fds) != 0)
+  {
+    XmlRpcUtil::error("XmlRpcDispatchMailbox::open: Could not create pipe (%s).", XmlRpcSocket::getErrorMsg().c_str());
+    return false;
+  }
+
+  // Neither end may block: the dispatcher drains the pipe and a full pipe
+  // already guarantees a wakeup.
+  fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+  fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+  XmlRpcSocket::setNonBlocking(fds[0]);
+  XmlRpcSocket::setNonBlocking(fds[1]);
+
+  setfd(fds[0]);
+  _writeFd = fds[1];
+  setKeepOpen(true);
+  _disp->addSource(this, XmlRpcDispatch::ReadableEvent);
+  return true;
+#else
+  XmlRpcUtil::error("XmlRpcDispatchMailbox::open: threads are not supported.");
+  return false;
+#endif
+}
+
+
+void
+XmlRpcDispatchMailbox::close()
+{
+#if defined(XMLRPC_THREADS)
+  if (_writeFd != -1)
+  {
+    ::close(_writeFd);
+    _writeFd = -1;
+  }
+#endif
+  XmlRpcSource::close();
+}
+
+
+void
+XmlRpcDispatchMailbox::wakeup()
+{
+#if defined(XMLRPC_THREADS)
+  char c = 0;
+  while (write(_writeFd, &c, 1) < 0 && errno == EINTR)
+    ;
+#endif
+}
+
+
+// Queue a source to be (re)monitored by the dispatcher thread
+void
+XmlRpcDispatchMailbox::post(XmlRpcSource* src, unsigned eventMask)
+{
+  bool wasEmpty;
+  {
+    XmlRpcMutex::Lock lock(_lock);
+    wasEmpty = _posted.empty();
+    _posted.push_back(std::make_pair(src, eventMask));
+  }
+  // Only the first post since the last wakeup needs to write to the pipe
+  if (wasEmpty)
+    wakeup();
+}
+
+
+void
+XmlRpcDispatchMailbox::postExit()
+{
+  {
+    XmlRpcMutex::Lock lock(_lock);
+    _exit = true;
+  }
+  wakeup();
+}
+
+
+void
+XmlRpcDispatchMailbox::postClear()
+{
+  {
+    XmlRpcMutex::Lock lock(_lock);
+    _clear = true;
+  }
+  wakeup();
+}
+
+
+// Runs on the dispatcher thread: monitor the posted sources
+unsigned
+XmlRpcDispatchMailbox::handleEvent(unsigned /*eventType*/)
+{
+#if defined(XMLRPC_THREADS)
+  char buf[64];
+  while (read(getfd(), buf, sizeof(buf)) > 0)
+    ;
+#endif
+
+  PostList posted;
+  bool doExit, doClear;
+  {
+    XmlRpcMutex::Lock lock(_lock);
+    posted.swap(_posted);
+    doExit = _exit;
+    doClear = _clear;
+    _exit = _clear = false;
+  }
+
+  for (PostList::iterator it=posted.begin(); it!=posted.end(); ++it)
+    _disp->addSource(it->first, it->second);
+
+  if (doClear)
+    _disp->clear();
+  if (doExit)
+    _disp->exit();
+
+  return XmlRpcDispatch::ReadableEvent;
+}
+
+
+
+XmlRpcDispatchThread::XmlRpcDispatchThread() :
+  _mailbox(&_disp), _running(false)
+{
+}
+
+
+XmlRpcDispatchThread::~XmlRpcDispatchThread()
+{
+  stop();
+}
+
+
+bool
+XmlRpcDispatchThread::start()
+{
+#if defined(XMLRPC_THREADS)
+  if ( ! _mailbox.open())
+    return false;
+
+  if (pthread_create(&_thread, 0, run, this) != 0)
+  {
+    XmlRpcUtil::error("XmlRpcDispatchThread::start: Could not create thread.");
+    _disp.clear();
+    return false;
+  }
+  _running = true;
+  return true;
+#else
+  return false;
+#endif
+}
+
+
+// Close every source of the dispatcher (including the mailbox), which
+// makes the dispatcher return from work().
+void
+XmlRpcDispatchThread::stop()
+{
+#if defined(XMLRPC_THREADS)
+  if ( ! _running)
+    return;
+
+  _mailbox.postClear();
+  pthread_join(_thread, 0);
+  _running = false;
+#endif
+}
+
+
+#if defined(XMLRPC_THREADS)
+void*
+XmlRpcDispatchThread::run(void* arg)
+{
+  XmlRpcDispatchThread* t = (XmlRpcDispatchThread*) arg;
+  t->_disp.work(-1.0);
+  return 0;
+}
+#endif
+
+
+
+XmlRpcThreadPool::XmlRpcThreadPool() :
+  _maxQueued(0), _maxQueueDepth(0), _queueTime(0.0), _running(false)
+{
+#if defined(XMLRPC_THREADS)
+  pthread_cond_init(&_notEmpty, 0);
+  pthread_cond_init(&_notFull, 0);
+#endif
+}
+
+
+XmlRpcThreadPool::~XmlRpcThreadPool()
+{
+  stop();
+#if defined(XMLRPC_THREADS)
+  pthread_cond_destroy(&_notEmpty);
+  pthread_cond_destroy(&_notFull);
+#endif
+}
+
+
+bool
+XmlRpcThreadPool::start(int nWorkers, int maxQueued)
+{
+#if defined(XMLRPC_THREADS)
+  if (nWorkers <= 0)
+  {
+    XmlRpcUtil::error("XmlRpcThreadPool::start: need at least one worker (got %d).", nWorkers);
+    return false;
+  }
+
+  _maxQueued = (maxQueued > 0) ? maxQueued : 1;
+  _running = true;
+
+  for (int i=0; i<nWorkers; ++i)
+  {
+    pthread_t t;
+    if (pthread_create(&t, 0, run, this) != 0)
+    {
+      XmlRpcUtil::error("XmlRpcThreadPool::start: Could not create worker thread %d.", i);
+      stop();
+      return false;
+    }
+    _threads.push_back(t);
+  }
+  XmlRpcUtil::log(2, "XmlRpcThreadPool::start: %d workers, queue size %d", nWorkers, _maxQueued);
+  return true;
+#else
+  XmlRpcUtil::error("XmlRpcThreadPool::start: threads are not supported.");
+  return false;
+#endif
+}
+
+
+// Let the workers finish the queued requests, then wait for them to exit
+void
+XmlRpcThreadPool::stop()
+{
+#if defined(XMLRPC_THREADS)
+  _lock.acquire();
+  _running = false;
+  pthread_cond_broadcast(&_notEmpty);
+  pthread_cond_broadcast(&_notFull);
+  _lock.release();
+
+  for (unsigned i=0; i<_threads.size(); ++i)
+    pthread_join(_threads[i], 0);
+  _threads.clear();
+#endif
+}
+
+
+bool
+XmlRpcThreadPool::submit(XmlRpcServerConnection* connection)
+{
+#if defined(XMLRPC_THREADS)
+  XmlRpcMutex::Lock lock(_lock);
+
+  // Apply backpressure to the dispatcher when the workers fall behind
+  while (_running && int(_queue.size()) >= _maxQueued)
+    pthread_cond_wait(&_notFull, &_lock._mutex);
+
+  if ( ! _running)
+    return false;
+
+  _queue.push_back(Job(connection, XmlRpcUtil::getTime()));
+  if (int(_queue.size()) > _maxQueueDepth)
+    _maxQueueDepth = int(_queue.size());
+  pthread_cond_signal(&_notEmpty);
+  return true;
+#else
+  (void) connection;
+  return false;
+#endif
+}
+
+
+int
+XmlRpcThreadPool::getQueueDepth()
+{
+  XmlRpcMutex::Lock lock(_lock);
+  return int(_queue.size());
+}
+
+
+int
+XmlRpcThreadPool::getMaxQueueDepth()
+{
+  XmlRpcMutex::Lock lock(_lock);
+  return _maxQueueDepth;
+}
+
+
+double
+XmlRpcThreadPool::getQueueTime()
+{
+  XmlRpcMutex::Lock lock(_lock);
+  return _queueTime;
+}
+
+
+#if defined(XMLRPC_THREADS)
+void*
+XmlRpcThreadPool::run(void* arg)
+{
+  ((XmlRpcThreadPool*) arg)->work();
+  return 0;
+}
+#endif
+
+
+// Worker thread: execute queued requests and hand each connection back
+// to its dispatcher to write the response.
+void
+XmlRpcThreadPool::work()
+{
+#if defined(XMLRPC_THREADS)
+  for (;;)
+  {
+    _lock.acquire();
+    while (_running && _queue.empty())
+      pthread_cond_wait(&_notEmpty, &_lock._mutex);
+
+    if (_queue.empty())   // Stopped and drained
+    {
+      _lock.release();
+      return;
+    }
+
+    Job job = _queue.front();
+    _queue.pop_front();
+    _queueTime += XmlRpcUtil::getTime() - job._queued;
+    pthread_cond_signal(&_notFull);
+    _lock.release();
+
+    XmlRpcServerConnection* connection = job._connection;
+    connection->executeRequest();
+    connection->getMailbox()->post(connection, XmlRpcDispatch::WritableEvent);
+  }
+#endif
+}
@@ -0,0 +1,182 @@
+
+#ifndef _XMLRPCTHREADPOOL_H_
+#define _XMLRPCTHREADPOOL_H_
+//
+// XmlRpc++ Copyright (c) 2002-2003 by Chris Morley
+//
+#if defined(_MSC_VER)
+# pragma warning(disable:4786)    // identifier was truncated in debug info
+#endif
+
+// Threaded servers are supported where pthreads are available.
+#if ! defined(_WINDOWS) && ! defined(XMLRPC_NO_THREADS)
+# define XMLRPC_THREADS
+#endif
+
+#ifndef MAKEDEPEND
+# include <deque>
+# include <vector>
+# if defined(XMLRPC_THREADS)
+#  include <pthread.h>
+# endif
+#endif
+
+#include "XmlRpcDispatch.h"
+#include "XmlRpcSource.h"
+
+namespace XmlRpc {
+
+  class XmlRpcServer;
+  class XmlRpcServerConnection;
+
+  //! A mutex. Locking is a no-op where threads are not supported.
+  class XmlRpcMutex {
+  public:
+    XmlRpcMutex();
+    ~XmlRpcMutex();
+
+    void acquire();
+    void release();
+
+    //! Holds the mutex for the lifetime of the object
+    class Lock {
+    public:
+      Lock(XmlRpcMutex& m) : _m(m) { _m.acquire(); }
+      ~Lock() { _m.release(); }
+    private:
+      XmlRpcMutex& _m;
+    };
+
+  private:
+#if defined(XMLRPC_THREADS)
+    friend class XmlRpcThreadPool;
+    pthread_mutex_t _mutex;
+#endif
+  };
+
+
+  //! Lets other threads hand sources to a dispatcher. The mailbox is itself
+  //! a source monitored by the dispatcher; posting writes a byte to a pipe
+  //! so the dispatcher wakes up and (re)starts monitoring the posted sources
+  //! from its own thread.
+  class XmlRpcDispatchMailbox : public XmlRpcSource {
+  public:
+    //! Constructor
+    //!  @param disp The dispatcher to deliver posted sources to
+    XmlRpcDispatchMailbox(XmlRpcDispatch* disp);
+    virtual ~XmlRpcDispatchMailbox();
+
+    //! Create the wakeup pipe and add the mailbox to the dispatcher.
+    bool open();
+
+    //! Have the dispatcher monitor src for the events in eventMask. Thread safe.
+    void post(XmlRpcSource* src, unsigned eventMask);
+
+    //! Have the dispatcher return from work(). Thread safe.
+    void postExit();
+
+    //! Have the dispatcher close all of its sources. Thread safe.
+    void postClear();
+
+    //! The dispatcher the mailbox delivers to
+    XmlRpcDispatch* getDispatch() const { return _disp; }
+
+    // XmlRpcSource interface implementation
+    virtual unsigned handleEvent(unsigned eventType);
+    virtual void close();
+
+  protected:
+    void wakeup();
+
+    XmlRpcDispatch* _disp;
+
+    // Write end of the wakeup pipe (the read end is the source fd)
+    int _writeFd;
+
+    // Sources posted since the dispatcher last woke up
+    typedef std::vector< std::pair<XmlRpcSource*, unsigned> > PostList;
+    PostList _posted;
+    bool _exit;
+    bool _clear;
+    XmlRpcMutex _lock;
+  };
+
+
+  //! A thread running a dispatcher for a share of a server's connections
+  class XmlRpcDispatchThread {
+  public:
+    XmlRpcDispatchThread();
+    ~XmlRpcDispatchThread();
+
+    //! Start the thread. Returns false on failure.
+    bool start();
+
+    //! Close all connections owned by the thread and wait for it to exit.
+    void stop();
+
+    //! Mailbox for handing connections to this thread
+    XmlRpcDispatchMailbox* getMailbox() { return &_mailbox; }
+
+  protected:
+    XmlRpcDispatch _disp;
+    XmlRpcDispatchMailbox _mailbox;
+    bool _running;
+#if defined(XMLRPC_THREADS)
+    static void* run(void* arg);
+    pthread_t _thread;
+#endif
+  };
+
+
+  //! A bounded queue of requests executed by a pool of worker threads.
+  //! Completed connections are posted back to their dispatcher's mailbox.
+  class XmlRpcThreadPool {
+  public:
+    XmlRpcThreadPool();
+    ~XmlRpcThreadPool();
+
+    //! Start nWorkers (at least 1) threads. At most maxQueued requests wait for a
+    //! worker; submit() blocks while the queue is full.
+    bool start(int nWorkers, int maxQueued);
+
+    //! Execute the requests still queued and wait for the workers to exit.
+    void stop();
+
+    //! Queue a connection whose request has been read. Returns false if the
+    //! pool is not running, in which case the caller executes the request.
+    bool submit(XmlRpcServerConnection* connection);
+
+    //! Requests currently waiting for a worker
+    int getQueueDepth();
+    //! Largest number of requests that have waited for a worker
+    int getMaxQueueDepth();
+    //! Total time in seconds requests have waited for a worker
+    double getQueueTime();
+
+  protected:
+    void work();
+
+    struct Job {
+      Job(XmlRpcServerConnection* c, double t) : _connection(c), _queued(t) {}
+      XmlRpcServerConnection* _connection;
+      double _queued;
+    };
+    std::deque<Job> _queue;
+
+    int _maxQueued;
+    int _maxQueueDepth;
+    double _queueTime;
+    bool _running;
+
+#if defined(XMLRPC_THREADS)
+    static void* run(void* arg);
+    std::vector<pthread_t> _threads;
+    XmlRpcMutex _lock;
+    pthread_cond_t _notEmpty;
+    pthread_cond_t _notFull;
+#endif
+  };
+
+} // namespace XmlRpc
+
+#endif  // _XMLRPCTHREADPOOL_H_
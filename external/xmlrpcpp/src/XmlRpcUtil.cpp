@@ -9,6 +9,18 @@
 # include <string.h>
 #endif
 
+#if defined(_WINDOWS)
+# include <sys/timeb.h>
+
+# define USE_FTIME
+# if defined(_MSC_VER)
+#  define timeb _timeb
+#  define ftime _ftime
+# endif
+#else
+# include <sys/time.h>
+#endif  // _WINDOWS
+
 #include "XmlRpc.h"
 
 using namespace XmlRpc;
@@ -103,14 +115,21 @@ XmlRpcUtil::parseTag(const char* tag, std::string const& xml, int* offset)
   if (*offset >= int(xml.length())) return std::string();
   size_t istart = xml.find(tag, *offset);
   if (istart == std::string::npos) return std::string();
-  istart += strlen(tag);
-  std::string etag = "</";
-  etag += tag + 1;
-  size_t iend = xml.find(etag, istart);
-  if (iend == std::string::npos) return std::string();
-
-  *offset = int(iend + etag.length());
-  return xml.substr(istart, iend-istart);
+  size_t tagLen = strlen(tag);
+  istart += tagLen;
+
+  // Look for "</" + (tag+1) without building the end tag
+  size_t iend = istart;
+  for (;;) {
+    iend = xml.find(tag + 1, iend);
+    if (iend == std::string::npos) return std::string();
+    if (iend >= istart + 2 && xml[iend-1] == '/' && xml[iend-2] == '<')
+      break;
+    ++iend;
+  }
+
+  *offset = int(iend + tagLen - 1);
+  return xml.substr(istart, iend-2-istart);
 }
 
 
@@ -165,14 +184,11 @@ XmlRpcUtil::getNextTag(std::string const& xml, int* offset)
 
   if (*cp != '<') return std::string();
 
-  std::string s;
-  do {
-    s += *cp;
-    ++pos;
-  } while (*cp++ != '>' && *cp != 0);
+  const char* ep = strchr(cp, '>');
+  size_t len = ep ? (ep - cp + 1) : strlen(cp);
 
-  *offset = int(pos);
-  return s;
+  *offset = int(pos + len);
+  return std::string(cp, len);
 }
 
 
@@ -193,31 +209,43 @@ XmlRpcUtil::xmlDecode(const std::string& encoded)
   if (iAmp == std::string::npos)
     return encoded;
 
-  std::string decoded(encoded, 0, iAmp);
-  std::string::size_type iSize = encoded.size();
-  decoded.reserve(iSize);
-
-  const char* ens = encoded.c_str();
-  while (iAmp != iSize) {
-    if (encoded[iAmp] == AMP && iAmp+1 < iSize) {
-      int iEntity;
-      for (iEntity=0; xmlEntity[iEntity] != 0; ++iEntity)
-	//if (encoded.compare(iAmp+1, xmlEntLen[iEntity], xmlEntity[iEntity]) == 0)
-	if (strncmp(ens+iAmp+1, xmlEntity[iEntity], xmlEntLen[iEntity]) == 0)
-        {
-          decoded += rawEntity[iEntity];
-          iAmp += xmlEntLen[iEntity]+1;
-          break;
-        }
-      if (xmlEntity[iEntity] == 0)    // unrecognized sequence
-        decoded += encoded[iAmp++];
-
-    } else {
-      decoded += encoded[iAmp++];
+  std::string decoded;
+  xmlDecode(encoded.c_str(), int(encoded.size()), decoded);
+  return decoded;
+}
+
+
+// Decode len chars of encoded xml, appending the raw text to decoded.
+// Runs of text without entities are appended in one piece.
+
+void
+XmlRpcUtil::xmlDecode(const char* encoded, int len, std::string& decoded)
+{
+  const char* cp = encoded;
+  const char* ep = encoded + len;
+
+  decoded.reserve(decoded.size() + len);
+  while (cp < ep) {
+    const char* amp = (const char*) memchr(cp, AMP, ep - cp);
+    if (amp == 0) {
+      decoded.append(cp, ep - cp);
+      break;
     }
+    decoded.append(cp, amp - cp);
+    cp = amp + 1;
+
+    int iEntity;
+    for (iEntity=0; xmlEntity[iEntity] != 0; ++iEntity)
+      if (ep - cp >= xmlEntLen[iEntity] &&
+          strncmp(cp, xmlEntity[iEntity], xmlEntLen[iEntity]) == 0)
+      {
+        decoded += rawEntity[iEntity];
+        cp += xmlEntLen[iEntity];
+        break;
+      }
+    if (xmlEntity[iEntity] == 0)    // unrecognized sequence
+      decoded += AMP;
   }
-    
-  return decoded;
 }
 
 
@@ -226,28 +254,115 @@ XmlRpcUtil::xmlDecode(const std::string& encoded)
 std::string 
 XmlRpcUtil::xmlEncode(const std::string& raw)
 {
-  std::string::size_type iRep = raw.find_first_of(rawEntity);
-  if (iRep == std::string::npos)
+  if (raw.find_first_of(rawEntity) == std::string::npos)
     return raw;
 
-  std::string encoded(raw, 0, iRep);
-  std::string::size_type iSize = raw.size();
+  std::string encoded;
+  xmlEncode(raw, encoded);
+  return encoded;
+}
 
-  while (iRep != iSize) {
-    int iEntity;
-    for (iEntity=0; rawEntity[iEntity] != 0; ++iEntity)
-      if (raw[iRep] == rawEntity[iEntity])
-      {
-        encoded += AMP;
-        encoded += xmlEntity[iEntity];
-        break;
-      }
-    if (rawEntity[iEntity] == 0)
-      encoded += raw[iRep];
-    ++iRep;
+
+// Append raw text as xml, copying the runs between entities in one go.
+void
+XmlRpcUtil::xmlEncode(const std::string& raw, std::string& encoded)
+{
+  std::string::size_type iStart = 0;
+  std::string::size_type iRep = raw.find_first_of(rawEntity);
+  while (iRep != std::string::npos) {
+    encoded.append(raw, iStart, iRep - iStart);
+    encoded += AMP;
+    encoded += xmlEntity[strchr(rawEntity, raw[iRep]) - rawEntity];
+    iStart = iRep + 1;
+    iRep = raw.find_first_of(rawEntity, iStart);
   }
-  return encoded;
+  encoded.append(raw, iStart, std::string::npos);
+}
+
+
+void
+XmlRpcUtil::appendInt(std::string& s, int i)
+{
+  char buf[16];
+  char* cp = buf + sizeof(buf);
+  // Work with the magnitude as unsigned so INT_MIN does not overflow
+  unsigned u = (i < 0) ? 0u - unsigned(i) : unsigned(i);
+  do {
+    *--cp = char('0' + u % 10);
+    u /= 10;
+  } while (u != 0);
+  if (i < 0)
+    *--cp = '-';
+  s.append(cp, buf + sizeof(buf) - cp);
+}
+
+
+// Formats like "%f" (six decimals) without going through snprintf. The
+// integer and fraction parts are split exactly; fractions that land too
+// close to a rounding tie to be sure of the last digit, very large values
+// and nan/inf are left to snprintf so the output is always the same.
+void
+XmlRpcUtil::appendDouble(std::string& s, double d)
+{
+  bool negative = d < 0 || (d == 0 && 1/d < 0);
+  double a = negative ? -d : d;
+  unsigned long long ip = 0, fp = 0;
+  bool fast = a < 1.0e15;
+  if (fast)
+  {
+    ip = (unsigned long long) a;
+    double scaled = (a - double(ip)) * 1.0e6;
+    fp = (unsigned long long) scaled;
+    double rem = scaled - double(fp);
+    if (rem > 0.5 - 1.0e-6 && rem < 0.5 + 1.0e-6)
+      fast = false;
+    else if (rem > 0.5 && ++fp == 1000000)
+    {
+      fp = 0;
+      ++ip;
+    }
+  }
+
+  if ( ! fast)
+  {
+    char buf[512];
+    snprintf(buf, sizeof(buf)-1, "%f", d);
+    buf[sizeof(buf)-1] = 0;
+    s += buf;
+    return;
+  }
+
+  char buf[32];
+  char* cp = buf + sizeof(buf);
+  for (int digit=0; digit<6; ++digit, fp /= 10)
+    *--cp = char('0' + fp % 10);
+  *--cp = '.';
+  do {
+    *--cp = char('0' + ip % 10);
+    ip /= 10;
+  } while (ip != 0);
+  if (negative)
+    *--cp = '-';
+  s.append(cp, buf + sizeof(buf) - cp);
 }
 
 
 
+double
+XmlRpcUtil::getTime()
+{
+#ifdef USE_FTIME
+  struct timeb	tbuff;
+
+  ftime(&tbuff);
+  return ((double) tbuff.time + ((double)tbuff.millitm / 1000.0) +
+	  ((double) tbuff.timezone * 60));
+#else
+  struct timeval	tv;
+  struct timezone	tz;
+
+  gettimeofday(&tv, &tz);
+  return (tv.tv_sec + tv.tv_usec / 1000000.0);
+#endif /* USE_FTIME */
+}
+
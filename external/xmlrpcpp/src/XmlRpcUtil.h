@@ -45,9 +45,21 @@ namespace XmlRpc {
     //! Convert raw text to encoded xml.
     static std::string xmlEncode(const std::string& raw);
 
+    //! Convert raw text to encoded xml, appending it to encoded
+    static void xmlEncode(const std::string& raw, std::string& encoded);
+
+    //! Append the decimal representation of i
+    static void appendInt(std::string& s, int i);
+
+    //! Append d as formatted by "%f"
+    static void appendDouble(std::string& s, double d);
+
     //! Convert encoded xml to raw text
     static std::string xmlDecode(const std::string& encoded);
 
+    //! Convert len chars of encoded xml to raw text, appending it to decoded
+    static void xmlDecode(const char* encoded, int len, std::string& decoded);
+
 
     //! Dump messages somewhere
     static void log(int level, const char* fmt, ...);
@@ -55,6 +67,10 @@ namespace XmlRpc {
     //! Dump error messages somewhere
     static void error(const char* fmt, ...);
 
+
+    //! Returns the current time in seconds
+    static double getTime();
+
   };
 } // namespace XmlRpc
 
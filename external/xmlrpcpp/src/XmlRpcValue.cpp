@@ -5,10 +5,12 @@
 #include "base64.h"
 
 #ifndef MAKEDEPEND
+# include <ctype.h>
 # include <iostream>
 # include <ostream>
 # include <stdlib.h>
 # include <stdio.h>
+# include <string.h>
 #endif
 
 namespace XmlRpc {
@@ -54,15 +56,51 @@ namespace XmlRpc {
   void XmlRpcValue::invalidate()
   {
     switch (_type) {
-      case TypeString:    delete _value.asString; break;
+      case TypeString:    asString().~basic_string(); break;
       case TypeDateTime:  delete _value.asTime;   break;
-      case TypeBase64:    delete _value.asBinary; break;
-      case TypeArray:     delete _value.asArray;  break;
-      case TypeStruct:    delete _value.asStruct; break;
+      case TypeBase64:    asBinary().~BinaryData(); break;
+      case TypeArray:     asArray().~ValueArray();  break;
+      case TypeStruct:    asStruct().~ValueStruct(); break;
       default: break;
     }
     _type = TypeInvalid;
-    _value.asBinary = 0;
+    _value.asTime = 0;
+  }
+
+
+  // Take over the value of src without copying it. The strings and
+  // containers are swapped into freshly constructed empty ones, which
+  // does not allocate.
+  void XmlRpcValue::moveFrom(XmlRpcValue& src)
+  {
+    _type = src._type;
+    switch (_type) {
+      case TypeString:
+        new (_value.asStorage) std::string();
+        asString().swap(src.asString());
+        break;
+      case TypeBase64:
+        new (_value.asStorage) BinaryData();
+        asBinary().swap(src.asBinary());
+        break;
+      case TypeArray:
+        new (_value.asStorage) ValueArray();
+        asArray().swap(src.asArray());
+        break;
+      case TypeStruct:
+        new (_value.asStorage) ValueStruct();
+        asStruct().swap(src.asStruct());
+        break;
+      case TypeDateTime:
+        _value.asTime = src._value.asTime;
+        src._type = TypeInvalid;
+        src._value.asTime = 0;
+        return;
+      default:
+        _value = src._value;
+        return;
+    }
+    src.invalidate();
   }
 
   
@@ -73,12 +111,12 @@ namespace XmlRpc {
     {
       _type = t;
       switch (_type) {    // Ensure there is a valid value for the type
-        case TypeString:   _value.asString = new std::string(); break;
-        case TypeDateTime: _value.asTime = new struct tm();     break;
-        case TypeBase64:   _value.asBinary = new BinaryData();  break;
-        case TypeArray:    _value.asArray = new ValueArray();   break;
-        case TypeStruct:   _value.asStruct = new ValueStruct(); break;
-        default:           _value.asBinary = 0; break;
+        case TypeString:   new (_value.asStorage) std::string(); break;
+        case TypeDateTime: _value.asTime = new struct tm();      break;
+        case TypeBase64:   new (_value.asStorage) BinaryData();  break;
+        case TypeArray:    new (_value.asStorage) ValueArray();  break;
+        case TypeStruct:   new (_value.asStorage) ValueStruct(); break;
+        default:           _value.asTime = 0; break;
       }
     }
     else if (_type != t)
@@ -89,7 +127,7 @@ namespace XmlRpc {
   {
     if (_type != TypeArray)
       throw XmlRpcException("type error: expected an array");
-    else if (int(_value.asArray->size()) < size)
+    else if (int(asArray().size()) < size)
       throw XmlRpcException("range error: array index too large");
   }
 
@@ -98,10 +136,10 @@ namespace XmlRpc {
   {
     if (_type == TypeInvalid) {
       _type = TypeArray;
-      _value.asArray = new ValueArray(size);
+      new (_value.asStorage) ValueArray(size);
     } else if (_type == TypeArray) {
-      if (int(_value.asArray->size()) < size)
-        _value.asArray->resize(size);
+      if (int(asArray().size()) < size)
+        asArray().resize(size);
     } else
       throw XmlRpcException("type error: expected an array");
   }
@@ -110,12 +148,35 @@ namespace XmlRpc {
   {
     if (_type == TypeInvalid) {
       _type = TypeStruct;
-      _value.asStruct = new ValueStruct();
+      new (_value.asStorage) ValueStruct();
     } else if (_type != TypeStruct)
       throw XmlRpcException("type error: expected a struct");
   }
 
 
+  // Orders struct members by name
+  static bool memberLess(std::pair<std::string, XmlRpcValue> const& m, std::string const& name)
+  {
+    return m.first < name;
+  }
+
+  static bool memberNameLess(std::pair<std::string, XmlRpcValue> const& m1,
+                             std::pair<std::string, XmlRpcValue> const& m2)
+  {
+    return m1.first < m2.first;
+  }
+
+
+  XmlRpcValue& XmlRpcValue::member(std::string const& name)
+  {
+    ValueStruct& members = asStruct();
+    ValueStruct::iterator it = std::lower_bound(members.begin(), members.end(), name, memberLess);
+    if (it == members.end() || it->first != name)
+      it = members.insert(it, ValueStruct::value_type(name, XmlRpcValue()));
+    return it->second;
+  }
+
+
   // Operators
   XmlRpcValue& XmlRpcValue::operator=(XmlRpcValue const& rhs)
   {
@@ -128,11 +189,11 @@ namespace XmlRpc {
         case TypeInt:      _value.asInt = rhs._value.asInt; break;
         case TypeDouble:   _value.asDouble = rhs._value.asDouble; break;
         case TypeDateTime: _value.asTime = new struct tm(*rhs._value.asTime); break;
-        case TypeString:   _value.asString = new std::string(*rhs._value.asString); break;
-        case TypeBase64:   _value.asBinary = new BinaryData(*rhs._value.asBinary); break;
-        case TypeArray:    _value.asArray = new ValueArray(*rhs._value.asArray); break;
-        case TypeStruct:   _value.asStruct = new ValueStruct(*rhs._value.asStruct); break;
-        default:           _value.asBinary = 0; break;
+        case TypeString:   new (_value.asStorage) std::string(rhs.asString()); break;
+        case TypeBase64:   new (_value.asStorage) BinaryData(rhs.asBinary()); break;
+        case TypeArray:    new (_value.asStorage) ValueArray(rhs.asArray()); break;
+        case TypeStruct:   new (_value.asStorage) ValueStruct(rhs.asStruct()); break;
+        default:           _value.asTime = 0; break;
       }
     }
     return *this;
@@ -157,19 +218,19 @@ namespace XmlRpc {
       case TypeInt:      return _value.asInt == other._value.asInt;
       case TypeDouble:   return _value.asDouble == other._value.asDouble;
       case TypeDateTime: return tmEq(*_value.asTime, *other._value.asTime);
-      case TypeString:   return *_value.asString == *other._value.asString;
-      case TypeBase64:   return *_value.asBinary == *other._value.asBinary;
-      case TypeArray:    return *_value.asArray == *other._value.asArray;
+      case TypeString:   return asString() == other.asString();
+      case TypeBase64:   return asBinary() == other.asBinary();
+      case TypeArray:    return asArray() == other.asArray();
 
       // The map<>::operator== requires the definition of value< for kcc
-      case TypeStruct:   //return *_value.asStruct == *other._value.asStruct;
+      case TypeStruct:   //return asStruct() == other.asStruct();
         {
-          if (_value.asStruct->size() != other._value.asStruct->size())
+          if (asStruct().size() != other.asStruct().size())
             return false;
           
-          ValueStruct::const_iterator it1=_value.asStruct->begin();
-          ValueStruct::const_iterator it2=other._value.asStruct->begin();
-          while (it1 != _value.asStruct->end()) {
+          ValueStruct::const_iterator it1=asStruct().begin();
+          ValueStruct::const_iterator it2=other.asStruct().begin();
+          while (it1 != asStruct().end()) {
             const XmlRpcValue& v1 = it1->second;
             const XmlRpcValue& v2 = it2->second;
             if ( ! (v1 == v2))
@@ -194,10 +255,10 @@ namespace XmlRpc {
   int XmlRpcValue::size() const
   {
     switch (_type) {
-      case TypeString: return int(_value.asString->size());
-      case TypeBase64: return int(_value.asBinary->size());
-      case TypeArray:  return int(_value.asArray->size());
-      case TypeStruct: return int(_value.asStruct->size());
+      case TypeString: return int(asString().size());
+      case TypeBase64: return int(asBinary().size());
+      case TypeArray:  return int(asArray().size());
+      case TypeStruct: return int(asStruct().size());
       default: break;
     }
 
@@ -207,11 +268,22 @@ namespace XmlRpc {
   // Checks for existence of struct member
   bool XmlRpcValue::hasMember(const std::string& name) const
   {
-    return _type == TypeStruct && _value.asStruct->find(name) != _value.asStruct->end();
+    if (_type != TypeStruct)
+      return false;
+    ValueStruct const& members = asStruct();
+    ValueStruct::const_iterator it = std::lower_bound(members.begin(), members.end(), name, memberLess);
+    return it != members.end() && it->first == name;
+  }
+
+  // Returns true if the len chars at tag are exactly the tag name
+  static inline bool tagIs(const char* tag, int len, const char* name)
+  {
+    return strncmp(tag, name, len) == 0 && name[len] == 0;
   }
 
   // Set the value from xml. The chars at *offset into valueXml 
   // should be the start of a <value> tag. Destroys any existing value.
+  // The type tag is examined in place rather than copied out of the xml.
   bool XmlRpcValue::fromXml(std::string const& valueXml, int* offset)
   {
     int savedOffset = *offset;
@@ -220,29 +292,39 @@ namespace XmlRpc {
     if ( ! XmlRpcUtil::nextTagIs(VALUE_TAG, valueXml, offset))
       return false;       // Not a value, offset not updated
 
-	int afterValueOffset = *offset;
-    std::string typeTag = XmlRpcUtil::getNextTag(valueXml, offset);
+    int afterValueOffset = *offset;
+    const char* tag = valueXml.c_str() + *offset;
+    while (*tag && isspace(*tag))
+      ++tag;
+
+    int tagLen = 0;
+    if (*tag == '<') {
+      const char* ep = strchr(tag, '>');
+      tagLen = ep ? int(ep - tag + 1) : int(strlen(tag));
+      *offset = int(tag - valueXml.c_str()) + tagLen;
+    }
+
     bool result = false;
-    if (typeTag == NIL_TAG)
-      result = nilFromXml(valueXml, offset);
-    else if (typeTag == BOOLEAN_TAG)
-      result = boolFromXml(valueXml, offset);
-    else if (typeTag == I4_TAG || typeTag == INT_TAG)
+    if (tagLen == 0 || tagIs(tag, tagLen, STRING_TAG))
+      result = stringFromXml(valueXml, offset);
+    else if (tagIs(tag, tagLen, I4_TAG) || tagIs(tag, tagLen, INT_TAG))
       result = intFromXml(valueXml, offset);
-    else if (typeTag == DOUBLE_TAG)
+    else if (tagIs(tag, tagLen, STRUCT_TAG))
+      result = structFromXml(valueXml, offset);
+    else if (tagIs(tag, tagLen, ARRAY_TAG))
+      result = arrayFromXml(valueXml, offset);
+    else if (tagIs(tag, tagLen, DOUBLE_TAG))
       result = doubleFromXml(valueXml, offset);
-    else if (typeTag.empty() || typeTag == STRING_TAG)
-      result = stringFromXml(valueXml, offset);
-    else if (typeTag == DATETIME_TAG)
+    else if (tagIs(tag, tagLen, BOOLEAN_TAG))
+      result = boolFromXml(valueXml, offset);
+    else if (tagIs(tag, tagLen, NIL_TAG))
+      result = nilFromXml(valueXml, offset);
+    else if (tagIs(tag, tagLen, DATETIME_TAG))
       result = timeFromXml(valueXml, offset);
-    else if (typeTag == BASE64_TAG)
+    else if (tagIs(tag, tagLen, BASE64_TAG))
       result = binaryFromXml(valueXml, offset);
-    else if (typeTag == ARRAY_TAG)
-      result = arrayFromXml(valueXml, offset);
-    else if (typeTag == STRUCT_TAG)
-      result = structFromXml(valueXml, offset);
     // Watch for empty/blank strings with no <string>tag
-    else if (typeTag == VALUE_ETAG)
+    else if (tagIs(tag, tagLen, VALUE_ETAG))
     {
       *offset = afterValueOffset;   // back up & try again
       result = stringFromXml(valueXml, offset);
@@ -258,36 +340,43 @@ namespace XmlRpc {
 
   // Encode the Value in xml
   std::string XmlRpcValue::toXml() const
+  {
+    std::string xml;
+    toXml(xml);
+    return xml;
+  }
+
+  // Encode the Value in xml, appending to xml. Nested values are written
+  // straight into the same buffer rather than built up and concatenated.
+  void XmlRpcValue::toXml(std::string& xml) const
   {
     switch (_type) {
-      case TypeNil:      return nilToXml();
-      case TypeBoolean:  return boolToXml();
-      case TypeInt:      return intToXml();
-      case TypeDouble:   return doubleToXml();
-      case TypeString:   return stringToXml();
-      case TypeDateTime: return timeToXml();
-      case TypeBase64:   return binaryToXml();
-      case TypeArray:    return arrayToXml();
-      case TypeStruct:   return structToXml();
-      default: break;
+      case TypeNil:      nilToXml(xml); break;
+      case TypeBoolean:  boolToXml(xml); break;
+      case TypeInt:      intToXml(xml); break;
+      case TypeDouble:   doubleToXml(xml); break;
+      case TypeString:   stringToXml(xml); break;
+      case TypeDateTime: timeToXml(xml); break;
+      case TypeBase64:   binaryToXml(xml); break;
+      case TypeArray:    arrayToXml(xml); break;
+      case TypeStruct:   structToXml(xml); break;
+      default: break;     // Invalid value
     }
-    return std::string();   // Invalid value
   }
 
   // Nil
   bool XmlRpcValue::nilFromXml(std::string const& /* valueXml */, int* /* offset */)
   {
     _type = TypeNil;
-    _value.asBinary = 0;
+    _value.asTime = 0;
     return true;
   }
 
-  std::string XmlRpcValue::nilToXml() const
+  void XmlRpcValue::nilToXml(std::string& xml) const
   {
-    std::string xml = VALUE_TAG;
+    xml += VALUE_TAG;
     xml += NIL_TAG;
     xml += VALUE_ETAG;
-    return xml;
   }
 
   // Boolean
@@ -305,14 +394,13 @@ namespace XmlRpc {
     return true;
   }
 
-  std::string XmlRpcValue::boolToXml() const
+  void XmlRpcValue::boolToXml(std::string& xml) const
   {
-    std::string xml = VALUE_TAG;
+    xml += VALUE_TAG;
     xml += BOOLEAN_TAG;
-    xml += (_value.asBool ? "1" : "0");
+    xml += (_value.asBool ? '1' : '0');
     xml += BOOLEAN_ETAG;
     xml += VALUE_ETAG;
-    return xml;
   }
 
   // Int
@@ -330,17 +418,13 @@ namespace XmlRpc {
     return true;
   }
 
-  std::string XmlRpcValue::intToXml() const
+  void XmlRpcValue::intToXml(std::string& xml) const
   {
-    char buf[256];
-    snprintf(buf, sizeof(buf)-1, "%d", _value.asInt);
-    buf[sizeof(buf)-1] = 0;
-    std::string xml = VALUE_TAG;
+    xml += VALUE_TAG;
     xml += I4_TAG;
-    xml += buf;
+    XmlRpcUtil::appendInt(xml, _value.asInt);
     xml += I4_ETAG;
     xml += VALUE_ETAG;
-    return xml;
   }
 
   // Double
@@ -358,21 +442,27 @@ namespace XmlRpc {
     return true;
   }
 
-  std::string XmlRpcValue::doubleToXml() const
+  void XmlRpcValue::doubleToXml(std::string& xml) const
   {
-    char buf[256];
-    snprintf(buf, sizeof(buf)-1, getDoubleFormat().c_str(), _value.asDouble);
-    buf[sizeof(buf)-1] = 0;
-
-    std::string xml = VALUE_TAG;
+    xml += VALUE_TAG;
     xml += DOUBLE_TAG;
-    xml += buf;
+
+    // The default format has a fast path; custom formats use snprintf
+    if (_doubleFormat == "%f")
+      XmlRpcUtil::appendDouble(xml, _value.asDouble);
+    else
+    {
+      char buf[256];
+      snprintf(buf, sizeof(buf)-1, getDoubleFormat().c_str(), _value.asDouble);
+      buf[sizeof(buf)-1] = 0;
+      xml += buf;
+    }
+
     xml += DOUBLE_ETAG;
     xml += VALUE_ETAG;
-    return xml;
   }
 
-  // String
+  // String. Entities are decoded straight into the value.
   bool XmlRpcValue::stringFromXml(std::string const& valueXml, int* offset)
   {
     size_t valueEnd = valueXml.find('<', *offset);
@@ -380,19 +470,19 @@ namespace XmlRpc {
       return false;     // No end tag;
 
     _type = TypeString;
-    _value.asString = new std::string(XmlRpcUtil::xmlDecode(valueXml.substr(*offset, valueEnd-*offset)));
-    *offset += int(_value.asString->length());
+    new (_value.asStorage) std::string();
+    XmlRpcUtil::xmlDecode(valueXml.c_str() + *offset, int(valueEnd - *offset), asString());
+    *offset = int(valueEnd);
     return true;
   }
 
-  std::string XmlRpcValue::stringToXml() const
+  void XmlRpcValue::stringToXml(std::string& xml) const
   {
-    std::string xml = VALUE_TAG;
+    xml += VALUE_TAG;
     //xml += STRING_TAG; optional
-    xml += XmlRpcUtil::xmlEncode(*_value.asString);
+    XmlRpcUtil::xmlEncode(asString(), xml);
     //xml += STRING_ETAG;
     xml += VALUE_ETAG;
-    return xml;
   }
 
   // DateTime (stored as a struct tm)
@@ -402,20 +492,19 @@ namespace XmlRpc {
     if (valueEnd == std::string::npos)
       return false;     // No end tag;
 
-    std::string stime = valueXml.substr(*offset, valueEnd-*offset);
-
+    // The conversions stop at the end tag, so scan the xml directly
     struct tm t;
-    if (sscanf(stime.c_str(),"%4d%2d%2dT%2d:%2d:%2d",&t.tm_year,&t.tm_mon,&t.tm_mday,&t.tm_hour,&t.tm_min,&t.tm_sec) != 6)
+    if (sscanf(valueXml.c_str() + *offset,"%4d%2d%2dT%2d:%2d:%2d",&t.tm_year,&t.tm_mon,&t.tm_mday,&t.tm_hour,&t.tm_min,&t.tm_sec) != 6)
       return false;
 
     t.tm_isdst = -1;
     _type = TypeDateTime;
     _value.asTime = new struct tm(t);
-    *offset += int(stime.length());
+    *offset = int(valueEnd);
     return true;
   }
 
-  std::string XmlRpcValue::timeToXml() const
+  void XmlRpcValue::timeToXml(std::string& xml) const
   {
     struct tm* t = _value.asTime;
     char buf[20];
@@ -423,12 +512,11 @@ namespace XmlRpc {
       t->tm_year,t->tm_mon,t->tm_mday,t->tm_hour,t->tm_min,t->tm_sec);
     buf[sizeof(buf)-1] = 0;
 
-    std::string xml = VALUE_TAG;
+    xml += VALUE_TAG;
     xml += DATETIME_TAG;
     xml += buf;
     xml += DATETIME_ETAG;
     xml += VALUE_ETAG;
-    return xml;
   }
 
 
@@ -440,37 +528,34 @@ namespace XmlRpc {
       return false;     // No end tag;
 
     _type = TypeBase64;
-    std::string asString = valueXml.substr(*offset, valueEnd-*offset);
-    _value.asBinary = new BinaryData();
+    new (_value.asStorage) BinaryData();
+    asBinary().reserve((valueEnd - *offset) / 4 * 3);
     // check whether base64 encodings can contain chars xml encodes...
 
-    // convert from base64 to binary
+    // convert from base64 to binary, straight from the xml
     int iostatus = 0;
 	  base64<char> decoder;
-    std::back_insert_iterator<BinaryData> ins = std::back_inserter(*(_value.asBinary));
-		decoder.get(asString.begin(), asString.end(), ins, iostatus);
+    std::back_insert_iterator<BinaryData> ins = std::back_inserter(asBinary());
+		decoder.get(valueXml.begin() + *offset, valueXml.begin() + valueEnd, ins, iostatus);
 
-    *offset += int(asString.length());
+    *offset = int(valueEnd);
     return true;
   }
 
 
-  std::string XmlRpcValue::binaryToXml() const
+  void XmlRpcValue::binaryToXml(std::string& xml) const
   {
-    // convert to base64
-    std::vector<char> base64data;
+    xml += VALUE_TAG;
+    xml += BASE64_TAG;
+
+    // convert to base64, straight into the xml
     int iostatus = 0;
 	  base64<char> encoder;
-    std::back_insert_iterator<std::vector<char> > ins = std::back_inserter(base64data);
-		encoder.put(_value.asBinary->begin(), _value.asBinary->end(), ins, iostatus, base64<>::crlf());
+    std::back_insert_iterator<std::string> ins = std::back_inserter(xml);
+		encoder.put(asBinary().begin(), asBinary().end(), ins, iostatus, base64<>::crlf());
 
-    // Wrap with xml
-    std::string xml = VALUE_TAG;
-    xml += BASE64_TAG;
-    xml.append(base64data.begin(), base64data.end());
     xml += BASE64_ETAG;
     xml += VALUE_ETAG;
-    return xml;
   }
 
 
@@ -481,10 +566,27 @@ namespace XmlRpc {
       return false;
 
     _type = TypeArray;
-    _value.asArray = new ValueArray;
-    XmlRpcValue v;
-    while (v.fromXml(valueXml, offset))
-      _value.asArray->push_back(v);       // copy...
+    new (_value.asStorage) ValueArray;
+
+    // Parse each element in place rather than copying it into the array,
+    // and grow the array by swapping so parsed elements are never copied.
+    ValueArray* a = &asArray();
+    for (;;) {
+      if (a->size() == a->capacity()) {
+        ValueArray grown;
+        grown.reserve(2 * a->size() + 4);
+        grown.resize(a->size());
+        for (size_t i=0; i<a->size(); ++i)
+          grown[i].swap((*a)[i]);
+        a->swap(grown);
+      }
+
+      a->push_back(XmlRpcValue());
+      if ( ! a->back().fromXml(valueXml, offset)) {
+        a->pop_back();
+        break;
+      }
+    }
 
     // Skip the trailing </data>
     (void) XmlRpcUtil::nextTagIs(DATA_ETAG, valueXml, offset);
@@ -494,67 +596,93 @@ namespace XmlRpc {
 
   // In general, its preferable to generate the xml of each element of the
   // array as it is needed rather than glomming up one big string.
-  std::string XmlRpcValue::arrayToXml() const
+  void XmlRpcValue::arrayToXml(std::string& xml) const
   {
-    std::string xml = VALUE_TAG;
+    xml += VALUE_TAG;
     xml += ARRAY_TAG;
     xml += DATA_TAG;
 
-    int s = int(_value.asArray->size());
+    int s = int(asArray().size());
     for (int i=0; i<s; ++i)
-       xml += _value.asArray->at(i).toXml();
+       asArray()[i].toXml(xml);
 
     xml += DATA_ETAG;
     xml += ARRAY_ETAG;
     xml += VALUE_ETAG;
-    return xml;
   }
 
 
-  // Struct
+  // Struct. Members are appended as they are parsed and sorted once at the end.
   bool XmlRpcValue::structFromXml(std::string const& valueXml, int* offset)
   {
     _type = TypeStruct;
-    _value.asStruct = new ValueStruct;
+    new (_value.asStorage) ValueStruct;
 
+    ValueStruct* members = &asStruct();
+    bool sorted = true;
     while (XmlRpcUtil::nextTagIs(MEMBER_TAG, valueXml, offset)) {
+      // Grow by swapping so parsed members are never copied
+      if (members->size() == members->capacity()) {
+        ValueStruct grown;
+        grown.reserve(2 * members->size() + 4);
+        grown.resize(members->size());
+        for (size_t i=0; i<members->size(); ++i) {
+          grown[i].first.swap((*members)[i].first);
+          grown[i].second.swap((*members)[i].second);
+        }
+        members->swap(grown);
+      }
+
       // name
-      const std::string name = XmlRpcUtil::parseTag(NAME_TAG, valueXml, offset);
-      // value
-      XmlRpcValue val(valueXml, offset);
-      if ( ! val.valid()) {
+      members->push_back(ValueStruct::value_type());
+      ValueStruct::value_type& m = members->back();
+      m.first = XmlRpcUtil::xmlDecode(XmlRpcUtil::parseTag(NAME_TAG, valueXml, offset));
+      if (members->size() > 1 && ! ((*members)[members->size()-2].first < m.first))
+        sorted = false;
+
+      // value, parsed in place
+      if ( ! m.second.fromXml(valueXml, offset)) {
         invalidate();
         return false;
       }
-      const std::pair<const std::string, XmlRpcValue> p(name, val);
-      _value.asStruct->insert(p);
 
       (void) XmlRpcUtil::nextTagIs(MEMBER_ETAG, valueXml, offset);
     }
+
+    // The first of duplicate members is kept
+    if ( ! sorted) {
+      std::stable_sort(members->begin(), members->end(), memberNameLess);
+      ValueStruct::iterator last = members->begin();
+      for (ValueStruct::iterator it=members->begin()+1; it!=members->end(); ++it)
+        if (it->first != last->first && ++last != it) {
+          last->first.swap(it->first);
+          last->second.swap(it->second);
+        }
+      members->erase(last + 1, members->end());
+    }
     return true;
   }
 
 
   // In general, its preferable to generate the xml of each element
   // as it is needed rather than glomming up one big string.
-  std::string XmlRpcValue::structToXml() const
+  void XmlRpcValue::structToXml(std::string& xml) const
   {
-    std::string xml = VALUE_TAG;
+    xml += VALUE_TAG;
     xml += STRUCT_TAG;
 
     ValueStruct::const_iterator it;
-    for (it=_value.asStruct->begin(); it!=_value.asStruct->end(); ++it) {
+    for (it=asStruct().begin(); it!=asStruct().end(); ++it) {
       xml += MEMBER_TAG;
       xml += NAME_TAG;
-      xml += XmlRpcUtil::xmlEncode(it->first);
+      XmlRpcUtil::xmlEncode(it->first, xml);
       xml += NAME_ETAG;
-      xml += it->second.toXml();
+      it->second.toXml(xml);
       xml += MEMBER_ETAG;
     }
 
     xml += STRUCT_ETAG;
     xml += VALUE_ETAG;
-    return xml;
   }
 
 
@@ -566,7 +694,7 @@ namespace XmlRpc {
       case TypeBoolean:  os << _value.asBool; break;
       case TypeInt:      os << _value.asInt; break;
       case TypeDouble:   os << _value.asDouble; break;
-      case TypeString:   os << *_value.asString; break;
+      case TypeString:   os << asString(); break;
       case TypeDateTime:
         {
           struct tm* t = _value.asTime;
@@ -582,17 +710,17 @@ namespace XmlRpc {
           int iostatus = 0;
           std::ostreambuf_iterator<char> out(os);
           base64<char> encoder;
-          encoder.put(_value.asBinary->begin(), _value.asBinary->end(), out, iostatus, base64<>::crlf());
+          encoder.put(asBinary().begin(), asBinary().end(), out, iostatus, base64<>::crlf());
           break;
         }
       case TypeArray:
         {
-          int s = int(_value.asArray->size());
+          int s = int(asArray().size());
           os << '{';
           for (int i=0; i<s; ++i)
           {
             if (i > 0) os << ',';
-            _value.asArray->at(i).write(os);
+            asArray()[i].write(os);
           }
           os << '}';
           break;
@@ -601,9 +729,9 @@ namespace XmlRpc {
         {
           os << '[';
           ValueStruct::const_iterator it;
-          for (it=_value.asStruct->begin(); it!=_value.asStruct->end(); ++it)
+          for (it=asStruct().begin(); it!=asStruct().end(); ++it)
           {
-            if (it!=_value.asStruct->begin()) os << ',';
+            if (it!=asStruct().begin()) os << ',';
             os << it->first << ':';
             it->second.write(os);
           }
@@ -9,7 +9,8 @@
 #endif
 
 #ifndef MAKEDEPEND
-# include <map>
+# include <algorithm>
+# include <new>
 # include <string>
 # include <vector>
 # include <time.h>
@@ -36,23 +37,25 @@ namespace XmlRpc {
       TypeNil
     };
 
-    // Non-primitive types
+    // Non-primitive types. Struct members are kept in a vector sorted by
+    // name; adding a member may move the others, so references to members
+    // are only good until the next member is added.
     typedef std::vector<char> BinaryData;
     typedef std::vector<XmlRpcValue> ValueArray;
-    typedef std::map<std::string, XmlRpcValue> ValueStruct;
+    typedef std::vector< std::pair<std::string, XmlRpcValue> > ValueStruct;
 
 
     //! Constructors
-    XmlRpcValue() : _type(TypeInvalid) { _value.asBinary = 0; }
+    XmlRpcValue() : _type(TypeInvalid) { _value.asTime = 0; }
     XmlRpcValue(bool value) : _type(TypeBoolean) { _value.asBool = value; }
     XmlRpcValue(int value)  : _type(TypeInt) { _value.asInt = value; }
     XmlRpcValue(double value)  : _type(TypeDouble) { _value.asDouble = value; }
 
     XmlRpcValue(std::string const& value) : _type(TypeString) 
-    { _value.asString = new std::string(value); }
+    { new (_value.asStorage) std::string(value); }
 
     XmlRpcValue(const char* value)  : _type(TypeString)
-    { _value.asString = new std::string(value); }
+    { new (_value.asStorage) std::string(value); }
 
     XmlRpcValue(struct tm* value)  : _type(TypeDateTime) 
     { _value.asTime = new struct tm(*value); }
@@ -60,7 +63,7 @@ namespace XmlRpc {
 
     XmlRpcValue(void* value, int nBytes)  : _type(TypeBase64)
     {
-      _value.asBinary = new BinaryData((char*)value, ((char*)value)+nBytes);
+      new (_value.asStorage) BinaryData((char*)value, ((char*)value)+nBytes);
     }
 
     //! Construct from xml, beginning at *offset chars into the string, updates offset
@@ -70,12 +73,28 @@ namespace XmlRpc {
     //! Copy
     XmlRpcValue(XmlRpcValue const& rhs) : _type(TypeInvalid) { *this = rhs; }
 
+#if __cplusplus >= 201103L
+    //! Move. rhs is left invalid.
+    XmlRpcValue(XmlRpcValue&& rhs) noexcept : _type(TypeInvalid) { moveFrom(rhs); }
+    XmlRpcValue& operator=(XmlRpcValue&& rhs) noexcept
+    { if (this != &rhs) { invalidate(); moveFrom(rhs); } return *this; }
+#endif
+
     //! Destructor (make virtual if you want to subclass)
     /*virtual*/ ~XmlRpcValue() { invalidate(); }
 
     //! Erase the current value
     void clear() { invalidate(); }
 
+    //! Exchange values with another XmlRpcValue without copying either
+    void swap(XmlRpcValue& other)
+    {
+      XmlRpcValue tmp;
+      tmp.moveFrom(*this);
+      moveFrom(other);
+      other.moveFrom(tmp);
+    }
+
     // Operators
     XmlRpcValue& operator=(XmlRpcValue const& rhs);
     XmlRpcValue& operator=(int const& rhs) { return operator=(XmlRpcValue(rhs)); }
@@ -88,15 +107,15 @@ namespace XmlRpc {
     operator bool&()          { assertTypeOrInvalid(TypeBoolean); return _value.asBool; }
     operator int&()           { assertTypeOrInvalid(TypeInt); return _value.asInt; }
     operator double&()        { assertTypeOrInvalid(TypeDouble); return _value.asDouble; }
-    operator std::string&()   { assertTypeOrInvalid(TypeString); return *_value.asString; }
-    operator BinaryData&()    { assertTypeOrInvalid(TypeBase64); return *_value.asBinary; }
+    operator std::string&()   { assertTypeOrInvalid(TypeString); return asString(); }
+    operator BinaryData&()    { assertTypeOrInvalid(TypeBase64); return asBinary(); }
     operator struct tm&()     { assertTypeOrInvalid(TypeDateTime); return *_value.asTime; }
 
-    XmlRpcValue const& operator[](int i) const { assertArray(i+1); return _value.asArray->at(i); }
-    XmlRpcValue& operator[](int i)             { assertArray(i+1); return _value.asArray->at(i); }
+    XmlRpcValue const& operator[](int i) const { assertArray(i+1); return asArray()[i]; }
+    XmlRpcValue& operator[](int i)             { assertArray(i+1); return asArray()[i]; }
 
-    XmlRpcValue& operator[](std::string const& k) { assertStruct(); return (*_value.asStruct)[k]; }
-    XmlRpcValue& operator[](const char* k) { assertStruct(); std::string s(k); return (*_value.asStruct)[s]; }
+    XmlRpcValue& operator[](std::string const& k) { assertStruct(); return member(k); }
+    XmlRpcValue& operator[](const char* k) { assertStruct(); return member(std::string(k)); }
 
     // Accessors
     //! Return true if the value has been set to something.
@@ -120,6 +139,9 @@ namespace XmlRpc {
     //! Encode the Value in xml
     std::string toXml() const;
 
+    //! Encode the Value in xml, appending it to xml
+    void toXml(std::string& xml) const;
+
     //! Write the value (no xml encoding)
     std::ostream& write(std::ostream& os) const;
 
@@ -137,6 +159,22 @@ namespace XmlRpc {
     // Clean up
     void invalidate();
 
+    // Take over the value of src, which is left invalid. This must be invalid.
+    void moveFrom(XmlRpcValue& src);
+
+    // Strings, binary data, arrays and structs live in _value.asStorage
+    std::string& asString()             { return *reinterpret_cast<std::string*>(_value.asStorage); }
+    std::string const& asString() const { return *reinterpret_cast<std::string const*>(_value.asStorage); }
+    BinaryData& asBinary()              { return *reinterpret_cast<BinaryData*>(_value.asStorage); }
+    BinaryData const& asBinary() const  { return *reinterpret_cast<BinaryData const*>(_value.asStorage); }
+    ValueArray& asArray()               { return *reinterpret_cast<ValueArray*>(_value.asStorage); }
+    ValueArray const& asArray() const   { return *reinterpret_cast<ValueArray const*>(_value.asStorage); }
+    ValueStruct& asStruct()             { return *reinterpret_cast<ValueStruct*>(_value.asStorage); }
+    ValueStruct const& asStruct() const { return *reinterpret_cast<ValueStruct const*>(_value.asStorage); }
+
+    // Find a struct member, adding it if it does not exist
+    XmlRpcValue& member(std::string const& name);
+
     // Type checking
     void assertTypeOrInvalid(Type t);
     void assertArray(int size) const;
@@ -154,16 +192,16 @@ namespace XmlRpc {
     bool arrayFromXml(std::string const& valueXml, int* offset);
     bool structFromXml(std::string const& valueXml, int* offset);
 
-    // XML encoding
-    std::string nilToXml() const;
-    std::string boolToXml() const;
-    std::string intToXml() const;
-    std::string doubleToXml() const;
-    std::string stringToXml() const;
-    std::string timeToXml() const;
-    std::string binaryToXml() const;
-    std::string arrayToXml() const;
-    std::string structToXml() const;
+    // XML encoding, appending to xml
+    void nilToXml(std::string& xml) const;
+    void boolToXml(std::string& xml) const;
+    void intToXml(std::string& xml) const;
+    void doubleToXml(std::string& xml) const;
+    void stringToXml(std::string& xml) const;
+    void timeToXml(std::string& xml) const;
+    void binaryToXml(std::string& xml) const;
+    void arrayToXml(std::string& xml) const;
+    void structToXml(std::string& xml) const;
 
     // Format strings
     static std::string _doubleFormat;
@@ -171,17 +209,17 @@ namespace XmlRpc {
     // Type tag and values
     Type _type;
 
-    // At some point I will split off Arrays and Structs into
-    // separate ref-counted objects for more efficient copying.
+    // Strings and containers are constructed in place in asStorage rather
+    // than allocated separately, so a value costs no allocation beyond the
+    // string's or container's own buffer (none for short strings). All
+    // vectors have the same size, whatever they hold.
     union {
       bool          asBool;
       int           asInt;
       double        asDouble;
       struct tm*    asTime;
-      std::string*  asString;
-      BinaryData*   asBinary;
-      ValueArray*   asArray;
-      ValueStruct*  asStruct;
+      char          asStorage[sizeof(std::string) > sizeof(BinaryData) ?
+                              sizeof(std::string) : sizeof(BinaryData)];
     } _value;
     
   };
@@ -29,4 +29,46 @@ LOCAL_SRC_FILES := \
     $(xmlrpc_test_files:$(LOCAL_PATH)/%=%)
 include $(BUILD_EXECUTABLE)
 
+include $(CLEAR_VARS)
+LOCAL_MODULE := libxmlrpc++-tests-asyncclient
+
+LOCAL_CLANG := true
+LOCAL_RTTI_FLAG := -frtti
+LOCAL_CPPFLAGS := -Wall -fexceptions
+LOCAL_C_INCLUDES = $(LOCAL_PATH)/../src
+LOCAL_SHARED_LIBRARIES := libxmlrpc++
+
+xmlrpc_test_files := $(LOCAL_PATH)/AsyncClient.cpp
+LOCAL_SRC_FILES := \
+    $(xmlrpc_test_files:$(LOCAL_PATH)/%=%)
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := libxmlrpc++-tests-loadclient
+
+LOCAL_CLANG := true
+LOCAL_RTTI_FLAG := -frtti
+LOCAL_CPPFLAGS := -Wall -fexceptions
+LOCAL_C_INCLUDES = $(LOCAL_PATH)/../src
+LOCAL_SHARED_LIBRARIES := libxmlrpc++
+
+xmlrpc_test_files := $(LOCAL_PATH)/LoadClient.cpp
+LOCAL_SRC_FILES := \
+    $(xmlrpc_test_files:$(LOCAL_PATH)/%=%)
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := libxmlrpc++-tests-threadedserver
+
+LOCAL_CLANG := true
+LOCAL_RTTI_FLAG := -frtti
+LOCAL_CPPFLAGS := -Wall -fexceptions
+LOCAL_C_INCLUDES = $(LOCAL_PATH)/../src
+LOCAL_SHARED_LIBRARIES := libxmlrpc++
+
+xmlrpc_test_files := $(LOCAL_PATH)/ThreadedServer.cpp
+LOCAL_SRC_FILES := \
+    $(xmlrpc_test_files:$(LOCAL_PATH)/%=%)
+include $(BUILD_EXECUTABLE)
+
 endif # HOST_OS == linux
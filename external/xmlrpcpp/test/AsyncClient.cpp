@@ -0,0 +1,73 @@
+// AsyncClient.cpp : Issues nCalls asynchronous Sum calls through a client
+// connection pool and checks every result. Calls queued behind a busy
+// connection are batched into system.multicall requests of up to maxBatch
+// calls (1 sends each call on its own).
+// Usage: AsyncClient serverHost serverPort nCalls [maxConnections [maxBatch]]
+#include "XmlRpc.h"
+
+#include <iostream>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace XmlRpc;
+
+
+static int nDone = 0;
+static int nErrors = 0;
+
+
+// Checks the result of one Sum call
+class SumCallback : public XmlRpcCallback {
+public:
+  SumCallback() : _expected(0.0) {}
+
+  void complete(bool ok, bool isFault, XmlRpcValue& result)
+  {
+    ++nDone;
+    if ( ! ok || isFault || result.getType() != XmlRpcValue::TypeDouble ||
+         double(result) != _expected) {
+      if (nErrors++ < 5)
+        std::cerr << "Call for " << _expected << " failed: " << result << "\n";
+    }
+  }
+
+  double _expected;
+};
+
+
+int main(int argc, char* argv[])
+{
+  if (argc < 4 || argc > 6) {
+    std::cerr << "Usage: AsyncClient serverHost serverPort nCalls [maxConnections [maxBatch]]\n";
+    return -1;
+  }
+  const char* host = argv[1];
+  int port = atoi(argv[2]);
+  int nCalls = atoi(argv[3]);
+  int maxConnections = (argc > 4) ? atoi(argv[4]) : 1;
+  int maxBatch = (argc > 5) ? atoi(argv[5]) : 32;
+
+  XmlRpcDispatch disp;
+  XmlRpcClientPool pool(&disp, maxConnections);
+  pool.setMaxBatch(maxBatch);
+
+  std::vector<SumCallback> callbacks(nCalls);
+  double start = XmlRpcUtil::getTime();
+  for (int i=0; i<nCalls; ++i) {
+    XmlRpcValue args;
+    args[0] = double(i);
+    args[1] = 1.0;
+    callbacks[i]._expected = i + 1.0;
+    if ( ! pool.executeAsync(host, port, "Sum", args, &callbacks[i]))
+      std::cerr << "Could not queue call " << i << "\n";
+  }
+
+  // Runs until every call has completed
+  disp.work(-1.0);
+  double elapsed = XmlRpcUtil::getTime() - start;
+
+  printf("%d calls completed in %.3f s (%.0f calls/s), %d errors, %d pending\n",
+         nDone, elapsed, nDone / elapsed, nErrors, pool.getPendingCalls());
+  return (nDone == nCalls && nErrors == 0) ? 0 : 1;
+}
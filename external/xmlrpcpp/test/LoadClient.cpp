@@ -0,0 +1,164 @@
+// LoadClient.cpp : Load test for an xmlrpc server. Opens nConnections concurrent
+// keep-alive connections, has each one call methodName (with no arguments)
+// back to back, and reports the aggregate request rate once a second.
+// Usage: LoadClient serverHost serverPort nConnections seconds [methodName]
+//
+// Thousands of connections need a matching open file limit (ulimit -n) and a
+// server listening with a large backlog.
+#include "XmlRpc.h"
+#include "XmlRpcSocket.h"
+
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace XmlRpc;
+
+// Totals across all connections
+static long nRequests = 0;
+static long nErrors = 0;
+static int nOpen = 0;
+
+
+// A single connection issuing requests one after another
+class LoadConnection : public XmlRpcSource {
+public:
+  LoadConnection(int fd, std::string& request) :
+    XmlRpcSource(fd, true), _request(request), _bytesWritten(0), _writing(true)
+  {
+    ++nOpen;
+  }
+
+  ~LoadConnection() { --nOpen; }
+
+  unsigned handleEvent(unsigned /*eventType*/)
+  {
+    for (;;) {
+      if (_writing) {
+        if ( ! XmlRpcSocket::nbWrite(getfd(), _request, &_bytesWritten)) {
+          ++nErrors;
+          return 0;
+        }
+        if (_bytesWritten < int(_request.length()))
+          return XmlRpcDispatch::WritableEvent;
+        _writing = false;
+        _response = "";
+      }
+
+      bool eof;
+      if ( ! XmlRpcSocket::nbRead(getfd(), _response, &eof) || eof) {
+        ++nErrors;
+        return 0;
+      }
+      if ( ! responseComplete())
+        return XmlRpcDispatch::ReadableEvent;
+
+      // Got the whole response, send the next request right away
+      ++nRequests;
+      _writing = true;
+      _bytesWritten = 0;
+    }
+  }
+
+private:
+  bool responseComplete()
+  {
+    std::string::size_type bp = _response.find("\r\n\r\n");
+    if (bp == std::string::npos)
+      return false;
+
+    const char *lp = strstr(_response.c_str(), "Content-length: ");
+    if (lp == 0)
+      return false;
+
+    int contentLength = atoi(lp + 16);
+    return int(_response.length() - (bp + 4)) >= contentLength;
+  }
+
+  std::string& _request;     // Shared by all connections
+  std::string _response;
+  int _bytesWritten;
+  bool _writing;
+};
+
+
+// Reports progress once a second and stops the test when time is up
+class Reporter : public XmlRpcSource {
+public:
+  Reporter(XmlRpcDispatch& disp, int seconds) :
+    _disp(disp), _seconds(seconds), _elapsed(0), _lastRequests(0) {}
+
+  unsigned handleEvent(unsigned /*eventType*/)
+  {
+    ++_elapsed;
+    printf("%3d s: %8ld req/s, %d connections, %ld errors\n",
+           _elapsed, nRequests - _lastRequests, nOpen, nErrors);
+    fflush(stdout);
+    _lastRequests = nRequests;
+
+    if (_elapsed < _seconds)
+      return TIMER_REARM;
+
+    _disp.clear();
+    return 0;
+  }
+
+private:
+  static const unsigned TIMER_REARM = 1;
+
+  XmlRpcDispatch& _disp;
+  int _seconds;
+  int _elapsed;
+  long _lastRequests;
+};
+
+
+int main(int argc, char* argv[])
+{
+  if (argc != 5 && argc != 6) {
+    std::cerr << "Usage: LoadClient serverHost serverPort nConnections seconds [methodName]\n";
+    return -1;
+  }
+  std::string host = argv[1];
+  int port = atoi(argv[2]);
+  int nConnections = atoi(argv[3]);
+  int seconds = atoi(argv[4]);
+  std::string methodName = (argc == 6) ? argv[5] : "Hello";
+
+  // Every connection sends the same request
+  char buff[40];
+  std::string body = "<?xml version=\"1.0\"?>\r\n<methodCall><methodName>";
+  body += methodName;
+  body += "</methodName>\r\n<params></params></methodCall>\r\n";
+  sprintf(buff, "%d\r\n\r\n", int(body.length()));
+
+  std::string request = "POST /RPC2 HTTP/1.1\r\nUser-Agent: XMLRPC++ LoadClient\r\nHost: ";
+  request += host;
+  request += "\r\nContent-Type: text/xml\r\nContent-length: ";
+  request += buff;
+  request += body;
+
+  XmlRpcDispatch disp;
+  for (int i=0; i<nConnections; ++i) {
+    int fd = XmlRpcSocket::socket();
+    if (fd < 0) {
+      std::cerr << "Could not create socket " << i << " (" << XmlRpcSocket::getErrorMsg() << ")\n";
+      break;
+    }
+    if ( ! XmlRpcSocket::setNonBlocking(fd) || ! XmlRpcSocket::connect(fd, host, port)) {
+      std::cerr << "Could not connect socket " << i << " (" << XmlRpcSocket::getErrorMsg() << ")\n";
+      XmlRpcSocket::close(fd);
+      break;
+    }
+    disp.addSource(new LoadConnection(fd, request), XmlRpcDispatch::WritableEvent);
+  }
+
+  Reporter reporter(disp, seconds);
+  disp.addTimer(&reporter, 1.0);
+  disp.work(-1.0);
+
+  printf("total: %ld requests in %d s (%.0f req/s), %ld errors\n",
+         nRequests, seconds, double(nRequests) / seconds, nErrors);
+  return 0;
+}
@@ -1,8 +1,13 @@
 // TestValues.cpp : Test XML encoding and decoding of XmlRpcValues.
+// Usage: TestValues [-bench nStructs nIterations] to also measure parse and
+// serialization throughput.
 
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
 
 #include "XmlRpcValue.h"
+#include "XmlRpcUtil.h"
 
 
 #include <assert.h>
@@ -208,6 +213,140 @@ void testStruct()
 
 
 
+// An array of nStructs structs, each with a mix of member types
+static XmlRpcValue makeStructArray(int nStructs)
+{
+  XmlRpcValue a;
+  a.setSize(nStructs);
+  for (int i=0; i<nStructs; ++i) {
+    char buf[40];
+    sprintf(buf, "host-%d", i);
+    XmlRpcValue& s = a[i];
+    s["id"] = i;
+    s["name"] = buf;
+    s["load"] = i / 4.0;    // Exact with the default double format
+    s["up"] = XmlRpcValue(i % 2 == 0);
+    s["note"] = "a <tagged> & 'quoted' \"string\"";
+    s["ports"].setSize(3);
+    for (int j=0; j<3; ++j)
+      s["ports"][j] = 8000 + j;
+  }
+  return a;
+}
+
+
+void testLargeArray()
+{
+  XmlRpcValue a = makeStructArray(1000);
+  std::string xml = a.toXml();
+
+  int offset = 0;
+  XmlRpcValue aXml(xml, &offset);
+  assert(offset == int(xml.length()));
+  assert(a == aXml);
+  assert(std::string(aXml[999]["note"]) == "a <tagged> & 'quoted' \"string\"");
+
+  // Member names are xml-encoded too
+  XmlRpcValue s;
+  s["a<b"] = 1;
+  offset = 0;
+  XmlRpcValue sXml(s.toXml(), &offset);
+  assert(sXml.hasMember("a<b"));
+}
+
+
+// Struct members are kept sorted; the first of duplicate members wins
+void testStructMembers()
+{
+  char csStructXml[] =
+    "<value><struct>"
+    "<member><name>zz</name><value><i4>1</i4></value></member>"
+    "<member><name>aa</name><value>first</value></member>"
+    "<member><name>mm</name><value><i4>3</i4></value></member>"
+    "<member><name>aa</name><value>second</value></member>"
+    "</struct></value>";
+
+  int offset = 0;
+  XmlRpcValue s(csStructXml, &offset);
+  assert(s.size() == 3);
+  assert(std::string(s["aa"]) == "first");
+  assert(int(s["mm"]) == 3 && int(s["zz"]) == 1);
+  assert(s.toXml().find("<name>aa</name><value>first</value></member><member><name>mm</name>") != std::string::npos);
+  assert( ! s.hasMember("bb"));
+
+  // Swapping and copying leave independent values
+  XmlRpcValue longString(std::string(100, 'x'));
+  XmlRpcValue t = s;
+  t.swap(longString);
+  assert(longString == s && t.size() == 100);
+}
+
+
+// The fast number formatting must match printf
+void testNumberFormat()
+{
+  const int ints[] = { 0, 1, -1, 9, 10, -10, 123456789, 2147483647, -2147483647-1 };
+  for (unsigned i=0; i<sizeof(ints)/sizeof(ints[0]); ++i) {
+    char buf[64];
+    sprintf(buf, "%d", ints[i]);
+    std::string s;
+    XmlRpcUtil::appendInt(s, ints[i]);
+    assert(s == buf);
+  }
+
+  const double doubles[] = { 0.0, -0.0, 1.0, -1.5, 0.25, 43.7, 3.14159265, 1e-7, -2.5e-7,
+                             123456.789012, 8.9e12, 1e300, -1e300 };
+  for (unsigned i=0; i<sizeof(doubles)/sizeof(doubles[0]); ++i) {
+    char buf[512];
+    sprintf(buf, "%f", doubles[i]);
+    std::string s;
+    XmlRpcUtil::appendDouble(s, doubles[i]);
+    assert(s == buf);
+  }
+
+  XmlRpcValue d(-0.5);
+  assert(d.toXml() == "<value><double>-0.500000</double></value>");
+}
+
+
+// Parse throughput for a large array of structs
+void benchParse(int nStructs, int nIterations)
+{
+  std::string xml = makeStructArray(nStructs).toXml();
+
+  double start = XmlRpcUtil::getTime();
+  for (int i=0; i<nIterations; ++i) {
+    int offset = 0;
+    XmlRpcValue v(xml, &offset);
+    assert(v.size() == nStructs);
+  }
+  double elapsed = XmlRpcUtil::getTime() - start;
+
+  double mb = double(xml.length()) * nIterations / (1024.0 * 1024.0);
+  printf("parsed %d x %d structs (%d bytes) in %.3f s: %.1f MB/s\n",
+         nIterations, nStructs, int(xml.length()), elapsed, mb / elapsed);
+}
+
+
+// Serialization throughput for a large array of structs, reusing one buffer
+void benchSerialize(int nStructs, int nIterations)
+{
+  XmlRpcValue a = makeStructArray(nStructs);
+  std::string xml;
+
+  double start = XmlRpcUtil::getTime();
+  for (int i=0; i<nIterations; ++i) {
+    xml.clear();
+    a.toXml(xml);
+  }
+  double elapsed = XmlRpcUtil::getTime() - start;
+
+  double mb = double(xml.length()) * nIterations / (1024.0 * 1024.0);
+  printf("serialized %d x %d structs (%d bytes) in %.3f s: %.1f MB/s\n",
+         nIterations, nStructs, int(xml.length()), elapsed, mb / elapsed);
+}
+
+
 int main(int argc, char* argv[])
 {
   testBoolean();
@@ -229,5 +368,17 @@ int main(int argc, char* argv[])
 
   testStruct();
 
+
+  testLargeArray();
+
+  testStructMembers();
+
+  testNumberFormat();
+
+  if (argc == 4 && strcmp(argv[1], "-bench") == 0) {
+    benchParse(atoi(argv[2]), atoi(argv[3]));
+    benchSerialize(atoi(argv[2]), atoi(argv[3]));
+  }
+
   return 0;
 }
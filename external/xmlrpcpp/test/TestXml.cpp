@@ -27,6 +27,24 @@ int main(int argc, char* argv[])
 
   std::string raw("<>&'\"");
   assert(XmlRpcUtil::xmlDecode(XmlRpcUtil::xmlEncode(raw)) == raw);
+
+  // Decoding a range appends to the output; unknown entities are kept
+  std::string decoded("x");
+  const char encoded[] = "a&lt;b&amp;c&bogus;&";
+  XmlRpcUtil::xmlDecode(encoded, 6, decoded);
+  assert(decoded == "xa<b");
+  decoded.clear();
+  XmlRpcUtil::xmlDecode(encoded, int(sizeof(encoded)-1), decoded);
+  assert(decoded == "a<b&c&bogus;&");
+
+  // Tag parsing
+  std::string xml("<a><b>one</b> <c>two</c><b>three</b></a>");
+  int offset = 0;
+  assert(XmlRpcUtil::parseTag("<b>", xml, &offset) == "one");
+  assert(XmlRpcUtil::nextTagIs("<c>", xml, &offset));
+  assert(XmlRpcUtil::parseTag("<b>", xml, &offset) == "three");
+  assert(XmlRpcUtil::getNextTag(xml, &offset) == "</a>");
+  assert(offset == int(xml.length()));
   
   std::cout << "Basic tests passed.\n";
 
@@ -0,0 +1,94 @@
+// ThreadedServer.cpp : XMLRPC server executing methods on worker threads.
+// Usage: ThreadedServer serverPort nWorkers nDispatchThreads
+//
+// Sleep(seconds) stands in for a slow method (disk access, say) and only
+// occupies one worker while other clients keep being served. Stats returns
+// the server's per-method call statistics.
+#include "XmlRpc.h"
+
+#include <iostream>
+#include <stdlib.h>
+#include <unistd.h>
+
+using namespace XmlRpc;
+
+// The server
+XmlRpcServer s;
+
+// No arguments, result is "Hello".
+class Hello : public XmlRpcServerMethod
+{
+public:
+  Hello(XmlRpcServer* s) : XmlRpcServerMethod("Hello", s) {}
+
+  void execute(XmlRpcValue& params, XmlRpcValue& result)
+  {
+    result = "Hello";
+  }
+
+  std::string help() { return std::string("Say hello"); }
+
+} hello(&s);    // This constructor registers the method with the server
+
+
+// One argument: the number of seconds to sleep before returning.
+class Sleep : public XmlRpcServerMethod
+{
+public:
+  Sleep(XmlRpcServer* s) : XmlRpcServerMethod("Sleep", s) {}
+
+  void execute(XmlRpcValue& params, XmlRpcValue& result)
+  {
+    int seconds = int(params[0]);
+    sleep(seconds);
+    result = seconds;
+  }
+
+  std::string help() { return std::string("Sleep for the specified number of seconds"); }
+
+} sleepMethod(&s);
+
+
+// No arguments, result is the server's call statistics.
+class Stats : public XmlRpcServerMethod
+{
+public:
+  Stats(XmlRpcServer* s) : XmlRpcServerMethod("Stats", s) {}
+
+  void execute(XmlRpcValue& params, XmlRpcValue& result)
+  {
+    _server->getStats(result);
+  }
+
+  std::string help() { return std::string("Per-method call counts and times, and worker queue depth"); }
+
+} stats(&s);
+
+
+int main(int argc, char* argv[])
+{
+  if (argc != 4) {
+    std::cerr << "Usage: ThreadedServer serverPort nWorkers nDispatchThreads\n";
+    return -1;
+  }
+  int port = atoi(argv[1]);
+  int nWorkers = atoi(argv[2]);
+  int nDispatchThreads = atoi(argv[3]);
+
+  // Start the worker and dispatch threads
+  if ( ! s.enableThreading(nWorkers, nDispatchThreads)) {
+    std::cerr << "Could not start threads\n";
+    return -1;
+  }
+
+  // Create the server socket on the specified port
+  s.bindAndListen(port, 1024);
+
+  // Enable introspection
+  s.enableIntrospection(true);
+
+  // Wait for requests indefinitely
+  s.work(-1.0);
+
+  return 0;
+}